@@ -0,0 +1,22 @@
+/**
+ * @file app.h
+ * @brief Start-up and main loop body of the firmware.
+ *
+ * `main()` calls `app_init()` once and then `app_loop_step()` forever. The host
+ * simulator calls the same two functions, with one simulation step between two
+ * passes of the loop, so both always run the same firmware.
+ */
+
+/**
+ * @brief Sets up the clocks and the peripherals, and loads the default PID parameters.
+ */
+void app_init(void);
+
+/**
+ * @brief One pass of the main loop.
+ *
+ * Runs the next ready task of the scheduler. When none is ready, does the
+ * background work instead: parses the received commands, flushes the LCD and
+ * sends the next row of the requested reports.
+ */
+void app_loop_step(void);
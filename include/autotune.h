@@ -0,0 +1,112 @@
+/**
+ * @file autotune.h
+ * @brief Relay feedback (Åström–Hägglund) auto-tuner for the speed PID.
+ *
+ * While running, the tuner replaces the PID in the control task: the motor power is
+ * switched between `bias + d` and `bias - d` each time the speed crosses the
+ * setpoint, outside a hysteresis band. The amplitude d is AUTOTUNE_AMPLITUDE, less
+ * if the bias is closer than that to one of the output limits: the relay must stay
+ * symmetric for the formula below to hold. The loop settles into a limit cycle whose
+ * period is the ultimate period Tu and whose amplitude gives the ultimate gain
+ * Ku = 4 d / (π √(a² - ε²)). The gains follow from Ku and Tu with the
+ * Ziegler–Nichols rules, converted to the per-period gains of the PID.
+ */
+
+#include <stdint.h>
+
+/** @brief Relay amplitude d, in percent of motor power around the bias. */
+#define AUTOTUNE_AMPLITUDE 10
+
+/** @brief Smallest amplitude the experiment runs with, it fails if the bias leaves less room to the limits. */
+#define AUTOTUNE_MIN_AMPLITUDE 3
+
+/** @brief Hysteresis ε of the relay around the setpoint, in RPM, above the encoder noise. */
+#define AUTOTUNE_HYSTERESIS_RPM 50
+
+/** @brief Limit cycles left out of the estimate while the oscillation settles. */
+#define AUTOTUNE_SETTLE_CYCLES 2
+
+/** @brief Limit cycles averaged into Ku and Tu. */
+#define AUTOTUNE_CYCLES 4
+
+/** @brief The experiment is abandoned if it has not finished after this time. */
+#define AUTOTUNE_TIMEOUT_MS 20000
+
+/**
+ * @brief Tuning rule: Kp = AUTOTUNE_KP_FACTOR Ku, Ti = AUTOTUNE_TI_FACTOR Tu, Td = AUTOTUNE_TD_FACTOR Tu.
+ *
+ * Classic Ziegler–Nichols. For a more damped response use the Tyreus–Luyben
+ * factors 0.45, 2.2 and 0.159.
+ */
+#define AUTOTUNE_KP_FACTOR 0.6f
+#define AUTOTUNE_TI_FACTOR 0.5f
+#define AUTOTUNE_TD_FACTOR 0.125f
+
+/**
+ * @brief Tuner states.
+ */
+enum
+{
+    AUTOTUNE_IDLE,    /**< Not running, no result yet. */
+    AUTOTUNE_RUNNING, /**< Relay experiment in progress. */
+    AUTOTUNE_DONE,    /**< Finished, the result is valid. */
+    AUTOTUNE_FAILED   /**< Timed out, motor stopped, output too close to a limit, or no usable oscillation. */
+};
+
+/**
+ * @struct Autotune_Result
+ * @brief Outcome of the last experiment.
+ */
+typedef struct
+{
+    float ku;        /**< Ultimate gain, in percent of output per RPM. */
+    uint32_t tu_us;  /**< Ultimate period in µs. */
+    float amplitude; /**< Mean peak amplitude of the speed oscillation, in RPM. */
+    float kp;        /**< Proportional gain for the PID. */
+    float ki;        /**< Integral gain for the PID, per nominal PID period. */
+    float kd;        /**< Derivative gain for the PID, per nominal PID period. */
+} Autotune_Result;
+
+/**
+ * @brief Starts an experiment at the current setpoint.
+ *
+ * The relay starts at the next call of `autotune_update()`.
+ *
+ * @param apply 1 to commit the gains to the PID when the experiment succeeds, 0 to only report them.
+ */
+void autotune_start(uint8_t apply);
+
+/**
+ * @brief Stops a running experiment, the PID takes over again at the next update.
+ */
+void autotune_abort(void);
+
+/**
+ * @brief Returns the state of the tuner.
+ *
+ * @return One of AUTOTUNE_IDLE, AUTOTUNE_RUNNING, AUTOTUNE_DONE or AUTOTUNE_FAILED.
+ */
+uint8_t autotune_get_state(void);
+
+/**
+ * @brief Copies the result of the last successful experiment.
+ *
+ * @param result Where the result is copied.
+ * @return 1 if a result is available, 0 otherwise.
+ */
+uint8_t autotune_get_result(Autotune_Result* result);
+
+/**
+ * @brief Runs one step of the experiment in place of the PID.
+ *
+ * Meant to be called from the control task while `autotune_get_state()` is
+ * AUTOTUNE_RUNNING. When the experiment ends, the result is reported on UART
+ * and, if requested, the gains are staged and committed.
+ *
+ * @param rpm_q16 Measured speed in RPM, Q16.16.
+ * @param setpoint_q16 Speed setpoint in RPM, Q16.16.
+ * @param power Motor power of the previous period, the relay bias on the first step.
+ * @param dt_us Time since the previous step in µs.
+ * @return Motor power to apply, in percent.
+ */
+uint8_t autotune_update(int32_t rpm_q16, int32_t setpoint_q16, uint8_t power, uint32_t dt_us);
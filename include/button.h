@@ -34,6 +34,16 @@
  */
 #define CONTROL_BUTTON_PIN GPIO11
 
+/**
+ * @brief GPIO port of the object gate, the source of EXTI10.
+ */
+#define OBJECT_GATE_PORT GPIOB
+
+/**
+ * @brief GPIO pin of the object gate (PB10), low while an object covers it.
+ */
+#define OBJECT_GATE_PIN GPIO10
+
 /**
  * @brief Debounce delay in milliseconds.
  *
@@ -71,6 +81,15 @@ uint8_t button_get_stop_flag(void);
  */
 uint8_t button_get_object_flag(void);
 
+/**
+ * @brief Reads whether an object covers the gate right now.
+ *
+ * Unlike the object flag, which is latched on the edge, this follows the pin.
+ *
+ * @return 1 while an object covers the gate, 0 otherwise.
+ */
+uint8_t button_get_object_present(void);
+
 /**
  * @brief Sets the state of the object flag.
  *
@@ -0,0 +1,122 @@
+/**
+ * @file feedforward.h
+ * @brief Learned feedforward map from the speed setpoint to the motor power.
+ *
+ * The map holds the steady-state power needed for speeds spaced FEEDFORWARD_RPM_STEP
+ * apart and is interpolated linearly in between. It is added to the PID output
+ * through `pid_set_feedforward_q16()`, so after a restart or a setpoint change the
+ * output jumps close to its final value at the first update, and the integral only
+ * has to correct what the map misses.
+ *
+ * The map is filled by a calibration sweep of the motor power, and refined online:
+ * whenever the loop has settled, part of the integral term is moved into the two
+ * points around the setpoint. The map starts empty, so until it is calibrated or
+ * learned the loop behaves as a plain PID. The points that were neither calibrated
+ * nor learned are filled from the others along the speed axis: interpolated between
+ * two of them, from 0 % at 0 RPM below the first one and in proportion to the speed
+ * above the last one.
+ */
+
+#include <stdint.h>
+
+/**
+ * @brief Runs the calibration sweep at start-up, before the PID takes over.
+ *
+ * Off by default: the belt runs through the whole speed range for a few seconds.
+ * Set it to 1 (e.g. `-D FEEDFORWARD_STARTUP_CAL=1`) to calibrate on every power-up.
+ */
+#ifndef FEEDFORWARD_STARTUP_CAL
+#define FEEDFORWARD_STARTUP_CAL 0
+#endif
+
+/** @brief Number of points of the map, the first one at 0 RPM. At most 16, one bit each in the valid mask. */
+#define FEEDFORWARD_POINTS 14
+
+/** @brief Speed between two points of the map, 14 points cover 0 to 6500 RPM. */
+#define FEEDFORWARD_RPM_STEP 500
+
+/** @brief Power steps of the calibration sweep, from 100 / FEEDFORWARD_CAL_STEPS percent to 100 percent. */
+#define FEEDFORWARD_CAL_STEPS 10
+
+/** @brief Time for the speed to settle after each power step, a dozen mechanical time constants. */
+#define FEEDFORWARD_CAL_SETTLE_MS 500
+
+/** @brief Time the speed is averaged over at each power step, ten PID periods average out the encoder quantization. */
+#define FEEDFORWARD_CAL_AVERAGE_MS 500
+
+/** @brief The loop counts as settled while the error stays within this band, in RPM. */
+#define FEEDFORWARD_LEARN_BAND_RPM 100
+
+/** @brief Settled PID updates between two refinements of the map. */
+#define FEEDFORWARD_LEARN_UPDATES 20
+
+/** @brief Each refinement moves 1 / 2^FEEDFORWARD_LEARN_SHIFT of the integral term into the map. */
+#define FEEDFORWARD_LEARN_SHIFT 2
+
+/**
+ * @brief Clears the map, the feedforward is 0 until it is calibrated or learned again.
+ */
+void feedforward_reset(void);
+
+/**
+ * @brief Returns the feedforward power for a speed, interpolated from the map.
+ *
+ * @param setpoint_q16 Speed setpoint in RPM, Q16.16.
+ * @return Motor power in percent, Q16.16.
+ */
+int32_t feedforward_lookup_q16(int32_t setpoint_q16);
+
+/**
+ * @brief Refines the map from the integral term once the loop has settled.
+ *
+ * Meant to be called after each PID update while the motor runs under the PID.
+ * After FEEDFORWARD_LEARN_UPDATES consecutive updates with the error inside
+ * FEEDFORWARD_LEARN_BAND_RPM and the output not saturated, the points around the
+ * setpoint are moved by a fraction of the integral term, weighted by their distance.
+ *
+ * @param setpoint_q16 Speed setpoint in RPM, Q16.16.
+ * @param error_q16 Setpoint minus measured speed in RPM, Q16.16.
+ * @param i_term_q16 Integral term of the last update, in percent of output, Q16.16.
+ * @param power Output of the last update, in percent.
+ * @return Change of the feedforward at the setpoint, in percent, Q16.16. The caller
+ *         shifts the integral by minus this value to keep the output unchanged.
+ */
+int32_t feedforward_learn(int32_t setpoint_q16, int32_t error_q16, int32_t i_term_q16, uint8_t power);
+
+/**
+ * @brief Starts the calibration sweep, it runs from the next call of `feedforward_calibrate_update()`.
+ */
+void feedforward_calibrate_start(void);
+
+/**
+ * @brief Stops a running calibration, the map keeps its previous content.
+ */
+void feedforward_calibrate_abort(void);
+
+/**
+ * @brief Returns whether the calibration sweep is running.
+ *
+ * @return 1 while calibrating, 0 otherwise.
+ */
+uint8_t feedforward_calibrating(void);
+
+/**
+ * @brief Runs one step of the calibration sweep in place of the PID.
+ *
+ * The power is raised by 100 / FEEDFORWARD_CAL_STEPS percent every
+ * FEEDFORWARD_CAL_SETTLE_MS + FEEDFORWARD_CAL_AVERAGE_MS and the mean speed of the
+ * second part of each step is recorded. After the last step the map is rebuilt by
+ * inverting the recorded power to speed curve, the integral term is cleared as the
+ * map now holds the steady-state power, and the map is sent on UART.
+ *
+ * @param rpm_q16 Measured speed in RPM, Q16.16.
+ * @param setpoint_q16 Speed setpoint in RPM, Q16.16, the power of the last step comes from the new map.
+ * @param dt_us Time since the previous step in µs.
+ * @return Motor power to apply, in percent.
+ */
+uint8_t feedforward_calibrate_update(int32_t rpm_q16, int32_t setpoint_q16, uint32_t dt_us);
+
+/**
+ * @brief Sends the map on UART, one power in percent per point, followed by `*` for the calibrated or learned points.
+ */
+void feedforward_report(void);
@@ -3,9 +3,12 @@
  * @brief Ultrasonic sensor HC-SR04 driver for STM32 using libopencm3.
  *
  * This file contains the functions necessary to initialize and retrieve
- * the distance measured by the HC-SR04 ultrasonic sensor.
+ * the distance measured by the HC-SR04 ultrasonic sensor. The echo edges are
+ * latched by the TIM4 capture registers and read when the measurement is polled,
+ * so a ping costs no capture interrupts.
  */
 
+#include "libopencm3/cm3/cortex.h"
 #include "libopencm3/cm3/nvic.h"
 #include "libopencm3/stm32/gpio.h"
 #include "libopencm3/stm32/rcc.h"
@@ -43,16 +46,67 @@
 /**
  * @brief Divisor to convert MHz to Hz, used for timing calculations.
  *
- * Used to set the timer's prescaler to achieve a 1 µs tick interval.
+ * Used to set the timer's prescaler. TIM4 is clocked at twice the APB1 frequency,
+ * so the resulting tick is 0.5 µs.
  */
 #define MHZ_DIVISOR 1000000
 
 /**
- * @brief Delay in microseconds for the trigger pulse.
+ * @brief Length of the trigger pulse in timer ticks.
  *
- * This value is used to generate a 10 µs pulse for the HC-SR04 sensor.
+ * 20 ticks of 0.5 µs give the 10 µs pulse the HC-SR04 needs. The end of the pulse
+ * is timed by the TIM4 channel 1 output compare.
  */
-#define DELAY_10US 32
+#define HCSR04_TRIGGER_TICKS 20
+
+/**
+ * @brief Echo timeout in timer ticks, counted from the end of the trigger pulse.
+ *
+ * 52000 ticks of 0.5 µs (26 ms) cover the echo of the farthest target
+ * (`MAX_CAP_DISTANCE`, 23.2 ms) plus the sensor start-up time. It is detected by
+ * the TIM4 channel 2 output compare.
+ */
+#define HCSR04_TIMEOUT_TICKS 52000
+
+/**
+ * @brief Measurement state: no measurement in progress and no result pending.
+ */
+#define HCSR04_IDLE 0
+
+/**
+ * @brief Measurement state: trigger pulse sent, waiting for the echo.
+ */
+#define HCSR04_BUSY 1
+
+/**
+ * @brief Measurement state: a distance is ready to be read.
+ */
+#define HCSR04_READY 2
+
+/**
+ * @brief Measurement state: no echo arrived before `HCSR04_TIMEOUT_TICKS`.
+ */
+#define HCSR04_TIMEOUT 3
+
+/**
+ * @brief Wait between the end of a measurement and the next trigger, in ms.
+ *
+ * Lets the echoes of the previous ping ring down before the next one, the HC-SR04
+ * picks up stray echoes of its own previous burst for 10 to 30 ms.
+ */
+#define HCSR04_GUARD_MS 20
+
+/**
+ * @brief Shortest wait accepted by `hcsr04_set_guard()`, in ms.
+ *
+ * Below it the stray echoes of the previous burst would be taken for the next one.
+ */
+#define HCSR04_GUARD_MIN_MS 10
+
+/**
+ * @brief Longest wait between two pings, reached by doubling the wait on consecutive timeouts.
+ */
+#define HCSR04_BACKOFF_MAX_MS 120
 
 /**
  * @brief Speed of sound in air, converted for sensor use.
@@ -62,6 +116,11 @@
  */
 #define SOUND_SPEED_DIVISOR 116
 
+/**
+ * @brief Millimeters per centimeter, used to keep distances in integer millimeters.
+ */
+#define MM_PER_CM 10
+
 /**
  * @brief Maximum distance the HC-SR04 sensor can measure.
  *
@@ -76,40 +135,126 @@
  */
 #define MIN_CAP_DISTANCE 2.0
 
+/**
+ * @brief Maximum measurable distance in millimeters (integer, folded at compile time).
+ */
+#define MAX_CAP_DISTANCE_MM ((uint16_t)(MAX_CAP_DISTANCE * MM_PER_CM))
+
+/**
+ * @brief Minimum measurable distance in millimeters (integer, folded at compile time).
+ */
+#define MIN_CAP_DISTANCE_MM ((uint16_t)(MIN_CAP_DISTANCE * MM_PER_CM))
+
 /**
  * @brief Initializes the pins and timers needed for the HC-SR04.
  *
  * This function configures the trigger pin (TRIG_PIN) as an output and the echo
  * pin (ECHO_PIN) as an input, setting up the necessary timers to measure the
- * duration of the echo pulse.
+ * duration of the echo pulse, time the trigger pulse and detect echo timeouts.
  */
 void hcsr04_init(void);
 
 /**
- * @brief Sends a 10 µs trigger pulse to the HC-SR04 sensor.
+ * @brief Starts a new distance measurement without blocking.
+ *
+ * Raises the trigger pin and arms a TIM4 compare that ends the 10 µs pulse from
+ * the interrupt. The echo is captured by TIM4 and a second compare flags a timeout,
+ * so no CPU time is spent waiting for the sound to come back.
+ *
+ * @return 1 if the measurement was started, 0 if one is already in progress.
+ */
+uint8_t hcsr04_start(void);
+
+/**
+ * @brief Returns the distance of the last echo, without consuming any result.
+ *
+ * @return Distance in millimeters, 0 before the first echo.
+ */
+uint16_t hcsr04_get_last_mm(void);
+
+/**
+ * @brief Polls the state of the current measurement.
+ *
+ * Checks the capture registers for the echo of the current measurement. When the
+ * measurement has finished, its distance is computed from the latched capture
+ * values, the result is consumed and the sensor goes back to `HCSR04_IDLE`,
+ * ready for `hcsr04_start()`.
+ *
+ * @param distance Where the measured distance in centimeters is stored when the
+ *                 result is `HCSR04_READY` (-1.0 on `HCSR04_TIMEOUT`).
+ * @return HCSR04_IDLE, HCSR04_BUSY, HCSR04_READY or HCSR04_TIMEOUT.
+ */
+uint8_t hcsr04_poll(float* distance);
+
+/**
+ * @brief Polls the current measurement, reporting the distance in integer millimeters.
+ *
+ * Same as `hcsr04_poll()` without any floating point work.
+ *
+ * @param distance_mm Where the saturated distance in millimeters is stored when the
+ *                    result is `HCSR04_READY`.
+ * @return HCSR04_IDLE, HCSR04_BUSY, HCSR04_READY or HCSR04_TIMEOUT.
+ */
+uint8_t hcsr04_poll_mm(uint16_t* distance_mm);
+
+/**
+ * @brief Runs the ping scheduler: triggers pings back to back and collects their results.
+ *
+ * Meant to be called every millisecond. A ping is triggered as soon as the wait
+ * after the previous one has elapsed: HCSR04_GUARD_MS after an echo, doubled on
+ * each consecutive timeout up to HCSR04_BACKOFF_MAX_MS. The pings from the first
+ * call after `hcsr04_ping_stop()` form a burst, whose rate is measured from one
+ * ping to the next.
+ *
+ * @param now_ms Current time in ms.
+ * @param distance Where the distance in centimeters is stored when the result is
+ *                 `HCSR04_READY` (-1.0 on `HCSR04_TIMEOUT`).
+ * @return HCSR04_BUSY while waiting, HCSR04_READY or HCSR04_TIMEOUT once per ping.
+ */
+uint8_t hcsr04_ping_step(uint32_t now_ms, float* distance);
+
+/**
+ * @brief Ends the current burst of pings, the next `hcsr04_ping_step()` starts a new one.
+ *
+ * A ping still in flight is dropped along with a result not yet collected, so the
+ * next burst never gets an echo of this one. If a ping was dropped, the next burst
+ * waits the guard time before its first trigger.
+ */
+void hcsr04_ping_stop(void);
+
+/**
+ * @brief Changes the wait after an echo.
+ *
+ * @param guard_ms Wait between the end of a measurement and the next trigger in ms, raised to HCSR04_GUARD_MIN_MS.
+ */
+void hcsr04_set_guard(uint16_t guard_ms);
+
+/**
+ * @brief Returns the ping rate achieved during the last burst.
  *
- * This function activates the trigger pin (TRIG_PIN) for 10 microseconds,
- * generating a pulse to start the distance measurement on the HC-SR04.
+ * @return Pings per second, times 10.
  */
-void hcsr04_trigger(void);
+uint16_t hcsr04_get_ping_rate_x10(void);
 
 /**
- * @brief Retrieves the distance measured by the HC-SR04 sensor in centimeters.
+ * @brief Sets a function to call when a measurement finishes.
  *
- * This function measures the time taken for the echo pulse to return to the
- * echo pin (ECHO_PIN) and calculates the distance in centimeters.
+ * The callback receives the measured distance in centimeters, or -1.0 on timeout.
+ * Echoes are detected by `hcsr04_poll()`, which runs the callback, while timeouts
+ * run it from the TIM4 interrupt.
  *
- * @return The measured distance in centimeters.
+ * @param callback Function to call, or NULL to disable the notification.
  */
-float hcsr04_get_distance(void);
+void hcsr04_set_callback(void (*callback)(float distance));
 
 /**
- * @brief Applies saturation to the distance values to avoid out-of-range results.
+ * @brief Applies saturation to a distance to avoid out-of-range results.
  *
  * This function ensures that the distance values remain within a reasonable range,
  * discarding any outlier or extreme values. Distances are constrained to a
  * minimum and maximum allowable range for accurate readings.
  *
- * @return The corrected distance value after applying saturation.
+ * @param distance_mm Distance in millimeters.
+ * @return The corrected distance value in millimeters after applying saturation.
  */
-float saturation(void);
+uint16_t saturation(uint16_t distance_mm);
@@ -0,0 +1,74 @@
+/**
+ * @file height_estimator.h
+ * @brief Streaming estimator of the distance to an object, with an early pass/reject decision.
+ *
+ * Each ping result goes in as soon as it arrives. Timeouts and distances outside
+ * the range of the HC-SR04 are dropped. The valid samples feed a running mean and
+ * variance (Welford's algorithm), and a sample too far from the running mean for
+ * the spread seen so far is dropped as an outlier. All valid samples are also kept
+ * sorted, for their median.
+ *
+ * The decision is taken as soon as the confidence interval of the mean,
+ * HEIGHT_CONFIDENCE_K standard errors wide on each side, lies entirely on one side
+ * of the threshold. With the usual sensor noise that takes three samples. If the
+ * pings run out first, the median of the valid samples decides, so a few bad
+ * echoes cannot tip the result.
+ */
+
+#include <stdint.h>
+
+/** @brief Decision: not enough evidence yet, keep pinging. */
+#define HEIGHT_PENDING 0
+
+/** @brief Decision: the distance is at or above the threshold. */
+#define HEIGHT_ABOVE 1
+
+/** @brief Decision: the distance is below the threshold, or no ping got a valid echo. */
+#define HEIGHT_BELOW 2
+
+/** @brief Largest number of pings for one object, and of samples kept for the median. */
+#define HEIGHT_MAX_SAMPLES 16
+
+/** @brief Valid samples needed before an early decision, the spread of two is too uncertain to trust. */
+#define HEIGHT_MIN_SAMPLES 3
+
+/** @brief Half-width of the confidence interval, in standard errors of the mean. */
+#define HEIGHT_CONFIDENCE_K 3.0f
+
+/** @brief Smallest standard deviation assumed, in cm, so two equal samples do not give certainty. */
+#define HEIGHT_SIGMA_FLOOR_CM 0.3f
+
+/** @brief A sample further than this many standard deviations from the mean is an outlier. */
+#define HEIGHT_OUTLIER_SIGMAS 4.0f
+
+/**
+ * @brief Starts the estimate of a new object.
+ *
+ * @param threshold_cm Distance the decision compares against, in cm.
+ * @param max_pings Pings after which the decision is forced, at most HEIGHT_MAX_SAMPLES.
+ */
+void height_reset(float threshold_cm, uint8_t max_pings);
+
+/**
+ * @brief Adds the result of a ping and returns the decision.
+ *
+ * @param distance Distance in cm, negative for a timeout.
+ * @return HEIGHT_PENDING, HEIGHT_ABOVE or HEIGHT_BELOW. Once decided, further
+ *         samples are ignored and the same decision is returned.
+ */
+uint8_t height_add_sample(float distance);
+
+/**
+ * @brief Returns the current estimate of the distance.
+ *
+ * @return Mean of the accepted samples, or the median of the valid samples when
+ *         the pings ran out, in cm. -1.0 if no ping got a valid echo.
+ */
+float height_get_estimate(void);
+
+/**
+ * @brief Returns the number of pings added since the last reset, valid or not.
+ *
+ * @return Pings.
+ */
+uint8_t height_get_pings(void);
@@ -0,0 +1,73 @@
+/**
+ * @file height_profile.h
+ * @brief Height of an object against belt position, recorded while the belt keeps running.
+ *
+ * Each ping result is stored with the encoder pulse count at the time it came in,
+ * relative to the count when the object reached the gate, so the samples map to
+ * positions along the object whatever the belt speed. When the buffer is full, every
+ * other sample is dropped and only one ping in two is kept from then on: the
+ * profile always spans the whole object, at a coarser step for longer ones.
+ *
+ * The sensor measures the distance down to the object, so the tallest point is the
+ * shortest distance. The pass/reject decision uses the HEIGHT_PROFILE_PERCENTILE
+ * height rather than the maximum, so a single short echo does not reject an object.
+ */
+
+#include <stdint.h>
+
+/** @brief Largest number of samples kept for one object. */
+#define HEIGHT_PROFILE_SAMPLES 64
+
+/** @brief Percentile of the heights used for the decision, 100 for the tallest point. */
+#define HEIGHT_PROFILE_PERCENTILE 90
+
+/**
+ * @brief Starts the profile of a new object.
+ *
+ * @param pulses Encoder pulse count when the object reached the gate.
+ */
+void height_profile_start(uint16_t pulses);
+
+/**
+ * @brief Adds the result of a ping to the profile.
+ *
+ * @param pulses Encoder pulse count when the result came in, wrap-safe.
+ * @param distance Distance in cm, negative for a timeout. Timeouts and distances
+ *                 outside the range of the HC-SR04 are counted but not stored.
+ */
+void height_profile_add(uint16_t pulses, float distance);
+
+/**
+ * @brief Returns the number of pings added since the start, valid or not.
+ *
+ * @return Pings.
+ */
+uint16_t height_profile_get_pings(void);
+
+/**
+ * @brief Returns the distance to the tallest point of the object.
+ *
+ * @return Shortest distance in the profile in cm, -1.0 if no ping got a valid echo.
+ */
+float height_profile_get_min(void);
+
+/**
+ * @brief Returns the distance at the HEIGHT_PROFILE_PERCENTILE height.
+ *
+ * @return Distance in cm, -1.0 if no ping got a valid echo.
+ */
+float height_profile_get_percentile(void);
+
+/**
+ * @brief Requests the profile of the last object on UART, sent by `height_profile_report_step()`.
+ */
+void height_profile_report_start(void);
+
+/**
+ * @brief Queues the next row of the report if the transmit buffer has room for it.
+ *
+ * Meant to be called from the main loop. Returns immediately when no report is pending.
+ * One row is sent per sample, with its position in encoder pulses and its distance in
+ * cm, followed by the distances to the tallest point and at the percentile height.
+ */
+void height_profile_report_step(void);
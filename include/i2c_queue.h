@@ -0,0 +1,131 @@
+/**
+ * @file i2c_queue.h
+ * @brief Asynchronous I2C1 transmit queue for the PCF8574 LCD backpack.
+ *
+ * Bytes written to the queue are sent to the PCF8574 in the background. Every
+ * contiguous run of queued bytes goes out as one multi-byte I2C write fed by
+ * DMA1, chained with repeated STARTs while there is data left. The CPU only
+ * takes a few event interrupts per write.
+ */
+
+#include "libopencm3/cm3/cortex.h"
+#include "libopencm3/cm3/nvic.h"
+#include "libopencm3/stm32/dma.h"
+#include "libopencm3/stm32/gpio.h"
+#include "libopencm3/stm32/i2c.h"
+#include "libopencm3/stm32/rcc.h"
+
+/**
+ * @brief I2C peripheral driven by the queue.
+ */
+#define I2C_QUEUE_I2C I2C1
+
+/**
+ * @brief DMA1 channel mapped to the I2C1 TX request.
+ */
+#define I2C_QUEUE_DMA_CHANNEL DMA_CHANNEL6
+
+/**
+ * @brief Size of the transmit queue in bytes.
+ *
+ * One LCD character costs four queued bytes, so this holds a full 16x2 screen
+ * including the cursor moves.
+ */
+#define I2C_QUEUE_SIZE 256
+
+/**
+ * @brief STM32 SDA pin of I2C1.
+ */
+#define I2C_QUEUE_SDA_PIN GPIO7
+
+/**
+ * @brief STM32 SCL pin of I2C1.
+ */
+#define I2C_QUEUE_SCL_PIN GPIO6
+
+/**
+ * @brief Initializes I2C1, its pins, DMA1 and the event interrupts used by the queue.
+ *
+ * Configures I2C1 in standard mode (100 kHz) on the SDA and SCL pins and prepares
+ * the DMA channel. The queue starts empty and every write goes to the given slave.
+ *
+ * @param address 7-bit I2C address of the slave the queue writes to.
+ */
+void i2c_queue_init(uint8_t address);
+
+/**
+ * @brief Queues bytes to be written to the slave.
+ *
+ * Either all bytes are queued or none. Whole sequences, such as the
+ * EN-high/EN-low frames of an LCD character, are never split. A transfer is
+ * started if the bus is idle.
+ *
+ * @param data Pointer to the bytes to send.
+ * @param len Number of bytes to send.
+ * @return The number of bytes queued (len, or 0 if there was not enough room).
+ */
+uint16_t i2c_queue_write(const uint8_t* data, uint16_t len);
+
+/**
+ * @brief Returns the number of bytes that can currently be queued.
+ *
+ * @return Free space in the queue in bytes.
+ */
+uint16_t i2c_queue_free(void);
+
+/**
+ * @brief Tells whether the queue still has bytes to send.
+ *
+ * @return 1 if a transfer is in progress, 0 if the queue is empty and the bus is idle.
+ */
+uint8_t i2c_queue_busy(void);
+
+/**
+ * @brief Waits until every queued byte has been sent.
+ *
+ * Busy-waits, so it is only meant for initialization code.
+ */
+void i2c_queue_flush(void);
+
+/**
+ * @brief Sets a function to call when the queue becomes empty.
+ *
+ * The callback runs in interrupt context after the final STOP condition has
+ * been requested.
+ *
+ * @param callback Function to call, or NULL to disable the notification.
+ */
+void i2c_queue_set_callback(void (*callback)(void));
+
+/**
+ * @brief Returns the number of bytes sent on the bus since initialization.
+ *
+ * Each byte takes 9 SCL clocks (90 µs at 100 kHz), so this counter gives the
+ * bus utilisation over any time window.
+ *
+ * @return Total number of bytes sent.
+ */
+uint32_t i2c_queue_get_bytes_sent(void);
+
+/**
+ * @brief Returns the number of I2C write transactions (START + address) issued.
+ *
+ * @return Total number of transactions.
+ */
+uint32_t i2c_queue_get_transfers(void);
+
+/**
+ * @brief Returns the number of writes rejected because the queue was full.
+ *
+ * @return Total number of rejected writes.
+ */
+uint32_t i2c_queue_get_overflows(void);
+
+/**
+ * @brief Returns the number of bus errors (NACK, bus error, arbitration lost).
+ *
+ * The bytes of a write that fails are dropped.
+ *
+ * @return Total number of bus errors.
+ */
+uint32_t i2c_queue_get_errors(void);
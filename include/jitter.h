@@ -0,0 +1,110 @@
+/**
+ * @file jitter.h
+ * @brief SysTick period, interrupt latency and PID period histograms.
+ *
+ * Each SysTick interrupt is timestamped on entry with the free-running DWT cycle
+ * counter, and the SysTick current value tells how long ago the counter wrapped,
+ * which is the latency from the tick to the first instruction of the handler.
+ * The start of each PID task run is timestamped the same way.
+ *
+ * Values go into histograms with power-of-two buckets: bucket 0 holds 0 cycles
+ * and bucket k holds [2^(k-1), 2^k) cycles. Periods are histogrammed by their
+ * deviation from the nominal period, so a perfectly periodic loop fills bucket 0
+ * and a late run shows its delay directly; their minimum and maximum are kept
+ * as absolute periods.
+ *
+ * Include this header from source files only, it defines the histogram identifiers.
+ */
+
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/systick.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of buckets of a histogram, the last one also holds everything above it.
+ */
+#define JITTER_BUCKETS 24
+
+/**
+ * @brief Histograms.
+ */
+enum
+{
+    JITTER_TICK_PERIOD,  /**< Deviation of the time between two SysTick handler entries. */
+    JITTER_TICK_LATENCY, /**< Time from the SysTick wrap to the handler entry. */
+    JITTER_PID_PERIOD,   /**< Deviation of the time between two PID task starts. */
+    JITTER_N_HISTOGRAMS  /**< Number of histograms. */
+};
+
+/**
+ * @struct Jitter_Histogram
+ * @brief A histogram and the range of its samples, in CPU cycles.
+ */
+typedef struct
+{
+    uint32_t buckets[JITTER_BUCKETS]; /**< Sample counts. */
+    uint32_t min;                     /**< Smallest sample (period for the period histograms). */
+    uint32_t max;                     /**< Largest sample (period for the period histograms). */
+} Jitter_Histogram;
+
+/**
+ * @brief Starts the cycle counter and clears the histograms.
+ *
+ * Call it once SysTick is configured, its reload value gives the nominal tick period.
+ *
+ * @param pid_period_ms Nominal period of the PID task in ticks.
+ */
+void jitter_init(uint16_t pid_period_ms);
+
+/**
+ * @brief Clears the histograms and the missed tick counter.
+ */
+void jitter_reset(void);
+
+/**
+ * @brief Samples the SysTick period and latency. Call it first in `sys_tick_handler()`.
+ */
+void jitter_tick(void);
+
+/**
+ * @brief Samples the PID period. Call it first in the PID task.
+ */
+void jitter_pid(void);
+
+/**
+ * @brief Returns the number of ticks that passed without a handler entry.
+ *
+ * @return Ticks lost because the handler was blocked for more than a tick period.
+ */
+uint32_t jitter_get_missed_ticks(void);
+
+/**
+ * @brief Copies a histogram, consistent even if it is updated meanwhile.
+ *
+ * @param histogram Histogram identifier.
+ * @param out Where the histogram is copied.
+ */
+void jitter_get(uint8_t histogram, Jitter_Histogram* out);
+
+/**
+ * @brief Lower bound in cycles of a bucket.
+ *
+ * @param bucket Bucket index.
+ * @return Smallest value counted in the bucket.
+ */
+uint32_t jitter_bucket_floor(uint8_t bucket);
+
+/**
+ * @brief Requests the histograms on UART, sent by `jitter_report_step()`.
+ */
+void jitter_report_start(void);
+
+/**
+ * @brief Queues the next row of the report if the transmit buffer has room for it.
+ *
+ * Meant to be called from the main loop. Returns immediately when no report is pending.
+ * One row is sent per non-empty bucket, with the counts of the three histograms,
+ * followed by the range of each histogram and the missed ticks.
+ */
+void jitter_report_step(void);
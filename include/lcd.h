@@ -4,11 +4,11 @@
  *
  * This file contains functions to initialize and control a 16x2 LCD
  * via I2C protocol, using an STM32 microcontroller and a PCF8574 as an I2C expander.
+ * Bytes for the LCD are queued in the asynchronous I2C transmit queue, so sending
+ * them does not block the CPU.
  */
 
-#include "libopencm3/stm32/gpio.h"
-#include "libopencm3/stm32/i2c.h"
-#include "libopencm3/stm32/rcc.h"
+#include <stdint.h>
 
 /**
  * @brief I2C address of the PCF8574.
@@ -17,20 +17,6 @@
  */
 #define PCF8574_ADDRESS 0x27
 
-/**
- * @brief STM32 SDA pin.
- *
- * The SDA (data) pin used for I2C communication.
- */
-#define SDA_PIN GPIO7
-
-/**
- * @brief STM32 SCL pin.
- *
- * The SCL (clock) pin used for I2C communication.
- */
-#define SCL_PIN GPIO6
-
 // LCD Commands
 /**
  * @brief Command to clear the LCD screen.
@@ -121,6 +107,21 @@
  */
 #define LCD_RS 0B00000001
 
+/**
+ * @brief Number of PCF8574 frames needed to send one byte to the LCD.
+ *
+ * Each nibble takes an EN-high frame followed by an EN-low frame.
+ */
+#define LCD_BYTE_FRAMES 4
+
+/**
+ * @brief Idle frames sent after a clear command.
+ *
+ * Clearing takes the LCD about 1.52 ms. 18 frames with EN low keep the bus busy
+ * for 1.6 ms at 100 kHz instead of stalling the CPU.
+ */
+#define LCD_CLEAR_PADDING 18
+
 /**
  * @brief Conversion factor to create a delay in milliseconds.
  *
@@ -129,6 +130,29 @@
  */
 #define TICKS_TO_MS 8000
 
+/**
+ * @brief Number of rows of the LCD panel.
+ */
+#define LCD_ROWS 2
+
+/**
+ * @brief Number of columns of the LCD panel.
+ */
+#define LCD_COLS 16
+
+/**
+ * @brief DDRAM address of the first cell of the second row.
+ */
+#define LCD_ROW1_ADDRESS 0x40
+
+/**
+ * @brief Maximum number of cells sent to the panel on each framebuffer flush step.
+ *
+ * Bounds the time spent in `lcd_fb_flush_step()`, so the main loop only pays for
+ * a few bytes of panel traffic per call.
+ */
+#define LCD_FB_CELLS_PER_STEP 2
+
 /**
  * @brief Initializes the LCD, pins, and I2C communication.
  *
@@ -140,7 +164,8 @@ void lcd_init(void);
 /**
  * @brief Sends a pulse to enable the LCD.
  *
- * Sets the enable bit (EN) to latch the data or command currently being sent to the LCD.
+ * Queues the data with the enable bit (EN) set and then cleared, latching the data
+ * or command currently being sent to the LCD.
  *
  * @param data Data to send along with the enable pulse.
  */
@@ -159,7 +184,8 @@ void lcd_send_nibble(uint8_t nibble, uint8_t mode);
 /**
  * @brief Sends a full byte of data or command to the LCD.
  *
- * Sends both nibbles of a byte to the LCD in 4-bit mode, either as data or a command.
+ * Queues both nibbles of a byte to the LCD in 4-bit mode, either as data or a command,
+ * as one sequence of `LCD_BYTE_FRAMES` frames. Only waits if the I2C queue is full.
  *
  * @param byte 8-bit data to send.
  * @param mode Mode for the data (0 for command, 1 for data).
@@ -204,8 +230,42 @@ void lcd_set_cursor(uint8_t row, uint8_t col);
 /**
  * @brief Creates a delay for a specified time in milliseconds.
  *
- * Introduces a delay by performing a software loop, useful for timing-sensitive operations on the LCD.
+ * Introduces a delay by performing a software loop. Only used during LCD initialization.
  *
  * @param ms Time to wait in milliseconds.
  */
 void delay_ms(uint32_t ms);
+
+/**
+ * @brief Blanks the whole framebuffer.
+ *
+ * Fills the RAM shadow of the 16x2 screen with spaces. The panel itself is not
+ * touched; the change reaches it through `lcd_fb_flush_step()`.
+ */
+void lcd_fb_clear(void);
+
+/**
+ * @brief Writes a string into the framebuffer.
+ *
+ * Copies the string into the RAM shadow starting at the given cell. Characters
+ * beyond the last column are dropped. It only writes to RAM, so it is safe to call
+ * from interrupt context.
+ *
+ * @param row The row number (0 for the first row, 1 for the second row).
+ * @param col The column number (0 to 15 for a 16x2 LCD).
+ * @param str Pointer to the null-terminated string to write.
+ * @return The column right after the last written character.
+ */
+uint8_t lcd_fb_write(uint8_t row, uint8_t col, const char* str);
+
+/**
+ * @brief Sends a bounded amount of pending framebuffer changes to the panel.
+ *
+ * Compares the framebuffer against the content already shown by the panel and
+ * sends at most `LCD_FB_CELLS_PER_STEP` changed cells, moving the cursor only when
+ * the next changed cell is not the one right after the previous write. Must be
+ * called from the main loop, never from an interrupt.
+ *
+ * @return 1 if the panel still differs from the framebuffer, 0 if it is up to date.
+ */
+uint8_t lcd_fb_flush_step(void);
@@ -26,11 +26,72 @@
 #define MOTOR_PORT GPIOB
 
 /**
- * @brief PWM period for motor control, specified in milliseconds.
+ * @brief PWM frequency for motor control, in Hz.
  *
- * Determines the frequency of the PWM signal, controlling the speed granularity.
+ * 20 kHz is above the audible range and far shorter than the mechanical time
+ * constant of the motor, so the torque ripple is filtered out by the winding
+ * inductance. It can be changed at build time (e.g. `-D MOTOR_PWM_HZ=1000`),
+ * down to about 20 Hz.
  */
-#define MOTOR_PERIOD_MS 50
+#ifndef MOTOR_PWM_HZ
+#define MOTOR_PWM_HZ 20000
+#endif
+
+/**
+ * @brief Clock of the motor timer in Hz, twice the 36 MHz APB1 clock.
+ */
+#define MOTOR_TIMER_CLOCK_HZ 72000000
+
+/**
+ * @brief Prescaler of the motor timer, the smallest one that fits the period in 16 bits.
+ *
+ * 1 at 20 kHz, so the duty has the full resolution of the timer clock.
+ */
+#define MOTOR_PRESCALER ((MOTOR_TIMER_CLOCK_HZ / MOTOR_PWM_HZ + 65535) / 65536)
+
+/**
+ * @brief PWM period in timer counts, 3600 at 20 kHz.
+ */
+#define MOTOR_PWM_PERIOD (MOTOR_TIMER_CLOCK_HZ / (MOTOR_PRESCALER * MOTOR_PWM_HZ))
+
+/**
+ * @brief Duty of `motor_set_duty()` that keeps the output high during the whole period.
+ */
+#define MOTOR_DUTY_MAX 0xFFFF
+
+/** @brief Motion profile: the duty follows `motor_set_duty()` immediately. */
+#define MOTOR_PROFILE_NONE 0
+
+/** @brief Motion profile: the duty ramps at a constant rate, a trapezoidal speed profile. */
+#define MOTOR_PROFILE_TRAPEZOIDAL 1
+
+/** @brief Motion profile: the ramp rate itself rises and falls at a limited rate, an S-curve. */
+#define MOTOR_PROFILE_SCURVE 2
+
+/**
+ * @brief Motion profile between the duty requested by the controller and the timer.
+ *
+ * With a profile, `motor_set_duty()` only sets a target and `motor_profile_tick()`
+ * moves the applied duty toward it every millisecond. After a restart the duty
+ * starts from 0, so the belt accelerates at a known rate instead of lurching to
+ * the duty the PID held. `motor_disable()` still cuts the output at once.
+ * Select it at build time, e.g. `-D MOTOR_PROFILE=MOTOR_PROFILE_TRAPEZOIDAL`.
+ * The default is the S-curve with PID_DT_AWARE, whose law holds the integral while
+ * the duty ramps, and no profile without it, since the plain law would wind up.
+ */
+#ifndef MOTOR_PROFILE
+#if !defined(PID_DT_AWARE) || PID_DT_AWARE /** Unset here means the default of pid.h, 1 */
+#define MOTOR_PROFILE MOTOR_PROFILE_SCURVE
+#else
+#define MOTOR_PROFILE MOTOR_PROFILE_NONE
+#endif
+#endif
+
+/** @brief Default time of a ramp from 0 to full duty, in ms. */
+#define MOTOR_RAMP_MS 100
+
+/** @brief Default time for the S-curve ramp rate to go from 0 to its maximum, in ms. */
+#define MOTOR_JERK_MS 20
 
 /**
  * @brief Motor disabled state value.
@@ -53,13 +114,6 @@
  */
 #define MOTOR_TIMER TIM3
 
-/**
- * @brief Conversion factor from milliseconds to seconds.
- *
- * Used to convert time periods in milliseconds to seconds.
- */
-#define MS_TO_SEC 1000
-
 /**
  * @brief Initializes the motor control GPIO and timer for PWM output.
  *
@@ -74,12 +128,54 @@ void motor_init(void);
  *
  * This function adjusts the PWM duty cycle to control the motor power output.
  * The power is set as a percentage, where 0% turns the motor off and 100%
- * sets it to maximum power.
+ * sets it to maximum power. Kept for callers that work in percent, it goes
+ * through `motor_set_duty()`.
  *
  * @param percentage Power level as a percentage (0 to 100).
  */
 void motor_set_power(uint8_t percentage);
 
+/**
+ * @brief Sets the motor power with the full resolution of the timer.
+ *
+ * The duty is scaled to the MOTOR_PWM_PERIOD counts of the timer, so at 20 kHz
+ * one count is 1/3600 of full power instead of the 1/100 of `motor_set_power()`.
+ * Ignored while the motor is disabled, like `motor_set_power()`.
+ *
+ * @param duty Fraction of the period the output is high, 0 to MOTOR_DUTY_MAX.
+ */
+void motor_set_duty(uint16_t duty);
+
+/**
+ * @brief Changes the ramp rates of the motion profile.
+ *
+ * @param ramp_ms Time of a ramp from 0 to full duty in ms, at least 1.
+ * @param jerk_ms Time for the ramp rate to reach its maximum in ms (S-curve only), at least 1.
+ */
+void motor_set_ramp(uint16_t ramp_ms, uint16_t jerk_ms);
+
+/**
+ * @brief Moves the applied duty one millisecond along the motion profile.
+ *
+ * Meant to be called every millisecond from a task, it never waits. Does nothing
+ * without a profile, while the motor is disabled or once the target is reached.
+ */
+void motor_profile_tick(void);
+
+/**
+ * @brief Returns whether the applied duty has reached the last requested duty.
+ *
+ * @return 1 when the profile is complete, 0 while it is still ramping.
+ */
+uint8_t motor_profile_done(void);
+
+/**
+ * @brief Returns the duty on the timer output, which lags the requested one while the profile ramps.
+ *
+ * @return Duty from 0 to MOTOR_DUTY_MAX.
+ */
+uint16_t motor_get_duty(void);
+
 /**
  * @brief Disables the motor output by turning off the PWM signal.
  *
@@ -0,0 +1,124 @@
+/**
+ * @file object_queue.h
+ * @brief Objects between the gate and the diverter, and the timing of the reject diverter.
+ *
+ * Each object that reaches the gate gets an entry at the back of a fixed-size FIFO
+ * with the encoder pulse count at its arrival; its distance and verdict are filled
+ * in once it is measured. Objects stay in order on the belt, so the front entry is
+ * always the next one to reach the diverter, DIVERTER_DISTANCE_PULSES downstream of
+ * the gate.
+ *
+ * The arrival of the front entry at the diverter is timed by the TIM2 output compare
+ * on the encoder count (`speedometer_set_alarm()`), so it follows the belt whatever
+ * its speed and whether it stops in between. A rejected object switches the diverter
+ * output on for DIVERTER_HOLD_PULSES of belt travel, then the entry leaves the queue
+ * and the next one is timed. The diverter is the compare output itself, so it
+ * switches on the exact pulse, whatever the interrupt latency. An object that
+ * reaches the diverter before it was measured is rejected too. The line never has to
+ * stop for a reject.
+ */
+
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <stdint.h>
+
+/**
+ * @brief Sends rejects to the diverter instead of stopping the line.
+ *
+ * Off by default, the belt needs a diverter on DIVERTER_PORT/DIVERTER_PIN. Set it to
+ * 1 (e.g. `-D REJECT_DIVERTER=1`) to track the objects on the belt and divert the
+ * rejects.
+ */
+#ifndef REJECT_DIVERTER
+#define REJECT_DIVERTER 0
+#endif
+
+/**
+ * @brief Entries of the FIFO, a power of two.
+ *
+ * More objects than this between the gate and the diverter stop the line.
+ */
+#define OBJECT_QUEUE_SIZE 8
+
+/** @brief GPIO port of the diverter output. */
+#define DIVERTER_PORT GPIOA
+
+/** @brief GPIO pin of the diverter output (PA1, the TIM2_CH2 alarm compare), high to divert. */
+#define DIVERTER_PIN GPIO1
+
+/** @brief Belt travel from the gate to the diverter in encoder pulses, 200 mm at 0.118 mm per pulse. */
+#define DIVERTER_DISTANCE_PULSES 1700
+
+/** @brief Belt travel the diverter stays on for, in encoder pulses, shorter than an object and the gap behind it. */
+#define DIVERTER_HOLD_PULSES 600
+
+/** @brief Longest gate to diverter distance in encoder pulses, the end of the hold stays within an alarm's reach. */
+#define DIVERTER_DISTANCE_MAX_PULSES (INT16_MAX - DIVERTER_HOLD_PULSES)
+
+/** @brief Verdict: not measured yet. */
+#define OBJECT_PENDING 0
+
+/** @brief Verdict: the object goes on. */
+#define OBJECT_PASS 1
+
+/** @brief Verdict: the object is diverted. */
+#define OBJECT_REJECT 2
+
+/** @brief An object between the gate and the diverter. */
+typedef struct
+{
+    uint16_t entry_pulses;  /**< Encoder pulse count when the object reached the gate. */
+    uint16_t divert_pulses; /**< Encoder pulse count when it reaches the diverter. */
+    float distance;         /**< Measured distance in cm, -1.0 until measured. */
+    uint8_t verdict;        /**< OBJECT_PENDING, OBJECT_PASS or OBJECT_REJECT. */
+} Queue_Object;
+
+/**
+ * @brief Configures the diverter output, off, and empties the queue.
+ */
+void object_queue_init(void);
+
+/**
+ * @brief Adds an object that has just reached the gate.
+ *
+ * @param entry_pulses Encoder pulse count at its arrival.
+ * @return 1 if added, 0 if the queue is full.
+ */
+uint8_t object_queue_push(uint16_t entry_pulses);
+
+/**
+ * @brief Records the measurement of the last object added.
+ *
+ * Ignored once the object has reached the diverter: it is already being diverted
+ * as a reject.
+ *
+ * @param distance Distance to the object in cm.
+ * @param verdict OBJECT_PASS or OBJECT_REJECT.
+ */
+void object_queue_set_verdict(float distance, uint8_t verdict);
+
+/**
+ * @brief Changes the distance from the gate to the diverter, for the objects added from now on.
+ *
+ * @param pulses Belt travel in encoder pulses, at most DIVERTER_DISTANCE_MAX_PULSES.
+ */
+void object_queue_set_distance(uint16_t pulses);
+
+/**
+ * @brief Returns the number of objects between the gate and the diverter.
+ *
+ * @return Objects in the queue.
+ */
+uint8_t object_queue_count(void);
+
+/**
+ * @brief Returns the number of objects diverted since start-up.
+ *
+ * @return Rejects.
+ */
+uint32_t object_queue_get_rejects(void);
+
+/**
+ * @brief Sends the queue on UART, one line per object from the next to reach the diverter.
+ */
+void object_queue_report(void);
@@ -10,6 +10,40 @@
 
 #include <stdint.h>
 
+/**
+ * @brief Selects the arithmetic of the controller at compile time.
+ *
+ * When 1, `pid_update()` runs on integers only: gains are stored in Q8.24 and
+ * signals (setpoint, error, integral) in Q16.16, with 64-bit products. The
+ * STM32F103 has no FPU, so this avoids the soft-float library calls of the
+ * float version on every control step. Set it to 0 (e.g. `-D PID_FIXED_POINT=0`)
+ * to go back to the float implementation.
+ */
+#ifndef PID_FIXED_POINT
+#define PID_FIXED_POINT 1
+#endif
+
+/** @brief Fractional bits of the Q16.16 signals (setpoint, measured value, error, integral). */
+#define PID_Q16_SHIFT 16
+
+/** @brief Value 1.0 in Q16.16. */
+#define PID_Q16_ONE (1L << PID_Q16_SHIFT)
+
+/** @brief Fractional bits of the Q8.24 gains, enough for gains in the 1e-3 range. */
+#define PID_GAIN_SHIFT 24
+
+/** @brief Gains must stay strictly within ±PID_GAIN_LIMIT, the range of Q8.24. */
+#define PID_GAIN_LIMIT 128.0f
+
+/**
+ * @brief Maximum revolutions per minute (RPM) for the motor.
+ *
+ * This constant defines the upper limit for the motor speed in RPM. It is used
+ * as a reference for setting the motor's speed range and calculating the setpoint.
+ * Setpoints outside 0 to MAX_RPM are rejected by "SET SP".
+ */
+#define MAX_RPM 6500
+
 /**
  * @brief Maximum output value for the PID controller.
  *
@@ -30,9 +64,61 @@
  * @brief Maximum allowable accumulated error for the integral term to prevent windup.
  *
  * Caps the accumulated error in the integral term to prevent excessive overshoot,
- * a condition known as integral windup.
+ * a condition known as integral windup. Large enough for the integral alone to
+ * reach MAX_PID_OUTPUT with the default integral gain.
+ */
+#define MAX_INTEGRAL_ERROR 80000.0
+
+/** @brief MAX_INTEGRAL_ERROR in Q16.16, beyond 32 bits. */
+#define MAX_INTEGRAL_ERROR_Q16 ((int64_t)MAX_INTEGRAL_ERROR * PID_Q16_ONE)
+
+/**
+ * @brief Selects the control law used by the PID task at compile time.
+ *
+ * When 1, the task calls `pid_update_dt_q16()` with the measured time since the
+ * previous update, also while the motor is disabled so the controller state stays
+ * current. When 0, it calls `pid_update_q16()` only while the motor runs.
+ */
+#ifndef PID_DT_AWARE
+#define PID_DT_AWARE 1
+#endif
+
+/**
+ * @brief Nominal time between two updates in µs.
+ *
+ * The gains are per nominal period: `pid_update_dt_q16()` gives the same output as
+ * `pid_update_q16()` for the same gains when called exactly at this period.
+ */
+#define PID_NOMINAL_DT_US 50000
+
+/** @brief Longest time accounted to a single `pid_update_dt_q16()`, longer gaps are clipped. */
+#define PID_MAX_DT_US 200000
+
+/**
+ * @brief Time constant of the low-pass filter on the derivative, in µs.
+ *
+ * Two nominal periods: the encoder quantization noise on the measurement is not
+ * amplified by the derivative gain, and the filter delay stays short against the
+ * mechanical time constant of the motor.
+ */
+#define PID_D_FILTER_US 100000
+
+/**
+ * @brief Tracking time of the back-calculation anti-windup, in nominal periods.
+ *
+ * While the output saturates, the integral term is pulled back by the excess over
+ * the limit divided by this number every nominal period.
  */
-#define MAX_INTEGRAL_ERROR 30000.0
+#define PID_TRACKING_PERIODS 2
+
+/** @brief Proportional gain loaded at start-up, in percent of output per RPM. */
+#define PID_DEFAULT_KP 0.0013f
+
+/** @brief Integral gain loaded at start-up. */
+#define PID_DEFAULT_KI 0.00126f
+
+/** @brief Derivative gain loaded at start-up. */
+#define PID_DEFAULT_KD 0.0006f
 
 /**
  * @struct PID_Controller
@@ -54,6 +140,8 @@ typedef struct
  *
  * This function sets up the PID controller structure with given proportional,
  * integral, and derivative gains, as well as the initial setpoint for the control loop.
+ * With PID_FIXED_POINT the gains are converted to Q8.24 here, once, so they must be
+ * within ±PID_GAIN_LIMIT; larger ones saturate.
  *
  * @param pid Pointer to the PID controller structure.
  */
@@ -81,3 +169,133 @@ uint8_t pid_update(float measured_value);
  * @param setpoint The desired setpoint for the control loop.
  */
 void pid_setpoint(float setpoint);
+
+/**
+ * @brief Returns a copy of the parameter set in use, or of the committed set waiting to be applied.
+ *
+ * Meant as the starting point of a new set for `pid_stage_params()`.
+ *
+ * @param params Where the gains and the current setpoint are copied.
+ */
+void pid_get_params(PID_Controller* params);
+
+/**
+ * @brief Stages a new parameter set without applying it.
+ *
+ * The set is copied into a second buffer, the controller keeps running with the
+ * current one. Staging again before the commit replaces the staged set, and also
+ * cancels a commit that was not applied yet.
+ *
+ * @param params Gains and setpoint to apply at the next commit.
+ */
+void pid_stage_params(const PID_Controller* params);
+
+/**
+ * @brief Requests the staged parameter set to be applied.
+ *
+ * The set is applied as a whole at the start of the next `pid_update()`, so an
+ * update never sees a mix of old and new gains. Each applied set increments the
+ * generation counter.
+ *
+ * @param bumpless 1 to rescale the integral so the output does not jump when
+ *                 the gains change, 0 to keep the integral as it is.
+ */
+void pid_commit_params(uint8_t bumpless);
+
+/**
+ * @brief Returns the number of parameter sets applied since start-up.
+ *
+ * A caller can compare it before and after `pid_commit_params()` to know when
+ * the new set is in use.
+ *
+ * @return Generation counter.
+ */
+uint32_t pid_get_generation(void);
+
+/**
+ * @brief Returns the contribution of each term to the last output, before clamping.
+ *
+ * @param p Where the proportional term is stored, in percent of output, Q16.16.
+ * @param i Where the integral term is stored, in percent of output, Q16.16.
+ * @param d Where the derivative term is stored, in percent of output, Q16.16.
+ */
+void pid_get_terms_q16(int32_t* p, int32_t* i, int32_t* d);
+
+/**
+ * @brief Returns the output of the last update with its fractional part.
+ *
+ * The update functions return the output truncated to whole percent, this is the
+ * same value clamped between MIN_PID_OUTPUT and MAX_PID_OUTPUT but at full
+ * resolution, meant for `motor_set_duty()`.
+ *
+ * @return Output of the last update in percent, Q16.16.
+ */
+int32_t pid_get_output_q16(void);
+
+/**
+ * @brief Updates the PID controller from a measured value in Q16.16.
+ *
+ * Same as `pid_update()`, but the caller provides the measured value already in
+ * fixed point, so no float conversion is needed with PID_FIXED_POINT.
+ *
+ * @param measured_q16 The current measured value of the process variable, in Q16.16.
+ * @return The control output, constrained between MIN_PID_OUTPUT and MAX_PID_OUTPUT.
+ */
+uint8_t pid_update_q16(int32_t measured_q16);
+
+/**
+ * @brief Updates the PID controller with the time elapsed since the previous update.
+ *
+ * Differs from `pid_update_q16()` in four ways:
+ * - The integral and derivative are scaled by `dt_us`, so late or early updates
+ *   are accounted for exactly. The gains stay per PID_NOMINAL_DT_US.
+ * - The derivative acts on the measured value, not on the error, so setpoint
+ *   changes cause no output kick, and it is low-pass filtered with PID_D_FILTER_US.
+ * - The integral is kept as its contribution to the output. Instead of being
+ *   capped, it is pulled back by the excess of the output over MIN_PID_OUTPUT or
+ *   MAX_PID_OUTPUT (back-calculation), so it never winds up beyond what the
+ *   output can use.
+ * - With `hold` set, the integral keeps its value. Meant for while the motor is
+ *   disabled: after a restart the output starts from where it was before the stop.
+ *
+ * @param measured_q16 The current measured value of the process variable, in Q16.16.
+ * @param dt_us Time since the previous update in µs, clipped to PID_MAX_DT_US.
+ * @param hold 1 to freeze the integral, 0 to integrate normally.
+ * @return The control output, constrained between MIN_PID_OUTPUT and MAX_PID_OUTPUT.
+ */
+uint8_t pid_update_dt_q16(int32_t measured_q16, uint32_t dt_us, uint8_t hold);
+
+/**
+ * @brief Sets the feedforward term added to the output of the next updates.
+ *
+ * The term is added before the output is clamped, so the integral only has to
+ * correct the difference between the feedforward and the output the loop needs,
+ * and the anti-windup sees the real output.
+ *
+ * @param feedforward_q16 Feedforward term in percent of output, Q16.16.
+ */
+void pid_set_feedforward_q16(int32_t feedforward_q16);
+
+/**
+ * @brief Adds a value to the integral term, in both control laws.
+ *
+ * Meant to hand part of the integral over to the feedforward: shifting the
+ * integral by minus the change of the feedforward keeps the output unchanged.
+ *
+ * @param delta_q16 Change of the integral term in percent of output, Q16.16.
+ */
+void pid_shift_integral_q16(int32_t delta_q16);
+
+/**
+ * @brief Sets the desired setpoint for the PID controller from a value in Q16.16.
+ *
+ * @param setpoint The desired setpoint for the control loop, in Q16.16.
+ */
+void pid_setpoint_q16(int32_t setpoint);
+
+/**
+ * @brief Returns the setpoint the controller regulates to, from the knob or from `SET SP`.
+ *
+ * @return The setpoint in RPM, Q16.16.
+ */
+int32_t pid_get_setpoint_q16(void);
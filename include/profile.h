@@ -0,0 +1,126 @@
+/**
+ * @file profile.h
+ * @brief Execution time profiling of the interrupts and tasks with the DWT cycle counter.
+ *
+ * Each profiled site reads the Cortex-M3 cycle counter (CYCCNT) on entry and on
+ * exit and adds the difference to its accumulators: number of runs, minimum,
+ * maximum and total cycles. The total over the profiled time gives the share of
+ * the CPU used by the site. Times include the interrupts that preempted the site.
+ *
+ * The report is a text table sent over UART, one row per site, paced by
+ * `profile_report_step()` so it never overflows the transmit buffer.
+ *
+ * Include this header from source files only, it defines the site identifiers.
+ */
+
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/rcc.h>
+#include <stdint.h>
+
+/**
+ * @brief Enables the profiling probes at compile time.
+ *
+ * When 0, `PROFILE_ENTER()` and `PROFILE_EXIT()` expand to nothing, so the
+ * interrupts and the scheduler run without any profiling code. Set it with
+ * `-D PROFILE_ENABLED=1` to measure.
+ */
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 0
+#endif
+
+/**
+ * @brief Number of scheduler tasks that get their own site, in task table order.
+ */
+#define PROFILE_MAX_TASKS 8
+
+/**
+ * @brief Profiled sites.
+ */
+enum
+{
+    PROFILE_SYSTICK,                                        /**< `sys_tick_handler()`. */
+    PROFILE_TIM2,                                           /**< `tim2_isr()`, encoder capture and position alarm. */
+    PROFILE_TIM4,                                           /**< `tim4_isr()`, ultrasonic trigger and timeout. */
+    PROFILE_USART1,                                         /**< `usart1_isr()`. */
+    PROFILE_EXTI15_10,                                      /**< `exti15_10_isr()`, buttons. */
+    PROFILE_ADC1,                                           /**< `adc1_2_isr()`, potentiometer watchdog. */
+    PROFILE_DMA1_CH1,                                       /**< `dma1_channel1_isr()`, potentiometer samples. */
+    PROFILE_DMA1_CH4,                                       /**< `dma1_channel4_isr()`, UART transmit. */
+    PROFILE_DMA1_CH5,                                       /**< `dma1_channel5_isr()`, UART receive. */
+    PROFILE_DMA1_CH6,                                       /**< `dma1_channel6_isr()`, I2C transmit. */
+    PROFILE_I2C1_EV,                                        /**< `i2c1_ev_isr()`. */
+    PROFILE_I2C1_ER,                                        /**< `i2c1_er_isr()`. */
+    PROFILE_TASK_FIRST,                                     /**< Scheduler task 0, the others follow. */
+    PROFILE_N_SITES = PROFILE_TASK_FIRST + PROFILE_MAX_TASKS /**< Number of sites. */
+};
+
+/**
+ * @struct Profile_Stats
+ * @brief Accumulators of a site, in CPU cycles.
+ */
+typedef struct
+{
+    uint32_t count; /**< Number of runs. */
+    uint32_t min;   /**< Shortest run, UINT32_MAX before the first one. */
+    uint32_t max;   /**< Longest run. */
+    uint64_t total; /**< Sum of all runs. */
+} Profile_Stats;
+
+#if PROFILE_ENABLED
+/**
+ * @brief Starts timing the enclosing block. Place it first in the function body.
+ */
+#define PROFILE_ENTER() uint32_t profile_start_ = dwt_read_cycle_counter()
+
+/**
+ * @brief Stops timing and accounts the run to `site`. Needed on every return path after `PROFILE_ENTER()`.
+ */
+#define PROFILE_EXIT(site) profile_record((site), dwt_read_cycle_counter() - profile_start_)
+#else
+#define PROFILE_ENTER()    do {} while (0)
+#define PROFILE_EXIT(site) do {} while (0)
+#endif
+
+/**
+ * @brief Starts the cycle counter and clears the accumulators.
+ */
+void profile_init(void);
+
+/**
+ * @brief Clears the accumulators and restarts the profiled time.
+ */
+void profile_reset(void);
+
+/**
+ * @brief Accounts one run of a site.
+ *
+ * Called by `PROFILE_EXIT()`. A site is only recorded from one context, so the
+ * accumulators need no locking.
+ *
+ * @param site Site identifier.
+ * @param cycles Duration of the run.
+ */
+void profile_record(uint8_t site, uint32_t cycles);
+
+/**
+ * @brief Copies the accumulators of a site, consistent even if the site runs meanwhile.
+ *
+ * @param site Site identifier.
+ * @param stats Where the accumulators are copied.
+ */
+void profile_get(uint8_t site, Profile_Stats* stats);
+
+/**
+ * @brief Requests a report table on UART, sent by `profile_report_step()`.
+ */
+void profile_report_start(void);
+
+/**
+ * @brief Queues the next row of the report if the transmit buffer has room for it.
+ *
+ * Meant to be called from the main loop. Returns immediately when no report is pending.
+ * The row columns are: site, runs, minimum, mean and maximum cycles, and the CPU
+ * share in hundredths of a percent of the time since the last reset.
+ */
+void profile_report_step(void);
@@ -0,0 +1,73 @@
+/**
+ * @file scheduler.h
+ * @brief Cooperative run-to-completion task scheduler.
+ *
+ * Tasks are described in a static table owned by the application. The SysTick
+ * interrupt only advances the tick counter and marks tasks ready, while the main
+ * loop dispatches the ready tasks by priority. A task released again before its
+ * previous release has finished is counted as an overrun.
+ */
+
+#include <libopencm3/cm3/cortex.h>
+#include <stdint.h>
+
+/**
+ * @struct Scheduler_Task
+ * @brief Entry of the task table.
+ *
+ * The first four fields are the configuration of the task, the remaining fields
+ * are bookkeeping maintained by the scheduler and must be left zeroed.
+ */
+typedef struct
+{
+    void (*run)(void);           /**< Task body, runs to completion. */
+    uint16_t period;             /**< Release period in ticks (ms). */
+    uint16_t phase;              /**< Tick offset of the first release, used to spread the load. */
+    uint8_t priority;            /**< Dispatch priority, 0 is the highest. */
+    volatile uint16_t countdown; /**< Ticks left until the next release. */
+    volatile uint8_t ready;      /**< 1 when released and waiting to be dispatched. */
+    volatile uint8_t running;    /**< 1 while the task body executes. */
+    volatile uint32_t runs;      /**< Number of completed executions. */
+    volatile uint32_t overruns;  /**< Releases that found the previous one still pending or running. */
+} Scheduler_Task;
+
+/**
+ * @brief Registers the task table and resets the tick counter.
+ *
+ * @param table Pointer to the application task table.
+ * @param n_tasks Number of entries in the table.
+ */
+void scheduler_init(Scheduler_Task* table, uint8_t n_tasks);
+
+/**
+ * @brief Advances the scheduler by one tick.
+ *
+ * Meant to be called from the SysTick interrupt. It only decrements the release
+ * countdowns and marks the released tasks ready, so its cost is a few cycles per task.
+ */
+void scheduler_tick(void);
+
+/**
+ * @brief Runs the highest-priority ready task, if any.
+ *
+ * Meant to be called from the main loop. Tasks with the same priority are served
+ * in table order.
+ *
+ * @return 1 if a task was executed, 0 if no task was ready.
+ */
+uint8_t scheduler_dispatch(void);
+
+/**
+ * @brief Returns the number of ticks since `scheduler_init()`.
+ *
+ * @return Tick counter (ms).
+ */
+uint32_t scheduler_get_ticks(void);
+
+/**
+ * @brief Returns the overrun counter of a task.
+ *
+ * @param task Index of the task in the table.
+ * @return Number of releases that found the previous one still pending or running.
+ */
+uint32_t scheduler_get_overruns(uint8_t task);
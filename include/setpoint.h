@@ -4,12 +4,20 @@
  *
  * This module initializes an ADC to read values from a potentiometer using DMA.
  * It includes functions to initialize the potentiometer ADC and retrieve the ADC value.
+ *
+ * The conversions are triggered by TIM1 channel 1 every 10 ms instead of running
+ * continuously. The DMA half-transfer and transfer-complete interrupts keep the sum
+ * of the buffer up to date, so reading the value costs no loop. The ADC analog
+ * watchdog watches a band around the last value and flags when the knob moves.
  */
 
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/adc.h>
 #include <libopencm3/stm32/dma.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
 
 /** @brief Number of data samples to collect via DMA. */
 #define N_DATA 10
@@ -17,6 +25,21 @@
 /** @brief Conversion constant to calculate potentiometer percentage value. */
 #define CONSTANT_TO_PERCENTAGE (24.42e-3) / N_DATA
 
+/** @brief CONSTANT_TO_PERCENTAGE in Q16.16 with 4 extra fractional bits (24.42e-3 / N_DATA * 2^20). */
+#define CONSTANT_TO_PERCENTAGE_Q20 2561
+
+/** @brief Timer whose channel 1 compare triggers the conversions (the 10 ms speedometer timebase). */
+#define POT_TRIGGER_TIMER TIM1
+
+/** @brief Half-width of the analog watchdog band, in ADC counts (about 1 % of the range). */
+#define POT_AWD_BAND 40
+
+/** @brief Maximum ADC reading (12-bit). */
+#define POT_ADC_MAX 4095
+
+/** @brief Buffer halves reported as changed after the watchdog fires, until the buffer holds only new samples. */
+#define POT_SETTLE_HALVES 3
+
 /** @brief ADC sample time configuration. */
 #define SAMPLE_TIME_CYCLES ADC_SMPR_SMP_239DOT5CYC
 
@@ -40,7 +63,8 @@
  *
  * This function configures the ADC and DMA to sample potentiometer values from the specified channel.
  * It sets up GPIO, enables the required clocks, configures the ADC sample time,
- * and initiates DMA for continuous data collection.
+ * and initiates DMA for continuous data collection. Conversions are paced by
+ * POT_TRIGGER_TIMER, which `speedometer_init()` starts.
  */
 void pot_init(void);
 
@@ -48,8 +72,30 @@ void pot_init(void);
  * @brief Retrieves the latest potentiometer value.
  *
  * This function returns the current potentiometer reading as an ADC value.
- * It should be called after `pot_init` has configured the ADC and DMA.
+ * It should be called after `pot_init` has configured the ADC and DMA. The
+ * average comes from the running sum kept by the DMA interrupts.
  *
  * @return The ADC value corresponding to the potentiometer position (0-4095 for 12-bit resolution).
  */
 float pot_get_value(void);
+
+/**
+ * @brief Retrieves the latest potentiometer value as a percentage in Q16.16.
+ *
+ * Integer-only counterpart of `pot_get_value()`, for the fixed-point control loop.
+ *
+ * @return The potentiometer position in percent (0-100), in Q16.16.
+ */
+int32_t pot_get_value_q16(void);
+
+/**
+ * @brief Reports whether the potentiometer moved since the last call.
+ *
+ * Set when the analog watchdog sees a conversion outside the band around the
+ * previous value, and kept set until the averaging buffer holds only samples
+ * taken after the move. Returns 1 once after start-up, so the first setpoint
+ * is always computed.
+ *
+ * @return 1 if the value changed since the previous call, 0 otherwise.
+ */
+uint8_t pot_changed(void);
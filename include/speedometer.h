@@ -6,8 +6,26 @@
  * connected to TIM2 as an external clock, and functions to retrieve the RPM and
  * radian-per-second (rad/s) values. It configures the required timers and DMA
  * to calculate rotational speed based on encoder pulses.
+ *
+ * With SPEEDOMETER_CAPTURE every encoder pulse is also timestamped, and the speed
+ * is computed at each `speedometer_update()` from the pulses seen since the previous
+ * update and the time between their edges (M/T method). At high speed many pulses
+ * fall in each update and it behaves like pulse counting; at low speed it measures
+ * the pulse period.
+ *
+ * TIM1 also copies the TIM2 pulse counter into a ring of SPEEDOMETER_RING_SIZE slots
+ * every SPEEDOMETER_SLOT_MS by DMA, so the speed can be read over any window up to
+ * SPEEDOMETER_MAX_WINDOW_MS, as well as an acceleration estimate, without CPU work
+ * in between.
+ *
+ * TIM2 channel 2 compares the pulse count, so a function can be called when the
+ * belt reaches a given position (`speedometer_set_alarm()`), and its output
+ * (TIM2_CH2, PA1) can switch at that position without waiting for the interrupt
+ * (`speedometer_set_alarm_output()`).
  */
 
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/dma.h>
 #include <libopencm3/stm32/exti.h>
@@ -20,6 +38,28 @@
  */
 #define PULSES_1TURN TIM_IC_PSC_8
 
+/**
+ * @brief Encoder pulses per full rotation.
+ */
+#define PULSES_PER_TURN 8
+
+/**
+ * @brief Selects the speed estimator at compile time.
+ *
+ * When 1, the speed comes from the timestamped encoder edges and is refreshed by
+ * `speedometer_update()`. When 0, it is the pulse count of the last 600 ms window.
+ */
+#ifndef SPEEDOMETER_CAPTURE
+#define SPEEDOMETER_CAPTURE 1
+#endif
+
+/**
+ * @brief Time without pulses after which the motor is considered stopped, in ms.
+ *
+ * 600 ms matches the 12.5 RPM resolution of the pulse counting window.
+ */
+#define SPEEDOMETER_STOP_TIMEOUT_MS 600
+
 /**
  * @brief GPIO pin connected to the speedometer sensor.
  */
@@ -46,22 +86,52 @@
 #define DMA_CH DMA_CHANNEL2
 
 /**
- * @brief Prescaler value for generating a 600 ms interval, used with TENMS_TIMER.
+ * @brief Prescaler value for a 100 kHz count, used with TENMS_TIMER.
  */
 #define MS_PS 719
 
 /**
- * @brief Timer update interval for measuring rotation, set to 600 ms.
+ * @brief Timer update interval for sampling the pulse counter, set to 10 ms.
+ */
+#define MS_INTERVAL 999
+
+/**
+ * @brief Time between two pulse counter samples in the ring, in ms (MS_INTERVAL + 1 at 100 kHz).
+ */
+#define SPEEDOMETER_SLOT_MS 10
+
+/**
+ * @brief Number of pulse counter samples kept by the DMA ring.
  */
-#define MS_INTERVAL 59999
+#define SPEEDOMETER_RING_SIZE 128
 
 /**
- * @brief Constant to convert encoder counts to radian per second (rad/s).
+ * @brief Longest speed window, in slots. Half the ring, so the acceleration can compare two windows.
+ */
+#define SPEEDOMETER_MAX_WINDOW_SLOTS ((SPEEDOMETER_RING_SIZE - 1) / 2)
+
+/**
+ * @brief Longest speed window, in ms.
+ */
+#define SPEEDOMETER_MAX_WINDOW_MS (SPEEDOMETER_MAX_WINDOW_SLOTS * SPEEDOMETER_SLOT_MS)
+
+/**
+ * @brief Window used by the pulse counting getters until `speedometer_set_window()` is called, in ms.
+ */
+#define SPEEDOMETER_DEFAULT_WINDOW_MS 600
+
+/**
+ * @brief RPM corresponding to one pulse per slot (60000 / (PULSES_PER_TURN * SPEEDOMETER_SLOT_MS)).
+ */
+#define SPEEDOMETER_RPM_PER_PULSE_SLOT 750
+
+/**
+ * @brief Constant to convert encoder counts over 600 ms to radian per second (rad/s).
  */
 #define CONSTANT_TO_RAD_S 1.309
 
 /**
- * @brief Constant to convert encoder counts to revolutions per minute (RPM).
+ * @brief Constant to convert encoder counts over 600 ms to revolutions per minute (RPM).
  */
 #define CONSTANT_TO_RPM 12.5
 
@@ -75,6 +145,17 @@
  */
 void speedometer_init(void);
 
+/**
+ * @brief Computes a new speed estimate from the encoder edges seen since the last call.
+ *
+ * Meant to be called once per control period, right before reading the speed. The
+ * speed is the number of new pulses divided by the time between the last edge of
+ * the previous call and the last edge of this one. Without new pulses the estimate
+ * decays to the highest speed compatible with the time since the last edge, and
+ * drops to 0 after SPEEDOMETER_STOP_TIMEOUT_MS. Does nothing when SPEEDOMETER_CAPTURE is 0.
+ */
+void speedometer_update(void);
+
 /**
  * @brief Gets the current speed in revolutions per minute (RPM).
  *
@@ -96,3 +177,94 @@ float speedometer_getRPM(void);
  * @return The current speed in radians per second (rad/s).
  */
 float speedometer_getRAD_S(void);
+
+/**
+ * @brief Gets the current speed in RPM as a Q16.16 value.
+ *
+ * Integer-only counterpart of `speedometer_getRPM()`, for the fixed-point
+ * control loop. Valid up to 32767 RPM.
+ *
+ * @return The current speed in RPM, in Q16.16.
+ */
+int32_t speedometer_getRPM_q16(void);
+
+/**
+ * @brief Selects the window of the pulse counting getters.
+ *
+ * Shorter windows react faster, longer ones are less noisy. Used by `speedometer_getRPM()`
+ * and friends when SPEEDOMETER_CAPTURE is 0, and for the acceleration in the telemetry
+ * records. Set from the serial console with "SET WIN".
+ *
+ * @param window_ms Window length in ms, rounded down to SPEEDOMETER_SLOT_MS and
+ *                  limited to SPEEDOMETER_SLOT_MS..SPEEDOMETER_MAX_WINDOW_MS.
+ */
+void speedometer_set_window(uint16_t window_ms);
+
+/**
+ * @brief Gets the window selected by `speedometer_set_window()`.
+ *
+ * @return Window length in ms.
+ */
+uint16_t speedometer_get_window(void);
+
+/**
+ * @brief Gets the speed counted over the last `window_ms`, in RPM as a Q16.16 value.
+ *
+ * Computed from the DMA ring, wrap-safe across the 16-bit pulse counter overflow.
+ *
+ * @param window_ms Window length in ms, rounded and limited as in `speedometer_set_window()`.
+ * @return The average speed over the window in RPM, in Q16.16.
+ */
+int32_t speedometer_getRPM_window_q16(uint16_t window_ms);
+
+/**
+ * @brief Gets the acceleration over two consecutive windows, in RPM/s as a Q16.16 value.
+ *
+ * Difference between the speed over the last `window_ms` and over the `window_ms`
+ * before it, divided by the window length.
+ *
+ * @param window_ms Window length in ms, rounded and limited as in `speedometer_set_window()`.
+ * @return The acceleration in RPM per second, in Q16.16.
+ */
+int32_t speedometer_get_accel_q16(uint16_t window_ms);
+
+/**
+ * @brief Gets the encoder pulse count, a measure of how far the belt has moved.
+ *
+ * The count wraps at 16 bits, the pulses between two readings are their 16-bit
+ * difference.
+ *
+ * @return Pulses counted by TIM2 since start-up, modulo 65536.
+ */
+uint16_t speedometer_get_pulses(void);
+
+/**
+ * @brief Calls a function from the TIM2 interrupt when the pulse count reaches a position.
+ *
+ * One alarm at a time, a new one replaces the previous one. The callback may set
+ * the next alarm.
+ *
+ * @param pulses Pulse count to wait for, less than 32768 pulses ahead.
+ * @param callback Function to call.
+ * @return 1 if the alarm is set, 0 if the count is already at or past `pulses`:
+ *         the callback is not called, the caller handles the position itself.
+ */
+uint8_t speedometer_set_alarm(uint16_t pulses, void (*callback)(void));
+
+/**
+ * @brief Clears the alarm set by `speedometer_set_alarm()`, if any.
+ */
+void speedometer_cancel_alarm(void);
+
+/**
+ * @brief Selects what the alarm compare does to its output, TIM2_CH2 on PA1, and enables the output.
+ *
+ * With TIM_OCM_ACTIVE or TIM_OCM_INACTIVE the hardware drives the output high or
+ * low when the count reaches the alarm position, before the interrupt runs.
+ * TIM_OCM_FROZEN keeps the level, TIM_OCM_FORCE_HIGH and TIM_OCM_FORCE_LOW set it
+ * at once. The pin only follows the output once configured as an alternate
+ * function output.
+ *
+ * @param mode Output compare mode of TIM2 channel 2.
+ */
+void speedometer_set_alarm_output(enum tim_oc_mode mode);
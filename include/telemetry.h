@@ -0,0 +1,98 @@
+/**
+ * @file telemetry.h
+ * @brief Binary telemetry stream on USART1.
+ *
+ * Every `telemetry_pid_tick()` call (one per PID period) can emit a fixed-layout
+ * record with the state of the control loop. Records are protected by a CRC-16 and
+ * framed with COBS, so the byte 0x00 only appears as a frame delimiter and a host
+ * can resynchronize at any point, even with text replies interleaved on the line.
+ *
+ * Frame on the wire: 0x00, COBS(record + CRC-16 little-endian), 0x00.
+ *
+ * This header only depends on <stdint.h>, so the host decoder in tools/ includes
+ * it to share the record layout.
+ */
+
+#include <stdint.h>
+
+/**
+ * @brief Version of the record layout, sent in every record.
+ */
+#define TELEMETRY_VERSION 3
+
+/**
+ * @brief Full power in `Telemetry_Record.duty`, the scale of MOTOR_DUTY_MAX.
+ */
+#define TELEMETRY_DUTY_MAX 0xFFFF
+
+/**
+ * @brief Records are sent every this many PID ticks after start-up (0 disables telemetry).
+ */
+#define TELEMETRY_DEFAULT_DIVIDER 0
+
+/**
+ * @brief CRC-16/CCITT-FALSE polynomial.
+ */
+#define TELEMETRY_CRC_POLY 0x1021
+
+/**
+ * @brief CRC-16/CCITT-FALSE initial value.
+ */
+#define TELEMETRY_CRC_INIT 0xFFFF
+
+/**
+ * @struct Telemetry_Record
+ * @brief Snapshot of the control loop, sent little-endian and without padding.
+ *
+ * Speeds are in RPM, the acceleration in RPM/s and PID terms in percent of output, all
+ * in Q16.16.
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t version;       /**< TELEMETRY_VERSION. */
+    uint8_t motor_state;   /**< MOTOR_ENABLED or MOTOR_DISABLED. */
+    uint16_t sequence;     /**< Record counter, gaps show lost records. */
+    uint32_t timestamp_ms; /**< Scheduler ticks since start-up. */
+    int32_t rpm_q16;       /**< Measured speed. */
+    int32_t setpoint_q16;  /**< Speed setpoint. */
+    int32_t accel_q16;     /**< Acceleration over the speedometer window. */
+    int32_t p_q16;         /**< Proportional term of the last PID update. */
+    int32_t i_q16;         /**< Integral term of the last PID update. */
+    int32_t d_q16;         /**< Derivative term of the last PID update. */
+    uint16_t height_mm;    /**< Last ultrasonic distance sample. */
+    uint16_t duty;         /**< PWM duty on the timer output, 0 to TELEMETRY_DUTY_MAX. */
+} Telemetry_Record;
+
+/**
+ * @brief Longest encoded frame: record, CRC, COBS overhead and both delimiters.
+ */
+#define TELEMETRY_FRAME_SIZE (sizeof(Telemetry_Record) + 2 + 1 + 2)
+
+/**
+ * @brief Computes the CRC-16/CCITT-FALSE of a buffer.
+ *
+ * @param data Bytes to check.
+ * @param len Number of bytes.
+ * @return The CRC.
+ */
+uint16_t telemetry_crc16(const uint8_t* data, uint16_t len);
+
+/**
+ * @brief Selects how often records are sent.
+ *
+ * @param divider A record is sent every `divider` PID ticks, 1 sends one every tick, 0 stops the stream.
+ */
+void telemetry_set_divider(uint16_t divider);
+
+/**
+ * @brief Called at the end of each PID update, sends a record when the divider is due.
+ *
+ * The frame is queued with `uart_write()`, so this never waits for the line. If the
+ * transmit buffer cannot hold the whole frame, the record is skipped and the gap
+ * shows in the sequence number.
+ *
+ * @param rpm_q16 Measured speed in RPM, Q16.16.
+ * @param setpoint_q16 Speed setpoint in RPM, Q16.16.
+ * @param duty PWM duty on the timer output, 0 to TELEMETRY_DUTY_MAX.
+ */
+void telemetry_pid_tick(int32_t rpm_q16, int32_t setpoint_q16, uint16_t duty);
@@ -1,31 +1,143 @@
+#include "libopencm3/cm3/cortex.h"
 #include "libopencm3/cm3/nvic.h"
+#include "libopencm3/stm32/dma.h"
 #include "libopencm3/stm32/gpio.h"
 #include "libopencm3/stm32/rcc.h"
 #include "libopencm3/stm32/usart.h"
-#include "pid.h"
+#include <string.h>
+
+/**
+ * @brief Baud rate set by `uart_init()`.
+ */
+#define UART_BAUDRATE 115200
+
+/**
+ * @brief DMA channel wired to the USART1 TX requests.
+ */
+#define UART_TX_DMA_CHANNEL DMA_CHANNEL4
+
+/**
+ * @brief Size of the transmit ring buffer in bytes.
+ */
+#define UART_TX_SIZE 256
+
+/**
+ * @brief DMA channel wired to the USART1 RX requests.
+ */
+#define UART_RX_DMA_CHANNEL DMA_CHANNEL5
+
+/**
+ * @brief Size of the circular receive buffer in bytes.
+ *
+ * It must hold everything received between two calls to `uart_poll()`.
+ */
+#define UART_RX_SIZE 128
+
+/**
+ * @brief Longest command line, terminator included. Longer lines are dropped.
+ */
+#define UART_LINE_SIZE 64
+
+/**
+ * @brief 1 to apply the PID parameters received by UART with a bumpless transfer.
+ */
+#define UART_PID_BUMPLESS 1
 
 /**
  * @brief Initializes the UART peripheral for communication.
  *
  * This function configures the GPIO pins for UART (PA9 for TX and PA10 for RX),
- * sets up USART1 with the desired settings (9600 baud rate, 8 data bits, 1 stop bit),
- * and enables interrupts for receiving data.
+ * sets up USART1 with the desired settings (UART_BAUDRATE, 8 data bits, 1 stop bit),
+ * enables interrupts for receiving data and the DMA channel that drains the
+ * transmit ring buffer.
  */
 void uart_init(void);
 
+/**
+ * @brief Changes the baud rate of USART1.
+ *
+ * Waits for the bytes already queued to be sent, so they go out at the old rate.
+ *
+ * @param baudrate New baud rate, e.g. 115200 or 460800.
+ */
+void uart_set_baudrate(uint32_t baudrate);
+
+/**
+ * @brief Queues bytes for transmission without blocking.
+ *
+ * The bytes are copied into the transmit ring buffer and sent by DMA. Safe to call
+ * from the main loop and from interrupts. If the buffer does not have room for all
+ * of them, the bytes that do not fit are dropped and counted as overflows.
+ *
+ * @param data Bytes to send.
+ * @param len Number of bytes.
+ * @return Number of bytes queued.
+ */
+uint16_t uart_write(const uint8_t* data, uint16_t len);
+
+/**
+ * @brief Returns the room left in the transmit ring buffer.
+ *
+ * @return Number of bytes `uart_write()` can queue right now.
+ */
+uint16_t uart_tx_free(void);
+
+/**
+ * @brief Returns the number of bytes sent by the DMA since start-up.
+ *
+ * @return Bytes sent.
+ */
+uint32_t uart_get_tx_bytes(void);
+
+/**
+ * @brief Returns the number of bytes dropped because the transmit buffer was full.
+ *
+ * @return Bytes dropped.
+ */
+uint32_t uart_get_tx_overflows(void);
+
 /**
  * @brief Interrupt Service Routine for USART1.
  *
- * This function handles received data on USART1. It stores characters in a buffer
- * until a newline or carriage return is detected, at which point it processes the command.
+ * The received bytes are written by DMA into a circular buffer, so this interrupt
+ * only fires when the line goes idle after a frame. It flags that data is waiting
+ * for `uart_poll()`, the commands are never parsed in interrupt context.
  */
 void usart1_isr(void);
 
+/**
+ * @brief Parses the bytes received since the last call.
+ *
+ * Meant to be called from the main loop. Splits the received bytes into lines on
+ * newline or carriage return and runs `process_uart_command()` on each complete line.
+ * Returns immediately when nothing was received.
+ */
+void uart_poll(void);
+
+/**
+ * @brief Returns the number of received lines dropped because they were longer than UART_LINE_SIZE.
+ *
+ * @return Lines dropped.
+ */
+uint32_t uart_get_rx_overflows(void);
+
 /**
  * @brief Processes a command received via UART.
  *
- * This function interprets commands in the format "SET PARAM VALUE" and updates
- * the corresponding PID parameter or setpoint.
+ * This function interprets commands in the format "SET PARAM VALUE" and updates the
+ * corresponding PID parameter or setpoint, the telemetry rate (TM), the motor ramp
+ * time (RAMP), the wait of the ultrasonic sensor after each echo (GUARD), the gate
+ * to diverter distance in encoder pulses (REJECT) or the speed window (WIN). Values
+ * outside the range of the setting are rejected. PID changes are staged and
+ * committed, so they take effect as a whole at the next control tick. "PROF" sends
+ * the profiling table and "JITTER" the timing histograms, followed by "RESET" they
+ * clear them. "TUNE" runs the relay auto-tuner and reports the gains, "TUNE APPLY"
+ * also commits them and "TUNE STOP" aborts it. "FF" sends the feedforward map,
+ * "FF CAL" runs its calibration sweep and "FF RESET" clears it. "PING" sends the ping
+ * rate the ultrasonic sensor achieved while measuring the last object, and "HEIGHTS"
+ * the height profile of the last object measured on the move. "QUEUE" sends the
+ * objects between the gate and the diverter. The line is split into tokens in place,
+ * without stdio and without copying.
  *
  * @param command Pointer to the received command string.
  */
@@ -34,7 +146,7 @@ void process_uart_command(const char* command);
 /**
  * @brief Sends a null-terminated string via UART.
  *
- * This function transmits a string character by character using the blocking method.
+ * This function queues the string with `uart_write()` and returns immediately.
  *
  * @param str Pointer to the string to send.
  */
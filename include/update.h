@@ -4,7 +4,8 @@
  *
  * This file contains functions for initializing the SysTick timer, handling
  * periodic system updates (such as PID updates, LCD display updates, and distance measurements),
- * and calculating the average distance measurement.
+ * and estimating the distance to each object. The periodic updates are tasks
+ * of the cooperative scheduler.
  */
 
 #include "button.h"
@@ -12,8 +13,11 @@
 #include "lcd.h"
 #include "motor_driver.h"
 #include "pid.h"
+#include "scheduler.h"
 #include "setpoint.h"
 #include "speedometer.h"
+#include "telemetry.h"
+#include "uart.h"
 #include "utils.h"
 #include <libopencm3/cm3/systick.h>
 
@@ -22,16 +26,53 @@
  */
 #define TICKS_FOR_MS 72000
 
+/** @brief Interval in milliseconds for checking the buttons and the motor state. */
+#define STATE_RATE 1
+
 /** @brief Sample time interval in milliseconds for PID updates. */
 #define PID_RATE 50
 
 /** @brief Sample time interval in milliseconds for updating the display. */
 #define DISPLAY_RATE 500
 
-/** @brief Sample time interval in milliseconds for object distance measurements. */
-#define MEASUREMENT_RATE 120
+/**
+ * @brief Sample time interval in milliseconds for object distance measurements.
+ *
+ * The task only polls the ping scheduler of the HC-SR04 driver, which fires each
+ * ping HCSR04_GUARD_MS after the previous echo, so the pings are not tied to this period.
+ */
+#define MEASUREMENT_RATE 1
+
+/**
+ * @brief PID updates after a motor restart that still hold the integral (with PID_DT_AWARE).
+ *
+ * The speedometer needs encoder edges in two updates before it has a new estimate,
+ * until then it reports the motor as stopped while it is already spinning up.
+ */
+#define PID_RESTART_HOLD 2
+
+/** @brief First release of the PID task, in ms after start-up. */
+#define PID_PHASE 0
+
+/** @brief First release of the measurement task, in ms after start-up. */
+#define MEASUREMENT_PHASE 2
+
+/** @brief First release of the display tasks, in ms after start-up. */
+#define DISPLAY_PHASE 5
 
-/** @brief Number of samples taken for each distance measurement average. */
+/**
+ * @brief Measures objects while the belt keeps running.
+ *
+ * Off by default: the belt stops at the gate and the streaming estimator decides
+ * from a few pings. Set it to 1 (e.g. `-D MEASURE_ON_THE_MOVE=1`) to keep the belt
+ * running: the pings are recorded against belt position for as long as the object
+ * covers the gate, the height profile decides, and the belt only stops on a reject.
+ */
+#ifndef MEASURE_ON_THE_MOVE
+#define MEASURE_ON_THE_MOVE 0
+#endif
+
+/** @brief Most pings for one object, the estimator usually decides after two or three. */
 #define N_MEASUREMENT 10
 
 /** @brief Threshold distance for measurement evaluation in [cm]. */
@@ -41,32 +82,28 @@
 #define MEASUREMENT_DISPLAY_TIME 6
 
 /**
- * @brief Maximum revolutions per minute (RPM) for the motor.
- *
- * This constant defines the upper limit for the motor speed in RPM. It is used
- * as a reference for setting the motor's speed range and calculating the setpoint.
+ * @brief Identifiers of the scheduler tasks, in task table order.
  */
-#define MAX_RPM 6500
+enum
+{
+    TASK_STATE,           /**< Button and motor state handling. */
+    TASK_PID,             /**< Speed control loop. */
+    TASK_MEASURE,         /**< Object height sampling. */
+    TASK_MEASURE_DISPLAY, /**< Measurement progress and result screen. */
+    TASK_SPEED_DISPLAY,   /**< Speed and setpoint screen. */
+    N_TASKS               /**< Number of tasks. */
+};
 
 /**
- * @brief Initializes the SysTick timer for system timing.
+ * @brief Initializes the task scheduler and the SysTick timer for system timing.
  *
- * Sets the reload value for generating an interrupt every millisecond, selects
- * the AHB clock as the source, and enables both the counter and the interrupt.
+ * Registers the task table, sets the reload value for generating an interrupt
+ * every millisecond, selects the AHB clock as the source, and enables both the
+ * counter and the interrupt. The SysTick interrupt only releases tasks; they run
+ * when the main loop calls `scheduler_dispatch()`.
  */
 void update_init(void);
 
-/**
- * @brief Calculates the average of recorded measurements.
- *
- * This function iterates through the measurement buffer and calculates the
- * average distance. Used primarily for processing distance measurements from
- * the sensor.
- *
- * @return The average distance measurement.
- */
-float get_measurement_prom(void);
-
 /**
  * @brief Displays the current speed and target setpoint on the LCD.
  *
@@ -78,9 +115,12 @@ void display_speed(void);
 /**
  * @brief Records distance measurements from the ultrasonic sensor.
  *
- * This function performs distance measurements using the ultrasonic sensor,
- * stores the results in a buffer, and determines if the measurement meets
- * the pass/fail threshold.
+ * This function runs the ping scheduler of the ultrasonic sensor and feeds each
+ * result to the height estimator, the next ping is triggered as soon as the
+ * previous echo has rung down. As soon as the estimator decides against the
+ * pass/fail threshold, or after N_MEASUREMENT pings, the measurement is done.
+ * With MEASURE_ON_THE_MOVE, each result goes into the height profile of the object
+ * instead, and the measurement is done once the object has left the gate.
  */
 void measure(void);
 
@@ -88,7 +128,7 @@ void measure(void);
  * @brief Displays measurement information on the LCD.
  *
  * Depending on whether a full set of measurements has been completed, this
- * function will either display the measurement percentage or the average
+ * function will either display the measurement percentage or the estimated
  * distance value. Used to provide feedback on object height or measurement
  * completion.
  */
@@ -98,7 +138,13 @@ void display_measure_info(void);
  * @brief Updates the PID controller for motor speed control.
  *
  * Retrieves the current potentiometer value for the setpoint, obtains the
- * current RPM from the speedometer, and adjusts motor power output based on
- * the PID controller's calculations.
+ * current RPM from the speedometer, and adjusts motor power output based on the
+ * PID controller's calculations. The setpoint is only recomputed when the
+ * potentiometer reports a change, so one set with "SET SP" holds until the knob
+ * moves; the display and the telemetry show the setpoint the controller uses.
+ * Setpoint and speed are kept in Q16.16, so the loop does no float arithmetic
+ * when PID_FIXED_POINT is enabled. With PID_DT_AWARE the controller gets the
+ * time since the previous call, measured with the cycle counter, and holds its
+ * integral while the motor is disabled.
  */
 void upt_pid(void);
@@ -1,12 +1,14 @@
 /**
  * @file utils.h
- * @brief Provides a function to convert a floating-point number to a string.
+ * @brief Provides functions to convert numbers to strings.
  *
- * This module defines a utility function for converting floating-point numbers
- * to a string representation. Note that there is a known issue with handling
- * certain multiples of 10, where precision limitations may cause unexpected formatting.
+ * This module defines utility functions for converting floating-point numbers
+ * and unsigned integers to a string representation. Note that there is a known
+ * issue with handling certain multiples of 10 in floats, where precision
+ * limitations may cause unexpected formatting.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 
 /**
@@ -20,3 +22,14 @@
  * @return Pointer to a string representing the number.
  */
 char* float_to_string(float number);
+
+/**
+ * @brief Writes an unsigned number right-aligned in a field, without stdio.
+ *
+ * @param out Where the characters are written, not null-terminated.
+ * @param value Number to write.
+ * @param width Field width, the number is not truncated if it is wider.
+ * @param decimals Digits after a decimal point, taken from the lowest digits of `value` (0 for none).
+ * @return Number of characters written.
+ */
+uint8_t uint_to_string(char* out, uint32_t value, uint8_t width, uint8_t decimals);
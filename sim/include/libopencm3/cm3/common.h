@@ -0,0 +1,35 @@
+/**
+ * @file common.h
+ * @brief Host stand-in for the libopencm3 register access macros.
+ *
+ * The peripheral address space (0x40000000 up to the end of RCC) is backed by a
+ * plain array, so firmware that reads or writes a register, or hands its address
+ * to the DMA, runs unchanged on the host. The simulated peripherals in `sim/` read
+ * and update the same array. Core peripherals (SysTick, DWT, NVIC) are only reached
+ * through their functions and have no registers here.
+ */
+
+#ifndef LIBOPENCM3_CM3_COMMON_H
+#define LIBOPENCM3_CM3_COMMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Start of the peripheral address space. */
+#define PERIPH_BASE 0x40000000U
+
+/** @brief Size of the simulated peripheral address space, up to the end of RCC. */
+#define SIM_PERIPH_SIZE 0x24000U
+
+/** @brief Register file of the simulated peripherals, one word per register. */
+extern volatile uint32_t sim_mmio[SIM_PERIPH_SIZE / 4];
+
+/** @brief 32-bit register at a peripheral address. */
+#define MMIO32(addr) (sim_mmio[((uint32_t)(addr) - PERIPH_BASE) / 4])
+
+#define PERIPH_BASE_APB1 (PERIPH_BASE + 0x00000)
+#define PERIPH_BASE_APB2 (PERIPH_BASE + 0x10000)
+#define PERIPH_BASE_AHB  (PERIPH_BASE + 0x18000)
+
+#endif
@@ -0,0 +1,19 @@
+/**
+ * @file cortex.h
+ * @brief Host stand-in for the libopencm3 interrupt masking functions.
+ *
+ * Masking defers simulated interrupts; the pending ones run when interrupts are
+ * enabled again, as on the Cortex-M3.
+ */
+
+#ifndef LIBOPENCM3_CORTEX_H
+#define LIBOPENCM3_CORTEX_H
+
+#include <libopencm3/cm3/common.h>
+
+void cm_enable_interrupts(void);
+void cm_disable_interrupts(void);
+bool cm_is_masked_interrupts(void);
+bool cm_mask_interrupts(bool mask);
+
+#endif
@@ -0,0 +1,17 @@
+/**
+ * @file dwt.h
+ * @brief Host stand-in for the libopencm3 DWT cycle counter functions.
+ *
+ * The cycle counter is the simulated time in CPU cycles at the AHB frequency.
+ */
+
+#ifndef LIBOPENCM3_CM3_DWT_H
+#define LIBOPENCM3_CM3_DWT_H
+
+#include <libopencm3/cm3/common.h>
+
+bool dwt_enable_cycle_counter(void);
+void dwt_disable_cycle_counter(void);
+uint32_t dwt_read_cycle_counter(void);
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * @file nvic.h
+ * @brief Host stand-in for the libopencm3 NVIC functions and STM32F1 interrupt handlers.
+ *
+ * Priorities are recorded but not used: simulated handlers never preempt each other.
+ */
+
+#ifndef LIBOPENCM3_NVIC_H
+#define LIBOPENCM3_NVIC_H
+
+#include <libopencm3/cm3/common.h>
+
+#define NVIC_DMA1_CHANNEL1_IRQ 11
+#define NVIC_DMA1_CHANNEL2_IRQ 12
+#define NVIC_DMA1_CHANNEL3_IRQ 13
+#define NVIC_DMA1_CHANNEL4_IRQ 14
+#define NVIC_DMA1_CHANNEL5_IRQ 15
+#define NVIC_DMA1_CHANNEL6_IRQ 16
+#define NVIC_DMA1_CHANNEL7_IRQ 17
+#define NVIC_ADC1_2_IRQ        18
+#define NVIC_TIM1_UP_IRQ       25
+#define NVIC_TIM1_CC_IRQ       27
+#define NVIC_TIM2_IRQ          28
+#define NVIC_TIM3_IRQ          29
+#define NVIC_TIM4_IRQ          30
+#define NVIC_I2C1_EV_IRQ       31
+#define NVIC_I2C1_ER_IRQ       32
+#define NVIC_USART1_IRQ        37
+#define NVIC_EXTI15_10_IRQ     40
+
+/** @brief Number of interrupt lines of the STM32F103. */
+#define NVIC_IRQ_COUNT 68
+
+void nvic_enable_irq(uint8_t irqn);
+void nvic_disable_irq(uint8_t irqn);
+uint8_t nvic_get_irq_enabled(uint8_t irqn);
+void nvic_set_priority(uint8_t irqn, uint8_t priority);
+
+void sys_tick_handler(void);
+void dma1_channel1_isr(void);
+void dma1_channel2_isr(void);
+void dma1_channel3_isr(void);
+void dma1_channel4_isr(void);
+void dma1_channel5_isr(void);
+void dma1_channel6_isr(void);
+void dma1_channel7_isr(void);
+void adc1_2_isr(void);
+void tim1_up_isr(void);
+void tim1_cc_isr(void);
+void tim2_isr(void);
+void tim3_isr(void);
+void tim4_isr(void);
+void i2c1_ev_isr(void);
+void i2c1_er_isr(void);
+void usart1_isr(void);
+void exti15_10_isr(void);
+
+#endif
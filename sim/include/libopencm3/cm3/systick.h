@@ -0,0 +1,25 @@
+/**
+ * @file systick.h
+ * @brief Host stand-in for the libopencm3 SysTick functions.
+ */
+
+#ifndef LIBOPENCM3_SYSTICK_H
+#define LIBOPENCM3_SYSTICK_H
+
+#include <libopencm3/cm3/common.h>
+
+#define STK_CSR_CLKSOURCE_AHB_DIV8 (0 << 2)
+#define STK_CSR_CLKSOURCE_AHB      (1 << 2)
+
+void systick_set_reload(uint32_t value);
+uint32_t systick_get_reload(void);
+uint32_t systick_get_value(void);
+void systick_set_clocksource(uint8_t clocksource);
+void systick_interrupt_enable(void);
+void systick_interrupt_disable(void);
+void systick_counter_enable(void);
+void systick_counter_disable(void);
+uint8_t systick_get_countflag(void);
+void systick_clear(void);
+
+#endif
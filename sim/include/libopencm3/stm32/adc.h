@@ -0,0 +1,108 @@
+/**
+ * @file adc.h
+ * @brief Host stand-in for the libopencm3 STM32F1 ADC functions.
+ *
+ * Only regular conversions are simulated. Calibration completes at once.
+ */
+
+#ifndef LIBOPENCM3_ADC_H
+#define LIBOPENCM3_ADC_H
+
+#include <libopencm3/cm3/common.h>
+
+#define ADC1 (PERIPH_BASE_APB2 + 0x2400)
+
+#define ADC_SR(adc)    MMIO32((adc) + 0x00)
+#define ADC_CR1(adc)   MMIO32((adc) + 0x04)
+#define ADC_CR2(adc)   MMIO32((adc) + 0x08)
+#define ADC_SMPR1(adc) MMIO32((adc) + 0x0C)
+#define ADC_SMPR2(adc) MMIO32((adc) + 0x10)
+#define ADC_HTR(adc)   MMIO32((adc) + 0x24)
+#define ADC_LTR(adc)   MMIO32((adc) + 0x28)
+#define ADC_SQR1(adc)  MMIO32((adc) + 0x2C)
+#define ADC_SQR2(adc)  MMIO32((adc) + 0x30)
+#define ADC_SQR3(adc)  MMIO32((adc) + 0x34)
+#define ADC_DR(adc)    MMIO32((adc) + 0x4C)
+
+#define ADC_SR_AWD  (1 << 0)
+#define ADC_SR_EOC  (1 << 1)
+#define ADC_SR_STRT (1 << 4)
+
+#define ADC_CR1_AWDCH_MASK 0x1F
+#define ADC_CR1_EOCIE      (1 << 5)
+#define ADC_CR1_AWDIE      (1 << 6)
+#define ADC_CR1_SCAN       (1 << 8)
+#define ADC_CR1_AWDSGL     (1 << 9)
+#define ADC_CR1_AWDEN      (1 << 23)
+
+#define ADC_CR2_ADON         (1 << 0)
+#define ADC_CR2_CONT         (1 << 1)
+#define ADC_CR2_CAL          (1 << 2)
+#define ADC_CR2_RSTCAL       (1 << 3)
+#define ADC_CR2_DMA          (1 << 8)
+#define ADC_CR2_ALIGN        (1 << 11)
+#define ADC_CR2_EXTSEL_MASK  (7 << 17)
+#define ADC_CR2_EXTTRIG      (1 << 20)
+#define ADC_CR2_SWSTART      (1 << 22)
+#define ADC_CR2_TSVREFE      (1 << 23)
+
+#define ADC_CR2_EXTSEL_TIM1_CC1 (0 << 17)
+#define ADC_CR2_EXTSEL_TIM1_CC2 (1 << 17)
+#define ADC_CR2_EXTSEL_TIM1_CC3 (2 << 17)
+#define ADC_CR2_EXTSEL_TIM2_CC2 (3 << 17)
+#define ADC_CR2_EXTSEL_TIM3_TRGO (4 << 17)
+#define ADC_CR2_EXTSEL_TIM4_CC4 (5 << 17)
+#define ADC_CR2_EXTSEL_EXTI11   (6 << 17)
+#define ADC_CR2_EXTSEL_SWSTART  (7 << 17)
+
+#define ADC_CHANNEL0  0x00
+#define ADC_CHANNEL1  0x01
+#define ADC_CHANNEL8  0x08
+#define ADC_CHANNEL9  0x09
+#define ADC_CHANNEL16 0x10
+#define ADC_CHANNEL17 0x11
+
+#define ADC_SMPR_SMP_1DOT5CYC   0x0
+#define ADC_SMPR_SMP_7DOT5CYC   0x1
+#define ADC_SMPR_SMP_13DOT5CYC  0x2
+#define ADC_SMPR_SMP_28DOT5CYC  0x3
+#define ADC_SMPR_SMP_41DOT5CYC  0x4
+#define ADC_SMPR_SMP_55DOT5CYC  0x5
+#define ADC_SMPR_SMP_71DOT5CYC  0x6
+#define ADC_SMPR_SMP_239DOT5CYC 0x7
+
+void adc_power_on(uint32_t adc);
+void adc_power_off(uint32_t adc);
+void adc_enable_dma(uint32_t adc);
+void adc_disable_dma(uint32_t adc);
+void adc_enable_eoc_interrupt(uint32_t adc);
+void adc_disable_eoc_interrupt(uint32_t adc);
+void adc_enable_scan_mode(uint32_t adc);
+void adc_disable_scan_mode(uint32_t adc);
+void adc_enable_temperature_sensor(void);
+void adc_disable_temperature_sensor(void);
+void adc_set_continuous_conversion_mode(uint32_t adc);
+void adc_set_single_conversion_mode(uint32_t adc);
+void adc_set_right_aligned(uint32_t adc);
+void adc_set_left_aligned(uint32_t adc);
+void adc_set_regular_sequence(uint32_t adc, uint8_t length, uint8_t channel[]);
+void adc_set_sample_time(uint32_t adc, uint8_t channel, uint8_t time);
+void adc_reset_calibration(uint32_t adc);
+void adc_calibrate(uint32_t adc);
+bool adc_is_calibrating(uint32_t adc);
+void adc_enable_external_trigger_regular(uint32_t adc, uint32_t trigger);
+void adc_disable_external_trigger_regular(uint32_t adc);
+void adc_start_conversion_regular(uint32_t adc);
+uint32_t adc_read_regular(uint32_t adc);
+bool adc_eoc(uint32_t adc);
+void adc_enable_analog_watchdog_regular(uint32_t adc);
+void adc_disable_analog_watchdog_regular(uint32_t adc);
+void adc_enable_analog_watchdog_on_selected_channel(uint32_t adc, uint8_t channel);
+void adc_set_watchdog_high_threshold(uint32_t adc, uint16_t threshold);
+void adc_set_watchdog_low_threshold(uint32_t adc, uint16_t threshold);
+void adc_enable_awd_interrupt(uint32_t adc);
+void adc_disable_awd_interrupt(uint32_t adc);
+bool adc_get_flag(uint32_t adc, uint32_t flag);
+void adc_clear_flag(uint32_t adc, uint32_t flag);
+
+#endif
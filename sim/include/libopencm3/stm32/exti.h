@@ -0,0 +1,54 @@
+/**
+ * @file exti.h
+ * @brief Host stand-in for the libopencm3 STM32F1 EXTI functions.
+ */
+
+#ifndef LIBOPENCM3_EXTI_H
+#define LIBOPENCM3_EXTI_H
+
+#include <libopencm3/cm3/common.h>
+
+#define EXTI_BASE (PERIPH_BASE_APB2 + 0x0400)
+#define AFIO_BASE (PERIPH_BASE_APB2 + 0x0000)
+
+#define EXTI_IMR   MMIO32(EXTI_BASE + 0x00)
+#define EXTI_EMR   MMIO32(EXTI_BASE + 0x04)
+#define EXTI_RTSR  MMIO32(EXTI_BASE + 0x08)
+#define EXTI_FTSR  MMIO32(EXTI_BASE + 0x0C)
+#define EXTI_SWIER MMIO32(EXTI_BASE + 0x10)
+#define EXTI_PR    MMIO32(EXTI_BASE + 0x14)
+
+#define AFIO_EXTICR(i) MMIO32(AFIO_BASE + 0x08 + 4 * (i))
+
+#define EXTI0  (1 << 0)
+#define EXTI1  (1 << 1)
+#define EXTI2  (1 << 2)
+#define EXTI3  (1 << 3)
+#define EXTI4  (1 << 4)
+#define EXTI5  (1 << 5)
+#define EXTI6  (1 << 6)
+#define EXTI7  (1 << 7)
+#define EXTI8  (1 << 8)
+#define EXTI9  (1 << 9)
+#define EXTI10 (1 << 10)
+#define EXTI11 (1 << 11)
+#define EXTI12 (1 << 12)
+#define EXTI13 (1 << 13)
+#define EXTI14 (1 << 14)
+#define EXTI15 (1 << 15)
+
+enum exti_trigger_type
+{
+    EXTI_TRIGGER_RISING,
+    EXTI_TRIGGER_FALLING,
+    EXTI_TRIGGER_BOTH,
+};
+
+void exti_set_trigger(uint32_t extis, enum exti_trigger_type trig);
+void exti_enable_request(uint32_t extis);
+void exti_disable_request(uint32_t extis);
+void exti_reset_request(uint32_t extis);
+void exti_select_source(uint32_t exti, uint32_t gpioport);
+uint32_t exti_get_flag_status(uint32_t exti);
+
+#endif
@@ -0,0 +1,69 @@
+/**
+ * @file i2c.h
+ * @brief Host stand-in for the libopencm3 STM32F1 I2C functions.
+ *
+ * The simulated master takes no bus time: each phase of a write completes as
+ * soon as the firmware allows it to.
+ */
+
+#ifndef LIBOPENCM3_I2C_H
+#define LIBOPENCM3_I2C_H
+
+#include <libopencm3/cm3/common.h>
+
+#define I2C1 (PERIPH_BASE_APB1 + 0x5400)
+
+#define I2C_CR1(i2c)   MMIO32((i2c) + 0x00)
+#define I2C_CR2(i2c)   MMIO32((i2c) + 0x04)
+#define I2C_OAR1(i2c)  MMIO32((i2c) + 0x08)
+#define I2C_DR(i2c)    MMIO32((i2c) + 0x10)
+#define I2C_SR1(i2c)   MMIO32((i2c) + 0x14)
+#define I2C_SR2(i2c)   MMIO32((i2c) + 0x18)
+#define I2C_CCR(i2c)   MMIO32((i2c) + 0x1C)
+#define I2C_TRISE(i2c) MMIO32((i2c) + 0x20)
+
+#define I2C_CR1_PE    (1 << 0)
+#define I2C_CR1_START (1 << 8)
+#define I2C_CR1_STOP  (1 << 9)
+
+#define I2C_CR2_FREQ_MASK 0x3F
+#define I2C_CR2_ITERREN   (1 << 8)
+#define I2C_CR2_ITEVTEN   (1 << 9)
+#define I2C_CR2_ITBUFEN   (1 << 10)
+#define I2C_CR2_DMAEN     (1 << 11)
+#define I2C_CR2_LAST      (1 << 12)
+
+#define I2C_SR1_SB   (1 << 0)
+#define I2C_SR1_ADDR (1 << 1)
+#define I2C_SR1_BTF  (1 << 2)
+#define I2C_SR1_TxE  (1 << 7)
+#define I2C_SR1_BERR (1 << 8)
+#define I2C_SR1_ARLO (1 << 9)
+#define I2C_SR1_AF   (1 << 10)
+
+#define I2C_SR2_MSL  (1 << 0)
+#define I2C_SR2_BUSY (1 << 1)
+
+#define I2C_CCR_FS (1 << 15)
+
+#define I2C_WRITE 0
+#define I2C_READ  1
+
+void i2c_peripheral_enable(uint32_t i2c);
+void i2c_peripheral_disable(uint32_t i2c);
+void i2c_set_standard_mode(uint32_t i2c);
+void i2c_set_fast_mode(uint32_t i2c);
+void i2c_set_clock_frequency(uint32_t i2c, uint8_t freq);
+void i2c_set_trise(uint32_t i2c, uint16_t trise);
+void i2c_set_ccr(uint32_t i2c, uint16_t freq);
+void i2c_send_start(uint32_t i2c);
+void i2c_send_stop(uint32_t i2c);
+void i2c_send_7bit_address(uint32_t i2c, uint8_t slave, uint8_t readwrite);
+void i2c_send_data(uint32_t i2c, uint8_t data);
+void i2c_enable_interrupt(uint32_t i2c, uint32_t interrupt);
+void i2c_disable_interrupt(uint32_t i2c, uint32_t interrupt);
+void i2c_enable_dma(uint32_t i2c);
+void i2c_disable_dma(uint32_t i2c);
+void i2c_set_dma_last_transfer(uint32_t i2c);
+
+#endif
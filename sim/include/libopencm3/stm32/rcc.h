@@ -0,0 +1,54 @@
+/**
+ * @file rcc.h
+ * @brief Host stand-in for the libopencm3 STM32F1 clock functions.
+ *
+ * Clock enables are accepted and ignored; the clock setup only sets the bus
+ * frequencies the firmware reads. Simulated timers always count at the AHB
+ * frequency divided by their prescaler, as with the 72 MHz configuration.
+ */
+
+#ifndef LIBOPENCM3_RCC_H
+#define LIBOPENCM3_RCC_H
+
+#include <libopencm3/cm3/common.h>
+
+enum rcc_periph_clken
+{
+    RCC_DMA1,
+    RCC_AFIO,
+    RCC_GPIOA,
+    RCC_GPIOB,
+    RCC_GPIOC,
+    RCC_ADC1,
+    RCC_TIM1,
+    RCC_USART1,
+    RCC_TIM2,
+    RCC_TIM3,
+    RCC_TIM4,
+    RCC_I2C1,
+};
+
+/** @brief Bus frequencies of a clock configuration. */
+struct rcc_clock_scale
+{
+    uint32_t ahb_frequency;
+    uint32_t apb1_frequency;
+    uint32_t apb2_frequency;
+};
+
+enum rcc_clock_hse
+{
+    RCC_CLOCK_HSE8_72MHZ,
+    RCC_CLOCK_HSE_END
+};
+
+extern const struct rcc_clock_scale rcc_hse_configs[RCC_CLOCK_HSE_END];
+extern uint32_t rcc_ahb_frequency;
+extern uint32_t rcc_apb1_frequency;
+extern uint32_t rcc_apb2_frequency;
+
+void rcc_clock_setup_pll(const struct rcc_clock_scale* clock);
+void rcc_periph_clock_enable(enum rcc_periph_clken clken);
+void rcc_periph_clock_disable(enum rcc_periph_clken clken);
+
+#endif
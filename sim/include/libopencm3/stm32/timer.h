@@ -0,0 +1,245 @@
+/**
+ * @file timer.h
+ * @brief Host stand-in for the libopencm3 STM32F1 timer functions.
+ *
+ * Registers and bit positions are those of the reference manual (RM0008), so the
+ * simulated timers in `sim/sim_timer.c` can work from the register file alone.
+ */
+
+#ifndef LIBOPENCM3_TIMER_H
+#define LIBOPENCM3_TIMER_H
+
+#include <libopencm3/cm3/common.h>
+
+#define TIM1 (PERIPH_BASE_APB2 + 0x2C00)
+#define TIM2 (PERIPH_BASE_APB1 + 0x0000)
+#define TIM3 (PERIPH_BASE_APB1 + 0x0400)
+#define TIM4 (PERIPH_BASE_APB1 + 0x0800)
+
+#define TIM_CR1(tim)   MMIO32((tim) + 0x00)
+#define TIM_CR2(tim)   MMIO32((tim) + 0x04)
+#define TIM_SMCR(tim)  MMIO32((tim) + 0x08)
+#define TIM_DIER(tim)  MMIO32((tim) + 0x0C)
+#define TIM_SR(tim)    MMIO32((tim) + 0x10)
+#define TIM_EGR(tim)   MMIO32((tim) + 0x14)
+#define TIM_CCMR1(tim) MMIO32((tim) + 0x18)
+#define TIM_CCMR2(tim) MMIO32((tim) + 0x1C)
+#define TIM_CCER(tim)  MMIO32((tim) + 0x20)
+#define TIM_CNT(tim)   MMIO32((tim) + 0x24)
+#define TIM_PSC(tim)   MMIO32((tim) + 0x28)
+#define TIM_ARR(tim)   MMIO32((tim) + 0x2C)
+#define TIM_RCR(tim)   MMIO32((tim) + 0x30)
+#define TIM_CCR1(tim)  MMIO32((tim) + 0x34)
+#define TIM_CCR2(tim)  MMIO32((tim) + 0x38)
+#define TIM_CCR3(tim)  MMIO32((tim) + 0x3C)
+#define TIM_CCR4(tim)  MMIO32((tim) + 0x40)
+#define TIM_BDTR(tim)  MMIO32((tim) + 0x44)
+#define TIM_DCR(tim)   MMIO32((tim) + 0x48)
+#define TIM_DMAR(tim)  MMIO32((tim) + 0x4C)
+
+#define TIM1_CNT  TIM_CNT(TIM1)
+#define TIM1_CCR1 TIM_CCR1(TIM1)
+#define TIM1_CCR2 TIM_CCR2(TIM1)
+#define TIM2_CNT  TIM_CNT(TIM2)
+#define TIM2_CCR1 TIM_CCR1(TIM2)
+#define TIM3_CNT  TIM_CNT(TIM3)
+#define TIM3_CCR3 TIM_CCR3(TIM3)
+#define TIM4_CNT  TIM_CNT(TIM4)
+#define TIM4_CCR3 TIM_CCR3(TIM4)
+#define TIM4_CCR4 TIM_CCR4(TIM4)
+
+#define TIM_CR1_CEN         (1 << 0)
+#define TIM_CR1_UDIS        (1 << 1)
+#define TIM_CR1_URS         (1 << 2)
+#define TIM_CR1_OPM         (1 << 3)
+#define TIM_CR1_DIR_UP      (0 << 4)
+#define TIM_CR1_DIR_DOWN    (1 << 4)
+#define TIM_CR1_CMS_EDGE    (0 << 5)
+#define TIM_CR1_CMS_CENTER_1 (1 << 5)
+#define TIM_CR1_CMS_MASK    (3 << 5)
+#define TIM_CR1_ARPE        (1 << 7)
+#define TIM_CR1_CKD_CK_INT  (0 << 8)
+#define TIM_CR1_CKD_MASK    (3 << 8)
+
+#define TIM_CR2_MMS_RESET          (0 << 4)
+#define TIM_CR2_MMS_ENABLE         (1 << 4)
+#define TIM_CR2_MMS_UPDATE         (2 << 4)
+#define TIM_CR2_MMS_COMPARE_PULSE  (3 << 4)
+#define TIM_CR2_MMS_COMPARE_OC1REF (4 << 4)
+#define TIM_CR2_MMS_MASK           (7 << 4)
+
+#define TIM_SMCR_SMS_OFF  0x0
+#define TIM_SMCR_SMS_RM   0x4
+#define TIM_SMCR_SMS_ECM1 0x7
+#define TIM_SMCR_SMS_MASK 0x7
+#define TIM_SMCR_TS_ITR0  (0x0 << 4)
+#define TIM_SMCR_TS_ITR1  (0x1 << 4)
+#define TIM_SMCR_TS_ITR2  (0x2 << 4)
+#define TIM_SMCR_TS_ITR3  (0x3 << 4)
+#define TIM_SMCR_TS_ETRF  (0x7 << 4)
+#define TIM_SMCR_TS_MASK  (0x7 << 4)
+#define TIM_SMCR_ETF_MASK (0xF << 8)
+#define TIM_SMCR_ETPS_MASK (0x3 << 12)
+#define TIM_SMCR_ETP      (1 << 15)
+
+#define TIM_DIER_UIE   (1 << 0)
+#define TIM_DIER_CC1IE (1 << 1)
+#define TIM_DIER_CC2IE (1 << 2)
+#define TIM_DIER_CC3IE (1 << 3)
+#define TIM_DIER_CC4IE (1 << 4)
+#define TIM_DIER_UDE   (1 << 8)
+#define TIM_DIER_CC1DE (1 << 9)
+#define TIM_DIER_CC2DE (1 << 10)
+#define TIM_DIER_CC3DE (1 << 11)
+#define TIM_DIER_CC4DE (1 << 12)
+
+#define TIM_SR_UIF   (1 << 0)
+#define TIM_SR_CC1IF (1 << 1)
+#define TIM_SR_CC2IF (1 << 2)
+#define TIM_SR_CC3IF (1 << 3)
+#define TIM_SR_CC4IF (1 << 4)
+#define TIM_SR_CC1OF (1 << 9)
+#define TIM_SR_CC2OF (1 << 10)
+#define TIM_SR_CC3OF (1 << 11)
+#define TIM_SR_CC4OF (1 << 12)
+
+#define TIM_CCER_CC1E (1 << 0)
+#define TIM_CCER_CC1P (1 << 1)
+#define TIM_CCER_CC2E (1 << 4)
+#define TIM_CCER_CC2P (1 << 5)
+#define TIM_CCER_CC3E (1 << 8)
+#define TIM_CCER_CC3P (1 << 9)
+#define TIM_CCER_CC4E (1 << 12)
+#define TIM_CCER_CC4P (1 << 13)
+
+#define TIM_EGR_UG (1 << 0)
+
+#define TIM_BDTR_MOE (1 << 15)
+
+enum tim_oc_id
+{
+    TIM_OC1 = 0,
+    TIM_OC1N,
+    TIM_OC2,
+    TIM_OC2N,
+    TIM_OC3,
+    TIM_OC3N,
+    TIM_OC4,
+};
+
+/** Values match the OCxM field of CCMRx. */
+enum tim_oc_mode
+{
+    TIM_OCM_FROZEN,
+    TIM_OCM_ACTIVE,
+    TIM_OCM_INACTIVE,
+    TIM_OCM_TOGGLE,
+    TIM_OCM_FORCE_LOW,
+    TIM_OCM_FORCE_HIGH,
+    TIM_OCM_PWM1,
+    TIM_OCM_PWM2,
+};
+
+enum tim_ic_id
+{
+    TIM_IC1,
+    TIM_IC2,
+    TIM_IC3,
+    TIM_IC4,
+};
+
+enum tim_ic_filter
+{
+    TIM_IC_OFF,
+    TIM_IC_CK_INT_N_2,
+    TIM_IC_CK_INT_N_4,
+    TIM_IC_CK_INT_N_8,
+    TIM_IC_DTF_DIV_2_N_6,
+    TIM_IC_DTF_DIV_2_N_8,
+    TIM_IC_DTF_DIV_4_N_6,
+    TIM_IC_DTF_DIV_4_N_8,
+    TIM_IC_DTF_DIV_8_N_6,
+    TIM_IC_DTF_DIV_8_N_8,
+    TIM_IC_DTF_DIV_16_N_5,
+    TIM_IC_DTF_DIV_16_N_6,
+    TIM_IC_DTF_DIV_16_N_8,
+    TIM_IC_DTF_DIV_32_N_5,
+    TIM_IC_DTF_DIV_32_N_6,
+    TIM_IC_DTF_DIV_32_N_8,
+};
+
+enum tim_ic_psc
+{
+    TIM_IC_PSC_OFF,
+    TIM_IC_PSC_2,
+    TIM_IC_PSC_4,
+    TIM_IC_PSC_8,
+};
+
+enum tim_ic_input
+{
+    TIM_IC_OUT = 0,
+    TIM_IC_IN_TI1 = 1,
+    TIM_IC_IN_TI2 = 2,
+    TIM_IC_IN_TRC = 3,
+    TIM_IC_IN_TI3 = 5,
+    TIM_IC_IN_TI4 = 6,
+};
+
+enum tim_ic_pol
+{
+    TIM_IC_RISING,
+    TIM_IC_FALLING,
+};
+
+enum tim_et_pol
+{
+    TIM_ET_RISING,
+    TIM_ET_FALLING,
+};
+
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div, uint32_t alignment, uint32_t direction);
+void timer_enable_preload(uint32_t timer_peripheral);
+void timer_disable_preload(uint32_t timer_peripheral);
+void timer_one_shot_mode(uint32_t timer_peripheral);
+void timer_continuous_mode(uint32_t timer_peripheral);
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value);
+void timer_set_period(uint32_t timer_peripheral, uint32_t period);
+void timer_set_repetition_counter(uint32_t timer_peripheral, uint32_t value);
+void timer_enable_counter(uint32_t timer_peripheral);
+void timer_disable_counter(uint32_t timer_peripheral);
+uint32_t timer_get_counter(uint32_t timer_peripheral);
+void timer_set_counter(uint32_t timer_peripheral, uint32_t count);
+void timer_generate_event(uint32_t timer_peripheral, uint32_t event);
+void timer_set_master_mode(uint32_t timer_peripheral, uint32_t mode);
+void timer_set_dma_on_compare_event(uint32_t timer_peripheral);
+void timer_enable_break_main_output(uint32_t timer_peripheral);
+
+void timer_enable_irq(uint32_t timer_peripheral, uint32_t irq);
+void timer_disable_irq(uint32_t timer_peripheral, uint32_t irq);
+bool timer_get_flag(uint32_t timer_peripheral, uint32_t flag);
+void timer_clear_flag(uint32_t timer_peripheral, uint32_t flag);
+
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id, enum tim_oc_mode oc_mode);
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id, uint32_t value);
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_disable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_enable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_disable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_set_oc_polarity_high(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_set_oc_polarity_low(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+
+void timer_ic_set_input(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_input in);
+void timer_ic_set_filter(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_filter flt);
+void timer_ic_set_prescaler(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_psc psc);
+void timer_ic_set_polarity(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_pol pol);
+void timer_ic_enable(uint32_t timer_peripheral, enum tim_ic_id ic);
+void timer_ic_disable(uint32_t timer_peripheral, enum tim_ic_id ic);
+
+void timer_slave_set_mode(uint32_t timer_peripheral, uint8_t mode);
+void timer_slave_set_trigger(uint32_t timer_peripheral, uint8_t trigger);
+void timer_slave_set_polarity(uint32_t timer_peripheral, enum tim_et_pol pol);
+void timer_slave_set_filter(uint32_t timer_peripheral, enum tim_ic_filter flt);
+void timer_slave_set_prescaler(uint32_t timer_peripheral, enum tim_ic_psc psc);
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * @file lcd_model.c
+ * @brief HD44780 16x2 character display behind a PCF8574 I2C backpack.
+ *
+ * The backpack port drives RS on P0, EN on P2 and D4 to D7 on P4 to P7. The
+ * controller latches its data bus on each falling edge of EN; it powers up in
+ * 8-bit mode and switches to 4-bit mode on a function set with DL cleared, as
+ * in the initialization sequence of the firmware. Only the instructions that
+ * change the displayed text are decoded.
+ */
+
+#include "sim.h"
+#include <string.h>
+
+#define LCD_MODEL_RS   0x01
+#define LCD_MODEL_EN   0x04
+#define LCD_MODEL_ROWS 2
+#define LCD_MODEL_COLS 16
+
+static uint8_t ddram[0x80];           /** Display data RAM, row 0 at 0x00 and row 1 at 0x40 */
+static uint8_t address = 0;           /** DDRAM address counter */
+static uint8_t four_bit = 0;          /** Interface width, 8 bits after power up */
+static uint8_t high_nibble = 0;       /** First half of a byte in 4-bit mode */
+static uint8_t have_high = 0;         /** 1 when the first half has been latched */
+static uint8_t port = 0;              /** Last byte written to the backpack */
+static uint8_t initialized = 0;       /** DDRAM filled with spaces */
+static char shown[LCD_MODEL_ROWS][LCD_MODEL_COLS + 1]; /** Screen at the last print */
+
+static void init_ddram(void)
+{
+    memset(ddram, ' ', sizeof(ddram));
+    initialized = 1;
+}
+
+/**
+ * @brief Runs an instruction (RS low) or stores a character (RS high).
+ */
+static void execute(uint8_t value, uint8_t rs)
+{
+    if (rs)
+    {
+        ddram[address] = value;
+        address = (address + 1) & 0x7F;
+        return;
+    }
+    if (value & 0x80) /** Set DDRAM address */
+    {
+        address = value & 0x7F;
+    }
+    else if (value & 0x40)
+    {
+        return; /** Set CGRAM address, custom characters are not modelled */
+    }
+    else if (value & 0x20) /** Function set */
+    {
+        four_bit = !(value & 0x10);
+    }
+    else if (value & 0x1C)
+    {
+        return; /** Shift, display control and entry mode: left to right entry is assumed */
+    }
+    else if (value & 0x02) /** Return home */
+    {
+        address = 0;
+    }
+    else if (value & 0x01) /** Clear display */
+    {
+        memset(ddram, ' ', sizeof(ddram));
+        address = 0;
+    }
+}
+
+void lcd_model_write(uint8_t data)
+{
+    uint8_t falling = (port & LCD_MODEL_EN) && !(data & LCD_MODEL_EN);
+    uint8_t nibble = data >> 4;
+
+    if (!initialized)
+    {
+        init_ddram();
+    }
+    port = data;
+    if (!falling)
+    {
+        return;
+    }
+
+    if (!four_bit)
+    {
+        execute((uint8_t)(nibble << 4), data & LCD_MODEL_RS);
+        have_high = 0;
+    }
+    else if (!have_high)
+    {
+        high_nibble = nibble;
+        have_high = 1;
+    }
+    else
+    {
+        execute((uint8_t)((high_nibble << 4) | nibble), data & LCD_MODEL_RS);
+        have_high = 0;
+    }
+}
+
+uint8_t lcd_model_print_changes(FILE* out, uint32_t time_ms)
+{
+    char screen[LCD_MODEL_ROWS][LCD_MODEL_COLS + 1];
+
+    if (!initialized)
+    {
+        init_ddram();
+    }
+    for (uint8_t row = 0; row < LCD_MODEL_ROWS; row++)
+    {
+        for (uint8_t col = 0; col < LCD_MODEL_COLS; col++)
+        {
+            uint8_t c = ddram[row * 0x40 + col];
+
+            screen[row][col] = (c >= 0x20 && c < 0x7F) ? (char)c : '?';
+        }
+        screen[row][LCD_MODEL_COLS] = '\0';
+    }
+    if (memcmp(screen, shown, sizeof(screen)) == 0)
+    {
+        return 0;
+    }
+
+    memcpy(shown, screen, sizeof(screen));
+    fprintf(out, "%8.3f s |%s|\n", time_ms / 1000.0, shown[0]);
+    fprintf(out, "%10s|%s|\n", "", shown[1]);
+    return 1;
+}
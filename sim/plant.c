@@ -0,0 +1,429 @@
+/**
+ * @file plant.c
+ * @brief Models of the motor, the belt and the devices wired to the board.
+ *
+ * Pins and channels follow the firmware: encoder on PA0 (TIM2 ETR and CH1), object
+ * gate on PB10 (low while an object covers it), stop button on PB11 (high while
+ * pressed), HC-SR04 TRIG on PB8 and ECHO on PB9 (TIM4 CH3/CH4), potentiometer on
+ * ADC channel 9, motor PWM from TIM3 channel 3, reject diverter on PA1 (high to push).
+ */
+
+#include "plant.h"
+#include "sim.h"
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+#include <math.h>
+
+#define PLANT_SUPPLY_V     12.0f   /** Motor supply */
+#define PLANT_R_OHM        2.0f    /** Armature resistance */
+#define PLANT_L_H          1e-3f   /** Armature inductance */
+#define PLANT_KE           0.015f  /** Back-EMF constant in V·s/rad, equal to the torque constant in N·m/A */
+#define PLANT_J            5e-6f   /** Rotor and reflected belt inertia in kg·m² */
+#define PLANT_B            5e-6f   /** Viscous friction in N·m·s/rad */
+#define PLANT_TC           0.004f  /** Coulomb friction in N·m, also the breakaway torque */
+#define PLANT_ENCODER_PPR  8       /** Encoder pulses per motor turn */
+#define PLANT_GEAR         100.0f  /** Motor turns per pulley turn */
+#define PLANT_PULLEY_MM    15.0f   /** Pulley radius */
+#define PLANT_GATE_MM      200.0f  /** Distance from the start of the belt to the gate and height sensor */
+#define PLANT_BELT_MM      600.0f  /** Length of the belt, objects fall off its end */
+#define PLANT_OBJECT_MM    80.0f   /** Length of an object along the belt */
+#define PLANT_SENSOR_MM    250.0f  /** Height of the HC-SR04 above the belt */
+#define PLANT_DIVERTER_MM  400.0f  /** Distance from the start of the belt to the diverter, 200 mm after the gate */
+#define PLANT_MAX_OBJECTS  16
+#define PLANT_MAX_GONE     256     /** Objects that left the belt, kept for `plant_get_fates()` */
+
+#define PLANT_STOP_PRESS_MS  100    /** Length of a stop button press */
+#define PLANT_TRIG_MIN_US    5      /** Shortest TRIG pulse the module answers */
+#define PLANT_ECHO_DELAY_US  250    /** From the end of TRIG to the start of the echo */
+#define PLANT_ECHO_US_PER_MM 5.831f /** Round trip of sound over one millimeter */
+#define PLANT_ECHO_RANGE_MM  4000.0f
+#define PLANT_ECHO_LOST_US   38000  /** Echo length when nothing is in range */
+#define PLANT_POT_NOISE      2      /** ADC noise, in LSB either way */
+
+#define US_TO_CYCLES(us) ((uint64_t)(us) * (SIM_CPU_HZ / 1000000U))
+
+/** @brief An object travelling on the belt. */
+typedef struct
+{
+    double start_mm; /** Belt travel when the object was placed */
+    float height_mm; /** Height seen by the HC-SR04 */
+    uint8_t active;  /** 1 while the object is on the belt */
+} Plant_Object;
+
+/** @brief Kinds of pin events raised within a step. */
+typedef enum
+{
+    EV_ENCODER_RISE,
+    EV_ENCODER_FALL,
+    EV_ECHO_RISE,
+    EV_ECHO_FALL,
+    EV_GATE,
+    EV_STOP_RELEASE,
+} Plant_Event_Kind;
+
+typedef struct
+{
+    uint64_t time;
+    Plant_Event_Kind kind;
+} Plant_Event;
+
+static uint64_t now = 0;          /** Start of the next step, in CPU cycles */
+static uint32_t rng = 1;          /** State of the noise generator */
+static float omega = 0;           /** Motor speed in rad/s */
+static float current = 0;         /** Motor current in A */
+static float load = 0;            /** Load torque in N·m */
+static double encoder = 0;        /** Encoder position in pulses */
+static double belt_mm = 0;        /** Belt travel since the start, a float would drift from the encoder */
+static float pot_percent = 0;     /** Potentiometer position */
+static uint8_t gate_covered = 0;  /** An object is under the gate */
+static uint64_t stop_release = 0; /** Time the stop button is released, 0 when not pressed */
+static uint64_t trig_rise = 0;    /** Time of the last rising edge of TRIG */
+static uint64_t echo_rise = 0;    /** Time of the next echo edges, 0 when none is pending */
+static uint64_t echo_fall = 0;
+static Plant_Object objects[PLANT_MAX_OBJECTS];
+static uint8_t diverter_on = 0;               /** The diverter pushes what is in front of it */
+static float gone_height[PLANT_MAX_GONE];     /** Height of each object that left the belt */
+static uint8_t gone_diverted[PLANT_MAX_GONE]; /** 1 if it was diverted, 0 if it fell off the end */
+static uint16_t n_gone = 0;
+static uint16_t stream_left = 0;              /** Objects of the stream still to place */
+static uint64_t stream_next = 0;              /** Time of the next object of the stream */
+static uint64_t stream_period = 0;
+static float stream_min_mm = 0;
+static float stream_max_mm = 0;
+
+/** @brief Next value of a xorshift32 generator. */
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/** @brief Uniform noise in [-amplitude, amplitude]. */
+static float noise(float amplitude)
+{
+    return amplitude * ((float)(next_random() % 2001U) / 1000.0f - 1.0f);
+}
+
+void plant_init(uint32_t seed)
+{
+    rng = seed ? seed : 1;
+    sim_gpio_input(GPIOB, GPIO10, 1); /** Gate clear */
+    sim_gpio_input(GPIOB, GPIO11, 0); /** Button released */
+    sim_gpio_input(GPIOB, GPIO9, 0);  /** No echo */
+    sim_gpio_input(GPIOA, GPIO0, 0);
+}
+
+void plant_set_pot(float percent)
+{
+    pot_percent = (percent < 0) ? 0 : (percent > 100) ? 100 : percent;
+}
+
+void plant_add_object(float height_mm)
+{
+    for (uint8_t i = 0; i < PLANT_MAX_OBJECTS; i++)
+    {
+        if (!objects[i].active)
+        {
+            objects[i].start_mm = belt_mm;
+            objects[i].height_mm = height_mm;
+            objects[i].active = 1;
+            return;
+        }
+    }
+}
+
+void plant_add_stream(uint16_t count, uint32_t period_ms, float min_mm, float max_mm)
+{
+    stream_left = count;
+    stream_period = US_TO_CYCLES((uint64_t)period_ms * 1000);
+    stream_next = sim_cycles;
+    stream_min_mm = min_mm;
+    stream_max_mm = max_mm;
+}
+
+void plant_get_fates(float min_distance_mm, Plant_Fates* out)
+{
+    out->passed = out->passed_tall = out->diverted = out->diverted_short = 0;
+    for (uint16_t i = 0; i < n_gone; i++)
+    {
+        uint8_t tall = PLANT_SENSOR_MM - gone_height[i] < min_distance_mm;
+
+        if (gone_diverted[i])
+        {
+            out->diverted++;
+            out->diverted_short += !tall;
+        }
+        else
+        {
+            out->passed++;
+            out->passed_tall += tall;
+        }
+    }
+    out->on_belt = 0;
+    for (uint8_t i = 0; i < PLANT_MAX_OBJECTS; i++)
+    {
+        out->on_belt += objects[i].active;
+    }
+}
+
+void plant_press_stop(void)
+{
+    sim_gpio_input(GPIOB, GPIO11, 1);
+    stop_release = sim_cycles + US_TO_CYCLES(PLANT_STOP_PRESS_MS * 1000);
+}
+
+void plant_set_load(float torque_mnm)
+{
+    load = torque_mnm / 1000.0f;
+}
+
+float plant_get_rpm(void)
+{
+    return omega * 60.0f / (2.0f * (float)M_PI);
+}
+
+float plant_get_current(void)
+{
+    return current;
+}
+
+float plant_get_belt_mm(void)
+{
+    return (float)belt_mm;
+}
+
+float plant_get_duty(void)
+{
+    if (!(TIM_CCER(TIM3) & TIM_CCER_CC3E))
+    {
+        return 0;
+    }
+    return 100.0f * (float)TIM_CCR3(TIM3) / (float)(TIM_ARR(TIM3) + 1);
+}
+
+/**
+ * @brief Height of what is under the sensor: the belt, or the object covering the gate.
+ */
+static float target_height(void)
+{
+    for (uint8_t i = 0; i < PLANT_MAX_OBJECTS; i++)
+    {
+        float front = belt_mm - objects[i].start_mm;
+
+        if (objects[i].active && front >= PLANT_GATE_MM && front < PLANT_GATE_MM + PLANT_OBJECT_MM)
+        {
+            return objects[i].height_mm;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Takes an object off the belt and records where it went.
+ */
+static void remove_object(uint8_t i, uint8_t diverted)
+{
+    objects[i].active = 0;
+    if (n_gone < PLANT_MAX_GONE)
+    {
+        gone_height[n_gone] = objects[i].height_mm;
+        gone_diverted[n_gone] = diverted;
+        n_gone++;
+    }
+}
+
+void plant_gpio_output(uint32_t port, uint16_t pins, uint16_t levels)
+{
+    if (port == GPIOA && (pins & GPIO1))
+    {
+        diverter_on = (levels & GPIO1) ? 1 : 0;
+        return;
+    }
+    if (port != GPIOB || !(pins & GPIO8))
+    {
+        return;
+    }
+    if (levels & GPIO8)
+    {
+        trig_rise = sim_cycles;
+    }
+    else if (sim_cycles - trig_rise >= US_TO_CYCLES(PLANT_TRIG_MIN_US) && echo_rise == 0 && echo_fall == 0)
+    {
+        float distance = PLANT_SENSOR_MM - target_height() + noise(1.0f);
+        float length_us = (distance < PLANT_ECHO_RANGE_MM) ? distance * PLANT_ECHO_US_PER_MM : PLANT_ECHO_LOST_US;
+
+        echo_rise = sim_cycles + US_TO_CYCLES(PLANT_ECHO_DELAY_US);
+        echo_fall = echo_rise + (uint64_t)(length_us * (SIM_CPU_HZ / 1000000U));
+    }
+}
+
+/** @brief Adds an event to a list kept in time order. */
+static void add_event(Plant_Event* list, uint8_t* n, uint64_t time, Plant_Event_Kind kind)
+{
+    uint8_t i = *n;
+
+    while (i > 0 && list[i - 1].time > time)
+    {
+        list[i] = list[i - 1];
+        i--;
+    }
+    list[i].time = time;
+    list[i].kind = kind;
+    (*n)++;
+}
+
+/**
+ * @brief Raises the pin and timer input edges of an event.
+ */
+static void raise(Plant_Event* ev, uint64_t start)
+{
+    uint32_t offset = (ev->time > start) ? (uint32_t)(ev->time - start) : 0;
+
+    sim_set_time(ev->time);
+    switch (ev->kind)
+    {
+        case EV_ENCODER_RISE:
+            sim_gpio_input(GPIOA, GPIO0, 1);
+            sim_timer_etr_edge(TIM2);
+            sim_timer_input_edge(TIM2, 1, 1, offset);
+            break;
+        case EV_ENCODER_FALL:
+            sim_gpio_input(GPIOA, GPIO0, 0);
+            sim_timer_input_edge(TIM2, 1, 0, offset);
+            break;
+        case EV_ECHO_RISE:
+            sim_gpio_input(GPIOB, GPIO9, 1);
+            sim_timer_input_edge(TIM4, 4, 1, offset);
+            echo_rise = 0;
+            break;
+        case EV_ECHO_FALL:
+            sim_gpio_input(GPIOB, GPIO9, 0);
+            sim_timer_input_edge(TIM4, 4, 0, offset);
+            echo_fall = 0;
+            break;
+        case EV_GATE:
+            sim_gpio_input(GPIOB, GPIO10, !gate_covered);
+            break;
+        case EV_STOP_RELEASE:
+            sim_gpio_input(GPIOB, GPIO11, 0);
+            stop_release = 0;
+            break;
+    }
+    sim_irq_dispatch();
+}
+
+/**
+ * @brief Integrates the motor over `dt` seconds with the mean voltage applied to it.
+ */
+static void motor_step(float volts, float dt)
+{
+    float torque;
+
+    current += (volts - PLANT_R_OHM * current - PLANT_KE * omega) / PLANT_L_H * dt;
+    if (current < 0)
+    {
+        current = 0; /** The freewheel diode blocks reverse current */
+    }
+
+    torque = PLANT_KE * current - PLANT_B * omega - load;
+    if (omega > 0)
+    {
+        torque -= PLANT_TC;
+    }
+    else if (torque <= PLANT_TC)
+    {
+        torque = 0; /** Static friction holds the shaft */
+    }
+    else
+    {
+        torque -= PLANT_TC;
+    }
+
+    omega += torque / PLANT_J * dt;
+    if (omega < 0)
+    {
+        omega = 0; /** Friction and load stop the motor, they do not reverse it */
+    }
+}
+
+void plant_step(uint32_t cycles)
+{
+    Plant_Event events[16];
+    uint8_t n = 0;
+    uint64_t start = now;
+    uint64_t end = now + cycles;
+    float dt = (float)cycles / SIM_CPU_HZ;
+    float omega_before = omega;
+    double from = encoder;
+    int32_t pot;
+    uint8_t covered;
+
+    pot = (int32_t)(pot_percent * 4095.0f / 100.0f + noise(PLANT_POT_NOISE) + 0.5f);
+    sim_adc_set_input(9, (uint16_t)((pot < 0) ? 0 : (pot > 4095) ? 4095 : pot));
+
+    motor_step(PLANT_SUPPLY_V * sim_timer_oc_high_cycles(TIM3, 3, cycles) / cycles, dt);
+
+    /** Encoder edges, placed by interpolating the position over the step */
+    encoder += (omega_before + omega) / 2.0f * dt / (2.0 * M_PI) * PLANT_ENCODER_PPR;
+    for (double edge = floor(from * 2.0) / 2.0 + 0.5; edge <= encoder && n < 12; edge += 0.5)
+    {
+        uint64_t t = start + (uint64_t)((edge - from) / (encoder - from) * cycles);
+
+        add_event(events, &n, t, (fmod(edge, 1.0) == 0.0) ? EV_ENCODER_RISE : EV_ENCODER_FALL);
+    }
+
+    belt_mm += (omega_before + omega) / 2.0 / PLANT_GEAR * PLANT_PULLEY_MM * dt;
+    for (uint8_t i = 0; i < PLANT_MAX_OBJECTS; i++)
+    {
+        float front = belt_mm - objects[i].start_mm;
+
+        if (objects[i].active && front >= PLANT_BELT_MM + PLANT_OBJECT_MM)
+        {
+            remove_object(i, 0); /** Fell off the end */
+        }
+        else if (objects[i].active && diverter_on && front >= PLANT_DIVERTER_MM &&
+                 front < PLANT_DIVERTER_MM + PLANT_OBJECT_MM)
+        {
+            remove_object(i, 1); /** Pushed off by the diverter */
+        }
+    }
+    if (stream_left && sim_cycles >= stream_next)
+    {
+        plant_add_object(stream_min_mm + (stream_max_mm - stream_min_mm) * (float)(next_random() % 1001U) / 1000.0f);
+        stream_left--;
+        stream_next += stream_period;
+    }
+    covered = 0;
+    for (uint8_t i = 0; i < PLANT_MAX_OBJECTS && !covered; i++)
+    {
+        float front = belt_mm - objects[i].start_mm;
+
+        covered = objects[i].active && front >= PLANT_GATE_MM && front < PLANT_GATE_MM + PLANT_OBJECT_MM;
+    }
+    if (covered != gate_covered)
+    {
+        gate_covered = covered;
+        add_event(events, &n, start + cycles / 2, EV_GATE);
+    }
+
+    if (stop_release && stop_release < end)
+    {
+        add_event(events, &n, stop_release, EV_STOP_RELEASE);
+    }
+    if (echo_rise && echo_rise < end)
+    {
+        add_event(events, &n, echo_rise, EV_ECHO_RISE);
+    }
+    if (echo_fall && echo_fall < end)
+    {
+        add_event(events, &n, echo_fall, EV_ECHO_FALL);
+    }
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        raise(&events[i], start);
+    }
+    now = end;
+}
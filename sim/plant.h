@@ -0,0 +1,90 @@
+/**
+ * @file plant.h
+ * @brief Simulated conveyor: DC motor, belt, object gate, stop button, HC-SR04 and potentiometer.
+ *
+ * The motor is driven by the TIM3 channel 3 PWM output (PB0) through a high side
+ * switch with a freewheel diode, and turns the belt through a gearbox. Objects
+ * placed at the start of the belt travel to the gate and height sensor, then past
+ * the reject diverter (PA1, high to push) to the end of the belt. All the devices
+ * are advanced by `plant_step()`, called by the simulation loop.
+ */
+
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <stdint.h>
+
+/**
+ * @brief Puts every device in its idle state and drives the idle pin levels.
+ *
+ * @param seed Seed of the sensor noise, the same seed gives the same run.
+ */
+void plant_init(uint32_t seed);
+
+/**
+ * @brief Turns the potentiometer knob.
+ *
+ * @param percent Position, 0 to 100.
+ */
+void plant_set_pot(float percent);
+
+/**
+ * @brief Places an object at the start of the belt.
+ *
+ * @param height_mm Height of the object seen by the HC-SR04.
+ */
+void plant_add_object(float height_mm);
+
+/**
+ * @brief Places objects of random heights at the start of the belt at a fixed period.
+ *
+ * @param count Number of objects.
+ * @param period_ms Time between two objects, the first one is placed at once.
+ * @param min_mm Lowest height, the heights are uniform between `min_mm` and `max_mm`.
+ * @param max_mm Highest height.
+ */
+void plant_add_stream(uint16_t count, uint32_t period_ms, float min_mm, float max_mm);
+
+/** @brief Where the objects went, by whether the HC-SR04 saw them closer than a distance. */
+typedef struct
+{
+    uint32_t passed;         /** Fell off the end of the belt */
+    uint32_t passed_tall;    /** Of those, closer to the sensor than the distance */
+    uint32_t diverted;       /** Pushed off by the diverter */
+    uint32_t diverted_short; /** Of those, not closer than the distance */
+    uint32_t on_belt;        /** Still on the belt */
+} Plant_Fates;
+
+/**
+ * @brief Counts the objects that left the belt, at the end or through the diverter.
+ *
+ * @param min_distance_mm Objects closer than this to the HC-SR04 should be rejected.
+ * @param out Where the counts are stored.
+ */
+void plant_get_fates(float min_distance_mm, Plant_Fates* out);
+
+/**
+ * @brief Presses the stop button for 100 ms.
+ */
+void plant_press_stop(void);
+
+/**
+ * @brief Applies a constant load torque on the motor shaft.
+ *
+ * @param torque_mnm Torque in mN·m, opposing the rotation.
+ */
+void plant_set_load(float torque_mnm);
+
+/** @brief Motor speed in RPM. */
+float plant_get_rpm(void);
+
+/** @brief Motor current in A. */
+float plant_get_current(void);
+
+/** @brief Distance travelled by the belt since the start, in mm. */
+float plant_get_belt_mm(void);
+
+/** @brief Duty cycle set on the motor PWM, in percent, 0 while the output is disabled. */
+float plant_get_duty(void);
+
+#endif
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Runs the scripted scenarios of the simulator and checks the outcome of each.
+#
+# Usage: sim/scenarios.sh [BUILD_DIR]
+#
+# Build the host environments first: pio run -e native -e native_diverter -e native_move -e native_move_stop
+# Each scenario runs the program of one environment with its events (-e) and checks
+# (-c, see sim_main.c). One line is printed per scenario, with the checks of the
+# failed ones, and the exit status is 1 if any scenario failed.
+
+build=${1:-.pio/build}
+log=$(mktemp)
+failed=0
+trap 'rm -f "$log"' EXIT
+
+run()
+{
+    env=$1
+    name=$2
+    shift 2
+    if "$build/$env/program" -q "$@" > /dev/null 2> "$log"; then
+        echo "ok      $env: $name"
+    else
+        echo "FAILED  $env: $name"
+        grep "sim: \(check\|bad\|unknown\)" "$log"
+        failed=1
+    fi
+}
+
+# Speed loop: start-up, setpoint steps (also once the feedforward learned a speed), load step, auto-tuned gains
+run native "start-up settles" -d 10 -c settle=3000,10000,3 -c overruns=0
+run native "setpoint step" -d 20 -e 10000:pot=80 -c settle=12000,20000,3 -c overruns=0
+run native "setpoint step after learning" -d 40 -e 20000:pot=80 -c settle=20500,40000,10 -c settle=21000,40000,3
+run native "load step" -d 20 -e 10000:load=20 -c settle=12000,20000,3 -c overruns=0
+run native "auto-tune" -d 60 -e "3000:uart=TUNE APPLY" -e 30000:pot=80 \
+    -c settle=20000,30000,3 -c settle=36000,60000,3 -c overruns=0
+run native "FF RESET after SET SP" -d 30 -e "20000:uart=SET SP 2000" -e "25000:uart=FF RESET" \
+    -c settle=22000,30000,3
+run native "telemetry every tick" -d 10 -e "1000:uart=SET TM 1" -c settle=3000,10000,3 -c overruns=0
+run native "telemetry with a short speed window" -d 10 -e "1000:uart=SET TM 1" -e "1000:uart=SET WIN 100" \
+    -c settle=3000,10000,3 -c overruns=0
+
+# Objects: a short one goes on, a tall one stops the line
+run native "short object passes" -d 20 -e 2000:object=50 -c passed=1 -c on_belt=0 -c wrong=0
+run native "tall object stops the line" -d 20 -e 2000:object=200 -c passed=0 -c on_belt=1 -c overruns=0
+
+# On the move without the diverter: the gate is free again as soon as an object has passed
+run native_move_stop "short objects pass" -d 60 -e 1000:stream=10,2200,40,80 -c on_belt=0 -c wrong=0 -c overruns=0
+run native_move_stop "tall object right after a short one" -d 30 -e 2000:object=50 -e 3580:object=200 \
+    -c passed=0 -c on_belt=2 -c overruns=0
+
+# Reject diverter, measuring with the belt stopped and on the move
+run native_diverter "stream sorted" -d 60 -e 1000:stream=20,2200,60,200 -c on_belt=0 -c wrong=0 -c overruns=0
+run native_move "stream sorted" -d 60 -e 1000:stream=20,2200,60,200 -c on_belt=0 -c wrong=0 -c overruns=0
+
+exit $failed
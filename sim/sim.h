@@ -0,0 +1,215 @@
+/**
+ * @file sim.h
+ * @brief Interfaces between the simulated peripherals, devices and the simulation loop.
+ *
+ * Simulated time is counted in CPU cycles at SIM_CPU_HZ. `sim_step()` advances it
+ * by SIM_STEP_CYCLES: the devices (motor, belt, sensors) move first and raise
+ * their pin edges at their exact times, then the timers count, and finally the
+ * interrupt handlers whose flags are set run. The firmware main loop runs between
+ * two steps and takes no simulated time; each interrupt handler takes SIM_ISR_CYCLES.
+ *
+ * Interrupts are level sensitive, as on the STM32: a handler runs again as long as
+ * it leaves its flag set and the interrupt enabled.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <libopencm3/cm3/nvic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** @brief CPU clock of the simulated 72 MHz configuration. */
+#define SIM_CPU_HZ 72000000U
+
+/** @brief Length of one simulation step in CPU cycles (10 µs). */
+#define SIM_STEP_CYCLES 720U
+
+/** @brief CPU cycles charged for each interrupt handler call (entry, body and exit). */
+#define SIM_ISR_CYCLES 60U
+
+/** @brief Handler calls in a row without time advancing after which the simulation aborts. */
+#define SIM_IRQ_STORM_LIMIT 100000U
+
+/** @brief CPU cycles per simulated millisecond. */
+#define SIM_CYCLES_PER_MS (SIM_CPU_HZ / 1000U)
+
+/** @brief Current simulated time in CPU cycles. */
+extern uint64_t sim_cycles;
+
+/* sim_core.c */
+
+/**
+ * @brief Resets the register file to the reset values of the peripherals.
+ */
+void sim_reset(void);
+
+/**
+ * @brief Advances the simulation by one step and runs the interrupt handlers that became pending.
+ */
+void sim_step(void);
+
+/**
+ * @brief Runs the pending interrupt handlers, unless interrupts are masked or a handler is running.
+ *
+ * Called after every register change that may raise an interrupt, so handlers run
+ * as soon as the hardware would start them.
+ */
+void sim_irq_dispatch(void);
+
+/**
+ * @brief Moves the simulated time forward to a device event inside the current step.
+ *
+ * @param t Time of the event in CPU cycles. Ignored if the clock is already past it.
+ */
+void sim_set_time(uint64_t t);
+
+/**
+ * @brief Gets the number of calls of an interrupt handler since the start.
+ */
+uint32_t sim_irq_count(uint8_t irqn);
+
+/* sim_timer.c */
+
+/**
+ * @brief Counts every running timer forward and raises their compare events.
+ *
+ * @param cycles CPU cycles elapsed since the previous call.
+ */
+void sim_timers_advance(uint32_t cycles);
+
+/**
+ * @brief Reports an edge on a timer input channel, latching the captures mapped to it.
+ *
+ * @param tim Timer base address.
+ * @param ti  Timer input, 1 to 4.
+ * @param rising 1 for a rising edge, 0 for a falling one.
+ * @param offset CPU cycles since the start of the current step, to compute the captured count.
+ */
+void sim_timer_input_edge(uint32_t tim, uint8_t ti, uint8_t rising, uint32_t offset);
+
+/**
+ * @brief Reports a rising edge on a timer ETR input, counted in external clock mode 1.
+ */
+void sim_timer_etr_edge(uint32_t tim);
+
+/**
+ * @brief Cycles, within the next `cycles`, during which an output compare channel drives its pin high.
+ *
+ * @param tim Timer base address.
+ * @param channel Channel, 1 to 4.
+ * @param cycles Length of the interval, starting now.
+ * @return High time in CPU cycles, 0 if the output is disabled.
+ */
+uint32_t sim_timer_oc_high_cycles(uint32_t tim, uint8_t channel, uint32_t cycles);
+
+/* sim_dma.c */
+
+/**
+ * @brief Serves one request of a DMA1 channel: moves one data item if the channel is enabled.
+ *
+ * Sets the half and full transfer flags but does not run their handlers, which
+ * is left to the caller, so a transfer is never interrupted by its own handler.
+ *
+ * @return 1 if an item was moved, 0 if the channel is disabled or done.
+ */
+uint8_t sim_dma_request(uint8_t channel);
+
+/**
+ * @brief Restores a host pointer from a 32-bit DMA address.
+ */
+void* sim_dma_pointer(uint32_t address);
+
+/**
+ * @brief Flags of a DMA1 channel that have their interrupt enabled.
+ */
+uint32_t sim_dma_irq_level(uint8_t channel);
+
+/* sim_adc.c */
+
+/**
+ * @brief Starts a regular conversion if the ADC is set to be triggered by `extsel`.
+ *
+ * @param extsel ADC_CR2_EXTSEL_* value of the event that occurred.
+ */
+void sim_adc_trigger(uint32_t extsel);
+
+/**
+ * @brief Sets the voltage seen by an ADC channel, as a 12-bit reading.
+ */
+void sim_adc_set_input(uint8_t channel, uint16_t value);
+
+uint32_t sim_adc_irq_level(void);
+
+/* sim_gpio.c */
+
+/**
+ * @brief Drives an input pin from a simulated device, raising the EXTI line on its edges.
+ */
+void sim_gpio_input(uint32_t port, uint16_t pin, uint8_t level);
+
+/**
+ * @brief Level a peripheral drives on a pin, seen while the pin is an alternate function output.
+ */
+void sim_gpio_alternate_output(uint32_t port, uint16_t pin, uint8_t level);
+
+uint32_t sim_exti_irq_level(void);
+
+/* sim_usart.c */
+
+/**
+ * @brief Moves USART1 data: drains the transmit DMA and receives the next queued byte.
+ */
+void sim_usart_service(void);
+
+/**
+ * @brief Queues bytes to be received by USART1, one per simulation step.
+ */
+void sim_usart_receive(const char* data, size_t len);
+
+/**
+ * @brief Sends the bytes transmitted by USART1 to a file, NULL to drop them.
+ */
+void sim_usart_set_output(FILE* out);
+
+uint32_t sim_usart_get_tx_bytes(void);
+uint32_t sim_usart_irq_level(void);
+void sim_usart_irq_done(uint32_t flags);
+
+/* sim_i2c.c */
+
+uint32_t sim_i2c_ev_irq_level(void);
+uint32_t sim_i2c_er_irq_level(void);
+void sim_i2c_ev_irq_done(uint32_t flags);
+
+/* lcd_model.c */
+
+/**
+ * @brief Feeds a byte written to the PCF8574 port of the LCD backpack.
+ */
+void lcd_model_write(uint8_t data);
+
+/**
+ * @brief Prints the screen if it changed since the last call.
+ *
+ * @param out File to print to.
+ * @param time_ms Simulated time shown next to the screen.
+ * @return 1 if the screen was printed.
+ */
+uint8_t lcd_model_print_changes(FILE* out, uint32_t time_ms);
+
+/* plant.c */
+
+/**
+ * @brief Advances the motor, belt and sensors over one step, raising their pin edges.
+ *
+ * @param cycles Length of the step in CPU cycles.
+ */
+void plant_step(uint32_t cycles);
+
+/**
+ * @brief Reports a change of a GPIO output driven by the firmware.
+ */
+void plant_gpio_output(uint32_t port, uint16_t pins, uint16_t levels);
+
+#endif
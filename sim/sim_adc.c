@@ -0,0 +1,249 @@
+/**
+ * @file sim_adc.c
+ * @brief ADC1: libopencm3 functions and single-channel regular conversions.
+ *
+ * A conversion completes at its trigger, the sampling time is not modelled.
+ * Calibration completes at once.
+ */
+
+#include "sim.h"
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/dma.h>
+
+static uint16_t inputs[18]; /** Reading of each channel, set by the devices */
+
+void sim_adc_set_input(uint8_t channel, uint16_t value)
+{
+    if (channel < sizeof(inputs) / sizeof(inputs[0]))
+    {
+        inputs[channel] = value & 0xFFF;
+    }
+}
+
+/**
+ * @brief Converts the first channel of the regular sequence.
+ */
+static void convert(void)
+{
+    uint8_t channel = ADC_SQR3(ADC1) & 0x1F;
+    uint16_t value = (channel < sizeof(inputs) / sizeof(inputs[0])) ? inputs[channel] : 0;
+    uint32_t cr1 = ADC_CR1(ADC1);
+
+    ADC_DR(ADC1) = (ADC_CR2(ADC1) & ADC_CR2_ALIGN) ? (uint32_t)value << 4 : value;
+    ADC_SR(ADC1) |= ADC_SR_EOC | ADC_SR_STRT;
+
+    if ((cr1 & ADC_CR1_AWDEN) && (!(cr1 & ADC_CR1_AWDSGL) || (cr1 & ADC_CR1_AWDCH_MASK) == channel) &&
+        (value > ADC_HTR(ADC1) || value < ADC_LTR(ADC1)))
+    {
+        ADC_SR(ADC1) |= ADC_SR_AWD;
+    }
+    if (ADC_CR2(ADC1) & ADC_CR2_DMA)
+    {
+        sim_dma_request(DMA_CHANNEL1); /** ADC1 requests are wired to channel 1 */
+        ADC_SR(ADC1) &= ~ADC_SR_EOC; /** Reading DR clears EOC */
+    }
+    sim_irq_dispatch();
+}
+
+void sim_adc_trigger(uint32_t extsel)
+{
+    uint32_t cr2 = ADC_CR2(ADC1);
+
+    if ((cr2 & ADC_CR2_ADON) && (cr2 & ADC_CR2_EXTTRIG) && (cr2 & ADC_CR2_EXTSEL_MASK) == extsel)
+    {
+        convert();
+    }
+}
+
+uint32_t sim_adc_irq_level(void)
+{
+    uint32_t sr = ADC_SR(ADC1);
+    uint32_t cr1 = ADC_CR1(ADC1);
+
+    return ((cr1 & ADC_CR1_AWDIE) ? sr & ADC_SR_AWD : 0) | ((cr1 & ADC_CR1_EOCIE) ? sr & ADC_SR_EOC : 0);
+}
+
+/* libopencm3 functions */
+
+void adc_power_on(uint32_t adc)
+{
+    ADC_CR2(adc) |= ADC_CR2_ADON;
+}
+
+void adc_power_off(uint32_t adc)
+{
+    ADC_CR2(adc) &= ~ADC_CR2_ADON;
+}
+
+void adc_enable_dma(uint32_t adc)
+{
+    ADC_CR2(adc) |= ADC_CR2_DMA;
+}
+
+void adc_disable_dma(uint32_t adc)
+{
+    ADC_CR2(adc) &= ~ADC_CR2_DMA;
+}
+
+void adc_enable_eoc_interrupt(uint32_t adc)
+{
+    ADC_CR1(adc) |= ADC_CR1_EOCIE;
+}
+
+void adc_disable_eoc_interrupt(uint32_t adc)
+{
+    ADC_CR1(adc) &= ~ADC_CR1_EOCIE;
+}
+
+void adc_enable_scan_mode(uint32_t adc)
+{
+    ADC_CR1(adc) |= ADC_CR1_SCAN;
+}
+
+void adc_disable_scan_mode(uint32_t adc)
+{
+    ADC_CR1(adc) &= ~ADC_CR1_SCAN;
+}
+
+void adc_enable_temperature_sensor(void)
+{
+    ADC_CR2(ADC1) |= ADC_CR2_TSVREFE;
+}
+
+void adc_disable_temperature_sensor(void)
+{
+    ADC_CR2(ADC1) &= ~ADC_CR2_TSVREFE;
+}
+
+void adc_set_continuous_conversion_mode(uint32_t adc)
+{
+    ADC_CR2(adc) |= ADC_CR2_CONT;
+}
+
+void adc_set_single_conversion_mode(uint32_t adc)
+{
+    ADC_CR2(adc) &= ~ADC_CR2_CONT;
+}
+
+void adc_set_right_aligned(uint32_t adc)
+{
+    ADC_CR2(adc) &= ~ADC_CR2_ALIGN;
+}
+
+void adc_set_left_aligned(uint32_t adc)
+{
+    ADC_CR2(adc) |= ADC_CR2_ALIGN;
+}
+
+void adc_set_regular_sequence(uint32_t adc, uint8_t length, uint8_t channel[])
+{
+    uint32_t sqr3 = 0;
+
+    for (uint8_t i = 0; i < length && i < 6; i++)
+    {
+        sqr3 |= (uint32_t)(channel[i] & 0x1F) << (5 * i);
+    }
+    ADC_SQR3(adc) = sqr3;
+    ADC_SQR1(adc) = (uint32_t)(length - 1) << 20;
+}
+
+void adc_set_sample_time(uint32_t adc, uint8_t channel, uint8_t time)
+{
+    if (channel < 10)
+    {
+        ADC_SMPR2(adc) = (ADC_SMPR2(adc) & ~(7U << (3 * channel))) | ((uint32_t)time << (3 * channel));
+    }
+    else
+    {
+        ADC_SMPR1(adc) = (ADC_SMPR1(adc) & ~(7U << (3 * (channel - 10)))) | ((uint32_t)time << (3 * (channel - 10)));
+    }
+}
+
+void adc_reset_calibration(uint32_t adc)
+{
+    ADC_CR2(adc) &= ~ADC_CR2_RSTCAL; /** Done at once */
+}
+
+void adc_calibrate(uint32_t adc)
+{
+    ADC_CR2(adc) &= ~ADC_CR2_CAL; /** Done at once */
+}
+
+bool adc_is_calibrating(uint32_t adc)
+{
+    return (ADC_CR2(adc) & ADC_CR2_CAL) != 0;
+}
+
+void adc_enable_external_trigger_regular(uint32_t adc, uint32_t trigger)
+{
+    ADC_CR2(adc) = (ADC_CR2(adc) & ~ADC_CR2_EXTSEL_MASK) | trigger | ADC_CR2_EXTTRIG;
+}
+
+void adc_disable_external_trigger_regular(uint32_t adc)
+{
+    ADC_CR2(adc) &= ~ADC_CR2_EXTTRIG;
+}
+
+void adc_start_conversion_regular(uint32_t adc)
+{
+    if (ADC_CR2(adc) & ADC_CR2_ADON)
+    {
+        convert();
+    }
+}
+
+uint32_t adc_read_regular(uint32_t adc)
+{
+    ADC_SR(adc) &= ~ADC_SR_EOC;
+    return ADC_DR(adc);
+}
+
+bool adc_eoc(uint32_t adc)
+{
+    return (ADC_SR(adc) & ADC_SR_EOC) != 0;
+}
+
+void adc_enable_analog_watchdog_regular(uint32_t adc)
+{
+    ADC_CR1(adc) |= ADC_CR1_AWDEN;
+}
+
+void adc_disable_analog_watchdog_regular(uint32_t adc)
+{
+    ADC_CR1(adc) &= ~ADC_CR1_AWDEN;
+}
+
+void adc_enable_analog_watchdog_on_selected_channel(uint32_t adc, uint8_t channel)
+{
+    ADC_CR1(adc) = (ADC_CR1(adc) & ~ADC_CR1_AWDCH_MASK) | channel | ADC_CR1_AWDSGL;
+}
+
+void adc_set_watchdog_high_threshold(uint32_t adc, uint16_t threshold)
+{
+    ADC_HTR(adc) = threshold & 0xFFF;
+}
+
+void adc_set_watchdog_low_threshold(uint32_t adc, uint16_t threshold)
+{
+    ADC_LTR(adc) = threshold & 0xFFF;
+}
+
+void adc_enable_awd_interrupt(uint32_t adc)
+{
+    ADC_CR1(adc) |= ADC_CR1_AWDIE;
+}
+
+void adc_disable_awd_interrupt(uint32_t adc)
+{
+    ADC_CR1(adc) &= ~ADC_CR1_AWDIE;
+}
+
+bool adc_get_flag(uint32_t adc, uint32_t flag)
+{
+    return (ADC_SR(adc) & flag) != 0;
+}
+
+void adc_clear_flag(uint32_t adc, uint32_t flag)
+{
+    ADC_SR(adc) &= ~flag;
+}
@@ -0,0 +1,454 @@
+/**
+ * @file sim_core.c
+ * @brief Register file, clocks, SysTick, DWT, NVIC and the simulation step.
+ */
+
+#include "sim.h"
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/usart.h>
+#include <stdlib.h>
+
+/** Handlers the firmware does not define resolve to NULL */
+#pragma weak sys_tick_handler
+#pragma weak dma1_channel1_isr
+#pragma weak dma1_channel2_isr
+#pragma weak dma1_channel3_isr
+#pragma weak dma1_channel4_isr
+#pragma weak dma1_channel5_isr
+#pragma weak dma1_channel6_isr
+#pragma weak dma1_channel7_isr
+#pragma weak adc1_2_isr
+#pragma weak tim1_up_isr
+#pragma weak tim1_cc_isr
+#pragma weak tim2_isr
+#pragma weak tim3_isr
+#pragma weak tim4_isr
+#pragma weak i2c1_ev_isr
+#pragma weak i2c1_er_isr
+#pragma weak usart1_isr
+#pragma weak exti15_10_isr
+
+/** @brief SysTick is an exception, kept apart from the NVIC lines. */
+#define SYSTICK_IRQ NVIC_IRQ_COUNT
+
+volatile uint32_t sim_mmio[SIM_PERIPH_SIZE / 4];
+uint64_t sim_cycles = 0;
+
+uint32_t rcc_ahb_frequency = 8000000; /** HSI until the clock is set up */
+uint32_t rcc_apb1_frequency = 8000000;
+uint32_t rcc_apb2_frequency = 8000000;
+
+const struct rcc_clock_scale rcc_hse_configs[RCC_CLOCK_HSE_END] = {
+    [RCC_CLOCK_HSE8_72MHZ] = {72000000, 36000000, 72000000},
+};
+
+static uint64_t periph_time = 0;         /** Time up to which the peripherals have been advanced */
+static uint8_t masked = 0;               /** 1 between `cm_disable_interrupts()` and `cm_enable_interrupts()` */
+static uint8_t in_handler = 0;           /** 1 while a handler runs, handlers do not preempt each other */
+static uint8_t enabled[SYSTICK_IRQ + 1]; /** NVIC enable bits, SysTick always enabled */
+static uint32_t calls[SYSTICK_IRQ + 1];  /** Handler calls per interrupt */
+static uint32_t storm = 0;               /** Handler calls since time last advanced */
+
+static uint32_t stk_reload = 0;       /** SysTick reload value */
+static uint32_t stk_csr = 0;          /** SysTick control bits: ENABLE, TICKINT, CLKSOURCE */
+static uint64_t stk_last = 0;         /** Time of the last SysTick reload */
+static uint8_t stk_countflag = 0;     /** Set at each wrap, cleared when read */
+static uint8_t stk_pending = 0;       /** SysTick exception pending */
+static uint8_t dwt_enabled = 0;       /** Cycle counter running */
+
+#define STK_CSR_ENABLE  (1 << 0)
+#define STK_CSR_TICKINT (1 << 1)
+
+static uint32_t systick_level(void)
+{
+    return stk_pending;
+}
+
+static uint32_t dma_level(uint8_t channel)
+{
+    return sim_dma_irq_level(channel);
+}
+
+static uint32_t dma1_level(void)
+{
+    return dma_level(1);
+}
+
+static uint32_t dma2_level(void)
+{
+    return dma_level(2);
+}
+
+static uint32_t dma3_level(void)
+{
+    return dma_level(3);
+}
+
+static uint32_t dma4_level(void)
+{
+    return dma_level(4);
+}
+
+static uint32_t dma5_level(void)
+{
+    return dma_level(5);
+}
+
+static uint32_t dma6_level(void)
+{
+    return dma_level(6);
+}
+
+static uint32_t dma7_level(void)
+{
+    return dma_level(7);
+}
+
+static uint32_t timer_level(uint32_t tim, uint32_t flags)
+{
+    return TIM_DIER(tim) & TIM_SR(tim) & flags;
+}
+
+static uint32_t tim1_up_level(void)
+{
+    return timer_level(TIM1, TIM_SR_UIF);
+}
+
+static uint32_t tim1_cc_level(void)
+{
+    return timer_level(TIM1, TIM_SR_CC1IF | TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF);
+}
+
+static uint32_t tim2_level(void)
+{
+    return timer_level(TIM2, 0x1F);
+}
+
+static uint32_t tim3_level(void)
+{
+    return timer_level(TIM3, 0x1F);
+}
+
+static uint32_t tim4_level(void)
+{
+    return timer_level(TIM4, 0x1F);
+}
+
+/** @brief An interrupt line: its handler, what asserts it, and what the hardware clears once it is served. */
+typedef struct
+{
+    uint8_t irqn;
+    void (*handler)(void);
+    uint32_t (*level)(void);
+    void (*done)(uint32_t flags);
+} Sim_Irq;
+
+static Sim_Irq irqs[] = {
+    {SYSTICK_IRQ, sys_tick_handler, systick_level, NULL},
+    {NVIC_DMA1_CHANNEL1_IRQ, dma1_channel1_isr, dma1_level, NULL},
+    {NVIC_DMA1_CHANNEL2_IRQ, dma1_channel2_isr, dma2_level, NULL},
+    {NVIC_DMA1_CHANNEL3_IRQ, dma1_channel3_isr, dma3_level, NULL},
+    {NVIC_DMA1_CHANNEL4_IRQ, dma1_channel4_isr, dma4_level, NULL},
+    {NVIC_DMA1_CHANNEL5_IRQ, dma1_channel5_isr, dma5_level, NULL},
+    {NVIC_DMA1_CHANNEL6_IRQ, dma1_channel6_isr, dma6_level, NULL},
+    {NVIC_DMA1_CHANNEL7_IRQ, dma1_channel7_isr, dma7_level, NULL},
+    {NVIC_ADC1_2_IRQ, adc1_2_isr, sim_adc_irq_level, NULL},
+    {NVIC_TIM1_UP_IRQ, tim1_up_isr, tim1_up_level, NULL},
+    {NVIC_TIM1_CC_IRQ, tim1_cc_isr, tim1_cc_level, NULL},
+    {NVIC_TIM2_IRQ, tim2_isr, tim2_level, NULL},
+    {NVIC_TIM3_IRQ, tim3_isr, tim3_level, NULL},
+    {NVIC_TIM4_IRQ, tim4_isr, tim4_level, NULL},
+    {NVIC_I2C1_EV_IRQ, i2c1_ev_isr, sim_i2c_ev_irq_level, sim_i2c_ev_irq_done},
+    {NVIC_I2C1_ER_IRQ, i2c1_er_isr, sim_i2c_er_irq_level, NULL},
+    {NVIC_USART1_IRQ, usart1_isr, sim_usart_irq_level, sim_usart_irq_done},
+    {NVIC_EXTI15_10_IRQ, exti15_10_isr, sim_exti_irq_level, NULL},
+};
+
+void sim_reset(void)
+{
+    static const uint32_t timers[] = {TIM1, TIM2, TIM3, TIM4};
+    static const uint32_t ports[] = {GPIOA, GPIOB, GPIOC};
+
+    for (uint32_t i = 0; i < SIM_PERIPH_SIZE / 4; i++)
+    {
+        sim_mmio[i] = 0;
+    }
+    for (uint8_t i = 0; i < sizeof(timers) / sizeof(timers[0]); i++)
+    {
+        TIM_ARR(timers[i]) = 0xFFFF;
+    }
+    for (uint8_t i = 0; i < sizeof(ports) / sizeof(ports[0]); i++)
+    {
+        GPIO_CRL(ports[i]) = 0x44444444; /** Floating inputs */
+        GPIO_CRH(ports[i]) = 0x44444444;
+    }
+    USART_SR(USART1) = USART_SR_TXE | USART_SR_TC;
+}
+
+void sim_set_time(uint64_t t)
+{
+    if (t > sim_cycles)
+    {
+        sim_cycles = t;
+        storm = 0;
+    }
+}
+
+uint32_t sim_irq_count(uint8_t irqn)
+{
+    return (irqn <= SYSTICK_IRQ) ? calls[irqn] : 0;
+}
+
+void sim_irq_dispatch(void)
+{
+    uint8_t served;
+
+    if (masked || in_handler)
+    {
+        return; /** Pending handlers run when the mask or the running handler is lifted */
+    }
+
+    do
+    {
+        served = 0;
+        sim_usart_service();
+        for (uint8_t i = 0; i < sizeof(irqs) / sizeof(irqs[0]); i++)
+        {
+            Sim_Irq* irq = &irqs[i];
+            uint32_t flags;
+
+            if (!enabled[irq->irqn] || !irq->handler || !(flags = irq->level()))
+            {
+                continue;
+            }
+            if (irq->irqn == SYSTICK_IRQ)
+            {
+                stk_pending = 0; /** Exceptions are pended, not level sensitive */
+            }
+
+            in_handler = 1;
+            irq->handler();
+            if (irq->done)
+            {
+                irq->done(flags); /** Still inside the handler: what it raises is served in the next scan */
+            }
+            in_handler = 0;
+            calls[irq->irqn]++;
+            sim_cycles += SIM_ISR_CYCLES;
+
+            if (++storm > SIM_IRQ_STORM_LIMIT)
+            {
+                fprintf(stderr, "sim: interrupt %u never cleared its flags, aborting\n", irq->irqn);
+                exit(2);
+            }
+            served = 1;
+            break; /** Rescan from the first line, a handler may have raised others */
+        }
+    } while (served && !masked);
+}
+
+/**
+ * @brief Counts SysTick down to the current time, pending its exception at each wrap.
+ */
+static void systick_advance(void)
+{
+    uint64_t period;
+
+    if (!(stk_csr & STK_CSR_ENABLE))
+    {
+        return;
+    }
+    period = (uint64_t)(stk_reload + 1) * ((stk_csr & STK_CSR_CLKSOURCE_AHB) ? 1 : 8);
+    while (sim_cycles - stk_last >= period)
+    {
+        stk_last += period;
+        stk_countflag = 1;
+        if (stk_csr & STK_CSR_TICKINT)
+        {
+            stk_pending = 1;
+        }
+    }
+}
+
+void sim_step(void)
+{
+    uint64_t target = periph_time + SIM_STEP_CYCLES;
+    uint32_t cycles;
+
+    if (target < sim_cycles)
+    {
+        target = sim_cycles; /** Handlers ran past the step, catch up with them */
+    }
+    cycles = (uint32_t)(target - periph_time);
+
+    plant_step(cycles);
+    sim_timers_advance(cycles);
+    periph_time = target;
+    sim_set_time(target);
+    systick_advance();
+    sim_irq_dispatch();
+}
+
+/* libopencm3 functions */
+
+void rcc_clock_setup_pll(const struct rcc_clock_scale* clock)
+{
+    rcc_ahb_frequency = clock->ahb_frequency;
+    rcc_apb1_frequency = clock->apb1_frequency;
+    rcc_apb2_frequency = clock->apb2_frequency;
+}
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken)
+{
+    (void)clken;
+}
+
+void rcc_periph_clock_disable(enum rcc_periph_clken clken)
+{
+    (void)clken;
+}
+
+void cm_enable_interrupts(void)
+{
+    masked = 0;
+    sim_irq_dispatch();
+}
+
+void cm_disable_interrupts(void)
+{
+    masked = 1;
+}
+
+bool cm_is_masked_interrupts(void)
+{
+    return masked;
+}
+
+bool cm_mask_interrupts(bool mask)
+{
+    bool old = masked;
+
+    if (mask)
+    {
+        cm_disable_interrupts();
+    }
+    else
+    {
+        cm_enable_interrupts();
+    }
+    return old;
+}
+
+void nvic_enable_irq(uint8_t irqn)
+{
+    if (irqn < NVIC_IRQ_COUNT)
+    {
+        enabled[irqn] = 1;
+        sim_irq_dispatch();
+    }
+}
+
+void nvic_disable_irq(uint8_t irqn)
+{
+    if (irqn < NVIC_IRQ_COUNT)
+    {
+        enabled[irqn] = 0;
+    }
+}
+
+uint8_t nvic_get_irq_enabled(uint8_t irqn)
+{
+    return (irqn < NVIC_IRQ_COUNT) ? enabled[irqn] : 0;
+}
+
+void nvic_set_priority(uint8_t irqn, uint8_t priority)
+{
+    (void)irqn;
+    (void)priority;
+}
+
+bool dwt_enable_cycle_counter(void)
+{
+    dwt_enabled = 1;
+    return true;
+}
+
+void dwt_disable_cycle_counter(void)
+{
+    dwt_enabled = 0;
+}
+
+uint32_t dwt_read_cycle_counter(void)
+{
+    return dwt_enabled ? (uint32_t)sim_cycles : 0;
+}
+
+void systick_set_reload(uint32_t value)
+{
+    stk_reload = value & 0xFFFFFF;
+}
+
+uint32_t systick_get_reload(void)
+{
+    return stk_reload;
+}
+
+uint32_t systick_get_value(void)
+{
+    uint32_t div = (stk_csr & STK_CSR_CLKSOURCE_AHB) ? 1 : 8;
+
+    if (!(stk_csr & STK_CSR_ENABLE))
+    {
+        return stk_reload;
+    }
+    return stk_reload - (uint32_t)((sim_cycles - stk_last) / div) % (stk_reload + 1);
+}
+
+void systick_set_clocksource(uint8_t clocksource)
+{
+    stk_csr = (stk_csr & ~STK_CSR_CLKSOURCE_AHB) | (clocksource & STK_CSR_CLKSOURCE_AHB);
+}
+
+void systick_interrupt_enable(void)
+{
+    stk_csr |= STK_CSR_TICKINT;
+}
+
+void systick_interrupt_disable(void)
+{
+    stk_csr &= ~STK_CSR_TICKINT;
+}
+
+void systick_counter_enable(void)
+{
+    if (!(stk_csr & STK_CSR_ENABLE))
+    {
+        stk_last = sim_cycles;
+    }
+    stk_csr |= STK_CSR_ENABLE;
+    enabled[SYSTICK_IRQ] = 1;
+}
+
+void systick_counter_disable(void)
+{
+    stk_csr &= ~STK_CSR_ENABLE;
+}
+
+uint8_t systick_get_countflag(void)
+{
+    uint8_t flag = stk_countflag;
+
+    stk_countflag = 0;
+    return flag;
+}
+
+void systick_clear(void)
+{
+    stk_last = sim_cycles;
+}
@@ -0,0 +1,256 @@
+/**
+ * @file sim_dma.c
+ * @brief DMA1: libopencm3 functions and the transfer engine.
+ *
+ * The firmware gives the DMA 32-bit addresses of its buffers and of the data
+ * registers. On the host those are truncated pointers; as the register file and
+ * the firmware buffers are static data of the same program, the upper half is
+ * taken back from the address of the register file.
+ */
+
+#include "sim.h"
+#include <libopencm3/stm32/dma.h>
+
+static uint16_t reload[8]; /** Number of data set by the firmware, reloaded in circular mode */
+
+void* sim_dma_pointer(uint32_t address)
+{
+    uintptr_t anchor = (uintptr_t)sim_mmio;
+
+    return (void*)((anchor & ~(uintptr_t)0xFFFFFFFFU) | address);
+}
+
+/** @brief Size in bytes of a PSIZE or MSIZE field value. */
+static uint8_t item_size(uint32_t field)
+{
+    return (uint8_t)(1U << field);
+}
+
+static uint32_t load(const volatile void* p, uint8_t size)
+{
+    switch (size)
+    {
+        case 1:
+            return *(const volatile uint8_t*)p;
+        case 2:
+            return *(const volatile uint16_t*)p;
+        default:
+            return *(const volatile uint32_t*)p;
+    }
+}
+
+static void store(volatile void* p, uint8_t size, uint32_t value)
+{
+    switch (size)
+    {
+        case 1:
+            *(volatile uint8_t*)p = (uint8_t)value;
+            break;
+        case 2:
+            *(volatile uint16_t*)p = (uint16_t)value;
+            break;
+        default:
+            *(volatile uint32_t*)p = value;
+            break;
+    }
+}
+
+uint8_t sim_dma_request(uint8_t channel)
+{
+    uint32_t ccr = DMA_CCR(DMA1, channel);
+    uint32_t remaining = DMA_CNDTR(DMA1, channel) & 0xFFFF;
+    uint32_t index, flags;
+    uint8_t psize, msize;
+    uint8_t* periph;
+    uint8_t* mem;
+
+    if (!(ccr & DMA_CCR_EN) || remaining == 0)
+    {
+        return 0;
+    }
+
+    psize = item_size((ccr & DMA_CCR_PSIZE_MASK) >> 8);
+    msize = item_size((ccr & DMA_CCR_MSIZE_MASK) >> 10);
+    index = reload[channel] - remaining;
+    periph = (uint8_t*)sim_dma_pointer(DMA_CPAR(DMA1, channel)) + ((ccr & DMA_CCR_PINC) ? index * psize : 0);
+    mem = (uint8_t*)sim_dma_pointer(DMA_CMAR(DMA1, channel)) + ((ccr & DMA_CCR_MINC) ? index * msize : 0);
+
+    if (ccr & DMA_CCR_DIR)
+    {
+        store(periph, psize, load(mem, msize));
+    }
+    else
+    {
+        store(mem, msize, load(periph, psize));
+    }
+
+    remaining--;
+    flags = 0;
+    if (reload[channel] - remaining == reload[channel] / 2U)
+    {
+        flags |= DMA_HTIF;
+    }
+    if (remaining == 0)
+    {
+        flags |= DMA_TCIF;
+        if (ccr & DMA_CCR_CIRC)
+        {
+            remaining = reload[channel];
+        }
+    }
+    DMA_CNDTR(DMA1, channel) = remaining;
+    if (flags)
+    {
+        DMA_ISR(DMA1) |= (flags | DMA_GIF) << DMA_FLAG_OFFSET(channel);
+    }
+    return 1;
+}
+
+uint32_t sim_dma_irq_level(uint8_t channel)
+{
+    uint32_t isr = (DMA_ISR(DMA1) >> DMA_FLAG_OFFSET(channel)) & 0xF;
+    uint32_t ccr = DMA_CCR(DMA1, channel);
+
+    /** TCIE, HTIE and TEIE share the bit positions of TCIF, HTIF and TEIF */
+    return isr & ccr & (DMA_TCIF | DMA_HTIF | DMA_TEIF);
+}
+
+/* libopencm3 functions */
+
+void dma_channel_reset(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) = 0;
+    DMA_CNDTR(dma, channel) = 0;
+    DMA_CPAR(dma, channel) = 0;
+    DMA_CMAR(dma, channel) = 0;
+    DMA_ISR(dma) &= ~(0xFU << DMA_FLAG_OFFSET(channel));
+    reload[channel] = 0;
+}
+
+void dma_clear_interrupt_flags(uint32_t dma, uint8_t channel, uint32_t interrupts)
+{
+    uint32_t flags = interrupts << DMA_FLAG_OFFSET(channel);
+
+    DMA_ISR(dma) &= ~flags;
+    if (!(DMA_ISR(dma) & (0xEU << DMA_FLAG_OFFSET(channel))))
+    {
+        DMA_ISR(dma) &= ~(DMA_GIF << DMA_FLAG_OFFSET(channel)); /** GIF follows the other flags */
+    }
+}
+
+bool dma_get_interrupt_flag(uint32_t dma, uint8_t channel, uint32_t interrupts)
+{
+    return (DMA_ISR(dma) & (interrupts << DMA_FLAG_OFFSET(channel))) != 0;
+}
+
+void dma_set_priority(uint32_t dma, uint8_t channel, uint32_t prio)
+{
+    DMA_CCR(dma, channel) = (DMA_CCR(dma, channel) & ~DMA_CCR_PL_MASK) | prio;
+}
+
+void dma_set_memory_size(uint32_t dma, uint8_t channel, uint32_t mem_size)
+{
+    DMA_CCR(dma, channel) = (DMA_CCR(dma, channel) & ~DMA_CCR_MSIZE_MASK) | mem_size;
+}
+
+void dma_set_peripheral_size(uint32_t dma, uint8_t channel, uint32_t peripheral_size)
+{
+    DMA_CCR(dma, channel) = (DMA_CCR(dma, channel) & ~DMA_CCR_PSIZE_MASK) | peripheral_size;
+}
+
+void dma_enable_memory_increment_mode(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) |= DMA_CCR_MINC;
+}
+
+void dma_disable_memory_increment_mode(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) &= ~DMA_CCR_MINC;
+}
+
+void dma_enable_peripheral_increment_mode(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) |= DMA_CCR_PINC;
+}
+
+void dma_disable_peripheral_increment_mode(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) &= ~DMA_CCR_PINC;
+}
+
+void dma_enable_circular_mode(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) |= DMA_CCR_CIRC;
+}
+
+void dma_set_read_from_peripheral(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) &= ~DMA_CCR_DIR;
+}
+
+void dma_set_read_from_memory(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) |= DMA_CCR_DIR;
+}
+
+void dma_enable_transfer_error_interrupt(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) |= DMA_CCR_TEIE;
+}
+
+void dma_disable_transfer_error_interrupt(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) &= ~DMA_CCR_TEIE;
+}
+
+void dma_enable_half_transfer_interrupt(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) |= DMA_CCR_HTIE;
+}
+
+void dma_disable_half_transfer_interrupt(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) &= ~DMA_CCR_HTIE;
+}
+
+void dma_enable_transfer_complete_interrupt(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) |= DMA_CCR_TCIE;
+}
+
+void dma_disable_transfer_complete_interrupt(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) &= ~DMA_CCR_TCIE;
+}
+
+void dma_enable_channel(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) |= DMA_CCR_EN;
+    sim_irq_dispatch();
+}
+
+void dma_disable_channel(uint32_t dma, uint8_t channel)
+{
+    DMA_CCR(dma, channel) &= ~DMA_CCR_EN;
+}
+
+void dma_set_peripheral_address(uint32_t dma, uint8_t channel, uint32_t address)
+{
+    DMA_CPAR(dma, channel) = address;
+}
+
+void dma_set_memory_address(uint32_t dma, uint8_t channel, uint32_t address)
+{
+    DMA_CMAR(dma, channel) = address;
+}
+
+uint16_t dma_get_number_of_data(uint32_t dma, uint8_t channel)
+{
+    return (uint16_t)DMA_CNDTR(dma, channel);
+}
+
+void dma_set_number_of_data(uint32_t dma, uint8_t channel, uint16_t number)
+{
+    DMA_CNDTR(dma, channel) = number;
+    reload[channel] = number;
+}
@@ -0,0 +1,283 @@
+/**
+ * @file sim_gpio.c
+ * @brief GPIO ports, AFIO and EXTI: libopencm3 functions and the pin edges.
+ *
+ * Output pins are reported to the devices as the firmware writes them, or as the
+ * peripheral drives them when they are alternate function outputs. Input pins read
+ * the level the devices drive, or their pull resistor when no device drives them.
+ */
+
+#include "sim.h"
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/gpio.h>
+
+#define PORT_COUNT 3
+
+static const uint32_t ports[PORT_COUNT] = {GPIOA, GPIOB, GPIOC};
+static uint16_t driven[PORT_COUNT];    /** Pins driven by a simulated device */
+static uint16_t alternate[PORT_COUNT]; /** Levels the peripherals drive on their alternate function outputs */
+static uint16_t reported[PORT_COUNT];  /** Levels last reported to the devices */
+
+static int8_t port_index(uint32_t port)
+{
+    for (uint8_t i = 0; i < PORT_COUNT; i++)
+    {
+        if (ports[i] == port)
+        {
+            return (int8_t)i;
+        }
+    }
+    return -1;
+}
+
+/** @brief Four configuration bits (CNF and MODE) of a pin. */
+static uint8_t pin_config(uint32_t port, uint8_t pin)
+{
+    uint32_t cr = (pin < 8) ? GPIO_CRL(port) : GPIO_CRH(port);
+
+    return (cr >> (4 * (pin % 8))) & 0xF;
+}
+
+/**
+ * @brief Output levels of the port: ODR, replaced by the peripheral level on alternate function outputs.
+ */
+static uint16_t output_levels(uint32_t port, int8_t index)
+{
+    uint16_t levels = (uint16_t)GPIO_ODR(port);
+
+    for (uint8_t pin = 0; pin < 16; pin++)
+    {
+        uint8_t config = pin_config(port, pin);
+        uint16_t bit = (uint16_t)(1U << pin);
+
+        if ((config & 3) != GPIO_MODE_INPUT && (config >> 2) >= GPIO_CNF_OUTPUT_ALTFN_PUSHPULL)
+        {
+            levels = (alternate[index] & bit) ? (levels | bit) : (levels & ~bit);
+        }
+    }
+    return levels;
+}
+
+/**
+ * @brief Recomputes the input data register of the pins no device drives.
+ *
+ * Outputs read back their output level, pulled inputs follow ODR (up when set),
+ * floating and analog inputs read low.
+ */
+static void refresh_idr(uint32_t port)
+{
+    int8_t index = port_index(port);
+    uint32_t idr = GPIO_IDR(port);
+    uint16_t levels;
+
+    if (index < 0)
+    {
+        return;
+    }
+    levels = output_levels(port, index);
+    for (uint8_t pin = 0; pin < 16; pin++)
+    {
+        uint8_t config = pin_config(port, pin);
+        uint16_t bit = (uint16_t)(1U << pin);
+        uint8_t level;
+
+        if (driven[index] & bit)
+        {
+            continue;
+        }
+        if ((config & 3) != GPIO_MODE_INPUT)
+        {
+            level = (levels & bit) ? 1 : 0;
+        }
+        else if ((config >> 2) == GPIO_CNF_INPUT_PULL_UPDOWN)
+        {
+            level = (GPIO_ODR(port) & bit) ? 1 : 0;
+        }
+        else
+        {
+            level = 0;
+        }
+        idr = level ? (idr | bit) : (idr & ~bit);
+    }
+    GPIO_IDR(port) = idr;
+}
+
+/**
+ * @brief Refreshes the inputs and reports the output levels that changed to the devices.
+ */
+static void update_outputs(uint32_t port)
+{
+    int8_t index = port_index(port);
+    uint16_t levels, changed;
+
+    refresh_idr(port);
+    if (index < 0)
+    {
+        return;
+    }
+    levels = output_levels(port, index);
+    changed = levels ^ reported[index];
+    reported[index] = levels;
+    if (changed)
+    {
+        plant_gpio_output(port, changed, levels);
+    }
+}
+
+/**
+ * @brief Writes the output data register and reports the change to the devices.
+ */
+static void write_odr(uint32_t port, uint16_t value)
+{
+    GPIO_ODR(port) = value;
+    update_outputs(port);
+}
+
+void sim_gpio_alternate_output(uint32_t port, uint16_t pin, uint8_t level)
+{
+    int8_t index = port_index(port);
+
+    if (index < 0)
+    {
+        return;
+    }
+    alternate[index] = level ? (alternate[index] | pin) : (alternate[index] & ~pin);
+    update_outputs(port);
+}
+
+void sim_gpio_input(uint32_t port, uint16_t pin, uint8_t level)
+{
+    int8_t index = port_index(port);
+    uint16_t before;
+    uint8_t line;
+
+    if (index < 0)
+    {
+        return;
+    }
+    driven[index] |= pin;
+    before = (uint16_t)GPIO_IDR(port);
+    GPIO_IDR(port) = level ? (before | pin) : (before & ~pin);
+    if (!((before ^ GPIO_IDR(port)) & pin))
+    {
+        return;
+    }
+
+    for (line = 0; line < 16 && !(pin & (1U << line)); line++)
+    {
+    }
+    /** The line follows this pin only if AFIO selects its port */
+    if (((AFIO_EXTICR(line / 4) >> (4 * (line % 4))) & 0xF) != (uint32_t)index)
+    {
+        return;
+    }
+    if ((level ? EXTI_RTSR : EXTI_FTSR) & pin)
+    {
+        EXTI_PR |= EXTI_IMR & pin;
+        sim_irq_dispatch();
+    }
+}
+
+uint32_t sim_exti_irq_level(void)
+{
+    return EXTI_PR & EXTI_IMR & 0xFC00; /** Lines 10 to 15 share the EXTI15_10 vector */
+}
+
+/* libopencm3 functions */
+
+void gpio_set_mode(uint32_t gpioport, uint8_t mode, uint8_t cnf, uint16_t gpios)
+{
+    for (uint8_t pin = 0; pin < 16; pin++)
+    {
+        volatile uint32_t* cr = (pin < 8) ? &GPIO_CRL(gpioport) : &GPIO_CRH(gpioport);
+        uint8_t shift = 4 * (pin % 8);
+
+        if (gpios & (1U << pin))
+        {
+            *cr = (*cr & ~(0xFU << shift)) | ((uint32_t)((cnf << 2) | mode) << shift);
+        }
+    }
+    update_outputs(gpioport); /** The pin may switch between ODR and its peripheral */
+}
+
+void gpio_set(uint32_t gpioport, uint16_t gpios)
+{
+    write_odr(gpioport, (uint16_t)(GPIO_ODR(gpioport) | gpios));
+}
+
+void gpio_clear(uint32_t gpioport, uint16_t gpios)
+{
+    write_odr(gpioport, (uint16_t)(GPIO_ODR(gpioport) & ~gpios));
+}
+
+void gpio_toggle(uint32_t gpioport, uint16_t gpios)
+{
+    write_odr(gpioport, (uint16_t)(GPIO_ODR(gpioport) ^ gpios));
+}
+
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios)
+{
+    return (uint16_t)(GPIO_IDR(gpioport) & gpios);
+}
+
+uint16_t gpio_port_read(uint32_t gpioport)
+{
+    return (uint16_t)GPIO_IDR(gpioport);
+}
+
+void exti_set_trigger(uint32_t extis, enum exti_trigger_type trig)
+{
+    switch (trig)
+    {
+        case EXTI_TRIGGER_RISING:
+            EXTI_RTSR |= extis;
+            EXTI_FTSR &= ~extis;
+            break;
+        case EXTI_TRIGGER_FALLING:
+            EXTI_RTSR &= ~extis;
+            EXTI_FTSR |= extis;
+            break;
+        case EXTI_TRIGGER_BOTH:
+            EXTI_RTSR |= extis;
+            EXTI_FTSR |= extis;
+            break;
+    }
+}
+
+void exti_enable_request(uint32_t extis)
+{
+    EXTI_IMR |= extis;
+    EXTI_EMR |= extis;
+}
+
+void exti_disable_request(uint32_t extis)
+{
+    EXTI_IMR &= ~extis;
+    EXTI_EMR &= ~extis;
+}
+
+void exti_reset_request(uint32_t extis)
+{
+    EXTI_PR &= ~extis; /** Write one to clear on the hardware */
+}
+
+void exti_select_source(uint32_t exti, uint32_t gpioport)
+{
+    int8_t index = port_index(gpioport);
+
+    for (uint8_t line = 0; line < 16; line++)
+    {
+        if ((exti & (1U << line)) && index >= 0)
+        {
+            volatile uint32_t* reg = &AFIO_EXTICR(line / 4);
+            uint8_t shift = 4 * (line % 4);
+
+            *reg = (*reg & ~(0xFU << shift)) | ((uint32_t)index << shift);
+        }
+    }
+}
+
+uint32_t exti_get_flag_status(uint32_t exti)
+{
+    return EXTI_PR & exti;
+}
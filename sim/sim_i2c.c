@@ -0,0 +1,144 @@
+/**
+ * @file sim_i2c.c
+ * @brief I2C1 master: libopencm3 functions and the write transfers to the LCD backpack.
+ *
+ * Each phase of a write completes as soon as the firmware allows it to: START
+ * sets SB, the address sets ADDR (or AF when no device answers), and once ADDR
+ * is cleared the DMA hands all its bytes to the slave and BTF is set.
+ */
+
+#include "sim.h"
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/i2c.h>
+
+#define SIM_LCD_ADDRESS 0x27 /** PCF8574 backpack of the LCD */
+
+/**
+ * @brief Data phase of a write: the DMA feeds DR until its count runs out.
+ */
+static void transfer(void)
+{
+    if (!(I2C_CR2(I2C1) & I2C_CR2_DMAEN))
+    {
+        return; /** Byte by byte transfers on TxE are not modelled */
+    }
+    while (sim_dma_request(DMA_CHANNEL6))
+    {
+        lcd_model_write((uint8_t)I2C_DR(I2C1));
+    }
+    I2C_SR1(I2C1) |= I2C_SR1_BTF | I2C_SR1_TxE;
+}
+
+uint32_t sim_i2c_ev_irq_level(void)
+{
+    return (I2C_CR2(I2C1) & I2C_CR2_ITEVTEN) ? I2C_SR1(I2C1) & (I2C_SR1_SB | I2C_SR1_ADDR | I2C_SR1_BTF) : 0;
+}
+
+uint32_t sim_i2c_er_irq_level(void)
+{
+    return (I2C_CR2(I2C1) & I2C_CR2_ITERREN) ? I2C_SR1(I2C1) & (I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_AF) : 0;
+}
+
+void sim_i2c_ev_irq_done(uint32_t flags)
+{
+    /** The handler read SR1 then SR2, which clears ADDR and starts the data phase */
+    if ((flags & I2C_SR1_ADDR) && (I2C_SR1(I2C1) & I2C_SR1_ADDR))
+    {
+        I2C_SR1(I2C1) &= ~I2C_SR1_ADDR;
+        transfer();
+    }
+}
+
+/* libopencm3 functions */
+
+void i2c_peripheral_enable(uint32_t i2c)
+{
+    I2C_CR1(i2c) |= I2C_CR1_PE;
+}
+
+void i2c_peripheral_disable(uint32_t i2c)
+{
+    I2C_CR1(i2c) &= ~I2C_CR1_PE;
+}
+
+void i2c_set_standard_mode(uint32_t i2c)
+{
+    I2C_CCR(i2c) &= ~I2C_CCR_FS;
+}
+
+void i2c_set_fast_mode(uint32_t i2c)
+{
+    I2C_CCR(i2c) |= I2C_CCR_FS;
+}
+
+void i2c_set_clock_frequency(uint32_t i2c, uint8_t freq)
+{
+    I2C_CR2(i2c) = (I2C_CR2(i2c) & ~I2C_CR2_FREQ_MASK) | (freq & I2C_CR2_FREQ_MASK);
+}
+
+void i2c_set_trise(uint32_t i2c, uint16_t trise)
+{
+    I2C_TRISE(i2c) = trise;
+}
+
+void i2c_set_ccr(uint32_t i2c, uint16_t freq)
+{
+    I2C_CCR(i2c) = (I2C_CCR(i2c) & ~0x0FFFU) | (freq & 0x0FFF);
+}
+
+void i2c_send_start(uint32_t i2c)
+{
+    if (!(I2C_CR1(i2c) & I2C_CR1_PE))
+    {
+        return;
+    }
+    I2C_SR1(i2c) = (I2C_SR1(i2c) & ~I2C_SR1_BTF) | I2C_SR1_SB;
+    I2C_SR2(i2c) |= I2C_SR2_MSL | I2C_SR2_BUSY;
+    sim_irq_dispatch();
+}
+
+void i2c_send_stop(uint32_t i2c)
+{
+    I2C_SR1(i2c) &= ~(I2C_SR1_BTF | I2C_SR1_TxE);
+    I2C_SR2(i2c) &= ~(I2C_SR2_MSL | I2C_SR2_BUSY);
+}
+
+void i2c_send_7bit_address(uint32_t i2c, uint8_t slave, uint8_t readwrite)
+{
+    I2C_DR(i2c) = (uint32_t)((slave << 1) | readwrite);
+    I2C_SR1(i2c) &= ~I2C_SR1_SB;
+    I2C_SR1(i2c) |= (slave == SIM_LCD_ADDRESS && readwrite == I2C_WRITE) ? I2C_SR1_ADDR : I2C_SR1_AF;
+    sim_irq_dispatch();
+}
+
+void i2c_send_data(uint32_t i2c, uint8_t data)
+{
+    I2C_DR(i2c) = data;
+    lcd_model_write(data);
+}
+
+void i2c_enable_interrupt(uint32_t i2c, uint32_t interrupt)
+{
+    I2C_CR2(i2c) |= interrupt;
+    sim_irq_dispatch();
+}
+
+void i2c_disable_interrupt(uint32_t i2c, uint32_t interrupt)
+{
+    I2C_CR2(i2c) &= ~interrupt;
+}
+
+void i2c_enable_dma(uint32_t i2c)
+{
+    I2C_CR2(i2c) |= I2C_CR2_DMAEN;
+}
+
+void i2c_disable_dma(uint32_t i2c)
+{
+    I2C_CR2(i2c) &= ~I2C_CR2_DMAEN;
+}
+
+void i2c_set_dma_last_transfer(uint32_t i2c)
+{
+    I2C_CR2(i2c) |= I2C_CR2_LAST;
+}
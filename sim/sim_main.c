@@ -0,0 +1,440 @@
+/**
+ * @file sim_main.c
+ * @brief Runs the firmware against the simulated board and conveyor on the host.
+ *
+ * The firmware is initialized and its main loop run by the same `app_init()` and
+ * `app_loop_step()` as in `src/main.c`, with one simulation step between two passes
+ * of the loop. Scripted events turn the knob, place objects, press the stop button,
+ * load the motor or send UART commands at given times. The LCD is printed when it
+ * changes, and a CSV trace of the control loop can be written for plotting.
+ *
+ * Usage: sim [-d seconds] [-p pot%] [-e ms:event]... [-c check]... [-u file] [-t trace.csv] [-T ms] [-s seed] [-q]
+ *
+ * Events: pot=PERCENT, object=HEIGHT_MM, stream=COUNT,PERIOD_MS,MIN_MM,MAX_MM, stop,
+ * load=MILLINEWTON_METERS, uart=TEXT (a line end is added to TEXT). A stream places
+ * COUNT objects of random heights, one every PERIOD_MS; the end summary tells where
+ * the objects went and how many of them the threshold would have sorted otherwise.
+ *
+ * Checks: settle=FROM_MS,TO_MS,PERCENT (motor speed within PERCENT of the setpoint
+ * over the window), passed=N, diverted=N, on_belt=N, wrong=MAX (objects on the wrong
+ * side of the threshold), overruns=MAX (task overruns in total). The result of each
+ * is printed at the end and the exit status is 1 if one failed, so sim/scenarios.sh
+ * and CI can run the program as a test.
+ */
+
+#include "app.h"
+#include "jitter.h"
+#include "plant.h"
+#include "sim.h"
+#include "update.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_MAX_EVENTS 64
+#define SIM_MAX_CHECKS 16
+
+/** @brief A scripted event. */
+typedef struct
+{
+    uint32_t time_ms;
+    char action[96]; /** Text after the time, e.g. "object=120" */
+} Sim_Event;
+
+/** @brief Kinds of check. */
+enum
+{
+    CHECK_SETTLE,   /** Speed error between two times, at most `limit` percent */
+    CHECK_PASSED,   /** Objects off the end of the belt, exactly `limit` */
+    CHECK_DIVERTED, /** Objects through the diverter, exactly `limit` */
+    CHECK_ON_BELT,  /** Objects still on the belt at the end, exactly `limit` */
+    CHECK_WRONG,    /** Objects on the wrong side of the threshold, at most `limit` */
+    CHECK_OVERRUNS  /** Task overruns in total, at most `limit` */
+};
+
+/** @brief A pass/fail condition on the run. */
+typedef struct
+{
+    uint8_t kind;
+    uint32_t from_ms; /** CHECK_SETTLE window */
+    uint32_t to_ms;
+    float limit;
+    float worst; /** Largest speed error in the window, in percent of the setpoint */
+    char text[48];
+} Sim_Check;
+
+static Sim_Event events[SIM_MAX_EVENTS];
+static uint8_t n_events = 0;
+static Sim_Check checks[SIM_MAX_CHECKS];
+static uint8_t n_checks = 0;
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-d seconds] [-p pot%%] [-e ms:event]... [-c check]... [-u uart-output] [-t trace.csv]"
+            " [-T trace-ms] [-s seed] [-q]\n"
+            "events: pot=PERCENT, object=HEIGHT_MM, stream=COUNT,PERIOD_MS,MIN_MM,MAX_MM, stop,"
+            " load=MILLINEWTON_METERS, uart=TEXT\n"
+            "checks: settle=FROM_MS,TO_MS,PERCENT, passed=N, diverted=N, on_belt=N, wrong=MAX, overruns=MAX\n",
+            name);
+    exit(1);
+}
+
+static int compare_events(const void* a, const void* b)
+{
+    const Sim_Event* ea = a;
+    const Sim_Event* eb = b;
+
+    return (ea->time_ms > eb->time_ms) - (ea->time_ms < eb->time_ms);
+}
+
+static void add_event(const char* arg)
+{
+    char* colon;
+
+    if (n_events == SIM_MAX_EVENTS || !(colon = strchr(arg, ':')))
+    {
+        fprintf(stderr, "sim: bad or too many events: %s\n", arg);
+        exit(1);
+    }
+    events[n_events].time_ms = (uint32_t)strtoul(arg, NULL, 10);
+    snprintf(events[n_events].action, sizeof(events[n_events].action), "%s", colon + 1);
+    n_events++;
+}
+
+/**
+ * @brief Parses a check, e.g. "settle=5000,10000,3" or "wrong=0".
+ */
+static void add_check(const char* arg)
+{
+    static const char* names[] = {"settle=", "passed=", "diverted=", "on_belt=", "wrong=", "overruns="};
+    Sim_Check* check = &checks[n_checks];
+    uint8_t kind;
+    int ok = 0;
+
+    for (kind = 0; kind < sizeof(names) / sizeof(names[0]); kind++)
+    {
+        if (strncmp(arg, names[kind], strlen(names[kind])) == 0)
+        {
+            break;
+        }
+    }
+    if (n_checks < SIM_MAX_CHECKS && kind == CHECK_SETTLE)
+    {
+        ok = sscanf(arg + 7, "%u,%u,%f", &check->from_ms, &check->to_ms, &check->limit) == 3;
+    }
+    else if (n_checks < SIM_MAX_CHECKS && kind < sizeof(names) / sizeof(names[0]))
+    {
+        ok = sscanf(arg + strlen(names[kind]), "%f", &check->limit) == 1;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "sim: bad or too many checks: %s\n", arg);
+        exit(1);
+    }
+    check->kind = kind;
+    check->worst = 0;
+    snprintf(check->text, sizeof(check->text), "%s", arg);
+    n_checks++;
+}
+
+/**
+ * @brief Tracks the largest speed error of the settle checks whose window contains `ms`.
+ */
+static void sample_checks(uint32_t ms)
+{
+    float setpoint = (float)pid_get_setpoint_q16() / PID_Q16_ONE; /** The knob, or `SET SP` after it */
+    float error = (setpoint > 0) ? 100.0f * fabsf(plant_get_rpm() - setpoint) / setpoint : 0;
+
+    for (uint8_t i = 0; i < n_checks; i++)
+    {
+        if (checks[i].kind == CHECK_SETTLE && ms >= checks[i].from_ms && ms <= checks[i].to_ms &&
+            error > checks[i].worst)
+        {
+            checks[i].worst = error;
+        }
+    }
+}
+
+/**
+ * @brief Evaluates the checks at the end of the run and prints the result of each.
+ *
+ * @return Number of checks that failed.
+ */
+static uint8_t evaluate_checks(const Plant_Fates* fates, uint32_t overruns)
+{
+    uint8_t failed = 0;
+
+    for (uint8_t i = 0; i < n_checks; i++)
+    {
+        const Sim_Check* check = &checks[i];
+        float value = 0;
+        int ok = 0;
+
+        switch (check->kind)
+        {
+            case CHECK_SETTLE:
+                value = check->worst;
+                ok = value <= check->limit;
+                break;
+            case CHECK_PASSED:
+                value = fates->passed;
+                ok = value == check->limit;
+                break;
+            case CHECK_DIVERTED:
+                value = fates->diverted;
+                ok = value == check->limit;
+                break;
+            case CHECK_ON_BELT:
+                value = fates->on_belt;
+                ok = value == check->limit;
+                break;
+            case CHECK_WRONG:
+                value = fates->passed_tall + fates->diverted_short;
+                ok = value <= check->limit;
+                break;
+            default:
+                value = overruns;
+                ok = value <= check->limit;
+                break;
+        }
+        fprintf(stderr, "sim: check %-24s %8.2f %s\n", check->text, value, ok ? "ok" : "FAILED");
+        failed += !ok;
+    }
+    return failed;
+}
+
+/**
+ * @brief Applies a scripted event to the plant or the UART line.
+ */
+static void apply_event(const Sim_Event* ev, uint8_t quiet)
+{
+    const char* a = ev->action;
+
+    if (!quiet)
+    {
+        printf("%8.3f s  event %s\n", ev->time_ms / 1000.0, a);
+    }
+    if (strncmp(a, "pot=", 4) == 0)
+    {
+        plant_set_pot(strtof(a + 4, NULL));
+    }
+    else if (strncmp(a, "object=", 7) == 0)
+    {
+        plant_add_object(strtof(a + 7, NULL));
+    }
+    else if (strncmp(a, "stream=", 7) == 0)
+    {
+        unsigned count, period_ms;
+        float min_mm, max_mm;
+
+        if (sscanf(a + 7, "%u,%u,%f,%f", &count, &period_ms, &min_mm, &max_mm) != 4)
+        {
+            fprintf(stderr, "sim: bad stream %s\n", a);
+            exit(1);
+        }
+        plant_add_stream((uint16_t)count, period_ms, min_mm, max_mm);
+    }
+    else if (strcmp(a, "stop") == 0)
+    {
+        plant_press_stop();
+    }
+    else if (strncmp(a, "load=", 5) == 0)
+    {
+        plant_set_load(strtof(a + 5, NULL));
+    }
+    else if (strncmp(a, "uart=", 5) == 0)
+    {
+        sim_usart_receive(a + 5, strlen(a + 5));
+        sim_usart_receive("\n", 1);
+    }
+    else
+    {
+        fprintf(stderr, "sim: unknown event %s\n", a);
+        exit(1);
+    }
+}
+
+/**
+ * @brief Prints the non-empty buckets of the timing histograms of the firmware.
+ */
+static void print_jitter(void)
+{
+    static const char* names[JITTER_N_HISTOGRAMS] = {"tick period", "tick latency", "pid period"};
+    Jitter_Histogram h;
+
+    for (uint8_t i = 0; i < JITTER_N_HISTOGRAMS; i++)
+    {
+        jitter_get(i, &h);
+        fprintf(stderr, "sim: jitter %-12s min %u max %u cycles, count from cycles:", names[i], h.min, h.max);
+        for (uint8_t b = 0; b < JITTER_BUCKETS; b++)
+        {
+            if (h.buckets[b])
+            {
+                fprintf(stderr, " %u:%u", jitter_bucket_floor(b), h.buckets[b]);
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "sim: jitter missed ticks %u\n", jitter_get_missed_ticks());
+}
+
+int main(int argc, char** argv)
+{
+    static const char* task_names[N_TASKS] = {"state", "pid", "measure", "measure display", "speed display"};
+    static const uint8_t irq_lines[] = {NVIC_TIM2_IRQ,
+                                        NVIC_TIM4_IRQ,
+                                        NVIC_DMA1_CHANNEL1_IRQ,
+                                        NVIC_DMA1_CHANNEL4_IRQ,
+                                        NVIC_DMA1_CHANNEL6_IRQ,
+                                        NVIC_I2C1_EV_IRQ,
+                                        NVIC_ADC1_2_IRQ,
+                                        NVIC_USART1_IRQ,
+                                        NVIC_EXTI15_10_IRQ};
+    static const char* irq_names[] = {
+        "TIM2", "TIM4", "DMA1 ch1", "DMA1 ch4", "DMA1 ch6", "I2C1 EV", "ADC1", "USART1", "EXTI15_10"};
+    float duration = 10;
+    float pot = 50;
+    uint32_t seed = 1;
+    uint32_t trace_ms = 10;
+    uint8_t quiet = 0;
+    FILE* uart_out = NULL;
+    FILE* trace = NULL;
+    uint8_t next_event = 0;
+    uint32_t last_ms = UINT32_MAX;
+    uint32_t overruns = 0;
+    uint8_t failed;
+    uint64_t end;
+    clock_t wall_start;
+    Plant_Fates fates;
+    double wall;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:p:e:c:u:t:T:s:q")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                duration = strtof(optarg, NULL);
+                break;
+            case 'p':
+                pot = strtof(optarg, NULL);
+                break;
+            case 'e':
+                add_event(optarg);
+                break;
+            case 'c':
+                add_check(optarg);
+                break;
+            case 'u':
+                uart_out = (strcmp(optarg, "-") == 0) ? stdout : fopen(optarg, "wb");
+                break;
+            case 't':
+                trace = fopen(optarg, "w");
+                break;
+            case 'T':
+                trace_ms = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc || duration <= 0 || trace_ms == 0)
+    {
+        usage(argv[0]);
+    }
+    qsort(events, n_events, sizeof(events[0]), compare_events);
+    if (trace)
+    {
+        fprintf(trace, "time_ms,pot,setpoint_rpm,rpm,measured_rpm,duty,current_a,belt_mm\n");
+    }
+
+    sim_reset();
+    sim_usart_set_output(uart_out);
+    plant_init(seed);
+    plant_set_pot(pot);
+    wall_start = clock();
+    app_init();
+
+    end = (uint64_t)(duration * 1000.0f) * SIM_CYCLES_PER_MS;
+    while (sim_cycles < end)
+    {
+        uint32_t ms = (uint32_t)(sim_cycles / SIM_CYCLES_PER_MS);
+
+        while (next_event < n_events && events[next_event].time_ms <= ms)
+        {
+            apply_event(&events[next_event++], quiet);
+        }
+
+        sim_step();
+        app_loop_step();
+
+        if (ms != last_ms)
+        {
+            last_ms = ms;
+            sample_checks(ms);
+            if (!quiet && ms % 10 == 0)
+            {
+                lcd_model_print_changes(stdout, ms);
+            }
+            if (trace && ms % trace_ms == 0)
+            {
+                fprintf(trace,
+                        "%u,%.2f,%.1f,%.1f,%.1f,%.1f,%.3f,%.1f\n",
+                        ms,
+                        pot_get_value(),
+                        (float)pid_get_setpoint_q16() / PID_Q16_ONE,
+                        plant_get_rpm(),
+                        (float)speedometer_getRPM_q16() / PID_Q16_ONE,
+                        plant_get_duty(),
+                        plant_get_current(),
+                        plant_get_belt_mm());
+            }
+        }
+    }
+
+    wall = (double)(clock() - wall_start) / CLOCKS_PER_SEC;
+    fprintf(stderr,
+            "sim: %.3f s simulated in %.3f s (%.1fx real time)\n",
+            (double)sim_cycles / SIM_CPU_HZ,
+            wall,
+            (wall > 0) ? (double)sim_cycles / SIM_CPU_HZ / wall : 0.0);
+    for (uint8_t i = 0; i < N_TASKS; i++)
+    {
+        fprintf(stderr, "sim: task %-16s overruns %u\n", task_names[i], scheduler_get_overruns(i));
+        overruns += scheduler_get_overruns(i);
+    }
+    for (uint8_t i = 0; i < sizeof(irq_lines); i++)
+    {
+        fprintf(stderr, "sim: irq %-10s calls %u\n", irq_names[i], sim_irq_count(irq_lines[i]));
+    }
+    fprintf(stderr, "sim: uart bytes sent %u\n", sim_usart_get_tx_bytes());
+    plant_get_fates(MEASUREMENT_TRHS * 10.0f, &fates);
+    fprintf(stderr,
+            "sim: objects passed %u (%u too tall), diverted %u (%u not too tall), on the belt %u\n",
+            fates.passed,
+            fates.passed_tall,
+            fates.diverted,
+            fates.diverted_short,
+            fates.on_belt);
+    print_jitter();
+    failed = evaluate_checks(&fates, overruns);
+
+    if (trace)
+    {
+        fclose(trace);
+    }
+    if (uart_out && uart_out != stdout)
+    {
+        fclose(uart_out);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
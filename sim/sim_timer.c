@@ -0,0 +1,607 @@
+/**
+ * @file sim_timer.c
+ * @brief TIM1 to TIM4: libopencm3 functions and the counting model.
+ *
+ * The timers count up at SIM_CPU_HZ / (PSC + 1), or on ETR edges in external clock
+ * mode 1. Compare matches set the CCxIF flags and issue their DMA and ADC trigger
+ * requests; input edges latch the counter into the capture registers. Writes to
+ * ARR and CCRx take effect at once, preload is not modelled. The compare outputs
+ * wired to a device as a logic level follow the active, inactive, toggle and forced
+ * modes; the PWM modes are sampled by the plant instead (`sim_timer_oc_high_cycles()`).
+ */
+
+#include "sim.h"
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+
+#define TIM_CCS_OUTPUT 0 /** CCxS value of a channel configured as output */
+
+/** @brief Simulation state of a timer that is not in its registers. */
+typedef struct
+{
+    uint32_t base;  /** Timer base address */
+    uint32_t sub;   /** CPU cycles already counted towards the next tick */
+    uint8_t dma[5]; /** DMA1 channel of the update (index 0) and CCx (1 to 4) requests, 0 if none */
+    uint8_t oc_ref; /** OCxREF level of each channel, bit 0 for channel 1 */
+} Sim_Timer;
+
+/** @brief Compare output driving a device pin as a logic level. */
+typedef struct
+{
+    uint32_t tim;    /** Timer base address */
+    uint8_t channel; /** Channel, 1 to 4 */
+    uint32_t port;   /** GPIO port of the output */
+    uint16_t pin;    /** GPIO pin of the output */
+} Sim_Oc_Pin;
+
+static Sim_Timer timers[] = {
+    {TIM1, 0, {5, 2, 3, 6, 4}, 0},
+    {TIM2, 0, {2, 5, 7, 1, 7}, 0},
+    {TIM3, 0, {3, 6, 0, 2, 3}, 0},
+    {TIM4, 0, {7, 1, 4, 5, 0}, 0},
+};
+
+static const Sim_Oc_Pin oc_pins[] = {
+    {TIM2, 2, GPIOA, GPIO1}, /** Reject diverter */
+};
+
+static Sim_Timer* find(uint32_t tim)
+{
+    for (uint8_t i = 0; i < sizeof(timers) / sizeof(timers[0]); i++)
+    {
+        if (timers[i].base == tim)
+        {
+            return &timers[i];
+        }
+    }
+    return NULL;
+}
+
+/** @brief CCMRx register and bit offset of a channel, 1 to 4. */
+static volatile uint32_t* ccmr(uint32_t tim, uint8_t channel, uint8_t* shift)
+{
+    *shift = ((channel - 1) % 2) * 8;
+    return (channel <= 2) ? &TIM_CCMR1(tim) : &TIM_CCMR2(tim);
+}
+
+static volatile uint32_t* ccr(uint32_t tim, uint8_t channel)
+{
+    return &MMIO32(tim + 0x34 + 4 * (channel - 1));
+}
+
+/** @brief Capture/compare selection (CCxS) of a channel, 0 for an output. */
+static uint8_t cc_selection(uint32_t tim, uint8_t channel)
+{
+    uint8_t shift;
+    return (*ccmr(tim, channel, &shift) >> shift) & 3;
+}
+
+/** @brief Compare mode (OCxM) of a channel, 1 to 4. */
+static uint8_t compare_mode(uint32_t tim, uint8_t channel)
+{
+    uint8_t shift;
+    return (*ccmr(tim, channel, &shift) >> (shift + 4)) & 7;
+}
+
+/**
+ * @brief Drives the pins wired to a channel with its output level: OCxREF, inverted by CCxP, low while disabled.
+ */
+static void drive_output(Sim_Timer* t, uint8_t channel)
+{
+    uint32_t ccer = TIM_CCER(t->base) >> (4 * (channel - 1));
+    uint8_t ref = (t->oc_ref >> (channel - 1)) & 1;
+    uint8_t level = (ccer & TIM_CCER_CC1E) ? (ref ^ ((ccer & TIM_CCER_CC1P) ? 1 : 0)) : 0;
+
+    for (uint8_t i = 0; i < sizeof(oc_pins) / sizeof(oc_pins[0]); i++)
+    {
+        if (oc_pins[i].tim == t->base && oc_pins[i].channel == channel)
+        {
+            sim_gpio_alternate_output(oc_pins[i].port, oc_pins[i].pin, level);
+        }
+    }
+}
+
+/**
+ * @brief OCxREF of a channel after a compare match, in the modes that act on the match.
+ */
+static void oc_match(Sim_Timer* t, uint8_t channel)
+{
+    uint8_t bit = (uint8_t)(1U << (channel - 1));
+
+    switch (compare_mode(t->base, channel))
+    {
+        case TIM_OCM_ACTIVE:
+            t->oc_ref |= bit;
+            break;
+        case TIM_OCM_INACTIVE:
+            t->oc_ref &= ~bit;
+            break;
+        case TIM_OCM_TOGGLE:
+            t->oc_ref ^= bit;
+            break;
+        default:
+            return; /** Frozen and forced levels hold, PWM is sampled by the plant */
+    }
+    drive_output(t, channel);
+}
+
+static uint8_t external_clock(uint32_t tim)
+{
+    return (TIM_SMCR(tim) & TIM_SMCR_SMS_MASK) == TIM_SMCR_SMS_ECM1;
+}
+
+/**
+ * @brief Actions of a compare match or capture on channel `channel`, 0 for the update event.
+ */
+static void timer_event(Sim_Timer* t, uint8_t channel)
+{
+    uint32_t tim = t->base;
+
+    TIM_SR(tim) |= (channel == 0) ? TIM_SR_UIF : (TIM_SR_CC1IF << (channel - 1));
+    if (t->dma[channel] && (TIM_DIER(tim) & ((channel == 0) ? TIM_DIER_UDE : (TIM_DIER_CC1DE << (channel - 1)))))
+    {
+        sim_dma_request(t->dma[channel]);
+    }
+
+    /** Regular ADC triggers of the STM32F1, the compare output must be enabled for them */
+    if (channel && (TIM_CCER(tim) & (TIM_CCER_CC1E << (4 * (channel - 1)))))
+    {
+        if (tim == TIM1 && channel <= 3)
+        {
+            sim_adc_trigger((uint32_t)(channel - 1) << 17);
+        }
+        else if (tim == TIM2 && channel == 2)
+        {
+            sim_adc_trigger(ADC_CR2_EXTSEL_TIM2_CC2);
+        }
+        else if (tim == TIM4 && channel == 4)
+        {
+            sim_adc_trigger(ADC_CR2_EXTSEL_TIM4_CC4);
+        }
+    }
+}
+
+/**
+ * @brief Counter value `offset` CPU cycles into the current step.
+ */
+static uint32_t count_at(Sim_Timer* t, uint32_t offset)
+{
+    uint32_t tim = t->base;
+
+    if (!(TIM_CR1(tim) & TIM_CR1_CEN) || external_clock(tim))
+    {
+        return TIM_CNT(tim);
+    }
+    return (TIM_CNT(tim) + (t->sub + offset) / (TIM_PSC(tim) + 1)) % (TIM_ARR(tim) + 1);
+}
+
+/**
+ * @brief Moves the counter forward by `ticks`, raising the compare and update events on the way.
+ *
+ * A step is always shorter than a timer period, so each event happens at most once.
+ */
+static void count(Sim_Timer* t, uint32_t ticks)
+{
+    uint32_t tim = t->base;
+    uint32_t period = TIM_ARR(tim) + 1;
+    uint32_t cnt = TIM_CNT(tim) % period;
+
+    for (uint8_t channel = 1; channel <= 4; channel++)
+    {
+        uint32_t match = *ccr(tim, channel);
+
+        /** The compare flag is set when the counter reaches CCRx, whatever the channel output does */
+        if (cc_selection(tim, channel) == TIM_CCS_OUTPUT && match < period &&
+            (ticks >= period || (match + period - cnt - 1) % period < ticks))
+        {
+            oc_match(t, channel); /** The output changes before the interrupt can run */
+            timer_event(t, channel);
+        }
+    }
+
+    if (cnt + ticks >= period)
+    {
+        timer_event(t, 0);
+        if (TIM_CR1(tim) & TIM_CR1_OPM)
+        {
+            TIM_CR1(tim) &= ~TIM_CR1_CEN;
+            TIM_CNT(tim) = 0;
+            return;
+        }
+    }
+    TIM_CNT(tim) = (cnt + ticks) % period;
+}
+
+void sim_timers_advance(uint32_t cycles)
+{
+    for (uint8_t i = 0; i < sizeof(timers) / sizeof(timers[0]); i++)
+    {
+        Sim_Timer* t = &timers[i];
+        uint32_t tim = t->base;
+        uint32_t total, psc;
+
+        if (!(TIM_CR1(tim) & TIM_CR1_CEN) || external_clock(tim))
+        {
+            continue;
+        }
+        psc = TIM_PSC(tim) + 1;
+        total = t->sub + cycles;
+        t->sub = total % psc;
+        if (total / psc)
+        {
+            count(t, total / psc);
+        }
+    }
+}
+
+void sim_timer_etr_edge(uint32_t tim)
+{
+    Sim_Timer* t = find(tim);
+
+    if (t && (TIM_CR1(tim) & TIM_CR1_CEN) && external_clock(tim) &&
+        (TIM_SMCR(tim) & TIM_SMCR_TS_MASK) == TIM_SMCR_TS_ETRF)
+    {
+        count(t, 1);
+    }
+}
+
+void sim_timer_input_edge(uint32_t tim, uint8_t ti, uint8_t rising, uint32_t offset)
+{
+    Sim_Timer* t = find(tim);
+
+    if (!t)
+    {
+        return;
+    }
+    for (uint8_t channel = 1; channel <= 4; channel++)
+    {
+        uint8_t sel = cc_selection(tim, channel);
+        uint8_t pair = (channel % 2) ? channel + 1 : channel - 1; /** TI1/TI2 and TI3/TI4 are swappable */
+        uint8_t falling = (TIM_CCER(tim) >> (4 * (channel - 1))) & TIM_CCER_CC1P ? 1 : 0;
+
+        if (!(TIM_CCER(tim) & (TIM_CCER_CC1E << (4 * (channel - 1)))) || sel == TIM_CCS_OUTPUT || sel == 3 ||
+            ti != ((sel == 1) ? channel : pair) || falling == rising)
+        {
+            continue;
+        }
+        if (TIM_SR(tim) & (TIM_SR_CC1IF << (channel - 1)))
+        {
+            TIM_SR(tim) |= TIM_SR_CC1OF << (channel - 1); /** Previous capture not read yet */
+        }
+        *ccr(tim, channel) = count_at(t, offset);
+        timer_event(t, channel);
+    }
+}
+
+/**
+ * @brief Number of counter values among `n` consecutive ones from `cnt` that are below `limit`.
+ */
+static uint32_t count_below(uint32_t cnt, uint32_t n, uint32_t limit, uint32_t period)
+{
+    uint32_t high, end;
+
+    if (limit >= period)
+    {
+        return n;
+    }
+    high = (n / period) * limit;
+    n %= period;
+    end = cnt + n;
+    if (cnt < limit)
+    {
+        high += ((end < limit) ? end : limit) - cnt;
+    }
+    if (end > period)
+    {
+        high += (end - period < limit) ? end - period : limit; /** Part after the wrap */
+    }
+    return high;
+}
+
+uint32_t sim_timer_oc_high_cycles(uint32_t tim, uint8_t channel, uint32_t cycles)
+{
+    Sim_Timer* t = find(tim);
+    uint8_t mode;
+    uint32_t period, cnt, ticks, high;
+
+    if (!t || !(TIM_CCER(tim) & (TIM_CCER_CC1E << (4 * (channel - 1)))) ||
+        cc_selection(tim, channel) != TIM_CCS_OUTPUT)
+    {
+        return 0;
+    }
+    mode = compare_mode(tim, channel);
+    if (mode == TIM_OCM_FORCE_HIGH)
+    {
+        return cycles;
+    }
+    if ((mode != TIM_OCM_PWM1 && mode != TIM_OCM_PWM2) || !(TIM_CR1(tim) & TIM_CR1_CEN))
+    {
+        return 0; /** Other modes only toggle on matches, not used to drive loads */
+    }
+
+    period = TIM_ARR(tim) + 1;
+    cnt = TIM_CNT(tim) % period;
+    ticks = (t->sub + cycles) / (TIM_PSC(tim) + 1);
+    if (ticks == 0)
+    {
+        high = (cnt < *ccr(tim, channel)) ? cycles : 0; /** Still on the same count */
+    }
+    else
+    {
+        high = (uint32_t)((uint64_t)count_below(cnt, ticks, *ccr(tim, channel), period) * cycles / ticks);
+    }
+    return (mode == TIM_OCM_PWM1) ? high : cycles - high;
+}
+
+/* libopencm3 functions */
+
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div, uint32_t alignment, uint32_t direction)
+{
+    uint32_t cr1 = TIM_CR1(timer_peripheral) & ~(TIM_CR1_CKD_MASK | TIM_CR1_CMS_MASK | TIM_CR1_DIR_DOWN);
+
+    TIM_CR1(timer_peripheral) = cr1 | clock_div | alignment | direction;
+}
+
+void timer_enable_preload(uint32_t timer_peripheral)
+{
+    TIM_CR1(timer_peripheral) |= TIM_CR1_ARPE;
+}
+
+void timer_disable_preload(uint32_t timer_peripheral)
+{
+    TIM_CR1(timer_peripheral) &= ~TIM_CR1_ARPE;
+}
+
+void timer_one_shot_mode(uint32_t timer_peripheral)
+{
+    TIM_CR1(timer_peripheral) |= TIM_CR1_OPM;
+}
+
+void timer_continuous_mode(uint32_t timer_peripheral)
+{
+    TIM_CR1(timer_peripheral) &= ~TIM_CR1_OPM;
+}
+
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value)
+{
+    TIM_PSC(timer_peripheral) = value & 0xFFFF;
+}
+
+void timer_set_period(uint32_t timer_peripheral, uint32_t period)
+{
+    TIM_ARR(timer_peripheral) = period & 0xFFFF;
+}
+
+void timer_set_repetition_counter(uint32_t timer_peripheral, uint32_t value)
+{
+    TIM_RCR(timer_peripheral) = value;
+}
+
+void timer_enable_counter(uint32_t timer_peripheral)
+{
+    TIM_CR1(timer_peripheral) |= TIM_CR1_CEN;
+}
+
+void timer_disable_counter(uint32_t timer_peripheral)
+{
+    TIM_CR1(timer_peripheral) &= ~TIM_CR1_CEN;
+}
+
+uint32_t timer_get_counter(uint32_t timer_peripheral)
+{
+    return TIM_CNT(timer_peripheral);
+}
+
+void timer_set_counter(uint32_t timer_peripheral, uint32_t count)
+{
+    TIM_CNT(timer_peripheral) = count & 0xFFFF;
+}
+
+void timer_generate_event(uint32_t timer_peripheral, uint32_t event)
+{
+    if (event & TIM_EGR_UG)
+    {
+        TIM_CNT(timer_peripheral) = 0;
+        TIM_SR(timer_peripheral) |= TIM_SR_UIF;
+    }
+}
+
+void timer_set_master_mode(uint32_t timer_peripheral, uint32_t mode)
+{
+    TIM_CR2(timer_peripheral) = (TIM_CR2(timer_peripheral) & ~TIM_CR2_MMS_MASK) | mode;
+}
+
+void timer_set_dma_on_compare_event(uint32_t timer_peripheral)
+{
+    (void)timer_peripheral; /** Requests are always issued on the compare events */
+}
+
+void timer_enable_break_main_output(uint32_t timer_peripheral)
+{
+    TIM_BDTR(timer_peripheral) |= TIM_BDTR_MOE;
+}
+
+void timer_enable_irq(uint32_t timer_peripheral, uint32_t irq)
+{
+    TIM_DIER(timer_peripheral) |= irq;
+    sim_irq_dispatch();
+}
+
+void timer_disable_irq(uint32_t timer_peripheral, uint32_t irq)
+{
+    TIM_DIER(timer_peripheral) &= ~irq;
+}
+
+bool timer_get_flag(uint32_t timer_peripheral, uint32_t flag)
+{
+    return (TIM_SR(timer_peripheral) & flag) != 0;
+}
+
+void timer_clear_flag(uint32_t timer_peripheral, uint32_t flag)
+{
+    TIM_SR(timer_peripheral) &= ~flag;
+}
+
+/** @brief Channel number, 1 to 4, of an output compare identifier. */
+static uint8_t oc_channel(enum tim_oc_id oc_id)
+{
+    return (uint8_t)(oc_id / 2 + 1);
+}
+
+/** @brief Drives the pins of a channel again after a change of its enable or polarity bit. */
+static void refresh_output(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+    Sim_Timer* t = find(timer_peripheral);
+
+    if (t)
+    {
+        drive_output(t, oc_channel(oc_id));
+    }
+}
+
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id, enum tim_oc_mode oc_mode)
+{
+    uint8_t shift;
+    volatile uint32_t* reg = ccmr(timer_peripheral, oc_channel(oc_id), &shift);
+
+    Sim_Timer* t = find(timer_peripheral);
+
+    /** Selects the output (CCxS = 0) and the compare mode */
+    *reg = (*reg & ~(0x73U << shift)) | ((uint32_t)oc_mode << (shift + 4));
+    if (t && (oc_mode == TIM_OCM_FORCE_HIGH || oc_mode == TIM_OCM_FORCE_LOW))
+    {
+        uint8_t bit = (uint8_t)(1U << (oc_channel(oc_id) - 1));
+
+        t->oc_ref = (oc_mode == TIM_OCM_FORCE_HIGH) ? (t->oc_ref | bit) : (t->oc_ref & ~bit);
+        drive_output(t, oc_channel(oc_id));
+    }
+}
+
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id, uint32_t value)
+{
+    *ccr(timer_peripheral, oc_channel(oc_id)) = value & 0xFFFF;
+}
+
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+    TIM_CCER(timer_peripheral) |= TIM_CCER_CC1E << (2 * oc_id);
+    refresh_output(timer_peripheral, oc_id);
+}
+
+void timer_disable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+    TIM_CCER(timer_peripheral) &= ~(TIM_CCER_CC1E << (2 * oc_id));
+    refresh_output(timer_peripheral, oc_id);
+}
+
+void timer_enable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+    uint8_t shift;
+    volatile uint32_t* reg = ccmr(timer_peripheral, oc_channel(oc_id), &shift);
+
+    *reg |= 1U << (shift + 3);
+}
+
+void timer_disable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+    uint8_t shift;
+    volatile uint32_t* reg = ccmr(timer_peripheral, oc_channel(oc_id), &shift);
+
+    *reg &= ~(1U << (shift + 3));
+}
+
+void timer_set_oc_polarity_high(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+    TIM_CCER(timer_peripheral) &= ~(TIM_CCER_CC1P << (2 * oc_id));
+    refresh_output(timer_peripheral, oc_id);
+}
+
+void timer_set_oc_polarity_low(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+    TIM_CCER(timer_peripheral) |= TIM_CCER_CC1P << (2 * oc_id);
+    refresh_output(timer_peripheral, oc_id);
+}
+
+void timer_ic_set_input(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_input in)
+{
+    uint8_t shift;
+    volatile uint32_t* reg = ccmr(timer_peripheral, ic + 1, &shift);
+    uint32_t sel = in & 3;
+
+    if ((ic == TIM_IC2 || ic == TIM_IC4) && (sel == TIM_IC_IN_TI1 || sel == TIM_IC_IN_TI2))
+    {
+        sel ^= 3; /** Same encoding as libopencm3: the selection bits are relative to the channel */
+    }
+    *reg = (*reg & ~(3U << shift)) | (sel << shift);
+}
+
+void timer_ic_set_filter(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_filter flt)
+{
+    uint8_t shift;
+    volatile uint32_t* reg = ccmr(timer_peripheral, ic + 1, &shift);
+
+    *reg = (*reg & ~(0xFU << (shift + 4))) | ((uint32_t)flt << (shift + 4));
+}
+
+void timer_ic_set_prescaler(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_psc psc)
+{
+    uint8_t shift;
+    volatile uint32_t* reg = ccmr(timer_peripheral, ic + 1, &shift);
+
+    *reg = (*reg & ~(3U << (shift + 2))) | ((uint32_t)psc << (shift + 2));
+}
+
+void timer_ic_set_polarity(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_pol pol)
+{
+    if (pol == TIM_IC_FALLING)
+    {
+        TIM_CCER(timer_peripheral) |= TIM_CCER_CC1P << (4 * ic);
+    }
+    else
+    {
+        TIM_CCER(timer_peripheral) &= ~(TIM_CCER_CC1P << (4 * ic));
+    }
+}
+
+void timer_ic_enable(uint32_t timer_peripheral, enum tim_ic_id ic)
+{
+    TIM_CCER(timer_peripheral) |= TIM_CCER_CC1E << (4 * ic);
+}
+
+void timer_ic_disable(uint32_t timer_peripheral, enum tim_ic_id ic)
+{
+    TIM_CCER(timer_peripheral) &= ~(TIM_CCER_CC1E << (4 * ic));
+}
+
+void timer_slave_set_mode(uint32_t timer_peripheral, uint8_t mode)
+{
+    TIM_SMCR(timer_peripheral) = (TIM_SMCR(timer_peripheral) & ~TIM_SMCR_SMS_MASK) | mode;
+}
+
+void timer_slave_set_trigger(uint32_t timer_peripheral, uint8_t trigger)
+{
+    TIM_SMCR(timer_peripheral) = (TIM_SMCR(timer_peripheral) & ~TIM_SMCR_TS_MASK) | trigger;
+}
+
+void timer_slave_set_polarity(uint32_t timer_peripheral, enum tim_et_pol pol)
+{
+    if (pol == TIM_ET_FALLING)
+    {
+        TIM_SMCR(timer_peripheral) |= TIM_SMCR_ETP;
+    }
+    else
+    {
+        TIM_SMCR(timer_peripheral) &= ~TIM_SMCR_ETP;
+    }
+}
+
+void timer_slave_set_filter(uint32_t timer_peripheral, enum tim_ic_filter flt)
+{
+    TIM_SMCR(timer_peripheral) = (TIM_SMCR(timer_peripheral) & ~TIM_SMCR_ETF_MASK) | ((uint32_t)flt << 8);
+}
+
+void timer_slave_set_prescaler(uint32_t timer_peripheral, enum tim_ic_psc psc)
+{
+    TIM_SMCR(timer_peripheral) = (TIM_SMCR(timer_peripheral) & ~TIM_SMCR_ETPS_MASK) | ((uint32_t)psc << 12);
+}
@@ -0,0 +1,224 @@
+/**
+ * @file sim_usart.c
+ * @brief USART1: libopencm3 functions, the transmit drain and the receive line.
+ *
+ * Transmitted bytes are written to the output file as soon as the DMA or the
+ * firmware hands them over, so waits on TC never block. Received bytes arrive
+ * one frame time apart at the configured baud rate, and IDLE rises one frame
+ * after the last of them.
+ */
+
+#include "sim.h"
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/usart.h>
+
+#define RX_FIFO_SIZE 4096U
+#define FRAME_BITS   10U /** Start, 8 data and stop bits */
+
+static FILE* output = NULL;
+static uint32_t tx_bytes = 0;
+
+static char rx_fifo[RX_FIFO_SIZE];
+static uint32_t rx_head = 0;     /** Next byte to receive */
+static uint32_t rx_tail = 0;     /** End of the queued bytes */
+static uint64_t rx_next = 0;     /** Earliest time of the next received frame */
+static uint8_t rx_pending_idle = 0; /** A frame was received since the last IDLE */
+
+void sim_usart_set_output(FILE* out)
+{
+    output = out;
+}
+
+uint32_t sim_usart_get_tx_bytes(void)
+{
+    return tx_bytes;
+}
+
+void sim_usart_receive(const char* data, size_t len)
+{
+    for (size_t i = 0; i < len && rx_tail - rx_head < RX_FIFO_SIZE; i++)
+    {
+        rx_fifo[rx_tail++ % RX_FIFO_SIZE] = data[i];
+    }
+}
+
+/** @brief Sends the byte the firmware or the DMA left in the data register. */
+static void transmit(void)
+{
+    tx_bytes++;
+    if (output)
+    {
+        fputc((int)(USART_DR(USART1) & 0xFF), output);
+    }
+}
+
+/** @brief CPU cycles of one frame at the configured baud rate. */
+static uint64_t frame_cycles(void)
+{
+    uint32_t brr = USART_BRR(USART1) ? USART_BRR(USART1) : 1;
+
+    return (uint64_t)FRAME_BITS * brr * (SIM_CPU_HZ / rcc_apb2_frequency);
+}
+
+void sim_usart_service(void)
+{
+    uint32_t cr1 = USART_CR1(USART1);
+
+    if (!(cr1 & USART_CR1_UE))
+    {
+        return;
+    }
+
+    if ((cr1 & USART_CR1_TE) && (USART_CR3(USART1) & USART_CR3_DMAT))
+    {
+        while (sim_dma_request(DMA_CHANNEL4))
+        {
+            transmit();
+        }
+    }
+
+    if (!(cr1 & USART_CR1_RE) || sim_cycles < rx_next)
+    {
+        return;
+    }
+    if (rx_head != rx_tail)
+    {
+        if (USART_SR(USART1) & USART_SR_RXNE)
+        {
+            USART_SR(USART1) |= USART_SR_ORE; /** Previous byte not read */
+        }
+        USART_DR(USART1) = (uint8_t)rx_fifo[rx_head++ % RX_FIFO_SIZE];
+        USART_SR(USART1) |= USART_SR_RXNE;
+        rx_next = sim_cycles + frame_cycles();
+        rx_pending_idle = 1;
+        if ((USART_CR3(USART1) & USART_CR3_DMAR) && sim_dma_request(DMA_CHANNEL5))
+        {
+            USART_SR(USART1) &= ~USART_SR_RXNE; /** The DMA read DR */
+        }
+    }
+    else if (rx_pending_idle)
+    {
+        USART_SR(USART1) |= USART_SR_IDLE;
+        rx_pending_idle = 0;
+    }
+}
+
+uint32_t sim_usart_irq_level(void)
+{
+    uint32_t sr = USART_SR(USART1);
+    uint32_t cr1 = USART_CR1(USART1);
+
+    /** Each enable bit of CR1 sits at the position of its flag in SR */
+    return sr & cr1 & (USART_SR_IDLE | USART_SR_RXNE | USART_SR_TC | USART_SR_TXE);
+}
+
+void sim_usart_irq_done(uint32_t flags)
+{
+    if (flags & USART_SR_IDLE)
+    {
+        USART_SR(USART1) &= ~USART_SR_IDLE; /** The handler read SR then DR */
+    }
+}
+
+/* libopencm3 functions */
+
+void usart_set_baudrate(uint32_t usart, uint32_t baud)
+{
+    USART_BRR(usart) = (rcc_apb2_frequency + baud / 2) / baud;
+}
+
+void usart_set_databits(uint32_t usart, uint32_t bits)
+{
+    if (bits == 8)
+    {
+        USART_CR1(usart) &= ~USART_CR1_M;
+    }
+    else
+    {
+        USART_CR1(usart) |= USART_CR1_M;
+    }
+}
+
+void usart_set_stopbits(uint32_t usart, uint32_t stopbits)
+{
+    USART_CR2(usart) = (USART_CR2(usart) & ~USART_CR2_STOPBITS_MASK) | stopbits;
+}
+
+void usart_set_parity(uint32_t usart, uint32_t parity)
+{
+    USART_CR1(usart) = (USART_CR1(usart) & ~USART_PARITY_ODD) | parity;
+}
+
+void usart_set_mode(uint32_t usart, uint32_t mode)
+{
+    USART_CR1(usart) = (USART_CR1(usart) & ~USART_MODE_TX_RX) | mode;
+}
+
+void usart_set_flow_control(uint32_t usart, uint32_t flowcontrol)
+{
+    USART_CR3(usart) = (USART_CR3(usart) & ~USART_FLOWCONTROL_RTS_CTS) | flowcontrol;
+}
+
+void usart_enable(uint32_t usart)
+{
+    USART_CR1(usart) |= USART_CR1_UE;
+    sim_irq_dispatch();
+}
+
+void usart_disable(uint32_t usart)
+{
+    USART_CR1(usart) &= ~USART_CR1_UE;
+}
+
+void usart_send(uint32_t usart, uint16_t data)
+{
+    USART_DR(usart) = data & 0xFF;
+    transmit();
+}
+
+void usart_send_blocking(uint32_t usart, uint16_t data)
+{
+    usart_send(usart, data);
+}
+
+uint16_t usart_recv(uint32_t usart)
+{
+    USART_SR(usart) &= ~(USART_SR_RXNE | USART_SR_ORE | USART_SR_IDLE);
+    return (uint16_t)(USART_DR(usart) & 0xFF);
+}
+
+void usart_enable_rx_interrupt(uint32_t usart)
+{
+    USART_CR1(usart) |= USART_CR1_RXNEIE;
+}
+
+void usart_disable_rx_interrupt(uint32_t usart)
+{
+    USART_CR1(usart) &= ~USART_CR1_RXNEIE;
+}
+
+void usart_enable_rx_dma(uint32_t usart)
+{
+    USART_CR3(usart) |= USART_CR3_DMAR;
+}
+
+void usart_disable_rx_dma(uint32_t usart)
+{
+    USART_CR3(usart) &= ~USART_CR3_DMAR;
+}
+
+void usart_enable_tx_dma(uint32_t usart)
+{
+    USART_CR3(usart) |= USART_CR3_DMAT;
+}
+
+void usart_disable_tx_dma(uint32_t usart)
+{
+    USART_CR3(usart) &= ~USART_CR3_DMAT;
+}
+
+bool usart_get_flag(uint32_t usart, uint32_t flag)
+{
+    return (USART_SR(usart) & flag) != 0;
+}
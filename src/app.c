@@ -0,0 +1,40 @@
+#include "app.h"
+#include "height_profile.h"
+#include "jitter.h"
+#include "profile.h"
+#include "update.h"
+
+static PID_Controller c; /**< Parameters loaded into the PID at start-up */
+
+void app_init(void)
+{
+    rcc_clock_setup_pll(&rcc_hse_configs[RCC_CLOCK_HSE8_72MHZ]);
+    profile_init();
+    speedometer_init();
+    hcsr04_init();
+    pot_init();
+    lcd_init();
+    motor_init();
+    update_init();
+    button_init();
+    uart_init();
+
+    c.kd = PID_DEFAULT_KD;
+    c.ki = PID_DEFAULT_KI;
+    c.kp = PID_DEFAULT_KP;
+    c.setpoint = MAX_RPM;
+
+    pid_init(&c);
+}
+
+void app_loop_step(void)
+{
+    if (!scheduler_dispatch()) /**< Run the next ready task, if any. */
+    {
+        uart_poll();                  /**< Parse the commands received since the last pass. */
+        lcd_fb_flush_step();          /**< Push pending screen changes to the LCD in the background. */
+        profile_report_step();        /**< Send the next row of a requested profile report. */
+        jitter_report_step();         /**< Send the next row of a requested jitter report. */
+        height_profile_report_step(); /**< Send the next row of a requested height profile. */
+    }
+}
@@ -0,0 +1,223 @@
+#include "autotune.h"
+#include "pid.h"
+#include "uart.h"
+#include "utils.h"
+
+#define PI_F 3.14159265f
+
+static volatile uint8_t state = AUTOTUNE_IDLE; /** One of the AUTOTUNE_* states */
+static volatile uint8_t starting = 0;          /** 1 until the first step of a new experiment */
+static uint8_t apply_gains = 0;                /** Commit the gains at the end of the experiment */
+static uint8_t bias = 0;                       /** Relay center, in percent of power */
+static uint8_t amplitude = 0;                  /** Relay amplitude d, fits between the bias and both limits */
+static uint8_t relay_high = 0;                 /** 1 while the relay drives `bias + d` */
+static uint32_t elapsed_us = 0;                /** Time since the start of the experiment */
+static uint32_t cycle_start_us = 0;            /** Time of the last switch to high, start of the current cycle */
+static uint8_t switches = 0;                   /** Switches to high, the first one starts the first cycle */
+static int32_t cycle_max_q16 = 0;              /** Highest speed in the current cycle */
+static int32_t cycle_min_q16 = 0;              /** Lowest speed in the current cycle */
+static uint64_t sum_period_us = 0;             /** Sum of the periods of the averaged cycles */
+static int64_t sum_swing_q16 = 0;              /** Sum of the peak-to-peak swings of the averaged cycles */
+static Autotune_Result result;                 /** Result of the last successful experiment */
+
+/**
+ * @brief Square root by Newton iterations, to avoid pulling in the math library for a single call.
+ */
+static float square_root(float x)
+{
+    float r = (x > 1.0f) ? x : 1.0f;
+
+    for (uint8_t i = 0; i < 24; i++)
+    {
+        r = 0.5f * (r + x / r);
+    }
+    return r;
+}
+
+void autotune_start(uint8_t apply)
+{
+    apply_gains = apply;
+    starting = 1;
+    state = AUTOTUNE_RUNNING;
+}
+
+void autotune_abort(void)
+{
+    if (state == AUTOTUNE_RUNNING)
+    {
+        state = AUTOTUNE_FAILED;
+        uart_send_string("Tune aborted.\n");
+    }
+}
+
+uint8_t autotune_get_state(void)
+{
+    return state;
+}
+
+uint8_t autotune_get_result(Autotune_Result* out)
+{
+    if (state != AUTOTUNE_DONE)
+    {
+        return 0;
+    }
+    *out = result;
+    return 1;
+}
+
+/**
+ * @brief Appends " NAME value" to a line, the value with `decimals` digits after the point.
+ *
+ * @return Number of characters written.
+ */
+static uint8_t format_field(char* out, const char* name, float value, uint8_t decimals)
+{
+    uint32_t scale = 1;
+    uint8_t len = 0;
+
+    for (uint8_t i = 0; i < decimals; i++)
+    {
+        scale *= 10;
+    }
+    out[len++] = ' ';
+    while (*name)
+    {
+        out[len++] = *name++;
+    }
+    out[len++] = ' ';
+    len += uint_to_string(&out[len], (uint32_t)(value * scale + 0.5f), 0, decimals);
+    return len;
+}
+
+/**
+ * @brief Computes Ku, Tu and the gains from the averaged cycles, then reports and optionally applies them.
+ */
+static void finish(void)
+{
+    float a = (float)sum_swing_q16 / PID_Q16_ONE / (2 * AUTOTUNE_CYCLES); /** Peak amplitude */
+    float eps = AUTOTUNE_HYSTERESIS_RPM;
+    float tu = (float)sum_period_us / AUTOTUNE_CYCLES;
+    char line[96];
+    uint8_t len = 0;
+
+    if (a <= eps)
+    {
+        state = AUTOTUNE_FAILED; /** The swing did not even leave the hysteresis band */
+        uart_send_string("Tune failed: no oscillation.\n");
+        return;
+    }
+
+    result.amplitude = a;
+    result.tu_us = (uint32_t)tu;
+    result.ku = 4.0f * amplitude / (PI_F * square_root(a * a - eps * eps));
+    result.kp = AUTOTUNE_KP_FACTOR * result.ku;
+    result.ki = result.kp * PID_NOMINAL_DT_US / (AUTOTUNE_TI_FACTOR * tu); /** Kp T / Ti */
+    result.kd = result.kp * AUTOTUNE_TD_FACTOR * tu / PID_NOMINAL_DT_US;   /** Kp Td / T */
+    state = AUTOTUNE_DONE;
+
+    memcpy(line, "Tune done:", 10);
+    len = 10;
+    len += format_field(&line[len], "KU", result.ku, 6);
+    len += format_field(&line[len], "TU_MS", tu / 1000.0f, 0);
+    len += format_field(&line[len], "KP", result.kp, 6);
+    len += format_field(&line[len], "KI", result.ki, 6);
+    len += format_field(&line[len], "KD", result.kd, 6);
+    line[len++] = '\n';
+    uart_write((const uint8_t*)line, len);
+
+    if (apply_gains)
+    {
+        PID_Controller params;
+
+        pid_get_params(&params);
+        params.kp = result.kp;
+        params.ki = result.ki;
+        params.kd = result.kd;
+        pid_stage_params(&params);
+        pid_commit_params(1); /** Bumpless, the PID takes over from the relay output */
+        uart_send_string("Tuned gains applied.\n");
+    }
+}
+
+uint8_t autotune_update(int32_t rpm_q16, int32_t setpoint_q16, uint8_t power, uint32_t dt_us)
+{
+    const int32_t eps_q16 = AUTOTUNE_HYSTERESIS_RPM * PID_Q16_ONE;
+
+    if (starting)
+    {
+        starting = 0;
+        bias = power; /** The output that held the speed so far */
+
+        /** A clipped relay is asymmetric and Ku would be wrong, the amplitude shrinks to fit both limits */
+        amplitude = AUTOTUNE_AMPLITUDE;
+        if (bias - MIN_PID_OUTPUT < amplitude)
+        {
+            amplitude = bias - MIN_PID_OUTPUT;
+        }
+        if (MAX_PID_OUTPUT - bias < amplitude)
+        {
+            amplitude = MAX_PID_OUTPUT - bias;
+        }
+        if (amplitude < AUTOTUNE_MIN_AMPLITUDE)
+        {
+            state = AUTOTUNE_FAILED;
+            uart_send_string("Tune failed: output too close to a limit.\n");
+            return power;
+        }
+        relay_high = rpm_q16 < setpoint_q16;
+        elapsed_us = 0;
+        switches = 0;
+        cycle_start_us = 0;
+        cycle_max_q16 = rpm_q16;
+        cycle_min_q16 = rpm_q16;
+        sum_period_us = 0;
+        sum_swing_q16 = 0;
+    }
+    else
+    {
+        elapsed_us += dt_us;
+    }
+
+    if (rpm_q16 > cycle_max_q16)
+    {
+        cycle_max_q16 = rpm_q16;
+    }
+    if (rpm_q16 < cycle_min_q16)
+    {
+        cycle_min_q16 = rpm_q16;
+    }
+
+    if (relay_high && rpm_q16 > setpoint_q16 + eps_q16)
+    {
+        relay_high = 0;
+    }
+    else if (!relay_high && rpm_q16 < setpoint_q16 - eps_q16)
+    {
+        /** Each switch to high closes a cycle of the limit cycle */
+        relay_high = 1;
+        if (switches > AUTOTUNE_SETTLE_CYCLES)
+        {
+            sum_period_us += elapsed_us - cycle_start_us;
+            sum_swing_q16 += cycle_max_q16 - cycle_min_q16;
+        }
+        switches++;
+        cycle_start_us = elapsed_us;
+        cycle_max_q16 = rpm_q16;
+        cycle_min_q16 = rpm_q16;
+
+        if (switches > AUTOTUNE_SETTLE_CYCLES + AUTOTUNE_CYCLES)
+        {
+            finish();
+            return power;
+        }
+    }
+
+    if (elapsed_us > (uint32_t)AUTOTUNE_TIMEOUT_MS * 1000)
+    {
+        state = AUTOTUNE_FAILED;
+        uart_send_string("Tune failed: timeout.\n");
+        return power;
+    }
+
+    return relay_high ? bias + amplitude : bias - amplitude;
+}
@@ -1,6 +1,7 @@
 #include "button.h"
 #include "libopencm3/cm3/systick.h"
 #include "motor_driver.h"
+#include "profile.h"
 
 static volatile uint8_t object_flag = 0;       /**< Flag used to indicate when object data should be displayed. */
 static volatile uint8_t stop_flag = 0;         /**< Flag used externally to control the data display (update). */
@@ -35,6 +36,7 @@ void button_init(void)
 
 void exti15_10_isr(void)
 {
+    PROFILE_ENTER();
     uint32_t current_time = systick_get_value(); /**< Get current time for debouncing logic. */
 
     // STOP_BUTTON Handler (EXTI11)
@@ -56,6 +58,7 @@ void exti15_10_isr(void)
             object_flag = 1;                 /**< Set object_flag to indicate an object detection event. */
         }
     }
+    PROFILE_EXIT(PROFILE_EXTI15_10);
 }
 
 uint8_t button_get_stop_flag()
@@ -68,6 +71,11 @@ uint8_t button_get_object_flag()
     return object_flag;
 }
 
+uint8_t button_get_object_present(void)
+{
+    return !gpio_get(OBJECT_GATE_PORT, OBJECT_GATE_PIN); /**< The gate pulls the pin low while covered. */
+}
+
 void button_set_object_flag(uint8_t boolean)
 {
     object_flag = boolean;
@@ -0,0 +1,259 @@
+#include "feedforward.h"
+#include "pid.h"
+#include "uart.h"
+#include "utils.h"
+
+#define RPM_STEP_Q16  ((int32_t)FEEDFORWARD_RPM_STEP * PID_Q16_ONE) /** Speed between two points, Q16.16 */
+#define MAX_POWER_Q16 ((int32_t)MAX_PID_OUTPUT * PID_Q16_ONE)       /** Highest power of the map, Q16.16 */
+
+static int32_t map_q16[FEEDFORWARD_POINTS];            /** Power in percent at each valid point, Q16.16 */
+static uint16_t valid = 0;                             /** Bit k set once point k was calibrated or learned */
+static uint8_t settled_updates = 0;                    /** Consecutive settled PID updates */
+static volatile uint8_t calibrating = 0;               /** 1 while the sweep runs */
+static volatile uint8_t starting = 0;                  /** 1 until the first step of a new sweep */
+static uint8_t cal_step = 0;                           /** Power step of the sweep, from 1 */
+static uint32_t step_elapsed_us = 0;                   /** Time since the start of the power step */
+static int64_t rpm_sum_q16 = 0;                        /** Sum of the speeds averaged in this step */
+static uint16_t rpm_count = 0;                         /** Speeds in `rpm_sum_q16` */
+static int32_t cal_rpm_q16[FEEDFORWARD_CAL_STEPS + 1]; /** Mean speed at each power step, 0 at 0 % */
+
+void feedforward_reset(void)
+{
+    for (uint8_t k = 0; k < FEEDFORWARD_POINTS; k++)
+    {
+        map_q16[k] = 0;
+    }
+    valid = 0;
+    settled_updates = 0;
+}
+
+/**
+ * @brief Returns the power at a point of the map, filled from the valid points if it is not valid itself.
+ *
+ * Between two valid points the power is interpolated, from 0 % at 0 RPM below the
+ * first one. Above the last one it grows in proportion to the speed. A single
+ * learned segment thus gives a usable feedforward over the whole range, instead of
+ * a bump that falls back to 0 on either side.
+ */
+static int32_t point_q16(uint8_t k)
+{
+    int8_t lo = k, hi = k;
+    int32_t below;
+
+    if (valid & (1U << k))
+    {
+        return map_q16[k];
+    }
+    while (--lo >= 0 && !(valid & (1U << lo)))
+        ;
+    while (++hi < FEEDFORWARD_POINTS && !(valid & (1U << hi)))
+        ;
+
+    if (hi < FEEDFORWARD_POINTS)
+    {
+        below = (lo >= 0) ? map_q16[lo] : 0; /** 0 RPM needs no power */
+        lo = (lo >= 0) ? lo : 0;
+        return below + (int32_t)((int64_t)(map_q16[hi] - below) * (k - lo) / (hi - lo));
+    }
+    if (lo > 0)
+    {
+        int64_t value = (int64_t)map_q16[lo] * k / lo;
+
+        return (value > MAX_POWER_Q16) ? MAX_POWER_Q16 : (int32_t)value;
+    }
+    return (lo == 0) ? map_q16[0] : 0;
+}
+
+/**
+ * @brief Finds the segment of the map holding a speed.
+ *
+ * @param rpm_q16 Speed in RPM, Q16.16.
+ * @param frac_q16 Where the position in the segment is stored, 0 to 1.0 in Q16.16.
+ * @return Index of the lower point of the segment.
+ */
+static uint8_t locate(int32_t rpm_q16, int32_t* frac_q16)
+{
+    if (rpm_q16 <= 0)
+    {
+        *frac_q16 = 0;
+        return 0;
+    }
+    if (rpm_q16 >= (FEEDFORWARD_POINTS - 1) * RPM_STEP_Q16)
+    {
+        *frac_q16 = PID_Q16_ONE; /** Above the map, the last point holds */
+        return FEEDFORWARD_POINTS - 2;
+    }
+    *frac_q16 = (int32_t)(((int64_t)(rpm_q16 % RPM_STEP_Q16) << PID_Q16_SHIFT) / RPM_STEP_Q16);
+    return rpm_q16 / RPM_STEP_Q16;
+}
+
+int32_t feedforward_lookup_q16(int32_t setpoint_q16)
+{
+    int32_t frac_q16;
+    uint8_t k = locate(setpoint_q16, &frac_q16);
+
+    int32_t lower_q16 = point_q16(k);
+
+    return lower_q16 + (int32_t)(((int64_t)(point_q16(k + 1) - lower_q16) * frac_q16) >> PID_Q16_SHIFT);
+}
+
+/**
+ * @brief Adds to a point of the map, keeping it within the output range, and marks it valid.
+ */
+static void adjust_point(uint8_t k, int32_t delta_q16)
+{
+    int32_t value;
+
+    if (!delta_q16)
+    {
+        return; /** No share of the integral, the point stays as it is */
+    }
+    value = point_q16(k) + delta_q16; /** A point learned for the first time starts from its filled value */
+    map_q16[k] = (value < 0) ? 0 : (value > MAX_POWER_Q16) ? MAX_POWER_Q16 : value;
+    valid |= 1U << k;
+}
+
+int32_t feedforward_learn(int32_t setpoint_q16, int32_t error_q16, int32_t i_term_q16, uint8_t power)
+{
+    const int32_t band_q16 = FEEDFORWARD_LEARN_BAND_RPM * PID_Q16_ONE;
+    int32_t frac_q16, before_q16, step_q16;
+    uint8_t k;
+
+    if (error_q16 > band_q16 || error_q16 < -band_q16 || power <= MIN_PID_OUTPUT || power >= MAX_PID_OUTPUT)
+    {
+        settled_updates = 0; /** Transients and saturation say nothing about the steady state */
+        return 0;
+    }
+    if (++settled_updates < FEEDFORWARD_LEARN_UPDATES)
+    {
+        return 0;
+    }
+    settled_updates = 0;
+
+    /** The integral holds what the map misses at this speed, share a part of it between the two points */
+    before_q16 = feedforward_lookup_q16(setpoint_q16);
+    step_q16 = i_term_q16 >> FEEDFORWARD_LEARN_SHIFT;
+    k = locate(setpoint_q16, &frac_q16);
+    adjust_point(k, (int32_t)(((int64_t)step_q16 * (PID_Q16_ONE - frac_q16)) >> PID_Q16_SHIFT));
+    adjust_point(k + 1, (int32_t)(((int64_t)step_q16 * frac_q16) >> PID_Q16_SHIFT));
+    return feedforward_lookup_q16(setpoint_q16) - before_q16;
+}
+
+void feedforward_calibrate_start(void)
+{
+    starting = 1;
+    calibrating = 1;
+}
+
+void feedforward_calibrate_abort(void)
+{
+    if (calibrating)
+    {
+        calibrating = 0;
+        uart_send_string("FF calibration aborted.\n");
+    }
+}
+
+uint8_t feedforward_calibrating(void)
+{
+    return calibrating;
+}
+
+/**
+ * @brief Rebuilds the map by inverting the power to speed curve of the sweep.
+ */
+static void build_map(void)
+{
+    const int32_t step_power_q16 = MAX_POWER_Q16 / FEEDFORWARD_CAL_STEPS;
+    uint8_t i = 0;
+
+    for (uint8_t s = 1; s <= FEEDFORWARD_CAL_STEPS; s++)
+    {
+        if (cal_rpm_q16[s] < cal_rpm_q16[s - 1])
+        {
+            cal_rpm_q16[s] = cal_rpm_q16[s - 1]; /** Noise must not fold the curve back */
+        }
+    }
+
+    for (uint8_t k = 0; k < FEEDFORWARD_POINTS; k++)
+    {
+        int32_t rpm_q16 = k * RPM_STEP_Q16;
+
+        /** Points are in increasing speed, the segment holding the next one is never before this one */
+        while (i < FEEDFORWARD_CAL_STEPS && cal_rpm_q16[i + 1] <= rpm_q16)
+        {
+            i++;
+        }
+        if (i == FEEDFORWARD_CAL_STEPS)
+        {
+            map_q16[k] = MAX_POWER_Q16; /** Faster than the motor at full power */
+            continue;
+        }
+        map_q16[k] = i * step_power_q16 + (int32_t)((int64_t)(rpm_q16 - cal_rpm_q16[i]) * step_power_q16 /
+                                                    (cal_rpm_q16[i + 1] - cal_rpm_q16[i]));
+    }
+    valid = (1U << FEEDFORWARD_POINTS) - 1; /** The sweep covers the whole range */
+}
+
+uint8_t feedforward_calibrate_update(int32_t rpm_q16, int32_t setpoint_q16, uint32_t dt_us)
+{
+    if (starting)
+    {
+        starting = 0;
+        cal_step = 1;
+        step_elapsed_us = 0;
+        rpm_sum_q16 = 0;
+        rpm_count = 0;
+        cal_rpm_q16[0] = 0; /** The motor stands still without power */
+        return MAX_PID_OUTPUT / FEEDFORWARD_CAL_STEPS;
+    }
+
+    step_elapsed_us += dt_us;
+    if (step_elapsed_us > FEEDFORWARD_CAL_SETTLE_MS * 1000UL)
+    {
+        rpm_sum_q16 += rpm_q16;
+        rpm_count++;
+    }
+    if (step_elapsed_us >= (FEEDFORWARD_CAL_SETTLE_MS + FEEDFORWARD_CAL_AVERAGE_MS) * 1000UL)
+    {
+        cal_rpm_q16[cal_step] = (int32_t)(rpm_sum_q16 / rpm_count);
+        step_elapsed_us = 0;
+        rpm_sum_q16 = 0;
+        rpm_count = 0;
+        if (++cal_step > FEEDFORWARD_CAL_STEPS)
+        {
+            int32_t p, i, d;
+
+            build_map();
+            pid_get_terms_q16(&p, &i, &d);
+            pid_shift_integral_q16(-i); /** The map now holds the steady-state power */
+            settled_updates = 0;
+            calibrating = 0;
+            uart_send_string("FF calibrated.\n");
+            feedforward_report();
+            return (uint8_t)(feedforward_lookup_q16(setpoint_q16) >> PID_Q16_SHIFT);
+        }
+    }
+    return cal_step * MAX_PID_OUTPUT / FEEDFORWARD_CAL_STEPS;
+}
+
+void feedforward_report(void)
+{
+    char line[20 + FEEDFORWARD_POINTS * 7];
+    uint8_t len = 0;
+
+    memcpy(line, "FF map %:", 9);
+    len = 9;
+    for (uint8_t k = 0; k < FEEDFORWARD_POINTS; k++)
+    {
+        line[len++] = ' ';
+        len += uint_to_string(&line[len], (uint32_t)(((int64_t)point_q16(k) * 10 + PID_Q16_ONE / 2) >> PID_Q16_SHIFT),
+                              0, 1);
+        if (valid & (1U << k))
+        {
+            line[len++] = '*'; /** Calibrated or learned, the others are filled from these */
+        }
+    }
+    line[len++] = '\n';
+    uart_write((const uint8_t*)line, len);
+}
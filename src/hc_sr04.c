@@ -1,8 +1,17 @@
 #include "hc_sr04.h"
+#include "profile.h"
 
-static volatile uint32_t times[2];           /** Array to store the timer values for rising and falling edges */
-static volatile float distance = 0;          /** Distance in centimeters */
-static volatile uint8_t conversion_flag = 0; /** Flag to indicate completion of distance measurement */
+static volatile uint16_t distance_mm = 0;            /** Distance of the last echo in millimeters */
+static volatile uint8_t state = HCSR04_IDLE;         /** State of the current measurement */
+static void (*done_callback)(float distance) = NULL; /** Function called when a measurement finishes */
+static uint16_t guard_ms = HCSR04_GUARD_MS;          /** Wait after an echo */
+static uint16_t wait_ms = HCSR04_GUARD_MS;           /** Wait after the last measurement, grows on timeouts */
+static uint32_t next_ping_ms = 0;                    /** Earliest time of the next trigger */
+static uint8_t bursting = 0;                         /** 1 once the current burst has its first ping */
+static uint32_t burst_start_ms = 0;                  /** End of the first ping of the burst */
+static uint16_t burst_pings = 0;                     /** Pings finished in the burst */
+static uint16_t ping_rate_x10 = 0;                   /** Pings per second times 10 of the last burst */
+static uint8_t cancelled = 0;                        /** 1 after a ping was dropped in flight */
 
 void hcsr04_init(void)
 {
@@ -28,68 +37,237 @@ void hcsr04_init(void)
     timer_ic_set_polarity(TIM4, TIM_IC3, TIM_IC_FALLING); /** Falling edge for CH3 */
     timer_ic_enable(TIM4, TIM_IC3);                       /** Enable input capture on CH3 */
 
-    /** Set the timer prescaler to create a 1 µs tick (based on APB1 frequency) */
+    /** Channels 1 and 2 are internal compares (their pins carry I2C1) timing the trigger pulse and the timeout */
+    timer_set_oc_mode(HCSR04_TIMER, TIM_OC1, TIM_OCM_FROZEN);
+    timer_set_oc_mode(HCSR04_TIMER, TIM_OC2, TIM_OCM_FROZEN);
+
+    /** Set the timer prescaler to create a 0.5 µs tick (TIM4 runs at twice the APB1 frequency) */
     timer_set_prescaler(HCSR04_TIMER, (rcc_apb1_frequency / MHZ_DIVISOR) - 1);
+    timer_set_period(HCSR04_TIMER, 0xFFFF); /** Free-running counter, compares are set relative to it */
+
     timer_enable_counter(HCSR04_TIMER); /** Start the timer */
+    nvic_enable_irq(NVIC_TIM4_IRQ);     /** Enable NVIC interrupt for TIM4 (trigger and timeout) */
+}
+
+/**
+ * @brief Takes the echo from the capture registers, if its falling edge was latched, and converts it to a distance.
+ *
+ * @return 1 if an echo was available, 0 otherwise.
+ */
+static uint8_t collect_echo(void)
+{
+    if (!timer_get_flag(HCSR04_TIMER, TIM_SR_CC3IF))
+    {
+        return 0;
+    }
+
+    uint16_t rising = TIM_CCR4(HCSR04_TIMER);
+    uint16_t falling = TIM_CCR3(HCSR04_TIMER); /** Reading CCR3 clears CC3IF */
 
-    /** Enable interrupts for both capture channels */
-    timer_enable_irq(HCSR04_TIMER, TIM_DIER_CC3IE | TIM_DIER_CC4IE);
-    nvic_enable_irq(NVIC_TIM4_IRQ); /** Enable NVIC interrupt for TIM4 */
+    /** Pulse width in 0.5 µs ticks, the 16-bit subtraction handles the counter wrap */
+    uint16_t ticks = falling - rising;
+    distance_mm = saturation(((uint32_t)ticks * MM_PER_CM) / SOUND_SPEED_DIVISOR);
+    return 1;
 }
 
-void hcsr04_trigger(void)
+/**
+ * @brief Ends the current measurement.
+ *
+ * @param result HCSR04_READY or HCSR04_TIMEOUT.
+ */
+static void finish(uint8_t result)
 {
-    gpio_set(HCSR04_PORT, TRIG_PIN);                  /** Set TRIG_PIN high to start the pulse */
-    for (volatile uint8_t i = 0; i < DELAY_10US; i++) /** Delay for approximately 10 µs */
+    timer_disable_irq(HCSR04_TIMER, TIM_DIER_CC2IE); /** The timeout is no longer needed */
+    state = result;
+}
+
+uint8_t hcsr04_start(void)
+{
+    if (state == HCSR04_BUSY)
     {
-        __asm__("nop"); /** No-operation for precise timing */
+        return 0;
     }
-    gpio_clear(HCSR04_PORT, TRIG_PIN); /** Set TRIG_PIN low to end the pulse */
+
+    timer_clear_flag(HCSR04_TIMER, TIM_SR_CC3IF | TIM_SR_CC4IF); /** Forget edges latched outside a measurement */
+    state = HCSR04_BUSY;
+
+    gpio_set(HCSR04_PORT, TRIG_PIN); /** Set TRIG_PIN high to start the pulse */
+    timer_set_oc_value(HCSR04_TIMER, TIM_OC1, (timer_get_counter(HCSR04_TIMER) + HCSR04_TRIGGER_TICKS) & 0xFFFF);
+    timer_clear_flag(HCSR04_TIMER, TIM_SR_CC1IF);
+    timer_enable_irq(HCSR04_TIMER, TIM_DIER_CC1IE); /** The compare interrupt ends the pulse */
+    return 1;
 }
 
-void tim4_isr(void)
+uint8_t hcsr04_poll_mm(uint16_t* value)
 {
-    /** Check if the rising edge capture flag is set */
-    if (timer_get_flag(HCSR04_TIMER, TIM_SR_CC4IF))
+    uint8_t s;
+    uint8_t detected = 0;
+
+    cm_disable_interrupts(); /** The timeout interrupt may end the measurement too */
+    if (state == HCSR04_BUSY && collect_echo())
     {
-        timer_clear_flag(HCSR04_TIMER, TIM_SR_CC4IF); /** Clear the rising edge flag */
-        times[0] = timer_get_counter(HCSR04_TIMER);   /** Record the rising edge time */
-        conversion_flag = 0;                          /** Reset conversion flag for new measurement */
+        finish(HCSR04_READY);
+        detected = 1;
     }
-    else
+    s = state;
+    if (s == HCSR04_READY || s == HCSR04_TIMEOUT)
     {
-        timer_clear_flag(HCSR04_TIMER, TIM_SR_CC3IF);             /** Clear the falling edge flag */
-        times[1] = timer_get_counter(HCSR04_TIMER);               /** Record the falling edge time */
-        distance = ((times[1] - times[0])) / SOUND_SPEED_DIVISOR; /** Calculate distance in cm */
-        conversion_flag = 1; /** Set flag to indicate distance measurement is ready */
+        *value = distance_mm;
+        state = HCSR04_IDLE; /** The result is consumed */
     }
+    cm_enable_interrupts();
+
+    if (detected && done_callback)
+    {
+        done_callback((float)distance_mm / MM_PER_CM);
+    }
+    return s;
+}
+
+uint8_t hcsr04_poll(float* value)
+{
+    uint16_t mm;
+    uint8_t s = hcsr04_poll_mm(&mm);
+
+    if (s == HCSR04_READY)
+    {
+        *value = (float)mm / MM_PER_CM; /** Return the measured distance in centimeters */
+    }
+    else if (s == HCSR04_TIMEOUT)
+    {
+        *value = -1.0f;
+    }
+    return s;
 }
 
-float hcsr04_get_distance(void)
+uint8_t hcsr04_ping_step(uint32_t now_ms, float* distance)
 {
-    hcsr04_trigger();          /** Start a new measurement by triggering the sensor */
-    uint32_t timeout = 0xFFFF; // Set a timeout limit
-    while (!conversion_flag && --timeout)
-        ; /** Wait until the measurement is complete */
-    if (!timeout)
+    uint8_t s = hcsr04_poll(distance);
+
+    if (s == HCSR04_READY || s == HCSR04_TIMEOUT)
     {
-        return -1.0f;
+        if (s == HCSR04_TIMEOUT)
+        {
+            /** Nothing came back, maybe nothing is in range: ping less often until an echo returns */
+            wait_ms = (wait_ms * 2 < HCSR04_BACKOFF_MAX_MS) ? wait_ms * 2 : HCSR04_BACKOFF_MAX_MS;
+        }
+        else
+        {
+            wait_ms = guard_ms;
+        }
+        next_ping_ms = now_ms + wait_ms;
+        if (!burst_pings++)
+        {
+            burst_start_ms = now_ms; /** The rate counts the intervals from one ping to the next */
+        }
+        else if (now_ms != burst_start_ms)
+        {
+            ping_rate_x10 = (uint16_t)((uint32_t)(burst_pings - 1) * 10000 / (now_ms - burst_start_ms));
+        }
+        return s;
+    }
+
+    if (s == HCSR04_IDLE && cancelled)
+    {
+        cancelled = 0;
+        next_ping_ms = now_ms + guard_ms; /** The echo of the dropped ping may still be ringing down */
+    }
+    if (s == HCSR04_IDLE && (int32_t)(now_ms - next_ping_ms) >= 0)
+    {
+        if (!bursting)
+        {
+            bursting = 1;
+            burst_pings = 0;
+        }
+        hcsr04_start();
+    }
+    return HCSR04_BUSY;
+}
+
+void hcsr04_ping_stop(void)
+{
+    bursting = 0; /** The rate of the burst is kept until the next one finishes a ping */
+
+    cm_disable_interrupts(); /** The interrupts of the ping in flight must not finish it afterwards */
+    if (state == HCSR04_BUSY)
+    {
+        timer_disable_irq(HCSR04_TIMER, TIM_DIER_CC1IE | TIM_DIER_CC2IE);
+        gpio_clear(HCSR04_PORT, TRIG_PIN);
+        cancelled = 1;
+    }
+    state = HCSR04_IDLE; /** A result not yet collected belongs to the burst that ended too */
+    cm_enable_interrupts();
+}
+
+void hcsr04_set_guard(uint16_t guard_ms_value)
+{
+    guard_ms = (guard_ms_value > HCSR04_GUARD_MIN_MS) ? guard_ms_value : HCSR04_GUARD_MIN_MS;
+    wait_ms = guard_ms;
+}
+
+uint16_t hcsr04_get_ping_rate_x10(void)
+{
+    return ping_rate_x10;
+}
+
+uint16_t hcsr04_get_last_mm(void)
+{
+    return distance_mm;
+}
+
+void hcsr04_set_callback(void (*callback)(float distance))
+{
+    done_callback = callback;
+}
+
+void tim4_isr(void)
+{
+    PROFILE_ENTER();
+    uint32_t enabled = TIM_DIER(HCSR04_TIMER); /** Compare flags are set on every match, only armed ones count */
+
+    /** End of the trigger pulse */
+    if ((enabled & TIM_DIER_CC1IE) && timer_get_flag(HCSR04_TIMER, TIM_SR_CC1IF))
+    {
+        timer_clear_flag(HCSR04_TIMER, TIM_SR_CC1IF);
+        timer_disable_irq(HCSR04_TIMER, TIM_DIER_CC1IE);
+        gpio_clear(HCSR04_PORT, TRIG_PIN); /** Set TRIG_PIN low to end the pulse */
+
+        /** Arm the echo timeout */
+        timer_set_oc_value(HCSR04_TIMER, TIM_OC2, (timer_get_counter(HCSR04_TIMER) + HCSR04_TIMEOUT_TICKS) & 0xFFFF);
+        timer_clear_flag(HCSR04_TIMER, TIM_SR_CC2IF);
+        timer_enable_irq(HCSR04_TIMER, TIM_DIER_CC2IE);
+    }
+
+    /** Timeout compare: the echo may still have arrived unnoticed since the last poll */
+    if ((enabled & TIM_DIER_CC2IE) && timer_get_flag(HCSR04_TIMER, TIM_SR_CC2IF))
+    {
+        timer_clear_flag(HCSR04_TIMER, TIM_SR_CC2IF);
+        if (state == HCSR04_BUSY)
+        {
+            uint8_t result = collect_echo() ? HCSR04_READY : HCSR04_TIMEOUT;
+
+            finish(result);
+            if (done_callback)
+            {
+                done_callback((result == HCSR04_READY) ? (float)distance_mm / MM_PER_CM : -1.0f);
+            }
+        }
     }
-    return saturation(); /** Return the measured distance with saturation applied */
+    PROFILE_EXIT(PROFILE_TIM4);
 }
 
-float saturation(void)
+uint16_t saturation(uint16_t value)
 {
-    if (distance > MAX_CAP_DISTANCE)
+    if (value > MAX_CAP_DISTANCE_MM)
     {
-        return MAX_CAP_DISTANCE; /** Cap distance at 400 cm if exceeded */
+        return MAX_CAP_DISTANCE_MM; /** Cap distance at 400 cm if exceeded */
     }
-    else if (distance <= MIN_CAP_DISTANCE)
+    else if (value <= MIN_CAP_DISTANCE_MM)
     {
-        return MIN_CAP_DISTANCE; /** Cap distance at 2 cm minimum */
+        return MIN_CAP_DISTANCE_MM; /** Cap distance at 2 cm minimum */
     }
     else
     {
-        return distance; /** Return the measured distance if within range */
+        return value; /** Return the measured distance if within range */
     }
 }
@@ -0,0 +1,113 @@
+#include "height_estimator.h"
+#include "hc_sr04.h"
+
+static float threshold = 0;               /** Distance the decision compares against */
+static uint8_t ping_limit = 0;            /** Pings after which the decision is forced */
+static uint8_t pings = 0;                 /** Pings added since the reset */
+static uint8_t decision = HEIGHT_PENDING; /** Decision, kept once taken */
+static uint8_t count = 0;                 /** Samples in the running mean */
+static float mean = 0;                    /** Running mean of the accepted samples */
+static float m2 = 0;                      /** Sum of the squared deviations from the mean (Welford) */
+static uint8_t n_sorted = 0;              /** Valid samples in `sorted` */
+static float sorted[HEIGHT_MAX_SAMPLES];  /** Valid samples in increasing order */
+static float estimate = -1.0f;            /** Result of the last decision, or the running mean */
+
+void height_reset(float threshold_cm, uint8_t max_pings)
+{
+    threshold = threshold_cm;
+    ping_limit = (max_pings < HEIGHT_MAX_SAMPLES) ? max_pings : HEIGHT_MAX_SAMPLES;
+    pings = 0;
+    decision = HEIGHT_PENDING;
+    count = 0;
+    mean = 0;
+    m2 = 0;
+    n_sorted = 0;
+    estimate = -1.0f;
+}
+
+/**
+ * @brief Inserts a sample in `sorted`, one insertion sort step.
+ */
+static void insert_sorted(float value)
+{
+    uint8_t i = n_sorted++;
+
+    while (i && sorted[i - 1] > value)
+    {
+        sorted[i] = sorted[i - 1];
+        i--;
+    }
+    sorted[i] = value;
+}
+
+/**
+ * @brief Variance assumed for the samples, never below the floor.
+ */
+static float variance(void)
+{
+    float v = (count > 1) ? m2 / (count - 1) : 0;
+
+    return (v > HEIGHT_SIGMA_FLOOR_CM * HEIGHT_SIGMA_FLOOR_CM) ? v : HEIGHT_SIGMA_FLOOR_CM * HEIGHT_SIGMA_FLOOR_CM;
+}
+
+uint8_t height_add_sample(float distance)
+{
+    if (decision != HEIGHT_PENDING)
+    {
+        return decision;
+    }
+    pings++;
+
+    /** Timeouts and saturated echoes carry no distance */
+    if (distance >= 0 && distance < MAX_CAP_DISTANCE)
+    {
+        float delta = distance - mean;
+
+        insert_sorted(distance);
+        /** Squares are compared, there is no square root to compute */
+        if (count < HEIGHT_MIN_SAMPLES || delta * delta <= HEIGHT_OUTLIER_SIGMAS * HEIGHT_OUTLIER_SIGMAS * variance())
+        {
+            count++;
+            mean += delta / count;
+            m2 += delta * (distance - mean);
+            estimate = mean;
+        }
+    }
+
+    if (count >= HEIGHT_MIN_SAMPLES)
+    {
+        float margin = mean - threshold;
+
+        /** |mean - threshold| > K sigma / sqrt(n), squared */
+        if (margin * margin * count > HEIGHT_CONFIDENCE_K * HEIGHT_CONFIDENCE_K * variance())
+        {
+            decision = (margin >= 0) ? HEIGHT_ABOVE : HEIGHT_BELOW;
+            return decision;
+        }
+    }
+
+    if (pings >= ping_limit)
+    {
+        if (n_sorted)
+        {
+            /** Out of pings, the median is not swayed by the samples the mean may have let in */
+            estimate = (n_sorted & 1) ? sorted[n_sorted / 2] : (sorted[n_sorted / 2 - 1] + sorted[n_sorted / 2]) / 2;
+            decision = (estimate >= threshold) ? HEIGHT_ABOVE : HEIGHT_BELOW;
+        }
+        else
+        {
+            decision = HEIGHT_BELOW; /** Nothing was measured, the object cannot be let through */
+        }
+    }
+    return decision;
+}
+
+float height_get_estimate(void)
+{
+    return estimate;
+}
+
+uint8_t height_get_pings(void)
+{
+    return pings;
+}
@@ -0,0 +1,149 @@
+#include "height_profile.h"
+#include "hc_sr04.h"
+#include "uart.h"
+#include "utils.h"
+
+#define REPORT_IDLE   -1 /** No report being sent */
+#define REPORT_HEADER -2 /** Column titles, then the samples from 0 */
+#define ROW_SIZE      32 /** Longest report row, newline included */
+
+static uint16_t start_pulses = 0;                  /** Pulse count when the object reached the gate */
+static uint16_t pings = 0;                         /** Pings added since the start */
+static uint8_t count = 0;                          /** Samples in the profile */
+static uint8_t stride = 1;                         /** One ping in `stride` is stored */
+static uint8_t skipped = 0;                        /** Pings since the last stored one */
+static uint16_t positions[HEIGHT_PROFILE_SAMPLES]; /** Pulses from the start to each sample */
+static float distances[HEIGHT_PROFILE_SAMPLES];    /** Distance of each sample in cm */
+static int16_t report_row = REPORT_IDLE;           /** Next row of the report */
+
+void height_profile_start(uint16_t pulses)
+{
+    start_pulses = pulses;
+    pings = 0;
+    count = 0;
+    stride = 1;
+    skipped = 0;
+}
+
+void height_profile_add(uint16_t pulses, float distance)
+{
+    pings++;
+    /** Timeouts and saturated echoes carry no distance */
+    if (distance < 0 || distance >= MAX_CAP_DISTANCE || ++skipped < stride)
+    {
+        return;
+    }
+    skipped = 0;
+
+    if (count == HEIGHT_PROFILE_SAMPLES)
+    {
+        /** Full: keep the even samples, which are still evenly spaced, and store half as often */
+        for (uint8_t i = 0; i < HEIGHT_PROFILE_SAMPLES / 2; i++)
+        {
+            positions[i] = positions[2 * i];
+            distances[i] = distances[2 * i];
+        }
+        count = HEIGHT_PROFILE_SAMPLES / 2;
+        stride *= 2;
+    }
+    positions[count] = pulses - start_pulses; /** The 16-bit subtraction is right across the counter overflow */
+    distances[count] = distance;
+    count++;
+}
+
+uint16_t height_profile_get_pings(void)
+{
+    return pings;
+}
+
+float height_profile_get_min(void)
+{
+    float min = -1.0f;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (min < 0 || distances[i] < min)
+        {
+            min = distances[i];
+        }
+    }
+    return min;
+}
+
+float height_profile_get_percentile(void)
+{
+    float sorted[HEIGHT_PROFILE_SAMPLES];
+
+    if (!count)
+    {
+        return -1.0f;
+    }
+    /** Insertion sort, once per object */
+    for (uint8_t n = 0; n < count; n++)
+    {
+        uint8_t i = n;
+
+        while (i && sorted[i - 1] > distances[n])
+        {
+            sorted[i] = sorted[i - 1];
+            i--;
+        }
+        sorted[i] = distances[n];
+    }
+    /** Shorter distances are taller points, the percentile height counts from the short end */
+    return sorted[(count - 1) * (100 - HEIGHT_PROFILE_PERCENTILE) / 100];
+}
+
+void height_profile_report_start(void)
+{
+    report_row = REPORT_HEADER;
+}
+
+/**
+ * @brief Appends a distance in cm with two decimals, right-aligned in `width` characters.
+ *
+ * @return Number of characters written.
+ */
+static uint8_t format_distance(char* out, float distance, uint8_t width)
+{
+    if (distance < 0)
+    {
+        return uint_to_string(out, 0, width, 0); /** No valid echo */
+    }
+    return uint_to_string(out, (uint32_t)(distance * 100 + 0.5f), width, 2);
+}
+
+void height_profile_report_step(void)
+{
+    char row[ROW_SIZE];
+    uint8_t len;
+
+    if (report_row == REPORT_IDLE || uart_tx_free() < ROW_SIZE)
+    {
+        return;
+    }
+    if (report_row == REPORT_HEADER)
+    {
+        uart_send_string("  pulses  dist_cm\n");
+        report_row = 0;
+        return;
+    }
+    if (report_row < count)
+    {
+        len = uint_to_string(row, positions[report_row], 8, 0);
+        len += format_distance(&row[len], distances[report_row], 9);
+        row[len++] = '\n';
+        uart_write((const uint8_t*)row, len);
+        report_row++;
+        return;
+    }
+
+    memcpy(row, "min ", 4);
+    len = 4 + format_distance(&row[4], height_profile_get_min(), 0);
+    memcpy(&row[len], " pct ", 5);
+    len += 5;
+    len += format_distance(&row[len], height_profile_get_percentile(), 0);
+    row[len++] = '\n';
+    uart_write((const uint8_t*)row, len);
+    report_row = REPORT_IDLE;
+}
@@ -0,0 +1,219 @@
+#include "i2c_queue.h"
+#include "profile.h"
+
+static uint8_t queue[I2C_QUEUE_SIZE];      /** Circular buffer with the bytes waiting to be sent */
+static volatile uint16_t head = 0;         /** Index where the next queued byte is stored (written by the producer) */
+static volatile uint16_t tail = 0;         /** Index of the first byte not yet sent (written by the ISRs) */
+static volatile uint16_t chunk_len = 0;    /** Number of bytes handed to the DMA for the current write */
+static volatile uint8_t busy = 0;          /** 1 while a write is in progress on the bus */
+static uint8_t slave_address = 0;          /** 7-bit address of the slave every write goes to */
+static void (*done_callback)(void) = NULL; /** Function called when the queue becomes empty */
+
+static volatile uint32_t bytes_sent = 0; /** Bytes sent on the bus */
+static volatile uint32_t transfers = 0;  /** I2C write transactions issued */
+static volatile uint32_t overflows = 0;  /** Writes rejected because the queue was full */
+static volatile uint32_t errors = 0;     /** Bus errors */
+
+/**
+ * @brief Hands the next contiguous run of queued bytes to the DMA and issues a (repeated) START.
+ *
+ * Called with the queue not empty, either to wake up an idle bus or from the ISRs to chain writes.
+ */
+static void start_chunk(void)
+{
+    uint16_t h = head;
+
+    /** The DMA cannot wrap around the buffer, so stop at its end and send the rest in the next write */
+    chunk_len = (h > tail) ? h - tail : I2C_QUEUE_SIZE - tail;
+
+    dma_disable_channel(DMA1, I2C_QUEUE_DMA_CHANNEL);
+    dma_clear_interrupt_flags(DMA1, I2C_QUEUE_DMA_CHANNEL, DMA_TCIF | DMA_TEIF);
+    dma_set_memory_address(DMA1, I2C_QUEUE_DMA_CHANNEL, (uint32_t)&queue[tail]);
+    dma_set_number_of_data(DMA1, I2C_QUEUE_DMA_CHANNEL, chunk_len);
+    dma_enable_channel(DMA1, I2C_QUEUE_DMA_CHANNEL);
+
+    busy = 1;
+    transfers++;
+    i2c_enable_interrupt(I2C_QUEUE_I2C, I2C_CR2_ITEVTEN); /** Wait for the SB event */
+    i2c_send_start(I2C_QUEUE_I2C);
+}
+
+/**
+ * @brief Retires the current write and either chains the next one or releases the bus.
+ *
+ * @param sent Number of bytes of the current write that reached the bus.
+ */
+static void end_chunk(uint16_t sent)
+{
+    bytes_sent += sent;
+    tail = (tail + chunk_len) % I2C_QUEUE_SIZE;
+
+    if (tail != head)
+    {
+        start_chunk(); /** Repeated START: the bus is kept until the queue is empty */
+    }
+    else
+    {
+        i2c_send_stop(I2C_QUEUE_I2C);
+        busy = 0;
+        if (done_callback)
+        {
+            done_callback();
+        }
+    }
+}
+
+void i2c_queue_init(uint8_t address)
+{
+    slave_address = address;
+
+    rcc_periph_clock_enable(RCC_GPIOB); /** Enable GPIOB clock for I2C */
+    rcc_periph_clock_enable(RCC_I2C1);  /** Enable I2C1 clock */
+    rcc_periph_clock_enable(RCC_DMA1);  /** Enable DMA1 clock */
+
+    gpio_set_mode(GPIOB,
+                  GPIO_MODE_OUTPUT_50_MHZ,
+                  GPIO_CNF_OUTPUT_ALTFN_PUSHPULL,
+                  I2C_QUEUE_SDA_PIN | I2C_QUEUE_SCL_PIN); /** Set GPIOB SDA and SCL pins to I2C mode */
+
+    i2c_peripheral_disable(I2C_QUEUE_I2C);      /** Disable I2C1 to configure it */
+    i2c_set_standard_mode(I2C_QUEUE_I2C);       /** Set I2C to standard mode (100kHz) */
+    i2c_set_clock_frequency(I2C_QUEUE_I2C, 36); /** Set I2C clock frequency to 36 MHz */
+    i2c_set_trise(I2C_QUEUE_I2C, 36);           /** Set rise time */
+    i2c_set_ccr(I2C_QUEUE_I2C, 180);            /** 36 MHz / (2 * 180) = 100 kHz SCL */
+    i2c_enable_dma(I2C_QUEUE_I2C);              /** TxE requests go to the DMA instead of the CPU */
+    i2c_enable_interrupt(I2C_QUEUE_I2C, I2C_CR2_ITERREN);
+    i2c_peripheral_enable(I2C_QUEUE_I2C); /** Enable I2C1 */
+
+    /** Configure DMA1 Channel 6 to move queued bytes into the I2C data register */
+    dma_channel_reset(DMA1, I2C_QUEUE_DMA_CHANNEL);
+    dma_set_priority(DMA1, I2C_QUEUE_DMA_CHANNEL, DMA_CCR_PL_MEDIUM);
+    dma_set_peripheral_address(DMA1, I2C_QUEUE_DMA_CHANNEL, (uint32_t)&I2C_DR(I2C_QUEUE_I2C));
+    dma_set_memory_size(DMA1, I2C_QUEUE_DMA_CHANNEL, DMA_CCR_MSIZE_8BIT);
+    dma_set_peripheral_size(DMA1, I2C_QUEUE_DMA_CHANNEL, DMA_CCR_PSIZE_8BIT);
+    dma_enable_memory_increment_mode(DMA1, I2C_QUEUE_DMA_CHANNEL);
+    dma_set_read_from_memory(DMA1, I2C_QUEUE_DMA_CHANNEL);
+    dma_enable_transfer_complete_interrupt(DMA1, I2C_QUEUE_DMA_CHANNEL);
+
+    nvic_enable_irq(NVIC_DMA1_CHANNEL6_IRQ);
+    nvic_enable_irq(NVIC_I2C1_EV_IRQ);
+    nvic_enable_irq(NVIC_I2C1_ER_IRQ);
+}
+
+uint16_t i2c_queue_write(const uint8_t* data, uint16_t len)
+{
+    if (len > i2c_queue_free())
+    {
+        overflows++; /** Never split a sequence: reject it as a whole */
+        return 0;
+    }
+
+    uint16_t h = head;
+    for (uint16_t i = 0; i < len; i++)
+    {
+        queue[h] = data[i];
+        h = (h + 1) % I2C_QUEUE_SIZE;
+    }
+
+    cm_disable_interrupts(); /** The ISRs must not see the bus go idle between these two steps */
+    head = h;
+    if (!busy)
+    {
+        start_chunk();
+    }
+    cm_enable_interrupts();
+
+    return len;
+}
+
+uint16_t i2c_queue_free(void)
+{
+    /** One slot is kept empty to tell a full queue from an empty one */
+    return (I2C_QUEUE_SIZE - 1) - ((head - tail + I2C_QUEUE_SIZE) % I2C_QUEUE_SIZE);
+}
+
+uint8_t i2c_queue_busy(void)
+{
+    return busy;
+}
+
+void i2c_queue_flush(void)
+{
+    while (busy)
+        ; /** Wait for the ISRs to drain the queue */
+}
+
+void i2c_queue_set_callback(void (*callback)(void))
+{
+    done_callback = callback;
+}
+
+uint32_t i2c_queue_get_bytes_sent(void)
+{
+    return bytes_sent;
+}
+
+uint32_t i2c_queue_get_transfers(void)
+{
+    return transfers;
+}
+
+uint32_t i2c_queue_get_overflows(void)
+{
+    return overflows;
+}
+
+uint32_t i2c_queue_get_errors(void)
+{
+    return errors;
+}
+
+void i2c1_ev_isr(void)
+{
+    PROFILE_ENTER();
+    uint32_t sr1 = I2C_SR1(I2C_QUEUE_I2C);
+
+    if (sr1 & I2C_SR1_SB)
+    {
+        i2c_send_7bit_address(I2C_QUEUE_I2C, slave_address, I2C_WRITE); /** Reading SR1 then writing DR clears SB */
+    }
+    else if (sr1 & I2C_SR1_ADDR)
+    {
+        (void)I2C_SR2(I2C_QUEUE_I2C); /** Reading SR1 then SR2 clears ADDR and lets the DMA feed the data */
+        i2c_disable_interrupt(I2C_QUEUE_I2C, I2C_CR2_ITEVTEN); /** Nothing to do until the DMA is done */
+    }
+    else if (sr1 & I2C_SR1_BTF)
+    {
+        /** Last byte fully shifted out: the write is complete */
+        i2c_disable_interrupt(I2C_QUEUE_I2C, I2C_CR2_ITEVTEN);
+        end_chunk(chunk_len);
+    }
+    PROFILE_EXIT(PROFILE_I2C1_EV);
+}
+
+void dma1_channel6_isr(void)
+{
+    PROFILE_ENTER();
+    if (dma_get_interrupt_flag(DMA1, I2C_QUEUE_DMA_CHANNEL, DMA_TCIF))
+    {
+        dma_clear_interrupt_flags(DMA1, I2C_QUEUE_DMA_CHANNEL, DMA_TCIF);
+        i2c_enable_interrupt(I2C_QUEUE_I2C, I2C_CR2_ITEVTEN); /** The last byte is in DR, wait for BTF */
+    }
+    PROFILE_EXIT(PROFILE_DMA1_CH6);
+}
+
+void i2c1_er_isr(void)
+{
+    PROFILE_ENTER();
+    /** NACK, bus error or arbitration lost: drop the bytes of this write and carry on */
+    I2C_SR1(I2C_QUEUE_I2C) &= ~(I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO);
+    i2c_disable_interrupt(I2C_QUEUE_I2C, I2C_CR2_ITEVTEN);
+    dma_disable_channel(DMA1, I2C_QUEUE_DMA_CHANNEL);
+    errors++;
+
+    if (busy)
+    {
+        end_chunk(chunk_len - dma_get_number_of_data(DMA1, I2C_QUEUE_DMA_CHANNEL));
+    }
+    PROFILE_EXIT(PROFILE_I2C1_ER);
+}
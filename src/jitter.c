@@ -0,0 +1,232 @@
+#include "jitter.h"
+#include "uart.h"
+#include "utils.h"
+
+#define REPORT_IDLE   -1                   /** No report being sent */
+#define REPORT_HEADER 0                    /** Column titles, then the buckets from 1 */
+#define REPORT_MIN    (JITTER_BUCKETS + 1) /** Row with the smallest samples */
+#define REPORT_MAX    (JITTER_BUCKETS + 2) /** Row with the largest samples */
+#define REPORT_MISSED (JITTER_BUCKETS + 3) /** Last row, the missed ticks */
+#define ROW_SIZE      64                   /** Longest report row, newline included */
+
+static Jitter_Histogram histograms[JITTER_N_HISTOGRAMS]; /** Indexed by the JITTER_* identifiers */
+static uint32_t tick_cycles = 0;                         /** Nominal tick period */
+static uint32_t pid_cycles = 0;                          /** Nominal PID period */
+static uint32_t last_tick = 0;                           /** Cycle counter at the previous tick entry */
+static uint32_t last_pid = 0;                            /** Cycle counter at the previous PID start */
+static uint8_t tick_valid = 0;                           /** 1 once `last_tick` holds a timestamp */
+static uint8_t pid_valid = 0;                            /** 1 once `last_pid` holds a timestamp */
+static volatile uint32_t missed_ticks = 0;               /** Ticks that passed without a handler entry */
+static int8_t report_row = REPORT_IDLE;                  /** Next row of the report */
+
+/**
+ * @brief Index of the bucket holding a value.
+ */
+static uint8_t bucket_of(uint32_t value)
+{
+    uint8_t bucket = value ? 32 - __builtin_clz(value) : 0; /** One CLZ instruction on the Cortex-M3 */
+
+    return (bucket < JITTER_BUCKETS) ? bucket : JITTER_BUCKETS - 1;
+}
+
+/**
+ * @brief Adds a sample to a histogram.
+ *
+ * @param h Histogram.
+ * @param value Value that selects the bucket.
+ * @param range Value compared with the minimum and maximum.
+ */
+static void add_sample(Jitter_Histogram* h, uint32_t value, uint32_t range)
+{
+    h->buckets[bucket_of(value)]++;
+    if (range < h->min)
+    {
+        h->min = range;
+    }
+    if (range > h->max)
+    {
+        h->max = range;
+    }
+}
+
+/**
+ * @brief Adds the period since the previous timestamp to a period histogram.
+ *
+ * @return The period in cycles, 0 on the first call after a reset.
+ */
+static uint32_t add_period(Jitter_Histogram* h, uint32_t* last, uint8_t* valid, uint32_t nominal)
+{
+    uint32_t now = dwt_read_cycle_counter();
+    uint32_t period = now - *last; /** Wraps correctly for periods under a minute */
+
+    *last = now;
+    if (!*valid)
+    {
+        *valid = 1;
+        return 0;
+    }
+    add_sample(h, (period > nominal) ? period - nominal : nominal - period, period);
+    return period;
+}
+
+void jitter_init(uint16_t pid_period_ms)
+{
+    dwt_enable_cycle_counter();
+    tick_cycles = systick_get_reload() + 1; /** SysTick runs on the AHB clock, like the cycle counter */
+    pid_cycles = tick_cycles * pid_period_ms;
+    jitter_reset();
+}
+
+void jitter_reset(void)
+{
+    cm_disable_interrupts(); /** The tick interrupt samples meanwhile */
+    for (uint8_t i = 0; i < JITTER_N_HISTOGRAMS; i++)
+    {
+        for (uint8_t b = 0; b < JITTER_BUCKETS; b++)
+        {
+            histograms[i].buckets[b] = 0;
+        }
+        histograms[i].min = UINT32_MAX;
+        histograms[i].max = 0;
+    }
+    tick_valid = 0;
+    pid_valid = 0;
+    missed_ticks = 0;
+    cm_enable_interrupts();
+}
+
+void jitter_tick(void)
+{
+    /** The counter reloaded when the tick fired and has counted down since */
+    uint32_t latency = systick_get_reload() - systick_get_value();
+    uint32_t period = add_period(&histograms[JITTER_TICK_PERIOD], &last_tick, &tick_valid, tick_cycles);
+
+    add_sample(&histograms[JITTER_TICK_LATENCY], latency, latency);
+    if (period > tick_cycles + tick_cycles / 2)
+    {
+        missed_ticks += (period + tick_cycles / 2) / tick_cycles - 1; /** The pending bit holds a single tick */
+    }
+}
+
+void jitter_pid(void)
+{
+    add_period(&histograms[JITTER_PID_PERIOD], &last_pid, &pid_valid, pid_cycles);
+}
+
+uint32_t jitter_get_missed_ticks(void)
+{
+    return missed_ticks;
+}
+
+void jitter_get(uint8_t histogram, Jitter_Histogram* out)
+{
+    cm_disable_interrupts();
+    *out = histograms[histogram];
+    cm_enable_interrupts();
+}
+
+uint32_t jitter_bucket_floor(uint8_t bucket)
+{
+    return bucket ? 1UL << (bucket - 1) : 0;
+}
+
+void jitter_report_start(void)
+{
+    report_row = REPORT_HEADER;
+}
+
+/**
+ * @brief Formats a report row: a first column and one value per histogram.
+ *
+ * @param row Where the row is written.
+ * @param label Text of the first column, NULL to write `first` instead.
+ * @param first Number of the first column.
+ * @param values One value per histogram.
+ * @return Number of characters.
+ */
+static uint8_t format_row(char* row, const char* label, uint32_t first, const uint32_t* values)
+{
+    static const uint8_t widths[JITTER_N_HISTOGRAMS] = {12, 13, 12}; /** Widths of the header titles */
+    uint8_t len = 0;
+
+    if (label)
+    {
+        while (len < 11 - strlen(label))
+        {
+            row[len++] = ' ';
+        }
+        while (*label)
+        {
+            row[len++] = *label++;
+        }
+    }
+    else
+    {
+        len = uint_to_string(row, first, 11, 0);
+    }
+    for (uint8_t i = 0; i < JITTER_N_HISTOGRAMS; i++)
+    {
+        len += uint_to_string(&row[len], values[i], widths[i], 0);
+    }
+    row[len++] = '\n';
+    return len;
+}
+
+void jitter_report_step(void)
+{
+    Jitter_Histogram h[JITTER_N_HISTOGRAMS];
+    uint32_t values[JITTER_N_HISTOGRAMS];
+    char row[ROW_SIZE];
+    uint8_t len = 0;
+
+    if (report_row == REPORT_IDLE || uart_tx_free() < ROW_SIZE)
+    {
+        return;
+    }
+    if (report_row == REPORT_HEADER)
+    {
+        uart_send_string("    from_cy tick_period tick_latency  pid_period\n");
+        report_row++;
+        return;
+    }
+    if (report_row == REPORT_MISSED)
+    {
+        uart_send_string("missed ticks: ");
+        len = uint_to_string(row, jitter_get_missed_ticks(), 0, 0);
+        row[len++] = '\n';
+        uart_write((const uint8_t*)row, len);
+        report_row = REPORT_IDLE;
+        return;
+    }
+
+    for (uint8_t i = 0; i < JITTER_N_HISTOGRAMS; i++)
+    {
+        jitter_get(i, &h[i]);
+    }
+
+    /** Empty buckets are skipped, one row is queued per call */
+    while (!len && report_row <= JITTER_BUCKETS)
+    {
+        uint8_t bucket = report_row - 1;
+
+        for (uint8_t i = 0; i < JITTER_N_HISTOGRAMS; i++)
+        {
+            values[i] = h[i].buckets[bucket];
+        }
+        if (values[0] || values[1] || values[2])
+        {
+            len = format_row(row, NULL, jitter_bucket_floor(bucket), values);
+        }
+        report_row++;
+    }
+    if (!len)
+    {
+        for (uint8_t i = 0; i < JITTER_N_HISTOGRAMS; i++)
+        {
+            values[i] = (report_row == REPORT_MIN) ? ((h[i].min == UINT32_MAX) ? 0 : h[i].min) : h[i].max;
+        }
+        len = format_row(row, (report_row == REPORT_MIN) ? "min" : "max", 0, values);
+        report_row++;
+    }
+    uart_write((const uint8_t*)row, len);
+}
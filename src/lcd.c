@@ -1,14 +1,41 @@
 #include "lcd.h"
+#include "i2c_queue.h"
 
-void lcd_pulse_enable(uint8_t data)
+#define LCD_CURSOR_UNKNOWN 0xFF /** Marks the panel cursor position as unknown */
+
+static volatile char fb[LCD_ROWS][LCD_COLS]; /** Framebuffer: content requested by the application */
+static char panel[LCD_ROWS][LCD_COLS];       /** Content currently shown by the panel */
+static uint8_t cursor_row = 0;               /** Row of the panel cursor */
+static uint8_t cursor_col = 0;               /** Column of the panel cursor, LCD_CURSOR_UNKNOWN if unknown */
+static uint8_t scan_pos = 0;                 /** Cell where the next flush step starts looking for changes */
+
+static void panel_reset(void)
 {
-    uint8_t d = data | LCD_EN;                            /** Set the EN bit high */
-    i2c_transfer7(I2C1, PCF8574_ADDRESS, &d, 1, NULL, 0); /** Send data with EN high to latch the command */
-    delay_ms(1);                                          /** Small delay for stability */
+    for (uint8_t row = 0; row < LCD_ROWS; row++)
+    {
+        for (uint8_t col = 0; col < LCD_COLS; col++)
+        {
+            panel[row][col] = ' '; /** A cleared panel shows blanks everywhere */
+        }
+    }
+    cursor_row = 0; /** Clearing also returns the cursor home */
+    cursor_col = 0;
+}
 
-    d = data & ~LCD_EN;                                   /** Clear the EN bit */
-    i2c_transfer7(I2C1, PCF8574_ADDRESS, &d, 1, NULL, 0); /** Send data with EN low to complete the pulse */
-    delay_ms(1);                                          /** Small delay to allow the LCD to process */
+/**
+ * @brief Queues LCD frames for the PCF8574, waiting only if the I2C queue has no room for them.
+ */
+static void lcd_queue(const uint8_t* frames, uint16_t len)
+{
+    while (i2c_queue_free() < len)
+        ; /** Only happens when a caller outruns the bus, the framebuffer checks for room first */
+    i2c_queue_write(frames, len);
+}
+
+void lcd_pulse_enable(uint8_t data)
+{
+    uint8_t frames[2] = {data | LCD_EN, data & ~LCD_EN}; /** EN high latches the data, EN low completes the pulse */
+    lcd_queue(frames, 2);
 }
 
 void lcd_send_nibble(uint8_t nibble, uint8_t mode)
@@ -20,45 +47,41 @@ void lcd_send_nibble(uint8_t nibble, uint8_t mode)
 
 void lcd_send_byte(uint8_t byte, uint8_t mode)
 {
-    lcd_send_nibble(byte & 0xF0, mode);        /** Send the upper nibble */
-    lcd_send_nibble((byte << 4) & 0xF0, mode); /** Send the lower nibble */
-    delay_ms(2);                               /** Delay for LCD processing after sending the byte */
+    uint8_t high = (byte & 0xF0) | mode | LCD_BACKLIGHT;       /** Upper nibble with mode and backlight */
+    uint8_t low = ((byte << 4) & 0xF0) | mode | LCD_BACKLIGHT; /** Lower nibble with mode and backlight */
+    uint8_t frames[LCD_BYTE_FRAMES] = {high | LCD_EN, high, low | LCD_EN, low};
+
+    /** A frame takes 90 µs on the bus, longer than the EN pulse and command times the LCD needs */
+    lcd_queue(frames, LCD_BYTE_FRAMES);
 }
 
 void lcd_init(void)
 {
-    rcc_periph_clock_enable(RCC_GPIOB); /** Enable GPIOB clock for I2C */
-    rcc_periph_clock_enable(RCC_I2C1);  /** Enable I2C1 clock */
-
-    gpio_set_mode(GPIOB,
-                  GPIO_MODE_OUTPUT_50_MHZ,
-                  GPIO_CNF_OUTPUT_ALTFN_PUSHPULL,
-                  SDA_PIN | SCL_PIN); /** Set GPIOB SDA and SCL pins to I2C mode */
-
-    i2c_peripheral_disable(I2C1);      /** Disable I2C1 to configure it */
-    i2c_set_standard_mode(I2C1);       /** Set I2C to standard mode (100kHz) */
-    i2c_set_clock_frequency(I2C1, 36); /** Set I2C clock frequency to 36 MHz */
-    i2c_set_trise(I2C1, 36);           /** Set rise time */
-    i2c_set_ccr(I2C1, 180);            /** Set I2C clock control register for 180kHz */
-    i2c_peripheral_enable(I2C1);       /** Enable I2C1 */
+    i2c_queue_init(PCF8574_ADDRESS); /** Set up I2C1 and the transmit queue */
 
     delay_ms(50); /** Wait for LCD to power up */
 
     lcd_send_nibble(0x30, 0); /** Send Function set command in 8-bit mode */
+    i2c_queue_flush();        /** Make sure the nibble reached the LCD */
     delay_ms(5);              /** Delay for LCD to process */
     lcd_send_nibble(0x30, 0); /** Repeat 8-bit function set */
+    i2c_queue_flush();        /** Make sure the nibble reached the LCD */
     delay_ms(5);              /** Delay for LCD to process */
     lcd_send_nibble(0x30, 0); /** Repeat once more */
+    i2c_queue_flush();        /** Make sure the nibble reached the LCD */
     delay_ms(5);              /** Delay for LCD to process */
     lcd_send_nibble(0x20, 0); /** Switch to 4-bit mode */
+    i2c_queue_flush();        /** Make sure the nibble reached the LCD */
     delay_ms(5);              /** Delay for LCD to process */
 
     /** Configure LCD settings in 4-bit mode */
     lcd_send_byte(LCD_FUNCTIONSET | LCD_2LINE | LCD_5x8DOTS | LCD_4BITMODE, 0);          /** 4-bit, 2-line display */
     lcd_send_byte(LCD_DISPLAYCONTROL | LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF, 0); /** Display on, cursor off */
     lcd_send_byte(LCD_ENTRYMODESET | LCD_ENTRYLEFT, 0); /** Set entry mode: cursor moves left */
-    lcd_send_byte(LCD_CLEARDISPLAY, 0);                 /** Clear the display */
-    delay_ms(2);                                        /** Delay for display clear */
+    lcd_clear();                                        /** Clear the display */
+    i2c_queue_flush();                                  /** Wait for the whole sequence to reach the LCD */
+
+    lcd_fb_clear(); /** Start with an empty framebuffer */
 }
 
 void lcd_print_char(char c)
@@ -76,8 +99,16 @@ void lcd_print_string(const char* str)
 
 void lcd_clear(void)
 {
-    lcd_send_byte(LCD_CLEARDISPLAY, 0); /** Send clear display command */
-    delay_ms(1);                        /** Delay to allow LCD to process clear command */
+    uint8_t padding[LCD_CLEAR_PADDING];
+
+    for (uint8_t i = 0; i < LCD_CLEAR_PADDING; i++)
+    {
+        padding[i] = LCD_BACKLIGHT; /** EN stays low, so the LCD ignores these frames */
+    }
+
+    lcd_send_byte(LCD_CLEARDISPLAY, 0);    /** Send clear display command */
+    lcd_queue(padding, LCD_CLEAR_PADDING); /** Keep the bus busy while the LCD processes the clear command */
+    panel_reset();                         /** Keep the panel shadow in sync with the screen */
 }
 
 void lcd_set_cursor(uint8_t row, uint8_t col)
@@ -90,10 +121,70 @@ void lcd_set_cursor(uint8_t row, uint8_t col)
     }
     else /** Determine address for row 1 */
     {
-        address = 0x40 + col;
+        address = LCD_ROW1_ADDRESS + col;
     }
 
     lcd_send_byte(LCD_SETDDRAMADDR | address, 0); /** Set DDRAM address to position cursor */
+    cursor_row = row;
+    cursor_col = col;
+}
+
+void lcd_fb_clear(void)
+{
+    for (uint8_t row = 0; row < LCD_ROWS; row++)
+    {
+        for (uint8_t col = 0; col < LCD_COLS; col++)
+        {
+            fb[row][col] = ' ';
+        }
+    }
+}
+
+uint8_t lcd_fb_write(uint8_t row, uint8_t col, const char* str)
+{
+    if (row >= LCD_ROWS)
+    {
+        return col; /** Nothing to write outside the panel */
+    }
+
+    while (*str && col < LCD_COLS) /** Copy until the string ends or the row is full */
+    {
+        fb[row][col++] = *str++;
+    }
+    return col;
+}
+
+uint8_t lcd_fb_flush_step(void)
+{
+    uint8_t sent = 0;
+
+    /** Visit every cell once, starting where the previous step stopped */
+    for (uint8_t i = 0; i < LCD_ROWS * LCD_COLS; i++)
+    {
+        uint8_t row = scan_pos / LCD_COLS;
+        uint8_t col = scan_pos % LCD_COLS;
+        char c = fb[row][col];
+
+        if (c != panel[row][col])
+        {
+            if (sent == LCD_FB_CELLS_PER_STEP || i2c_queue_free() < 2 * LCD_BYTE_FRAMES)
+            {
+                return 1; /** Budget used up or no room for a cursor move and a character, resume here next call */
+            }
+            if (cursor_row != row || cursor_col != col)
+            {
+                lcd_set_cursor(row, col); /** Only move the cursor when the cell is not the next one */
+            }
+            lcd_print_char(c);
+            panel[row][col] = c;
+            sent++;
+
+            /** The panel auto-increments the address, but past the last column it does not wrap to the next row */
+            cursor_col = (col + 1 < LCD_COLS) ? col + 1 : LCD_CURSOR_UNKNOWN;
+        }
+        scan_pos = (scan_pos + 1) % (LCD_ROWS * LCD_COLS);
+    }
+    return 0;
 }
 
 void delay_ms(uint32_t ms)
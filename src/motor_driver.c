@@ -1,6 +1,24 @@
 #include "motor_driver.h"
 
-static uint8_t motor_state = 0; /**< Motor state: 1 indicates enabled, 0 indicates disabled */
+static uint8_t motor_state = 0;            /**< Motor state: 1 indicates enabled, 0 indicates disabled */
+static volatile uint16_t duty_target = 0;  /**< Duty last requested by `motor_set_duty()` */
+static volatile uint16_t duty_applied = 0; /**< Duty on the timer output */
+
+static int32_t slew_max = MOTOR_DUTY_MAX / MOTOR_RAMP_MS;                  /**< Highest duty change per ms */
+static int32_t slew_step = MOTOR_DUTY_MAX / MOTOR_RAMP_MS / MOTOR_JERK_MS; /**< Change of `slew` per ms (S-curve) */
+#if MOTOR_PROFILE != MOTOR_PROFILE_NONE
+static int32_t slew = 0; /**< Duty change of the last profile tick, per ms */
+#endif
+
+/**
+ * @brief Writes a duty to the timer, rounded to the nearest count.
+ */
+static void apply_duty(uint16_t duty)
+{
+    duty_applied = duty;
+    /** MOTOR_DUTY_MAX gives a compare value of a whole period */
+    timer_set_oc_value(MOTOR_TIMER, TIM_OC3, ((uint32_t)duty * MOTOR_PWM_PERIOD + MOTOR_DUTY_MAX / 2) / MOTOR_DUTY_MAX);
+}
 
 void motor_init()
 {
@@ -18,28 +36,91 @@ void motor_init()
                    TIM_CR1_DIR_UP);    /**< Configure TIMER in up-counting mode with auto-reload */
     timer_enable_preload(MOTOR_TIMER); /**< Enable preload for the timer */
 
-    timer_set_prescaler(MOTOR_TIMER, 72 - 1); /**< Set prescaler to 72-1 for a 1 MHz tick frequency */
-    timer_set_period(MOTOR_TIMER, MOTOR_PERIOD_MS * MS_TO_SEC - 1); /**< Set PWM period based on MOTOR_PERIOD_MS */
+    timer_set_prescaler(MOTOR_TIMER, MOTOR_PRESCALER - 1); /**< Count at the timer clock when the period fits */
+    timer_set_period(MOTOR_TIMER, MOTOR_PWM_PERIOD - 1);   /**< Set PWM period based on MOTOR_PWM_HZ */
 
     timer_disable_oc_output(MOTOR_TIMER, TIM_OC3);         /**< Disable output compare on TIM3 Channel 3 */
     timer_set_oc_mode(MOTOR_TIMER, TIM_OC3, TIM_OCM_PWM1); /**< Set output compare mode to PWM1 on TIM3 Channel 3 */
-    timer_set_oc_value(MOTOR_TIMER, TIM_OC3, (MOTOR_PERIOD_MS * MS_TO_SEC) / 100); /**< Set duty cycle to 1% */
-    motor_enable();                                                                /**< Enable motor output */
+    timer_set_oc_value(MOTOR_TIMER, TIM_OC3, MOTOR_PWM_PERIOD / 100); /**< Set duty cycle to 1% */
+    motor_enable();                                                   /**< Enable motor output */
 
     timer_enable_counter(MOTOR_TIMER); /**< Start the timer counter */
 }
 
 void motor_set_power(uint8_t percentage)
+{
+    if (percentage > 100)
+        percentage = 100; /**< Cap percentage at 100 to avoid exceeding maximum duty cycle */
+    motor_set_duty((uint16_t)((uint32_t)percentage * MOTOR_DUTY_MAX / 100)); /**< Same duty at the full resolution */
+}
+
+void motor_set_duty(uint16_t duty)
 {
     if (motor_state) /**< Set power only if the motor is enabled */
     {
-        if (percentage > 100)
-            percentage = 100; /**< Cap percentage at 100 to avoid exceeding maximum duty cycle */
-        timer_set_oc_value(MOTOR_TIMER,
-                           TIM_OC3,
-                           (MOTOR_PERIOD_MS * MS_TO_SEC * percentage) /
-                               100); /**< Update duty cycle based on specified percentage */
+        duty_target = duty;
+#if MOTOR_PROFILE == MOTOR_PROFILE_NONE
+        apply_duty(duty);
+#endif
+    }
+}
+
+void motor_set_ramp(uint16_t ramp_ms, uint16_t jerk_ms)
+{
+    slew_max = MOTOR_DUTY_MAX / (ramp_ms ? ramp_ms : 1);
+    slew_step = slew_max / (jerk_ms ? jerk_ms : 1);
+    if (slew_step == 0)
+    {
+        slew_step = 1;
+    }
+}
+
+void motor_profile_tick(void)
+{
+#if MOTOR_PROFILE != MOTOR_PROFILE_NONE
+    int32_t remaining = (int32_t)duty_target - duty_applied;
+    int32_t distance = (remaining < 0) ? -remaining : remaining;
+
+    if (!motor_state || !remaining)
+    {
+        slew = 0;
+        return;
+    }
+    if ((slew < 0) != (remaining < 0))
+    {
+        slew = 0; /** The target went the other way, the ramp starts over */
+    }
+    int32_t rate = (slew < 0) ? -slew : slew;
+#if MOTOR_PROFILE == MOTOR_PROFILE_SCURVE
+    /** Slow down once the distance covered while the rate falls to 0 reaches the remaining one */
+    if ((int64_t)rate * (rate + slew_step) / (2 * slew_step) >= distance)
+    {
+        rate = (rate > slew_step) ? rate - slew_step : slew_step;
+    }
+    else if (rate < slew_max)
+    {
+        rate = (rate + slew_step < slew_max) ? rate + slew_step : slew_max;
+    }
+#else
+    rate = slew_max;
+#endif
+    if (rate > distance)
+    {
+        rate = distance;
     }
+    slew = (remaining < 0) ? -rate : rate;
+    apply_duty((uint16_t)(duty_applied + slew));
+#endif
+}
+
+uint8_t motor_profile_done(void)
+{
+    return duty_applied == duty_target;
+}
+
+uint16_t motor_get_duty(void)
+{
+    return duty_applied;
 }
 
 void motor_disable()
@@ -50,6 +131,13 @@ void motor_disable()
 
 void motor_enable()
 {
+#if MOTOR_PROFILE != MOTOR_PROFILE_NONE
+    if (!motor_state)
+    {
+        slew = 0;
+        apply_duty(0); /**< A restart ramps up from standstill */
+    }
+#endif
     motor_state = 1;                              /**< Set motor state to enabled */
     timer_enable_oc_output(MOTOR_TIMER, TIM_OC3); /**< Enable PWM output on TIM3 Channel 3 */
 }
@@ -0,0 +1,202 @@
+#include "object_queue.h"
+#include "speedometer.h"
+#include "uart.h"
+#include "utils.h"
+
+#define INDEX_MASK (OBJECT_QUEUE_SIZE - 1) /** Wraps an index of the ring */
+
+static Queue_Object queue[OBJECT_QUEUE_SIZE];               /** Ring of the objects, oldest at `head` */
+static volatile uint8_t head = 0;                           /** Index of the next object to reach the diverter */
+static volatile uint8_t count = 0;                          /** Objects in the ring */
+static volatile uint8_t diverting = 0;                      /** 1 while the diverter is on for the front object */
+static uint16_t distance_pulses = DIVERTER_DISTANCE_PULSES; /** Gate to diverter, for new objects */
+static volatile uint32_t rejects = 0;                       /** Objects diverted since start-up */
+
+static void schedule(void);
+
+/**
+ * @brief Drops the front object and times the next one.
+ */
+static void pop(void)
+{
+    head = (head + 1) & INDEX_MASK;
+    count--;
+    schedule();
+}
+
+/**
+ * @brief Alarm: the front object has gone past the diverter, the compare already switched it off.
+ */
+static void on_release(void)
+{
+    diverting = 0;
+    pop();
+}
+
+/**
+ * @brief Alarm: the front object is at the diverter, the compare already switched it on unless it passes.
+ */
+static void on_arrival(void)
+{
+    if (queue[head].verdict == OBJECT_PASS)
+    {
+        pop();
+        return;
+    }
+
+    /** Rejected, or not measured in time and cannot be let through */
+    diverting = 1;
+    rejects++;
+    speedometer_set_alarm_output(TIM_OCM_INACTIVE); /** Off when the count reaches the end of the hold */
+    if (!speedometer_set_alarm(queue[head].divert_pulses + DIVERTER_HOLD_PULSES, on_release))
+    {
+        speedometer_set_alarm_output(TIM_OCM_FORCE_LOW); /** The belt already moved past the hold */
+        on_release();
+    }
+}
+
+/**
+ * @brief Times the arrival of the front object at the diverter, if there is one.
+ */
+static void schedule(void)
+{
+    uint8_t reject;
+
+    if (!count || diverting)
+    {
+        return; /** Nothing to time, or the release is already timed */
+    }
+    /** The compare switches the diverter on by itself, unless the object is already known to pass */
+    reject = queue[head].verdict != OBJECT_PASS;
+    speedometer_set_alarm_output(reject ? TIM_OCM_ACTIVE : TIM_OCM_FROZEN);
+    if (!speedometer_set_alarm(queue[head].divert_pulses, on_arrival))
+    {
+        if (reject)
+        {
+            speedometer_set_alarm_output(TIM_OCM_FORCE_HIGH); /** Already there */
+        }
+        on_arrival();
+    }
+}
+
+void object_queue_init(void)
+{
+    rcc_periph_clock_enable(RCC_GPIOA);
+    speedometer_cancel_alarm();
+    speedometer_set_alarm_output(TIM_OCM_FORCE_LOW); /** Off before the pin follows the compare output */
+    gpio_set_mode(DIVERTER_PORT, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, DIVERTER_PIN);
+    head = 0;
+    count = 0;
+    diverting = 0;
+}
+
+uint8_t object_queue_push(uint16_t entry_pulses)
+{
+    Queue_Object* object;
+
+    if (count == OBJECT_QUEUE_SIZE)
+    {
+        return 0;
+    }
+    object = &queue[(head + count) & INDEX_MASK];
+    object->entry_pulses = entry_pulses;
+    object->divert_pulses = entry_pulses + distance_pulses;
+    object->distance = -1.0f;
+    object->verdict = OBJECT_PENDING;
+
+    cm_disable_interrupts(); /** The alarm pops from the TIM2 interrupt */
+    count++;
+    if (count == 1)
+    {
+        schedule(); /** The queue was idle, time this one */
+    }
+    cm_enable_interrupts();
+    return 1;
+}
+
+void object_queue_set_verdict(float distance, uint8_t verdict)
+{
+    cm_disable_interrupts();
+    if (count)
+    {
+        uint8_t last = (head + count - 1) & INDEX_MASK;
+        Queue_Object* object = &queue[last];
+        /** At the head, the compare may have switched the diverter on already: it stays a reject */
+        uint8_t arrived =
+            last == head && (diverting || (int16_t)(object->divert_pulses - speedometer_get_pulses()) <= 0);
+
+        if (object->verdict == OBJECT_PENDING && !arrived)
+        {
+            object->distance = distance;
+            object->verdict = verdict;
+            if (last == head && verdict == OBJECT_PASS)
+            {
+                speedometer_set_alarm_output(TIM_OCM_FROZEN); /** Its arrival must leave the diverter off */
+            }
+        }
+    }
+    cm_enable_interrupts();
+}
+
+void object_queue_set_distance(uint16_t pulses)
+{
+    distance_pulses = pulses;
+}
+
+uint8_t object_queue_count(void)
+{
+    return count;
+}
+
+uint32_t object_queue_get_rejects(void)
+{
+    return rejects;
+}
+
+void object_queue_report(void)
+{
+    static const char* verdicts[] = {"pending", "pass", "reject"};
+    Queue_Object objects[OBJECT_QUEUE_SIZE];
+    uint8_t n, first;
+    char row[48];
+    uint8_t len;
+
+    cm_disable_interrupts(); /** A consistent copy, the alarm may pop meanwhile */
+    n = count;
+    first = head;
+    for (uint8_t i = 0; i < n; i++)
+    {
+        objects[i] = queue[(first + i) & INDEX_MASK];
+    }
+    cm_enable_interrupts();
+
+    memcpy(row, "Queue: ", 7);
+    len = 7 + uint_to_string(&row[7], n, 0, 0);
+    memcpy(&row[len], " rejects ", 9);
+    len += 9;
+    len += uint_to_string(&row[len], object_queue_get_rejects(), 0, 0);
+    row[len++] = '\n';
+    uart_write((const uint8_t*)row, len);
+    if (n)
+    {
+        uart_send_string(" to_go_p  dist_cm verdict\n");
+    }
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        const char* verdict = verdicts[objects[i].verdict];
+        /** Pulses left before the diverter, the 16-bit difference is right across the counter overflow */
+        int16_t left = (int16_t)(objects[i].divert_pulses - speedometer_get_pulses());
+
+        len = uint_to_string(row, (left > 0) ? (uint32_t)left : 0, 8, 0);
+        len += uint_to_string(&row[len],
+                              (objects[i].distance < 0) ? 0 : (uint32_t)(objects[i].distance * 100 + 0.5f), 9, 2);
+        row[len++] = ' ';
+        while (*verdict)
+        {
+            row[len++] = *verdict++;
+        }
+        row[len++] = '\n';
+        uart_write((const uint8_t*)row, len);
+    }
+}
@@ -1,16 +1,381 @@
 #include "pid.h"
 
 PID_Controller pid;
+static int32_t p_term_q16; /**< Proportional term of the last update, Q16.16 */
+static int32_t i_term_q16; /**< Integral term of the last update, Q16.16 */
+static int32_t d_term_q16; /**< Derivative term of the last update, Q16.16 */
+static int32_t ff_q16;     /**< Feedforward term added to the output, Q16.16 */
+static int32_t out_q16;    /**< Clamped output of the last update, Q16.16 */
+
+static PID_Controller staged;               /**< Parameter set waiting to be applied */
+static volatile uint8_t commit_pending = 0; /**< 1 when `staged` must be applied at the next update */
+static uint8_t commit_bumpless = 0;         /**< 1 if the pending commit rescales the integral */
+static volatile uint32_t generation = 0;    /**< Number of parameter sets applied */
+
+static void apply_staged(void);
+
+void pid_get_terms_q16(int32_t* p, int32_t* i, int32_t* d)
+{
+    *p = p_term_q16;
+    *i = i_term_q16;
+    *d = d_term_q16;
+}
+
+int32_t pid_get_output_q16(void)
+{
+    return out_q16;
+}
+
+void pid_stage_params(const PID_Controller* params)
+{
+    commit_pending = 0; /** A half-written set must never be applied */
+    staged = *params;
+}
+
+void pid_commit_params(uint8_t bumpless)
+{
+    commit_bumpless = bumpless;
+    commit_pending = 1;
+}
+
+uint32_t pid_get_generation(void)
+{
+    return generation;
+}
+
+void pid_set_feedforward_q16(int32_t feedforward_q16)
+{
+    ff_q16 = feedforward_q16;
+}
+
+#if PID_FIXED_POINT
+
+static int32_t kp_q24;         /**< Proportional gain in Q8.24 */
+static int32_t ki_q24;         /**< Integral gain in Q8.24 */
+static int32_t kd_q24;         /**< Derivative gain in Q8.24 */
+static int32_t setpoint_q16;   /**< Setpoint in Q16.16 */
+static int32_t prev_error_q16; /**< Previous error (for derivative calculation) in Q16.16 */
+static int64_t integral_q16;   /**< Accumulated integral in Q16.16, wider than 32 bits at full output */
+
+static int32_t i_out_q16;         /**< Integral term of `pid_update_dt_q16()`, in percent of output, Q16.16 */
+static int32_t slope_q16;         /**< Filtered change of the measured value per nominal period, Q16.16 */
+static int32_t prev_measured_q16; /**< Previous measured value (derivative on measurement) in Q16.16 */
+static uint8_t measured_valid;    /**< 1 once `prev_measured_q16` holds a measurement */
+
+/**
+ * @brief Converts a float gain to Q8.24, done only when a parameter set is loaded.
+ *
+ * Gains outside ±PID_GAIN_LIMIT saturate instead of overflowing the conversion.
+ */
+static int32_t gain_to_q24(float gain)
+{
+    float scaled = gain * (float)(1L << PID_GAIN_SHIFT);
+
+    if (scaled >= 2147483648.0f)
+    {
+        return INT32_MAX;
+    }
+    if (scaled <= -2147483648.0f)
+    {
+        return INT32_MIN;
+    }
+    return (int32_t)scaled;
+}
+
+/**
+ * @brief Loads a parameter set into the fixed-point state.
+ */
+static void load_params(const PID_Controller* control)
+{
+    pid = *control; /** Copy the control parameters into the local PID controller */
+    kp_q24 = gain_to_q24(pid.kp);
+    ki_q24 = gain_to_q24(pid.ki);
+    kd_q24 = gain_to_q24(pid.kd);
+    setpoint_q16 = (int32_t)(pid.setpoint * PID_Q16_ONE);
+}
+
+/**
+ * @brief Applies the staged parameter set, called at the start of an update.
+ *
+ * With bumpless transfer the integral is rescaled so that the P and I terms give
+ * the same output with the new gains as with the old ones for the last error.
+ */
+static void apply_staged(void)
+{
+    int32_t old_kp = kp_q24, old_ki = ki_q24;
+
+    load_params(&staged);
+    if (commit_bumpless)
+    {
+        /** The dt-aware integral is already in output units, only the P term change is compensated */
+        i_out_q16 += (int32_t)(((int64_t)(old_kp - kp_q24) * prev_error_q16) >> PID_GAIN_SHIFT);
+    }
+    if (commit_bumpless && ki_q24 != 0)
+    {
+        int64_t integral = ((int64_t)(old_kp - kp_q24) * prev_error_q16 + (int64_t)old_ki * integral_q16) / ki_q24;
+
+        if (integral > MAX_INTEGRAL_ERROR_Q16)
+        {
+            integral = MAX_INTEGRAL_ERROR_Q16;
+        }
+        else if (integral < -MAX_INTEGRAL_ERROR_Q16)
+        {
+            integral = -MAX_INTEGRAL_ERROR_Q16;
+        }
+        integral_q16 = integral;
+    }
+    commit_pending = 0;
+    generation++;
+}
+
+void pid_init(PID_Controller* control)
+{
+    load_params(control);
+}
+
+void pid_get_params(PID_Controller* params)
+{
+    if (commit_pending)
+    {
+        *params = staged; /** The set that will be in use once the pending commit is applied */
+        return;
+    }
+    *params = pid;
+    params->setpoint = (float)setpoint_q16 / PID_Q16_ONE; /** The setpoint may have been set in Q16.16 */
+}
+
+uint8_t pid_update_q16(int32_t measured_q16)
+{
+    if (commit_pending)
+    {
+        apply_staged(); /** Parameter changes only take effect between two updates */
+    }
+
+    /** Calculate the current error as the difference between setpoint and measured value */
+    int32_t error = setpoint_q16 - measured_q16;
+
+    /** Update the integral term */
+    int64_t integral = integral_q16 + error;
+
+    /** Cap the integral to prevent windup */
+    if (integral > MAX_INTEGRAL_ERROR_Q16)
+    {
+        integral = MAX_INTEGRAL_ERROR_Q16; /** Limit the integral to a maximum threshold */
+    }
+    else if (integral < -MAX_INTEGRAL_ERROR_Q16)
+    {
+        integral = -MAX_INTEGRAL_ERROR_Q16; /** Limit the integral to a minimum threshold */
+    }
+    integral_q16 = integral;
+
+    /** Calculate the derivative term as the difference from the previous error */
+    int64_t derivative = (int64_t)error - prev_error_q16;
+
+    /** Q8.24 gains times Q16.16 signals give the output in Q24.40 */
+    int64_t p = (int64_t)kp_q24 * error;
+    int64_t i = (int64_t)ki_q24 * integral_q16;
+    int64_t d = (int64_t)kd_q24 * derivative;
+    int64_t output = p + i + d + ((int64_t)ff_q16 << PID_GAIN_SHIFT);
+
+    p_term_q16 = (int32_t)(p >> PID_GAIN_SHIFT);
+    i_term_q16 = (int32_t)(i >> PID_GAIN_SHIFT);
+    d_term_q16 = (int32_t)(d >> PID_GAIN_SHIFT);
+
+    /** Constrain the output to ensure it stays within allowed limits */
+    if (output > ((int64_t)MAX_PID_OUTPUT << (PID_GAIN_SHIFT + PID_Q16_SHIFT)))
+    {
+        output = (int64_t)MAX_PID_OUTPUT << (PID_GAIN_SHIFT + PID_Q16_SHIFT); /** Cap output at the maximum limit */
+    }
+    else if (output < ((int64_t)MIN_PID_OUTPUT << (PID_GAIN_SHIFT + PID_Q16_SHIFT)))
+    {
+        output = (int64_t)MIN_PID_OUTPUT << (PID_GAIN_SHIFT + PID_Q16_SHIFT); /** Cap output at the minimum limit */
+    }
+
+    out_q16 = (int32_t)(output >> PID_GAIN_SHIFT);
+
+    /** Save the current error to use in the next cycle for the derivative calculation */
+    prev_error_q16 = error;
+
+    /** Return the integer part of the constrained output, as the float version truncates it */
+    return (uint8_t)(output >> (PID_GAIN_SHIFT + PID_Q16_SHIFT));
+}
+
+uint8_t pid_update(float measured_value)
+{
+    return pid_update_q16((int32_t)(measured_value * PID_Q16_ONE));
+}
+
+uint8_t pid_update_dt_q16(int32_t measured_q16, uint32_t dt_us, uint8_t hold)
+{
+    if (commit_pending)
+    {
+        apply_staged(); /** Parameter changes only take effect between two updates */
+    }
+    if (dt_us == 0)
+    {
+        dt_us = 1;
+    }
+    else if (dt_us > PID_MAX_DT_US)
+    {
+        dt_us = PID_MAX_DT_US; /** A long gap is accounted as a late update, not as one huge step */
+    }
+
+    int32_t error = setpoint_q16 - measured_q16;
+
+    /** Change of the measured value per nominal period, through a first-order low-pass filter */
+    if (measured_valid)
+    {
+        int64_t slope = (int64_t)(measured_q16 - prev_measured_q16) * PID_NOMINAL_DT_US / dt_us;
+        int64_t alpha_q16 = ((int64_t)dt_us << PID_Q16_SHIFT) / (PID_D_FILTER_US + dt_us);
+
+        if (slope > INT32_MAX / 2)
+        {
+            slope = INT32_MAX / 2;
+        }
+        else if (slope < -(INT32_MAX / 2))
+        {
+            slope = -(INT32_MAX / 2);
+        }
+        slope_q16 += (int32_t)(((slope - slope_q16) * alpha_q16) >> PID_Q16_SHIFT);
+    }
+    prev_measured_q16 = measured_q16;
+    measured_valid = 1;
+
+    /** Integrate the error over dt before computing the output, as `pid_update_q16()` does */
+    if (!hold)
+    {
+        i_out_q16 += (int32_t)((((int64_t)ki_q24 * error) >> PID_GAIN_SHIFT) * dt_us / PID_NOMINAL_DT_US);
+    }
+
+    /** Terms in percent of output, Q16.16; the derivative opposes the change of the measurement */
+    int64_t p = ((int64_t)kp_q24 * error) >> PID_GAIN_SHIFT;
+    int64_t d = -(((int64_t)kd_q24 * slope_q16) >> PID_GAIN_SHIFT);
+    int64_t unsaturated = p + i_out_q16 + d + ff_q16;
+    int64_t output = unsaturated;
+
+    if (output > ((int64_t)MAX_PID_OUTPUT << PID_Q16_SHIFT))
+    {
+        output = (int64_t)MAX_PID_OUTPUT << PID_Q16_SHIFT;
+    }
+    else if (output < ((int64_t)MIN_PID_OUTPUT << PID_Q16_SHIFT))
+    {
+        output = (int64_t)MIN_PID_OUTPUT << PID_Q16_SHIFT;
+    }
+
+    p_term_q16 = (int32_t)p;
+    i_term_q16 = i_out_q16;
+    d_term_q16 = (int32_t)d;
+    out_q16 = (int32_t)output;
+
+    if (!hold)
+    {
+        /** Feed back the excess over the limits (back-calculation), the integral never winds up beyond them */
+        i_out_q16 += (int32_t)((output - unsaturated) * dt_us / (PID_NOMINAL_DT_US * PID_TRACKING_PERIODS));
+    }
+
+    prev_error_q16 = error; /** Used by the bumpless transfer */
+
+    return (uint8_t)(output >> PID_Q16_SHIFT);
+}
+
+void pid_shift_integral_q16(int32_t delta_q16)
+{
+    i_out_q16 += delta_q16;
+    if (ki_q24 != 0)
+    {
+        int64_t integral = integral_q16 + ((int64_t)delta_q16 << PID_GAIN_SHIFT) / ki_q24;
+
+        if (integral > MAX_INTEGRAL_ERROR_Q16)
+        {
+            integral = MAX_INTEGRAL_ERROR_Q16;
+        }
+        else if (integral < -MAX_INTEGRAL_ERROR_Q16)
+        {
+            integral = -MAX_INTEGRAL_ERROR_Q16;
+        }
+        integral_q16 = integral;
+    }
+}
+
+void pid_setpoint_q16(int32_t setpoint)
+{
+    setpoint_q16 = setpoint;
+}
+
+int32_t pid_get_setpoint_q16(void)
+{
+    return setpoint_q16;
+}
+
+void pid_setpoint(float setpoint)
+{
+    pid.setpoint = setpoint; /** Update the setpoint in the PID controller */
+    setpoint_q16 = (int32_t)(setpoint * PID_Q16_ONE);
+}
+
+#else
+
 static float prev_error; /**< Previous error (for derivative calculation) */
 static float integral;   /**< Accumulated integral */
 
+static float i_out;            /**< Integral term of `pid_update_dt_q16()`, in percent of output */
+static float slope;            /**< Filtered change of the measured value per nominal period */
+static float prev_measured;    /**< Previous measured value (derivative on measurement) */
+static uint8_t measured_valid; /**< 1 once `prev_measured` holds a measurement */
+
+/**
+ * @brief Applies the staged parameter set, called at the start of an update.
+ *
+ * With bumpless transfer the integral is rescaled so that the P and I terms give
+ * the same output with the new gains as with the old ones for the last error.
+ */
+static void apply_staged(void)
+{
+    float old_kp = pid.kp, old_ki = pid.ki;
+
+    pid = staged;
+    if (commit_bumpless)
+    {
+        i_out += (old_kp - pid.kp) * prev_error; /** The dt-aware integral is already in output units */
+    }
+    if (commit_bumpless && pid.ki != 0.0f)
+    {
+        integral = ((old_kp - pid.kp) * prev_error + old_ki * integral) / pid.ki;
+        if (integral > MAX_INTEGRAL_ERROR)
+        {
+            integral = MAX_INTEGRAL_ERROR;
+        }
+        else if (integral < -MAX_INTEGRAL_ERROR)
+        {
+            integral = -MAX_INTEGRAL_ERROR;
+        }
+    }
+    commit_pending = 0;
+    generation++;
+}
+
 void pid_init(PID_Controller* control)
 {
     pid = *control; /** Copy the control parameters into the local PID controller */
 }
 
+void pid_get_params(PID_Controller* params)
+{
+    if (commit_pending)
+    {
+        *params = staged; /** The set that will be in use once the pending commit is applied */
+        return;
+    }
+    *params = pid;
+}
+
 uint8_t pid_update(float measured_value)
 {
+    if (commit_pending)
+    {
+        apply_staged(); /** Parameter changes only take effect between two updates */
+    }
+
     /** Calculate the current error as the difference between setpoint and measured value */
     float error = pid.setpoint - measured_value;
 
@@ -31,7 +396,14 @@ uint8_t pid_update(float measured_value)
     float derivative = error - prev_error;
 
     /** Calculate the PID output based on the error, integral, and derivative terms */
-    float output = (pid.kp * error) + (pid.ki * integral) + (pid.kd * derivative);
+    float p = pid.kp * error;
+    float i = pid.ki * integral;
+    float d = pid.kd * derivative;
+    float output = p + i + d + (float)ff_q16 / PID_Q16_ONE;
+
+    p_term_q16 = (int32_t)(p * PID_Q16_ONE);
+    i_term_q16 = (int32_t)(i * PID_Q16_ONE);
+    d_term_q16 = (int32_t)(d * PID_Q16_ONE);
 
     /** Constrain the output to ensure it stays within allowed limits */
     if (output > MAX_PID_OUTPUT)
@@ -43,6 +415,8 @@ uint8_t pid_update(float measured_value)
         output = MIN_PID_OUTPUT; /** Cap output at the minimum limit */
     }
 
+    out_q16 = (int32_t)(output * PID_Q16_ONE);
+
     /** Save the current error to use in the next cycle for the derivative calculation */
     prev_error = error;
 
@@ -50,7 +424,108 @@ uint8_t pid_update(float measured_value)
     return (uint8_t)output;
 }
 
+uint8_t pid_update_q16(int32_t measured_q16)
+{
+    return pid_update((float)measured_q16 / PID_Q16_ONE);
+}
+
+uint8_t pid_update_dt_q16(int32_t measured_q16, uint32_t dt_us, uint8_t hold)
+{
+    float measured_value = (float)measured_q16 / PID_Q16_ONE;
+
+    if (commit_pending)
+    {
+        apply_staged(); /** Parameter changes only take effect between two updates */
+    }
+    if (dt_us == 0)
+    {
+        dt_us = 1;
+    }
+    else if (dt_us > PID_MAX_DT_US)
+    {
+        dt_us = PID_MAX_DT_US; /** A long gap is accounted as a late update, not as one huge step */
+    }
+
+    float periods = (float)dt_us / PID_NOMINAL_DT_US; /** dt in nominal periods */
+    float error = pid.setpoint - measured_value;
+
+    /** Change of the measured value per nominal period, through a first-order low-pass filter */
+    if (measured_valid)
+    {
+        slope += ((measured_value - prev_measured) / periods - slope) * dt_us / (PID_D_FILTER_US + dt_us);
+    }
+    prev_measured = measured_value;
+    measured_valid = 1;
+
+    /** Integrate the error over dt before computing the output, as `pid_update()` does */
+    if (!hold)
+    {
+        i_out += pid.ki * error * periods;
+    }
+
+    /** The derivative opposes the change of the measurement */
+    float p = pid.kp * error;
+    float d = -pid.kd * slope;
+    float unsaturated = p + i_out + d + (float)ff_q16 / PID_Q16_ONE;
+    float output = unsaturated;
+
+    if (output > MAX_PID_OUTPUT)
+    {
+        output = MAX_PID_OUTPUT;
+    }
+    else if (output < MIN_PID_OUTPUT)
+    {
+        output = MIN_PID_OUTPUT;
+    }
+
+    p_term_q16 = (int32_t)(p * PID_Q16_ONE);
+    i_term_q16 = (int32_t)(i_out * PID_Q16_ONE);
+    d_term_q16 = (int32_t)(d * PID_Q16_ONE);
+    out_q16 = (int32_t)(output * PID_Q16_ONE);
+
+    if (!hold)
+    {
+        /** Feed back the excess over the limits (back-calculation), the integral never winds up beyond them */
+        i_out += (output - unsaturated) / PID_TRACKING_PERIODS * periods;
+    }
+
+    prev_error = error; /** Used by the bumpless transfer */
+
+    return (uint8_t)output;
+}
+
+void pid_shift_integral_q16(int32_t delta_q16)
+{
+    float delta = (float)delta_q16 / PID_Q16_ONE;
+
+    i_out += delta;
+    if (pid.ki != 0.0f)
+    {
+        integral += delta / pid.ki;
+        if (integral > MAX_INTEGRAL_ERROR)
+        {
+            integral = MAX_INTEGRAL_ERROR;
+        }
+        else if (integral < -MAX_INTEGRAL_ERROR)
+        {
+            integral = -MAX_INTEGRAL_ERROR;
+        }
+    }
+}
+
+void pid_setpoint_q16(int32_t setpoint)
+{
+    pid.setpoint = (float)setpoint / PID_Q16_ONE;
+}
+
+int32_t pid_get_setpoint_q16(void)
+{
+    return (int32_t)(pid.setpoint * PID_Q16_ONE);
+}
+
 void pid_setpoint(float setpoint)
 {
     pid.setpoint = setpoint; /** Update the setpoint in the PID controller */
 }
+
+#endif
@@ -0,0 +1,152 @@
+#include "profile.h"
+#include "scheduler.h"
+#include "uart.h"
+#include "utils.h"
+
+#define REPORT_IDLE   -1 /** No report being sent */
+#define REPORT_HEADER 0  /** Next row is the column titles, then sites from 1 */
+#define ROW_SIZE      72 /** Longest report row, newline included */
+
+static Profile_Stats stats[PROFILE_N_SITES]; /** Accumulators, indexed by site */
+static uint32_t start_ticks = 0;             /** Scheduler ticks at the last reset */
+static int8_t report_row = REPORT_IDLE;      /** Next row of the report */
+
+static const char* const site_names[PROFILE_TASK_FIRST] = {
+    [PROFILE_SYSTICK] = "systick",
+    [PROFILE_TIM2] = "tim2",
+    [PROFILE_TIM4] = "tim4",
+    [PROFILE_USART1] = "usart1",
+    [PROFILE_EXTI15_10] = "exti15_10",
+    [PROFILE_ADC1] = "adc1",
+    [PROFILE_DMA1_CH1] = "dma1_ch1",
+    [PROFILE_DMA1_CH4] = "dma1_ch4",
+    [PROFILE_DMA1_CH5] = "dma1_ch5",
+    [PROFILE_DMA1_CH6] = "dma1_ch6",
+    [PROFILE_I2C1_EV] = "i2c1_ev",
+    [PROFILE_I2C1_ER] = "i2c1_er",
+};
+
+void profile_init(void)
+{
+    dwt_enable_cycle_counter();
+    profile_reset();
+}
+
+void profile_reset(void)
+{
+    cm_disable_interrupts(); /** Sites may be recording meanwhile */
+    for (uint8_t i = 0; i < PROFILE_N_SITES; i++)
+    {
+        stats[i].count = 0;
+        stats[i].min = UINT32_MAX;
+        stats[i].max = 0;
+        stats[i].total = 0;
+    }
+    start_ticks = scheduler_get_ticks();
+    cm_enable_interrupts();
+}
+
+void profile_record(uint8_t site, uint32_t cycles)
+{
+    Profile_Stats* s;
+
+    if (site >= PROFILE_N_SITES)
+    {
+        return;
+    }
+    s = &stats[site];
+    s->count++;
+    s->total += cycles;
+    if (cycles < s->min)
+    {
+        s->min = cycles;
+    }
+    if (cycles > s->max)
+    {
+        s->max = cycles;
+    }
+}
+
+void profile_get(uint8_t site, Profile_Stats* out)
+{
+    cm_disable_interrupts();
+    *out = stats[site];
+    cm_enable_interrupts();
+}
+
+void profile_report_start(void)
+{
+    report_row = REPORT_HEADER;
+}
+
+/**
+ * @brief Formats the report row of a site.
+ *
+ * @return Number of characters, 0 if the site never ran.
+ */
+static uint8_t format_site(uint8_t site, char* row)
+{
+    uint64_t elapsed = (uint64_t)(scheduler_get_ticks() - start_ticks) * (rcc_ahb_frequency / 1000);
+    const char* name = (site < PROFILE_TASK_FIRST) ? site_names[site] : "task";
+    Profile_Stats s;
+    uint8_t len = 0;
+
+    profile_get(site, &s);
+    if (!s.count)
+    {
+        return 0;
+    }
+
+    while (*name)
+    {
+        row[len++] = *name++;
+    }
+    if (site >= PROFILE_TASK_FIRST)
+    {
+        row[len++] = '0' + (site - PROFILE_TASK_FIRST);
+    }
+    while (len < 10)
+    {
+        row[len++] = ' ';
+    }
+    len += uint_to_string(&row[len], s.count, 11, 0);
+    len += uint_to_string(&row[len], s.min, 9, 0);
+    len += uint_to_string(&row[len], (uint32_t)(s.total / s.count), 9, 0);
+    len += uint_to_string(&row[len], s.max, 9, 0);
+    len += uint_to_string(&row[len], elapsed ? (uint32_t)(s.total * 10000 / elapsed) : 0, 8, 2);
+    row[len++] = '\n';
+    return len;
+}
+
+void profile_report_step(void)
+{
+    char row[ROW_SIZE];
+    uint8_t len = 0;
+
+    if (report_row == REPORT_IDLE || uart_tx_free() < ROW_SIZE)
+    {
+        return;
+    }
+
+    if (report_row == REPORT_HEADER)
+    {
+        uart_send_string("site             runs   min_cy  mean_cy   max_cy   cpu_%\n");
+        report_row++;
+        return;
+    }
+
+    /** Sites that never ran are skipped, one row is queued per call */
+    while (!len && report_row <= PROFILE_N_SITES)
+    {
+        len = format_site(report_row - 1, row);
+        report_row++;
+    }
+    if (len)
+    {
+        uart_write((const uint8_t*)row, len);
+    }
+    if (report_row > PROFILE_N_SITES)
+    {
+        report_row = REPORT_IDLE;
+    }
+}
@@ -0,0 +1,82 @@
+#include "scheduler.h"
+#include "profile.h"
+
+static Scheduler_Task* tasks = NULL; /**< Task table registered by the application. */
+static uint8_t task_count = 0;       /**< Number of entries in the task table. */
+static volatile uint32_t ticks = 0;  /**< Ticks elapsed since initialization. */
+
+void scheduler_init(Scheduler_Task* table, uint8_t n_tasks)
+{
+    tasks = table;
+    task_count = n_tasks;
+    ticks = 0;
+
+    for (uint8_t i = 0; i < task_count; i++)
+    {
+        tasks[i].countdown = tasks[i].phase + 1; /**< First release after `phase` ticks. */
+        tasks[i].ready = 0;
+        tasks[i].running = 0;
+        tasks[i].runs = 0;
+        tasks[i].overruns = 0;
+    }
+}
+
+void scheduler_tick(void)
+{
+    ticks++;
+
+    for (uint8_t i = 0; i < task_count; i++)
+    {
+        if (--tasks[i].countdown == 0)
+        {
+            tasks[i].countdown = tasks[i].period;
+            if (tasks[i].ready || tasks[i].running)
+            {
+                tasks[i].overruns++; /**< Previous release not finished: coalesce and count it. */
+            }
+            tasks[i].ready = 1;
+        }
+    }
+}
+
+uint8_t scheduler_dispatch(void)
+{
+    Scheduler_Task* next = NULL;
+
+    /** Pick the ready task with the highest priority, ties go to the first in the table. */
+    for (uint8_t i = 0; i < task_count; i++)
+    {
+        if (tasks[i].ready && (!next || tasks[i].priority < next->priority))
+        {
+            next = &tasks[i];
+        }
+    }
+
+    if (!next)
+    {
+        return 0;
+    }
+
+    cm_disable_interrupts(); /**< The tick interrupt writes the same flags. */
+    next->ready = 0;
+    next->running = 1;
+    cm_enable_interrupts();
+
+    PROFILE_ENTER();
+    next->run();
+    PROFILE_EXIT(PROFILE_TASK_FIRST + (next - tasks)); /**< Tasks past PROFILE_MAX_TASKS are not profiled. */
+
+    next->running = 0;
+    next->runs++;
+    return 1;
+}
+
+uint32_t scheduler_get_ticks(void)
+{
+    return ticks;
+}
+
+uint32_t scheduler_get_overruns(uint8_t task)
+{
+    return (task < task_count) ? tasks[task].overruns : 0;
+}
@@ -1,6 +1,38 @@
 #include "setpoint.h"
+#include "profile.h"
 
 static volatile uint16_t potBuff[N_DATA]; /** Buffer to store ADC readings for the potentiometer */
+static volatile uint32_t half_sum[2];     /** Sum of each half of the buffer, refreshed by the DMA interrupts */
+static volatile uint8_t changed = 1;      /** Set when the knob moved since the last `pot_changed()` */
+static volatile uint8_t settling = 0;     /** Buffer halves still to be reported as changed */
+
+/**
+ * @brief Centers the analog watchdog band on an ADC reading.
+ *
+ * @param value ADC reading the band is centered on.
+ */
+static void awd_center(uint16_t value)
+{
+    adc_set_watchdog_low_threshold(POT_ADC, (value > POT_AWD_BAND) ? value - POT_AWD_BAND : 0);
+    adc_set_watchdog_high_threshold(POT_ADC,
+                                    (value < POT_ADC_MAX - POT_AWD_BAND) ? value + POT_AWD_BAND : POT_ADC_MAX);
+}
+
+/**
+ * @brief Sums one half of the buffer.
+ *
+ * @param half 0 for the first half, 1 for the second one.
+ */
+static uint32_t sum_half(uint8_t half)
+{
+    uint32_t ac = 0;
+
+    for (uint8_t i = half * (N_DATA / 2); i < (half + 1) * (N_DATA / 2); i++)
+    {
+        ac += potBuff[i];
+    }
+    return ac;
+}
 
 void pot_init(void)
 {
@@ -25,16 +57,19 @@ void pot_init(void)
     dma_enable_circular_mode(DMA1, POT_DMA_CHANNEL);         /** Enable circular mode for continuous data transfer */
     dma_enable_memory_increment_mode(DMA1, POT_DMA_CHANNEL); /** Enable memory increment mode to move through buffer */
     dma_set_read_from_peripheral(DMA1, POT_DMA_CHANNEL);     /** Configure DMA to read from the peripheral (ADC) */
-    dma_enable_channel(DMA1, POT_DMA_CHANNEL);               /** Enable the DMA channel */
+    dma_enable_half_transfer_interrupt(DMA1, POT_DMA_CHANNEL);     /** First half filled */
+    dma_enable_transfer_complete_interrupt(DMA1, POT_DMA_CHANNEL); /** Second half filled */
+    nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+    dma_enable_channel(DMA1, POT_DMA_CHANNEL); /** Enable the DMA channel */
 
     /** ADC setup: disable ADC to configure DMA settings */
-    adc_power_off(ADC1);                      /** Turn off the ADC */
-    adc_enable_dma(ADC1);                     /** Enable DMA mode in ADC */
-    adc_disable_eoc_interrupt(ADC1);          /** Disable end-of-conversion interrupt */
-    adc_enable_scan_mode(ADC1);               /** Enable scan mode for multi-channel if needed */
-    adc_disable_temperature_sensor();         /** Disable internal temperature sensor channel */
-    adc_set_continuous_conversion_mode(ADC1); /** Enable continuous conversion mode */
-    adc_set_right_aligned(ADC1);              /** Set right alignment for ADC results */
+    adc_power_off(ADC1);                  /** Turn off the ADC */
+    adc_enable_dma(ADC1);                 /** Enable DMA mode in ADC */
+    adc_disable_eoc_interrupt(ADC1);      /** Disable end-of-conversion interrupt */
+    adc_disable_scan_mode(ADC1);          /** A single channel is converted */
+    adc_disable_temperature_sensor();     /** Disable internal temperature sensor channel */
+    adc_set_single_conversion_mode(ADC1); /** One conversion per timer trigger */
+    adc_set_right_aligned(ADC1);          /** Set right alignment for ADC results */
 
     /** Set up the ADC channel sequence and sample time */
     uint8_t ch[1] = {POT_ADC_CHANNEL};     /** Define the ADC channel for the potentiometer */
@@ -48,21 +83,85 @@ void pot_init(void)
     while (adc_is_calibrating(ADC1))
         ; /** Wait for calibration to complete */
 
-    adc_enable_external_trigger_regular(ADC1,
-                                        ADC_CR2_EXTSEL_SWSTART); /** Enable software trigger for conversion start */
-    adc_start_conversion_regular(ADC1);                          /** Start the ADC conversions */
+    /** Watch the potentiometer channel, the band is moved to each new position by the watchdog interrupt */
+    adc_enable_analog_watchdog_on_selected_channel(ADC1, POT_ADC_CHANNEL);
+    adc_enable_analog_watchdog_regular(ADC1);
+    awd_center(0);
+    adc_enable_awd_interrupt(ADC1);
+    nvic_enable_irq(NVIC_ADC1_2_IRQ);
+
+    /** The ADC triggers on the TIM1 CC1 event, which needs the channel in PWM mode with its output enabled */
+    timer_set_oc_mode(POT_TRIGGER_TIMER, TIM_OC1, TIM_OCM_PWM1);
+    timer_enable_oc_output(POT_TRIGGER_TIMER, TIM_OC1); /** PA8 stays a GPIO input, the pin is not driven */
+    adc_enable_external_trigger_regular(ADC1, ADC_CR2_EXTSEL_TIM1_CC1); /** Convert on each timer compare */
 }
 
 float pot_get_value(void)
 {
-    uint32_t ac = 0; /** Accumulator for averaging buffer values */
+    uint32_t ac = half_sum[0] + half_sum[1]; /** Running sum kept by the DMA interrupts */
+
+    /** Return the average value, converted to a percentage */
+    return (float)ac * CONSTANT_TO_PERCENTAGE;
+}
+
+int32_t pot_get_value_q16(void)
+{
+    uint32_t ac = half_sum[0] + half_sum[1]; /** Running sum kept by the DMA interrupts */
 
-    /** Sum up all values in the buffer */
-    for (uint8_t i = 0; i < N_DATA; i++)
+    /** N_DATA * 4095 * 2561 still fits in 32 bits */
+    return (int32_t)((ac * CONSTANT_TO_PERCENTAGE_Q20) >> 4);
+}
+
+uint8_t pot_changed(void)
+{
+    uint8_t c;
+
+    cm_disable_interrupts();
+    c = changed;
+    changed = 0;
+    cm_enable_interrupts();
+    return c;
+}
+
+void dma1_channel1_isr(void)
+{
+    PROFILE_ENTER();
+    uint8_t half;
+
+    if (dma_get_interrupt_flag(DMA1, POT_DMA_CHANNEL, DMA_HTIF))
     {
-        ac += potBuff[i];
+        dma_clear_interrupt_flags(DMA1, POT_DMA_CHANNEL, DMA_HTIF);
+        half = 0;
+    }
+    else if (dma_get_interrupt_flag(DMA1, POT_DMA_CHANNEL, DMA_TCIF))
+    {
+        dma_clear_interrupt_flags(DMA1, POT_DMA_CHANNEL, DMA_TCIF);
+        half = 1;
+    }
+    else
+    {
+        PROFILE_EXIT(PROFILE_DMA1_CH1);
+        return;
     }
 
-    /** Return the average value, converted to a percentage */
-    return (float)ac * CONSTANT_TO_PERCENTAGE;
+    half_sum[half] = sum_half(half); /** Only the half the DMA just finished is summed again */
+    if (settling)
+    {
+        settling--;
+        changed = 1; /** The average is still moving towards the new position */
+    }
+    PROFILE_EXIT(PROFILE_DMA1_CH1);
+}
+
+void adc1_2_isr(void)
+{
+    PROFILE_ENTER();
+    if (adc_get_flag(POT_ADC, ADC_SR_AWD))
+    {
+        adc_clear_flag(POT_ADC, ADC_SR_AWD);
+        awd_center(ADC_DR(POT_ADC)); /** Follow the knob, the next move is measured from here */
+        settling = POT_SETTLE_HALVES;
+        changed = 1;
+    }
+    PROFILE_EXIT(PROFILE_ADC1);
 }
@@ -1,7 +1,72 @@
 #include "speedometer.h"
-#include <stdlib.h>
+#include "profile.h"
 
-static volatile uint16_t turns[2]; /** Variable to store the number of encoder turns */
+static volatile uint16_t turns[SPEEDOMETER_RING_SIZE]; /** Pulse counter samples written by DMA every slot */
+static uint16_t window_slots = SPEEDOMETER_DEFAULT_WINDOW_MS / SPEEDOMETER_SLOT_MS; /** Window of the getters */
+static void (*volatile alarm_callback)(void) = NULL; /** Function called at the alarm position, NULL when none is set */
+
+/**
+ * @brief Converts a window length to a number of ring slots.
+ *
+ * @param window_ms Window length in ms.
+ * @return Number of slots, between 1 and SPEEDOMETER_MAX_WINDOW_SLOTS.
+ */
+static uint16_t ms_to_slots(uint16_t window_ms)
+{
+    uint16_t slots = window_ms / SPEEDOMETER_SLOT_MS;
+
+    if (slots < 1)
+    {
+        return 1;
+    }
+    return (slots > SPEEDOMETER_MAX_WINDOW_SLOTS) ? SPEEDOMETER_MAX_WINDOW_SLOTS : slots;
+}
+
+/**
+ * @brief Returns the index of the most recent sample written by the DMA.
+ */
+static uint16_t latest_slot(void)
+{
+    uint16_t written = SPEEDOMETER_RING_SIZE - dma_get_number_of_data(DMA1, DMA_CH);
+    return (written + SPEEDOMETER_RING_SIZE - 1) % SPEEDOMETER_RING_SIZE;
+}
+
+/**
+ * @brief Average speed over `slots` slots ending at the sample `end`.
+ *
+ * @return Speed in RPM, Q16.16.
+ */
+static int32_t window_rpm_q16(uint16_t end, uint16_t slots)
+{
+    /** The 16-bit subtraction gives the right pulse count across the counter overflow */
+    uint16_t pulses = turns[end] - turns[(end + SPEEDOMETER_RING_SIZE - slots) % SPEEDOMETER_RING_SIZE];
+
+    return (int32_t)((((uint64_t)pulses * SPEEDOMETER_RPM_PER_PULSE_SLOT) << 16) / slots);
+}
+
+#if SPEEDOMETER_CAPTURE
+static volatile uint32_t edge_time = 0;  /** Cycle counter value at the last encoder edge */
+static volatile uint32_t edge_count = 0; /** Number of encoder edges seen by the capture interrupt */
+static uint32_t ref_time = 0;            /** Edge time used as the start of the next period */
+static uint32_t ref_count = 0;           /** Edge count used as the start of the next period */
+static uint8_t ref_valid = 0;            /** 0 until an edge has been seen since start-up or the last stop */
+static int32_t rpm_q16 = 0;              /** Last speed estimate in RPM, Q16.16 */
+
+/**
+ * @brief Converts a number of pulses over a number of CPU cycles to RPM in Q16.16.
+ *
+ * @param pulses Encoder pulses.
+ * @param cycles CPU cycles over which the pulses were counted, not 0.
+ * @return Speed in RPM, Q16.16, saturated to INT32_MAX.
+ */
+static int32_t pulses_to_rpm_q16(uint32_t pulses, uint32_t cycles)
+{
+    /** One pulse per cycle would be rcc_ahb_frequency * 60 / PULSES_PER_TURN RPM */
+    uint64_t rpm = ((((uint64_t)rcc_ahb_frequency * 60 / PULSES_PER_TURN) << 16) * pulses) / cycles;
+
+    return (rpm > INT32_MAX) ? INT32_MAX : (int32_t)rpm;
+}
+#endif
 
 void speedometer_init(void)
 {
@@ -21,12 +86,25 @@ void speedometer_init(void)
     timer_slave_set_filter(ENCODER_TIMER, TIM_IC_DTF_DIV_32_N_8); /** Set filter to reduce noise */
     // timer_slave_set_prescaler(ENCODER_TIMER, PULSES_1TURN);    /** Automaticaly computes to turns */
 
+#if SPEEDOMETER_CAPTURE
+    /** Timestamp every pulse: TIM2 CH1 sees the same pin as ETR, its capture interrupt reads the cycle counter */
+    dwt_enable_cycle_counter();
+    timer_ic_set_input(ENCODER_TIMER, TIM_IC1, TIM_IC_IN_TI1);
+    timer_ic_set_filter(ENCODER_TIMER, TIM_IC1, TIM_IC_DTF_DIV_32_N_8); /** Same filter as the pulse counter */
+    timer_ic_set_polarity(ENCODER_TIMER, TIM_IC1, TIM_IC_RISING);
+    timer_ic_enable(ENCODER_TIMER, TIM_IC1);
+    timer_enable_irq(ENCODER_TIMER, TIM_DIER_CC1IE);
+#endif
+    /** CH2 compares the pulse count for the position alarm, its interrupt is enabled while an alarm is set */
+    timer_set_oc_mode(ENCODER_TIMER, TIM_OC2, TIM_OCM_FROZEN);
+    nvic_enable_irq(NVIC_TIM2_IRQ);
+
     /**
      * Configure TIM1 (TENMS_TIMER) to generate periodic DMA requests
      */
     timer_set_prescaler(TENMS_TIMER, MS_PS);                 /** Set prescaler to adjust timer clock speed */
-    timer_set_period(TENMS_TIMER, MS_INTERVAL);              /** Set timer period to 600ms */
-    timer_set_oc_value(TENMS_TIMER, TIM_OC1, 49999);         /** Set output compare value */
+    timer_set_period(TENMS_TIMER, MS_INTERVAL);              /** Set timer period to 10ms */
+    timer_set_oc_value(TENMS_TIMER, TIM_OC1, MS_INTERVAL);   /** Set output compare value */
     timer_set_oc_mode(TENMS_TIMER, TIM_OC1, TIM_OCM_FROZEN); /** Freeze output when counter reaches OC1 value */
     timer_enable_irq(TENMS_TIMER, TIM_DIER_CC1DE);           /** Enable DMA request on update events */
 
@@ -36,16 +114,13 @@ void speedometer_init(void)
     dma_channel_reset(DMA1, DMA_CH);                      /** Reset DMA channel to clear previous configuration */
     dma_set_priority(DMA1, DMA_CH, DMA_CCR_PL_VERY_HIGH); /** Set high priority for DMA transfers */
     dma_set_peripheral_address(DMA1, DMA_CH, (uint32_t)&TIM2_CNT); /** Set DMA source to TIM2 counter register */
-    dma_set_memory_address(DMA1, DMA_CH, (uint32_t)turns);         /** Set DMA destination to `turns` variable */
-    dma_set_number_of_data(DMA1, DMA_CH, 2);                       /** Transfer a single data item per request */
+    dma_set_memory_address(DMA1, DMA_CH, (uint32_t)turns);         /** Set DMA destination to the `turns` ring */
+    dma_set_number_of_data(DMA1, DMA_CH, SPEEDOMETER_RING_SIZE);   /** One ring slot per request */
     dma_set_peripheral_size(DMA1, DMA_CH, DMA_CCR_PSIZE_16BIT);    /** Set peripheral data size to 16 bits */
     dma_set_memory_size(DMA1, DMA_CH, DMA_CCR_MSIZE_16BIT);        /** Set memory data size to 16 bits */
     dma_enable_circular_mode(DMA1, DMA_CH);                        /** Enable circular mode for continuous updates */
     dma_enable_memory_increment_mode(DMA1, DMA_CH);
-
-    /** Enable transfer complete interrupt to reset TIM2 counter after each DMA transfer */
-    dma_enable_transfer_complete_interrupt(DMA1, DMA_CH); /** Enable interrupt on transfer completion */
-    // nvic_enable_irq(NVIC_DMA1_CHANNEL2_IRQ);              /** Enable NVIC interrupt for DMA channel 2 */
+    dma_set_read_from_peripheral(DMA1, DMA_CH);
     dma_enable_channel(DMA1, DMA_CH); /** Start the DMA channel */
 
     /** Enable all counters to begin measurements */
@@ -53,12 +128,174 @@ void speedometer_init(void)
     timer_enable_counter(TENMS_TIMER);   /** Start TIM1 (measurement timer) */
 }
 
+#if SPEEDOMETER_CAPTURE
+
+void speedometer_update(void)
+{
+    uint32_t t, n, now;
+
+    cm_disable_interrupts(); /** Edge time and count must come from the same edge */
+    t = edge_time;
+    n = edge_count;
+    now = dwt_read_cycle_counter();
+    cm_enable_interrupts();
+
+    if (n != ref_count)
+    {
+        /** New pulses: period from the last edge of the previous update to the last edge of this one */
+        if (ref_valid && t != ref_time)
+        {
+            rpm_q16 = pulses_to_rpm_q16(n - ref_count, t - ref_time);
+        }
+        ref_valid = 1;
+        ref_count = n;
+        ref_time = t;
+    }
+    else if (ref_valid)
+    {
+        uint32_t since = now - ref_time;
+
+        if (since > (rcc_ahb_frequency / 1000) * SPEEDOMETER_STOP_TIMEOUT_MS)
+        {
+            rpm_q16 = 0; /** Stopped, the next edge starts a new period */
+            ref_valid = 0;
+        }
+        else
+        {
+            /** No pulse yet: the speed cannot be higher than one pulse over the time since the last edge */
+            int32_t bound = pulses_to_rpm_q16(1, since);
+            if (bound < rpm_q16)
+            {
+                rpm_q16 = bound;
+            }
+        }
+    }
+}
+
+float speedometer_getRPM(void)
+{
+    return (float)rpm_q16 / 65536; /** Convert Q16.16 to RPM */
+}
+
+int32_t speedometer_getRPM_q16(void)
+{
+    return rpm_q16;
+}
+
+float speedometer_getRAD_S(void)
+{
+    return (float)rpm_q16 * (float)(CONSTANT_TO_RAD_S / CONSTANT_TO_RPM / 65536); /** Convert Q16.16 RPM to rad/s */
+}
+
+#else
+
+void speedometer_update(void)
+{
+}
+
 float speedometer_getRPM(void)
 {
-    return (float)(abs(turns[1] - turns[0]) * CONSTANT_TO_RPM); /** Convert turns to RPM */
+    return (float)speedometer_getRPM_q16() / 65536; /** Convert Q16.16 to RPM */
+}
+
+int32_t speedometer_getRPM_q16(void)
+{
+    return window_rpm_q16(latest_slot(), window_slots); /** Pulses over the selected window, in RPM */
 }
 
 float speedometer_getRAD_S(void)
 {
-    return (float)(abs(turns[1] - turns[0]) * CONSTANT_TO_RAD_S); /** Convert turns to rad/s */
+    return (float)speedometer_getRPM_q16() * (float)(CONSTANT_TO_RAD_S / CONSTANT_TO_RPM / 65536); /** RPM to rad/s */
+}
+
+#endif
+
+void speedometer_set_window(uint16_t window_ms)
+{
+    window_slots = ms_to_slots(window_ms);
+}
+
+uint16_t speedometer_get_window(void)
+{
+    return window_slots * SPEEDOMETER_SLOT_MS;
+}
+
+int32_t speedometer_getRPM_window_q16(uint16_t window_ms)
+{
+    return window_rpm_q16(latest_slot(), ms_to_slots(window_ms));
+}
+
+int32_t speedometer_get_accel_q16(uint16_t window_ms)
+{
+    uint16_t slots = ms_to_slots(window_ms);
+    uint16_t end = latest_slot();
+    int32_t recent = window_rpm_q16(end, slots);
+    int32_t previous = window_rpm_q16((end + SPEEDOMETER_RING_SIZE - slots) % SPEEDOMETER_RING_SIZE, slots);
+
+    /** Speed change over one window, scaled to one second */
+    return (int32_t)(((int64_t)(recent - previous) * 1000) / (slots * SPEEDOMETER_SLOT_MS));
+}
+
+uint16_t speedometer_get_pulses(void)
+{
+    return (uint16_t)timer_get_counter(ENCODER_TIMER);
+}
+
+uint8_t speedometer_set_alarm(uint16_t pulses, void (*callback)(void))
+{
+    uint8_t armed = 1;
+    bool masked = cm_mask_interrupts(1); /** Also called from the TIM2 interrupt, which must stay masked */
+
+    /** The count must not reach the position between the check and the arming */
+    timer_set_oc_value(ENCODER_TIMER, TIM_OC2, pulses);
+    timer_clear_flag(ENCODER_TIMER, TIM_SR_CC2IF);
+    alarm_callback = callback;
+    timer_enable_irq(ENCODER_TIMER, TIM_DIER_CC2IE);
+    /** The compare only fires when the count steps onto the position, one already reached would wait a wrap */
+    if ((int16_t)(pulses - (uint16_t)timer_get_counter(ENCODER_TIMER)) <= 0)
+    {
+        timer_disable_irq(ENCODER_TIMER, TIM_DIER_CC2IE);
+        alarm_callback = NULL;
+        armed = 0;
+    }
+    cm_mask_interrupts(masked);
+    return armed;
+}
+
+void speedometer_cancel_alarm(void)
+{
+    timer_disable_irq(ENCODER_TIMER, TIM_DIER_CC2IE);
+    alarm_callback = NULL;
+}
+
+void speedometer_set_alarm_output(enum tim_oc_mode mode)
+{
+    timer_set_oc_mode(ENCODER_TIMER, TIM_OC2, mode);
+    timer_enable_oc_output(ENCODER_TIMER, TIM_OC2);
+}
+
+void tim2_isr(void)
+{
+    PROFILE_ENTER();
+#if SPEEDOMETER_CAPTURE
+    if (timer_get_flag(ENCODER_TIMER, TIM_SR_CC1IF))
+    {
+        timer_clear_flag(ENCODER_TIMER, TIM_SR_CC1IF);
+        edge_time = dwt_read_cycle_counter();
+        edge_count++;
+    }
+#endif
+    if (timer_get_flag(ENCODER_TIMER, TIM_SR_CC2IF))
+    {
+        void (*callback)(void) = alarm_callback;
+
+        timer_clear_flag(ENCODER_TIMER, TIM_SR_CC2IF); /** Also set by matches while no alarm is set */
+        if (callback)
+        {
+            timer_disable_irq(ENCODER_TIMER, TIM_DIER_CC2IE);
+            alarm_callback = NULL;
+            callback(); /** May set the next alarm */
+        }
+    }
+    PROFILE_EXIT(PROFILE_TIM2);
 }
@@ -0,0 +1,113 @@
+#include "telemetry.h"
+#include "hc_sr04.h"
+#include "motor_driver.h"
+#include "pid.h"
+#include "scheduler.h"
+#include "speedometer.h"
+#include "uart.h"
+
+static uint16_t divider = TELEMETRY_DEFAULT_DIVIDER; /** PID ticks between two records, 0 when disabled */
+static uint16_t countdown = 1;                       /** PID ticks left until the next record */
+static uint16_t sequence = 0;                        /** Sequence number of the next record */
+
+/**
+ * @brief Encodes a buffer with Consistent Overhead Byte Stuffing.
+ *
+ * The output has no 0x00 bytes and is one byte longer than the input for inputs
+ * shorter than 254 bytes.
+ *
+ * @param in Bytes to encode.
+ * @param len Number of bytes, less than 254.
+ * @param out Where the encoded bytes are written, at least `len + 1` bytes.
+ * @return Number of encoded bytes.
+ */
+static uint16_t cobs_encode(const uint8_t* in, uint16_t len, uint8_t* out)
+{
+    uint16_t code_index = 0; /** Where the length code of the current block goes */
+    uint16_t out_len = 1;
+    uint8_t code = 1;
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+        if (in[i] == 0)
+        {
+            out[code_index] = code; /** Close the block, the zero is implied by the code */
+            code_index = out_len++;
+            code = 1;
+        }
+        else
+        {
+            out[out_len++] = in[i];
+            code++;
+        }
+    }
+    out[code_index] = code;
+    return out_len;
+}
+
+uint16_t telemetry_crc16(const uint8_t* data, uint16_t len)
+{
+    uint16_t crc = TELEMETRY_CRC_INIT;
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ TELEMETRY_CRC_POLY : crc << 1;
+        }
+    }
+    return crc;
+}
+
+void telemetry_set_divider(uint16_t value)
+{
+    divider = value;
+    countdown = 1; /** Start the new rate with the next tick */
+}
+
+void telemetry_pid_tick(int32_t rpm_q16, int32_t setpoint_q16, uint16_t duty)
+{
+    uint8_t raw[sizeof(Telemetry_Record) + 2];
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+    Telemetry_Record record;
+    int32_t p, i, d;
+    uint16_t crc, len;
+
+    if (!divider || --countdown)
+    {
+        return;
+    }
+    countdown = divider;
+
+    if (uart_tx_free() < TELEMETRY_FRAME_SIZE)
+    {
+        sequence++; /** A partial frame would be useless, skip the record and let the gap show */
+        return;
+    }
+
+    record.version = TELEMETRY_VERSION;
+    record.motor_state = motor_get_state();
+    record.sequence = sequence++;
+    record.timestamp_ms = scheduler_get_ticks();
+    record.rpm_q16 = rpm_q16;
+    record.setpoint_q16 = setpoint_q16;
+    record.accel_q16 = speedometer_get_accel_q16(speedometer_get_window());
+    pid_get_terms_q16(&p, &i, &d); /** Through locals, the packed fields may be unaligned */
+    record.p_q16 = p;
+    record.i_q16 = i;
+    record.d_q16 = d;
+    record.height_mm = hcsr04_get_last_mm();
+    record.duty = duty;
+
+    /** Record and CRC, little-endian, then COBS between two delimiters */
+    memcpy(raw, &record, sizeof(record));
+    crc = telemetry_crc16(raw, sizeof(record));
+    raw[sizeof(record)] = crc & 0xFF;
+    raw[sizeof(record) + 1] = crc >> 8;
+
+    frame[0] = 0;
+    len = 1 + cobs_encode(raw, sizeof(raw), &frame[1]);
+    frame[len++] = 0;
+    uart_write(frame, len);
+}
@@ -1,10 +1,52 @@
 #include "uart.h"
+#include "autotune.h"
+#include "feedforward.h"
+#include "hc_sr04.h"
+#include "height_profile.h"
+#include "jitter.h"
+#include "motor_driver.h"
+#include "object_queue.h"
+#include "pid.h"
+#include "profile.h"
+#include "speedometer.h"
+#include "telemetry.h"
+#include "utils.h"
 
-volatile char uart_rx_buffer[64]; /**< Buffer to store received data from UART. */
 
-volatile uint8_t uart_rx_index = 0; /**< Index to keep track of the current position in the receive buffer. */
+static uint8_t tx_ring[UART_TX_SIZE];      /**< Bytes waiting to be sent. */
+static volatile uint16_t tx_head = 0;      /**< Index where the next queued byte is stored. */
+static volatile uint16_t tx_tail = 0;      /**< Index of the first byte not yet sent. */
+static volatile uint16_t tx_chunk_len = 0; /**< Number of bytes handed to the DMA. */
+static volatile uint8_t tx_busy = 0;       /**< 1 while the DMA is sending. */
+static volatile uint32_t tx_bytes = 0;     /**< Bytes sent. */
+static volatile uint32_t tx_overflows = 0; /**< Bytes dropped because the ring was full. */
 
-extern PID_Controller c; /**< External reference to the PID controller instance. */
+static volatile uint8_t rx_ring[UART_RX_SIZE]; /**< Received bytes, written by DMA. */
+static uint16_t rx_read = 0;                   /**< Index of the first byte not yet parsed. */
+static volatile uint8_t rx_pending = 0;        /**< Set by the interrupts when bytes are waiting. */
+static char line[UART_LINE_SIZE];              /**< Line being assembled by `uart_poll()`. */
+static uint8_t line_len = 0;                   /**< Characters in `line`. */
+static uint8_t line_dropped = 0;               /**< 1 while skipping the rest of a line that was too long. */
+static uint32_t rx_overflows = 0;              /**< Lines dropped for being too long. */
+
+/**
+ * @brief Hands the next contiguous run of queued bytes to the DMA.
+ *
+ * Called with interrupts disabled or from the DMA interrupt, with the ring not empty.
+ */
+static void tx_start_chunk(void)
+{
+    uint16_t h = tx_head;
+
+    /** The DMA cannot wrap around the ring, the rest goes in the next transfer */
+    tx_chunk_len = (h > tx_tail) ? h - tx_tail : UART_TX_SIZE - tx_tail;
+
+    dma_disable_channel(DMA1, UART_TX_DMA_CHANNEL);
+    dma_set_memory_address(DMA1, UART_TX_DMA_CHANNEL, (uint32_t)&tx_ring[tx_tail]);
+    dma_set_number_of_data(DMA1, UART_TX_DMA_CHANNEL, tx_chunk_len);
+    dma_enable_channel(DMA1, UART_TX_DMA_CHANNEL);
+    tx_busy = 1;
+}
 
 void uart_init(void)
 {
@@ -19,15 +61,45 @@ void uart_init(void)
     gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, GPIO10);
 
     /** Configure USART1 parameters */
-    usart_set_baudrate(USART1, 9600);                       // Set baud rate to 9600
+    usart_set_baudrate(USART1, UART_BAUDRATE);              // Set baud rate
     usart_set_databits(USART1, 8);                          // Use 8 data bits
     usart_set_stopbits(USART1, USART_STOPBITS_1);           // Set 1 stop bit
     usart_set_mode(USART1, USART_MODE_TX_RX);               // Enable both TX and RX modes
     usart_set_parity(USART1, USART_PARITY_NONE);            // No parity check
     usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE); // No flow control
 
-    /** Enable RX interrupt */
-    usart_enable_rx_interrupt(USART1);
+    /** Configure DMA1 Channel 4 to move queued bytes into the USART data register */
+    rcc_periph_clock_enable(RCC_DMA1);
+    dma_channel_reset(DMA1, UART_TX_DMA_CHANNEL);
+    dma_set_priority(DMA1, UART_TX_DMA_CHANNEL, DMA_CCR_PL_LOW);
+    dma_set_peripheral_address(DMA1, UART_TX_DMA_CHANNEL, (uint32_t)&USART1_DR);
+    dma_set_memory_size(DMA1, UART_TX_DMA_CHANNEL, DMA_CCR_MSIZE_8BIT);
+    dma_set_peripheral_size(DMA1, UART_TX_DMA_CHANNEL, DMA_CCR_PSIZE_8BIT);
+    dma_enable_memory_increment_mode(DMA1, UART_TX_DMA_CHANNEL);
+    dma_set_read_from_memory(DMA1, UART_TX_DMA_CHANNEL);
+    dma_enable_transfer_complete_interrupt(DMA1, UART_TX_DMA_CHANNEL);
+    nvic_enable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+    usart_enable_tx_dma(USART1); /** TXE requests go to the DMA */
+
+    /** Configure DMA1 Channel 5 to write the received bytes into the circular buffer */
+    dma_channel_reset(DMA1, UART_RX_DMA_CHANNEL);
+    dma_set_priority(DMA1, UART_RX_DMA_CHANNEL, DMA_CCR_PL_MEDIUM);
+    dma_set_peripheral_address(DMA1, UART_RX_DMA_CHANNEL, (uint32_t)&USART1_DR);
+    dma_set_memory_address(DMA1, UART_RX_DMA_CHANNEL, (uint32_t)rx_ring);
+    dma_set_number_of_data(DMA1, UART_RX_DMA_CHANNEL, UART_RX_SIZE);
+    dma_set_memory_size(DMA1, UART_RX_DMA_CHANNEL, DMA_CCR_MSIZE_8BIT);
+    dma_set_peripheral_size(DMA1, UART_RX_DMA_CHANNEL, DMA_CCR_PSIZE_8BIT);
+    dma_enable_circular_mode(DMA1, UART_RX_DMA_CHANNEL);
+    dma_enable_memory_increment_mode(DMA1, UART_RX_DMA_CHANNEL);
+    dma_set_read_from_peripheral(DMA1, UART_RX_DMA_CHANNEL);
+    dma_enable_half_transfer_interrupt(DMA1, UART_RX_DMA_CHANNEL);     /** Long streams without a pause */
+    dma_enable_transfer_complete_interrupt(DMA1, UART_RX_DMA_CHANNEL); /** are also handed over */
+    nvic_enable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+    dma_enable_channel(DMA1, UART_RX_DMA_CHANNEL);
+    usart_enable_rx_dma(USART1);
+
+    /** Enable the idle line interrupt, raised once at the end of each frame */
+    USART_CR1(USART1) |= USART_CR1_IDLEIE;
 
     /** Configure NVIC to handle USART1 interrupts */
     nvic_enable_irq(NVIC_USART1_IRQ);
@@ -38,67 +110,439 @@ void uart_init(void)
 
 void usart1_isr(void)
 {
-    /** Check if the RXNE flag is set, indicating data is available to read */
-    if (usart_get_flag(USART1, USART_SR_RXNE))
+    PROFILE_ENTER();
+    if (usart_get_flag(USART1, USART_SR_IDLE))
+    {
+        (void)USART_DR(USART1); /** Reading SR then DR clears IDLE, the byte itself was taken by the DMA */
+        rx_pending = 1;
+    }
+    PROFILE_EXIT(PROFILE_USART1);
+}
+
+void dma1_channel5_isr(void)
+{
+    PROFILE_ENTER();
+    dma_clear_interrupt_flags(DMA1, UART_RX_DMA_CHANNEL, DMA_HTIF | DMA_TCIF);
+    rx_pending = 1;
+    PROFILE_EXIT(PROFILE_DMA1_CH5);
+}
+
+/**
+ * @brief Returns the next space-separated token of a line.
+ *
+ * @param cursor Position in the line, moved past the token.
+ * @param len Where the length of the token is stored.
+ * @return Pointer to the first character of the token, NULL at the end of the line.
+ */
+static const char* next_token(const char** cursor, uint8_t* len)
+{
+    const char* p = *cursor;
+
+    while (*p == ' ' || *p == '\t')
     {
-        /** Read the received character */
-        char received_char = usart_recv(USART1);
+        p++;
+    }
+    const char* start = p;
+    while (*p && *p != ' ' && *p != '\t')
+    {
+        p++;
+    }
+
+    *cursor = p;
+    *len = p - start;
+    return (*len) ? start : NULL;
+}
+
+/**
+ * @brief Compares a token with a word.
+ *
+ * @return 1 if they are equal, 0 otherwise.
+ */
+static uint8_t token_is(const char* token, uint8_t len, const char* word)
+{
+    return strncmp(token, word, len) == 0 && word[len] == '\0';
+}
+
+/**
+ * @brief Converts a token to a float, in the formats accepted by `%f` ("-12", "0.0013", "1.3e-3").
+ *
+ * @param token First character of the token.
+ * @param len Length of the token.
+ * @param value Where the number is stored.
+ * @return 1 if the whole token is a number, 0 otherwise.
+ */
+static uint8_t parse_float(const char* token, uint8_t len, float* value)
+{
+    const char* end = token + len;
+    float result = 0.0f;
+    float scale = 1.0f;
+    uint8_t digits = 0;
+    int8_t sign = 1;
 
-        /** Store the character in the buffer if space is available */
-        if (uart_rx_index < sizeof(uart_rx_buffer) - 1)
+    if (token < end && (*token == '-' || *token == '+'))
+    {
+        sign = (*token++ == '-') ? -1 : 1;
+    }
+    for (; token < end && *token >= '0' && *token <= '9'; token++, digits++)
+    {
+        result = result * 10.0f + (*token - '0');
+    }
+    if (token < end && *token == '.')
+    {
+        for (token++; token < end && *token >= '0' && *token <= '9'; token++, digits++)
         {
-            uart_rx_buffer[uart_rx_index++] = received_char;
+            scale /= 10.0f;
+            result += (*token - '0') * scale;
+        }
+    }
+    if (!digits)
+    {
+        return 0;
+    }
+    if (token < end && (*token == 'e' || *token == 'E'))
+    {
+        int8_t exp_sign = 1;
+        uint8_t exponent = 0;
+
+        token++;
+        if (token < end && (*token == '-' || *token == '+'))
+        {
+            exp_sign = (*token++ == '-') ? -1 : 1;
+        }
+        if (token == end)
+        {
+            return 0;
+        }
+        for (; token < end && *token >= '0' && *token <= '9' && exponent < 38; token++)
+        {
+            exponent = exponent * 10 + (*token - '0');
+        }
+        while (exponent--)
+        {
+            result = (exp_sign > 0) ? result * 10.0f : result / 10.0f;
+        }
+    }
+    if (token != end)
+    {
+        return 0; /** Trailing characters */
+    }
+
+    *value = sign * result;
+    return 1;
+}
+
+/**
+ * @brief Checks a command value against the range of the setting it goes to.
+ *
+ * @return 1 if `min <= value <= max`, 0 otherwise or for a NaN.
+ */
+static uint8_t value_in_range(float value, float min, float max)
+{
+    return value >= min && value <= max;
+}
 
-            /** If a newline or carriage return is received, process the command */
-            if (received_char == '\n' || received_char == '\r')
+/**
+ * @brief Checks that a PID gain fits the Q8.24 gains of the fixed-point engine.
+ *
+ * @return 1 if `-PID_GAIN_LIMIT < value < PID_GAIN_LIMIT`, 0 otherwise or for a NaN.
+ */
+static uint8_t gain_in_range(float value)
+{
+    return value > -PID_GAIN_LIMIT && value < PID_GAIN_LIMIT;
+}
+
+void uart_poll(void)
+{
+    if (!rx_pending)
+    {
+        return;
+    }
+    rx_pending = 0; /** Cleared before reading, so bytes arriving meanwhile raise it again */
+
+    uint16_t write = (UART_RX_SIZE - dma_get_number_of_data(DMA1, UART_RX_DMA_CHANNEL)) % UART_RX_SIZE;
+
+    while (rx_read != write)
+    {
+        char ch = rx_ring[rx_read];
+        rx_read = (rx_read + 1) % UART_RX_SIZE;
+
+        if (ch == '\n' || ch == '\r')
+        {
+            if (!line_dropped && line_len)
             {
-                uart_rx_buffer[uart_rx_index] = '\0'; // Null-terminate the string
-                uart_rx_index = 0;                    // Reset the index
-                process_uart_command(uart_rx_buffer); // Process the received command
+                line[line_len] = '\0';
+                process_uart_command(line);
             }
+            line_len = 0;
+            line_dropped = 0;
+        }
+        else if (line_dropped)
+        {
+            /** Skip the rest of a line that did not fit */
+        }
+        else if (line_len < UART_LINE_SIZE - 1)
+        {
+            line[line_len++] = ch;
         }
         else
         {
-            /** If the buffer is full, reset the index to prevent overflow */
-            uart_rx_index = 0;
+            rx_overflows++;
+            line_dropped = 1;
         }
     }
 }
 
+uint32_t uart_get_rx_overflows(void)
+{
+    return rx_overflows;
+}
+
 void process_uart_command(const char* command)
 {
+    const char* cursor = command;
+    const char *verb, *param, *number;
+    uint8_t verb_len, param_len, number_len;
+    uint8_t gains_changed = 1;
+    PID_Controller params;
     float value;
-    char param[16];
 
-    /** Parse the command into a parameter name and value */
-    if (sscanf(command, "SET %s %f", param, &value) == 2)
+    /** Split the command into a verb, a parameter name and a value */
+    verb = next_token(&cursor, &verb_len);
+    param = next_token(&cursor, &param_len);
+    number = next_token(&cursor, &number_len);
+
+    if (verb && token_is(verb, verb_len, "SET") && param && number && parse_float(number, number_len, &value))
     {
-        if (strcmp(param, "KP") == 0)
+        pid_get_params(&params); /** Only the named parameter changes, the rest of the set is kept */
+
+        if (token_is(param, param_len, "KP"))
         {
-            c.kp = value; // Update proportional gain
-            uart_send_string("KP updated successfully.\n");
+            if (gain_in_range(value))
+            {
+                params.kp = value; // Update proportional gain
+                uart_send_string("KP updated successfully.\n");
+            }
+            else
+            {
+                uart_send_string("Value out of range.\n");
+                gains_changed = 0;
+            }
         }
-        else if (strcmp(param, "KI") == 0)
+        else if (token_is(param, param_len, "KI"))
         {
-            c.ki = value; // Update integral gain
-            uart_send_string("KI updated successfully.\n");
+            if (gain_in_range(value))
+            {
+                params.ki = value; // Update integral gain
+                uart_send_string("KI updated successfully.\n");
+            }
+            else
+            {
+                uart_send_string("Value out of range.\n");
+                gains_changed = 0;
+            }
         }
-        else if (strcmp(param, "KD") == 0)
+        else if (token_is(param, param_len, "KD"))
         {
-            c.kd = value; // Update derivative gain
-            uart_send_string("KD updated successfully.\n");
+            if (gain_in_range(value))
+            {
+                params.kd = value; // Update derivative gain
+                uart_send_string("KD updated successfully.\n");
+            }
+            else
+            {
+                uart_send_string("Value out of range.\n");
+                gains_changed = 0;
+            }
         }
-        else if (strcmp(param, "SP") == 0)
+        else if (token_is(param, param_len, "SP"))
         {
-            c.setpoint = value; // Update setpoint
-            uart_send_string("Setpoint updated successfully.\n");
+            if (value_in_range(value, 0, MAX_RPM))
+            {
+                params.setpoint = value; // Update setpoint
+                uart_send_string("Setpoint updated successfully.\n");
+            }
+            else
+            {
+                uart_send_string("Value out of range.\n");
+                gains_changed = 0;
+            }
+        }
+        else if (token_is(param, param_len, "TM"))
+        {
+            if (value_in_range(value, 0, UINT16_MAX))
+            {
+                telemetry_set_divider((uint16_t)value); // Records every VALUE PID ticks, 0 stops them
+                uart_send_string("Telemetry rate updated successfully.\n");
+            }
+            else
+            {
+                uart_send_string("Value out of range.\n");
+            }
+            gains_changed = 0;
+        }
+        else if (token_is(param, param_len, "RAMP"))
+        {
+            if (value_in_range(value, 1, UINT16_MAX))
+            {
+                motor_set_ramp((uint16_t)value, MOTOR_JERK_MS); // Ramp from 0 to full duty in VALUE ms
+                uart_send_string("Motor ramp updated successfully.\n");
+            }
+            else
+            {
+                uart_send_string("Value out of range.\n");
+            }
+            gains_changed = 0;
+        }
+        else if (token_is(param, param_len, "REJECT"))
+        {
+            if (value_in_range(value, 1, DIVERTER_DISTANCE_MAX_PULSES))
+            {
+                object_queue_set_distance((uint16_t)value); // Diverter VALUE encoder pulses after the gate
+                uart_send_string("Diverter distance updated successfully.\n");
+            }
+            else
+            {
+                uart_send_string("Value out of range.\n");
+            }
+            gains_changed = 0;
+        }
+        else if (token_is(param, param_len, "GUARD"))
+        {
+            if (value_in_range(value, HCSR04_GUARD_MIN_MS, UINT16_MAX))
+            {
+                hcsr04_set_guard((uint16_t)value); // Wait VALUE ms after each echo before the next ping
+                uart_send_string("Ping guard updated successfully.\n");
+            }
+            else
+            {
+                uart_send_string("Value out of range.\n");
+            }
+            gains_changed = 0;
+        }
+        else if (token_is(param, param_len, "WIN"))
+        {
+            if (value_in_range(value, SPEEDOMETER_SLOT_MS, SPEEDOMETER_MAX_WINDOW_MS))
+            {
+                speedometer_set_window((uint16_t)value); // Count the speed and acceleration over VALUE ms
+                uart_send_string("Speed window updated successfully.\n");
+            }
+            else
+            {
+                uart_send_string("Value out of range.\n");
+            }
+            gains_changed = 0;
         }
         else
         {
             /** Handle invalid parameter names */
             uart_send_string("Invalid parameter.\n");
+            gains_changed = 0;
+        }
+
+        if (gains_changed)
+        {
+            /** Applied as a whole at the next control tick */
+            pid_stage_params(&params);
+            pid_commit_params(UART_PID_BUMPLESS);
+        }
+    }
+    else if (verb && token_is(verb, verb_len, "PROF") && !number)
+    {
+        if (!param)
+        {
+            profile_report_start(); /** The table is sent row by row from the main loop */
+        }
+        else if (token_is(param, param_len, "RESET"))
+        {
+            profile_reset();
+            uart_send_string("Profile reset.\n");
+        }
+        else
+        {
+            uart_send_string("Invalid command format. Use 'PROF' or 'PROF RESET'.\n");
+        }
+    }
+    else if (verb && token_is(verb, verb_len, "JITTER") && !number)
+    {
+        if (!param)
+        {
+            jitter_report_start(); /** The histograms are sent row by row from the main loop */
+        }
+        else if (token_is(param, param_len, "RESET"))
+        {
+            jitter_reset();
+            uart_send_string("Jitter reset.\n");
+        }
+        else
+        {
+            uart_send_string("Invalid command format. Use 'JITTER' or 'JITTER RESET'.\n");
+        }
+    }
+    else if (verb && token_is(verb, verb_len, "TUNE") && !number)
+    {
+        if (param && token_is(param, param_len, "STOP"))
+        {
+            if (autotune_get_state() == AUTOTUNE_RUNNING)
+            {
+                autotune_abort(); /** Replies "Tune aborted." */
+            }
+            else
+            {
+                uart_send_string("Tune not running.\n");
+            }
+        }
+        else if (!param || token_is(param, param_len, "APPLY"))
+        {
+            autotune_start(param != NULL); /** The relay runs from the next control tick */
+            uart_send_string("Tune started.\n");
+        }
+        else
+        {
+            uart_send_string("Invalid command format. Use 'TUNE', 'TUNE APPLY' or 'TUNE STOP'.\n");
         }
     }
+    else if (verb && token_is(verb, verb_len, "FF") && !number)
+    {
+        if (!param)
+        {
+            feedforward_report();
+        }
+        else if (token_is(param, param_len, "CAL"))
+        {
+            autotune_abort(); /** Both replace the PID, the sweep comes first */
+            feedforward_calibrate_start();
+            uart_send_string("FF calibration started.\n");
+        }
+        else if (token_is(param, param_len, "RESET"))
+        {
+            /** The integral takes over the feedforward at the current setpoint, the output does not jump */
+            pid_shift_integral_q16(feedforward_lookup_q16(pid_get_setpoint_q16()));
+            feedforward_reset();
+            uart_send_string("FF reset.\n");
+        }
+        else
+        {
+            uart_send_string("Invalid command format. Use 'FF', 'FF CAL' or 'FF RESET'.\n");
+        }
+    }
+    else if (verb && token_is(verb, verb_len, "QUEUE") && !param && !number)
+    {
+        object_queue_report();
+    }
+    else if (verb && token_is(verb, verb_len, "HEIGHTS") && !param && !number)
+    {
+        height_profile_report_start(); /** The profile is sent row by row from the main loop */
+    }
+    else if (verb && token_is(verb, verb_len, "PING") && !param && !number)
+    {
+        char reply[32];
+        uint8_t len;
+
+        memcpy(reply, "Pings/s: ", 9);
+        len = 9 + uint_to_string(&reply[9], hcsr04_get_ping_rate_x10(), 0, 1);
+        reply[len++] = '\n';
+        uart_write((const uint8_t*)reply, len);
+    }
     else
     {
         /** Handle invalid command format */
@@ -106,10 +550,78 @@ void process_uart_command(const char* command)
     }
 }
 
+void uart_set_baudrate(uint32_t baudrate)
+{
+    while (tx_busy)
+        ; /** Let the queued bytes go out at the old rate */
+    while (!usart_get_flag(USART1, USART_SR_TC))
+        ; /** Wait for the last byte to leave the shift register */
+
+    usart_disable(USART1);
+    usart_set_baudrate(USART1, baudrate);
+    usart_enable(USART1);
+}
+
+uint16_t uart_write(const uint8_t* data, uint16_t len)
+{
+    uint16_t queued = 0;
+
+    cm_disable_interrupts(); /** Writers may be interrupts too, and the DMA interrupt moves the tail */
+    uint16_t h = tx_head;
+    while (queued < len && (h + 1) % UART_TX_SIZE != tx_tail)
+    {
+        tx_ring[h] = data[queued++];
+        h = (h + 1) % UART_TX_SIZE;
+    }
+    tx_head = h;
+    tx_overflows += len - queued;
+    if (!tx_busy && tx_head != tx_tail)
+    {
+        tx_start_chunk();
+    }
+    cm_enable_interrupts();
+
+    return queued;
+}
+
+uint16_t uart_tx_free(void)
+{
+    /** One slot is kept empty to tell a full ring from an empty one */
+    return (UART_TX_SIZE - 1) - ((tx_head - tx_tail + UART_TX_SIZE) % UART_TX_SIZE);
+}
+
+uint32_t uart_get_tx_bytes(void)
+{
+    return tx_bytes;
+}
+
+uint32_t uart_get_tx_overflows(void)
+{
+    return tx_overflows;
+}
+
 void uart_send_string(const char* str)
 {
-    while (*str)
+    uart_write((const uint8_t*)str, strlen(str));
+}
+
+void dma1_channel4_isr(void)
+{
+    PROFILE_ENTER();
+    if (dma_get_interrupt_flag(DMA1, UART_TX_DMA_CHANNEL, DMA_TCIF))
     {
-        usart_send_blocking(USART1, *str++);
+        dma_clear_interrupt_flags(DMA1, UART_TX_DMA_CHANNEL, DMA_TCIF);
+        tx_bytes += tx_chunk_len;
+        tx_tail = (tx_tail + tx_chunk_len) % UART_TX_SIZE;
+
+        if (tx_tail != tx_head)
+        {
+            tx_start_chunk(); /** More bytes were queued while this run was sent */
+        }
+        else
+        {
+            tx_busy = 0;
+        }
     }
+    PROFILE_EXIT(PROFILE_DMA1_CH4);
 }
@@ -1,160 +1,341 @@
 #include "update.h"
+#include "autotune.h"
+#include "feedforward.h"
+#include "height_estimator.h"
+#include "height_profile.h"
+#include "jitter.h"
+#include "object_queue.h"
+#include "profile.h"
 
-static volatile float speed = 0;            /**< Current speed in RPM. */
-static volatile float set = 0;              /**< Current setpoint in RPM. */
-static volatile float measurement_prom = 0; /**< Average of the distance measurements. */
-
-static volatile uint16_t response__pid_count = 0;         /**< Counter for PID response timing. */
-static volatile uint16_t response__measurement_count = 0; /**< Counter for measurement response timing. */
-static volatile uint16_t response__display_count = 0;     /**< Counter for display response timing. */
+static volatile int32_t speed = 0;          /**< Current speed in RPM, Q16.16. */
+static volatile int32_t set = 0;            /**< Setpoint of the last PID update in RPM, Q16.16. */
+static volatile float measurement_prom = 0; /**< Estimated distance to the last object. */
+static uint32_t last_pid_cycles = 0;        /**< Cycle counter at the previous PID update. */
+static uint8_t power = 0;                   /**< Motor power set by the last PID update, in percent. */
+static uint8_t measuring = 0;               /**< 1 from the arrival of an object at the gate to its verdict. */
+#if PID_DT_AWARE
+static uint8_t pid_hold_updates = 0; /**< PID updates left with the integral held. */
+#endif
 
 static volatile uint8_t measure_done_flag = 0, pass_flag = 0,
                         showing_measure_flag =
                             0;             /**< Flags for measurement completion and threshold pass/fail status. */
-static volatile uint8_t measure_count = 0; /**< Count of current measurements stored in the buffer. */
-static volatile float measurements[N_MEASUREMENT]; /**< Buffer for storing distance measurements. */
 
 volatile uint16_t remaining_measure_dtime = MEASUREMENT_DISPLAY_TIME; /**< Remaining time for displaying measurement. */
 
+static void task_state(void);
+static void task_pid(void);
+static void task_measure(void);
+static void task_measure_display(void);
+static void task_speed_display(void);
+
+/** Task table, indexed by the TASK_* identifiers. Phases keep the periodic tasks from piling up on the same tick. */
+static Scheduler_Task tasks[N_TASKS] = {
+    [TASK_STATE] = {task_state, STATE_RATE, 0, 0},
+    [TASK_PID] = {task_pid, PID_RATE, PID_PHASE, 1},
+    [TASK_MEASURE] = {task_measure, MEASUREMENT_RATE, MEASUREMENT_PHASE, 2},
+    [TASK_MEASURE_DISPLAY] = {task_measure_display, DISPLAY_RATE / 2, DISPLAY_PHASE, 3},
+    [TASK_SPEED_DISPLAY] = {task_speed_display, DISPLAY_RATE, DISPLAY_PHASE, 3},
+};
+
 void update_init(void)
 {
+    scheduler_init(tasks, N_TASKS);                 /**< Register the task table before the first tick. */
     systick_set_reload(TICKS_FOR_MS - 1);           /**< Set reload value for 1 ms. */
     systick_set_clocksource(STK_CSR_CLKSOURCE_AHB); /**< Use the AHB clock as the SysTick source. */
     systick_counter_enable();                       /**< Enable the SysTick counter. */
     systick_interrupt_enable();                     /**< Enable SysTick interrupt. */
+    jitter_init(PID_RATE);                          /**< Start timing the ticks and the control loop. */
+    height_reset(MEASUREMENT_TRHS, N_MEASUREMENT);  /**< Ready for the first object. */
+#if REJECT_DIVERTER
+    object_queue_init(); /**< Diverter off, no object on the belt. */
+#endif
+#if FEEDFORWARD_STARTUP_CAL
+    feedforward_calibrate_start(); /**< Sweep the motor before the PID takes over. */
+#endif
 }
 
 void sys_tick_handler(void)
 {
+    PROFILE_ENTER();
+    jitter_tick();           /**< Timestamp the entry before anything else runs. */
     systick_get_countflag(); /**< Clears the interrupt flag by reading the count flag. */
+    scheduler_tick();        /**< Only release tasks here, they run from the main loop. */
+    PROFILE_EXIT(PROFILE_SYSTICK);
+}
 
+static void task_state(void)
+{
     if (button_get_stop_flag()) // Stopped
     {
         systick_counter_disable(); /**< Disable SysTick counter if motor is stopped. */
-        lcd_clear();
-        lcd_print_string("    STOPPED!    "); /**< Display "STOPPED!" if motor is stopped. */
-        lcd_set_cursor(2, 0);                 /**< Move cursor to the second row for the setpoint display. */
-        lcd_print_string("Please Restart ");
+        lcd_fb_clear();
+        lcd_fb_write(0, 0, "    STOPPED!    "); /**< Display "STOPPED!" if motor is stopped. */
+        lcd_fb_write(1, 0, "Please Restart ");  /**< Second row asks for a restart. */
     }
-    else // Not Stopped
+    else if (button_get_object_flag()) // Object
     {
-        if (button_get_object_flag()) // Object
-        {
-            motor_disable();
-            if (response__measurement_count >= MEASUREMENT_RATE)
-            {
-                response__measurement_count = 0;
-                measure();
-            }
-            if (response__display_count >= DISPLAY_RATE / 2)
-            {
-                response__display_count = 0;
-                display_measure_info();
-            }
-            response__measurement_count++;
-            response__display_count++;
-        }
-        else // No object
-        {
-            motor_enable();
-            response__measurement_count = 0;
-            if (response__pid_count >= PID_RATE)
-            {
-                response__pid_count = 0;
-                upt_pid();
-            }
-            if (response__display_count >= DISPLAY_RATE)
-            {
-                response__display_count = 0;
-                if (showing_measure_flag) // Display Measurement
-                {
-                    remaining_measure_dtime--;
-                    if (remaining_measure_dtime == 0)
-                    {
-                        showing_measure_flag = 0;
-                        remaining_measure_dtime = MEASUREMENT_DISPLAY_TIME;
-                    }
-                }
-                else
-                { // Display Speed
-                    display_speed();
-                }
-            }
-            response__pid_count++;
-            response__display_count++;
-        }
+#if !MEASURE_ON_THE_MOVE
+        motor_disable(); /**< The belt holds the object under the sensor. */
+#endif
+        autotune_abort();             /**< A relay experiment needs the motor running. */
+        feedforward_calibrate_abort(); /**< So does the calibration sweep. */
+    }
+    else // No object
+    {
+        motor_enable();
+    }
+    motor_profile_tick(); /**< The duty moves toward the PID output every tick. */
+}
+
+static void task_pid(void)
+{
+    jitter_pid(); /**< The sampling instant of the loop, whether it runs or not. */
+#if PID_DT_AWARE
+    if (!button_get_stop_flag()) /**< Also while an object holds the motor, the controller state stays current. */
+#else
+    if (!button_get_stop_flag() && (MEASURE_ON_THE_MOVE || !button_get_object_flag()))
+#endif
+    {
+        upt_pid();
     }
 }
 
-float get_measurement_prom(void)
+static void task_measure(void)
 {
-    float ac = 0;
-    for (uint8_t i = 0; i < N_MEASUREMENT; i++)
+    if (!button_get_stop_flag() && button_get_object_flag())
     {
-        ac += measurements[i];
+        measure();
+    }
+}
+
+static void task_measure_display(void)
+{
+    if (!button_get_stop_flag() && button_get_object_flag())
+    {
+        display_measure_info();
+    }
+}
+
+static void task_speed_display(void)
+{
+    if (button_get_stop_flag() || button_get_object_flag())
+    {
+        return;
+    }
+
+    if (showing_measure_flag) // Display Measurement
+    {
+        remaining_measure_dtime--;
+        if (remaining_measure_dtime == 0)
+        {
+            showing_measure_flag = 0;
+            remaining_measure_dtime = MEASUREMENT_DISPLAY_TIME;
+        }
+    }
+    else
+    { // Display Speed
+        display_speed();
     }
-    return ac / N_MEASUREMENT;
 }
 
 void display_speed(void)
 {
-    lcd_clear();
-    lcd_print_string("RPM: ");                /**< Display "RPM:" label on the LCD. */
-    lcd_print_string(float_to_string(speed)); /**< Display the current speed in RPM. */
-    lcd_set_cursor(2, 0);                     /**< Move cursor to the second row for setpoint display. */
-    lcd_print_string("Target: ");             /**< Display "Target:" label for setpoint. */
-    lcd_print_string(float_to_string(set));   /**< Display the current setpoint in RPM. */
+    uint8_t col;
+
+    lcd_fb_clear();
+    col = lcd_fb_write(0, 0, "RPM: ");                                 /**< Display "RPM:" label on the LCD. */
+    lcd_fb_write(0, col, float_to_string((float)speed / PID_Q16_ONE)); /**< Display the current speed in RPM. */
+    col = lcd_fb_write(1, 0, "Target: ");                              /**< Display "Target:" label for setpoint. */
+    lcd_fb_write(1, col, float_to_string((float)set / PID_Q16_ONE));   /**< Display the current setpoint in RPM. */
+}
+
+/**
+ * @brief Ends the measurement of an object.
+ *
+ * Without the diverter a reject stops everything. A pass of an object held under
+ * the sensor is shown by `display_measure_info()`, which restarts the belt. On the
+ * move, and with REJECT_DIVERTER, where the verdict goes to the object queue that
+ * diverts a reject downstream, the belt never stopped: the result is shown here and
+ * the gate is ready for the next object at once.
+ *
+ * @param distance Distance to the object that decided, in cm.
+ * @param pass 1 if the object passes.
+ */
+static void finish_measure(float distance, uint8_t pass)
+{
+    uint8_t col;
+
+    measuring = 0;
+    measurement_prom = distance;
+    pass_flag = pass;   /**< Set pass or fail flag based on threshold. */
+    hcsr04_ping_stop(); /**< The rate of this object's pings is kept. */
+#if REJECT_DIVERTER
+    object_queue_set_verdict(distance, pass ? OBJECT_PASS : OBJECT_REJECT);
+#else
+    if (!pass_flag)
+    {
+        measure_done_flag = 1;
+        motor_disable(); /**< On the move the belt was still running. */
+        lcd_fb_clear();
+        col = lcd_fb_write(0, 0, "NOT PASS : ");                 /**< Indicate measurement did not pass. */
+        lcd_fb_write(0, col, float_to_string(measurement_prom)); /**< Display the failed measurement. */
+        systick_counter_disable(); /**< Stop the system and restart when object is not present. */
+        return;
+    }
+#if !MEASURE_ON_THE_MOVE
+    measure_done_flag = 1; /**< The display shows the result, then lets the object go. */
+    return;
+#endif
+#endif
+    lcd_fb_clear();
+    col = lcd_fb_write(0, 0, pass ? "Height: " : "REJECT : "); /**< The line goes on either way. */
+    lcd_fb_write(0, col, float_to_string(measurement_prom));
+    showing_measure_flag = 1;
+    remaining_measure_dtime = MEASUREMENT_DISPLAY_TIME; /**< Shown for the full time, even over the last one. */
+    button_set_object_flag(0); /**< The next object can come, the belt restarts if it was stopped. */
 }
 
 void measure(void)
 {
-    if (!measure_done_flag)
+    float distance;
+    uint8_t status;
+
+    if (measure_done_flag)
     {
-        measurements[measure_count] = hcsr04_get_distance(); /**< Store distance in the measurement buffer. */
-        measure_count++;
+        return;
+    }
 
-        if (measure_count == N_MEASUREMENT)
+    if (!measuring) /**< The object has just reached the gate. */
+    {
+        measuring = 1;
+#if MEASURE_ON_THE_MOVE
+        height_profile_start(speedometer_get_pulses()); /**< Positions count from the arrival at the gate. */
+#endif
+#if REJECT_DIVERTER
+        if (!object_queue_push(speedometer_get_pulses()))
         {
-            measure_count = 0;
-            measure_done_flag = 1;
-            measurement_prom = get_measurement_prom(); /**< Calculate average measurement. */
-            pass_flag =
-                (MEASUREMENT_TRHS <= measurement_prom) ? 1 : 0; /**< Set pass or fail flag based on threshold. */
-            if (!pass_flag)
-            {
-                lcd_clear();
-                lcd_print_string("NOT PASS : ");                     /**< Indicate measurement did not pass. */
-                lcd_print_string(float_to_string(measurement_prom)); /**< Display the failed measurement. */
-                systick_counter_disable(); /**< Stop the system and restart when object is not present. */
-            }
+            motor_disable(); /**< Too many objects to track, none may reach the diverter untracked. */
+            lcd_fb_clear();
+            lcd_fb_write(0, 0, "QUEUE FULL");
+            systick_counter_disable(); /**< Stop the system until a restart. */
+            return;
         }
+#endif
     }
+    /** Triggers the next ping once the previous one has rung down, collects its result. */
+    status = hcsr04_ping_step(scheduler_get_ticks(), &distance);
+#if MEASURE_ON_THE_MOVE
+    if (status == HCSR04_READY || status == HCSR04_TIMEOUT)
+    {
+        height_profile_add(speedometer_get_pulses(), distance); /**< Tagged with the belt position. */
+    }
+    if (!button_get_object_present()) /**< The whole object went past the sensor. */
+    {
+        float distance_pct = height_profile_get_percentile();
+
+        finish_measure(distance_pct, distance_pct >= MEASUREMENT_TRHS); /**< No valid echo (-1.0) rejects. */
+    }
+#else
+    if (status == HCSR04_READY || status == HCSR04_TIMEOUT)
+    {
+        uint8_t decision = height_add_sample(distance); /**< Timeouts (-1.0) are dropped by the estimator. */
+
+        if (decision != HEIGHT_PENDING)
+        {
+            float estimate = height_get_estimate();
+
+            height_reset(MEASUREMENT_TRHS, N_MEASUREMENT); /**< Ready for the next object. */
+            finish_measure(estimate, decision == HEIGHT_ABOVE);
+        }
+    }
+#endif
 }
 
 void upt_pid(void)
 {
-    set = pot_get_value() * MAX_RPM / 100;
-    pid_setpoint(set);                  /**< Update setpoint based on potentiometer input. */
-    speed = speedometer_getRPM();       /**< Retrieve the current speed in RPM. */
-    motor_set_power(pid_update(speed)); /**< Update motor power based on PID output and current speed. */
+    uint32_t now = dwt_read_cycle_counter(); /**< Sampling instant of this update. */
+    uint32_t dt_us = (now - last_pid_cycles) / (rcc_ahb_frequency / 1000000);
+    int32_t output; /**< Motor power in percent, Q16.16. */
+    last_pid_cycles = now;
+
+    if (pot_changed()) /**< The setpoint is only recomputed when the knob moves, `SET SP` holds until then. */
+    {
+        /** Percentage to RPM, divided first to stay in 32 bits */
+        pid_setpoint_q16((pot_get_value_q16() / 100) * MAX_RPM);
+    }
+    set = pid_get_setpoint_q16();          /**< The knob or the last `SET SP`, whichever came last. */
+    speedometer_update();                  /**< Fresh speed estimate for this control period. */
+    speed = speedometer_getRPM_q16();      /**< Retrieve the current speed in RPM. */
+    if (feedforward_calibrating())
+    {
+        power = feedforward_calibrate_update(speed, set, dt_us); /**< The power sweep replaces the PID. */
+        output = (int32_t)power << PID_Q16_SHIFT;
+    }
+    else if (autotune_get_state() == AUTOTUNE_RUNNING)
+    {
+        power = autotune_update(speed, set, power, dt_us); /**< The relay experiment replaces the PID. */
+        output = (int32_t)power << PID_Q16_SHIFT;
+    }
+    else
+    {
+        pid_set_feedforward_q16(feedforward_lookup_q16(set)); /**< The map gives most of the output. */
+#if PID_DT_AWARE
+        if (motor_get_state() == MOTOR_DISABLED)
+        {
+            pid_hold_updates = PID_RESTART_HOLD; /**< Held while stopped and for the first updates after the restart. */
+        }
+        /** The integral also waits for the motor profile, it must not wind up while the duty ramps */
+        power = pid_update_dt_q16(speed, dt_us, pid_hold_updates > 0 || !motor_profile_done());
+        if (pid_hold_updates && motor_get_state() == MOTOR_ENABLED)
+        {
+            pid_hold_updates--;
+        }
+#else
+        power = pid_update_q16(speed); /**< PID output for the current speed. */
+#endif
+        output = pid_get_output_q16(); /**< The same output with its fraction of a percent. */
+        if (motor_get_state() == MOTOR_ENABLED)
+        {
+            int32_t p, i, d, learned;
+
+            pid_get_terms_q16(&p, &i, &d);
+            /** Move the settled integral into the map */
+            learned = feedforward_learn(set, set - speed, i, power);
+            if (learned)
+            {
+                pid_shift_integral_q16(-learned); /**< The output stays the same. */
+            }
+        }
+    }
+    /** Percent to the 16-bit duty, the fraction of a percent reaches the motor too */
+    motor_set_duty((uint16_t)(((int64_t)output * MOTOR_DUTY_MAX) / ((int32_t)MAX_PID_OUTPUT << PID_Q16_SHIFT)));
+    telemetry_pid_tick(speed, set, motor_get_duty()); /**< Stream the loop state when a record is due. */
 }
 
 void display_measure_info(void)
 {
-    lcd_clear();
+    uint8_t col;
+
+    lcd_fb_clear();
     if (measure_done_flag)
     {
-        lcd_print_string("Height: ");                              /**< Display "Height:" label on the LCD. */
-        lcd_print_string(float_to_string(get_measurement_prom())); /**< Display measurement value. */
-        showing_measure_flag = 1;                                  /**< Set flag to indicate measurement in display. */
-        button_set_object_flag(0);                                 /**< Reset object flag. */
-        measure_done_flag = 0;                                     /**< Reset for new measurements. */
+        col = lcd_fb_write(0, 0, "Height: ");                    /**< Display "Height:" label on the LCD. */
+        lcd_fb_write(0, col, float_to_string(measurement_prom)); /**< Display measurement value. */
+        showing_measure_flag = 1;  /**< Set flag to indicate measurement in display. */
+        button_set_object_flag(0); /**< Reset object flag. */
+        measure_done_flag = 0;     /**< Reset for new measurements. */
     }
     else // Display Percentage
     {
-        lcd_print_string("Measuring height"); /**< Indicate that object measurement is in progress. */
-        lcd_set_cursor(2, 0);                 /**< Move cursor to the second row for setpoint display. */
-        lcd_print_string(float_to_string(measure_count * 10)); /**< Display measurement percentage. */
-        lcd_print_string("/100");
+#if MEASURE_ON_THE_MOVE
+        lcd_fb_write(0, 0, "Profiling height");                                /**< The object is passing by. */
+        col = lcd_fb_write(1, 0, float_to_string(height_profile_get_pings())); /**< Pings so far. */
+        lcd_fb_write(1, col, " pings");
+#else
+        lcd_fb_write(0, 0, "Measuring height"); /**< Indicate that object measurement is in progress. */
+        col = lcd_fb_write(1, 0, float_to_string(height_get_pings() * 100 / N_MEASUREMENT)); /**< Pings done. */
+        lcd_fb_write(1, col, "/100");
+#endif
     }
 }
@@ -60,3 +60,29 @@ char* float_to_string(float number)
 
     return str; /** Return the pointer to the static buffer */
 }
+
+uint8_t uint_to_string(char* out, uint32_t value, uint8_t width, uint8_t decimals)
+{
+    char digits[12];
+    uint8_t n = 0, len = 0;
+
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value || n <= decimals);
+
+    for (uint8_t i = n + (decimals ? 1 : 0); i < width; i++)
+    {
+        out[len++] = ' ';
+    }
+    while (n)
+    {
+        if (decimals && n == decimals)
+        {
+            out[len++] = '.';
+        }
+        out[len++] = digits[--n];
+    }
+    return len;
+}
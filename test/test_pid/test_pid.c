@@ -0,0 +1,157 @@
+/**
+ * @file test_pid.c
+ * @brief Host test of the PID engine selected by PID_FIXED_POINT against a double-precision reference.
+ *
+ * Both control laws are fed the same speed trace: a first-order response to a
+ * sequence of targets with deterministic noise, which drives the output into both
+ * limits and through setpoint changes. The trace does not depend on the output, so
+ * every build sees exactly the same inputs and the reference below gives the output
+ * the laws are documented to compute. The `test_native` environment runs it on the
+ * fixed-point engine and `test_native_float` on the float one:
+ *
+ *     pio test -e test_native -e test_native_float
+ *
+ * Each law keeps its own state in pid.c and starts from zero, so each test only
+ * uses one of them.
+ */
+
+#include "pid.h"
+#include <unity.h>
+
+/** @brief Largest difference allowed between the engine and the reference, in percent of output. */
+#define PID_TEST_TOLERANCE 0.02
+
+/** @brief Control steps of each trace. */
+#define PID_TEST_STEPS 2000
+
+/** @brief Setpoint of the trace in RPM, changed halfway through. */
+#define PID_TEST_SETPOINT 4000.0
+
+/** @brief Setpoint from the middle of the trace in RPM. */
+#define PID_TEST_SETPOINT_2 1500.0
+
+static uint32_t seed; /** State of the noise generator */
+
+/**
+ * @brief Deterministic noise in [-1, 1), the same on every host.
+ */
+static double noise(void)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (double)(seed >> 8) / (double)(1u << 23) - 1.0;
+}
+
+/**
+ * @brief Measured speed at step `n` of the trace, in RPM.
+ */
+static double measured_at(uint32_t n, double* speed)
+{
+    static const double targets[] = {3000, 4200, 3900, 4050, 6200, 1600, 1400, 1550};
+    double target = targets[(n / 250) % (sizeof(targets) / sizeof(targets[0]))];
+
+    *speed += (target - *speed) * 0.08;
+    return *speed + 12.0 * noise();
+}
+
+/**
+ * @brief Jittered time between two updates, around PID_NOMINAL_DT_US.
+ */
+static uint32_t dt_at(uint32_t n)
+{
+    return (n % 97 == 0) ? 3 * PID_NOMINAL_DT_US : PID_NOMINAL_DT_US + (int32_t)(2000.0 * noise());
+}
+
+/**
+ * @brief Clamps an output to the limits of the controller.
+ */
+static double clamp_output(double output)
+{
+    return (output > MAX_PID_OUTPUT) ? MAX_PID_OUTPUT : (output < MIN_PID_OUTPUT) ? MIN_PID_OUTPUT : output;
+}
+
+void setUp(void)
+{
+    PID_Controller params = {PID_DEFAULT_KP, PID_DEFAULT_KI, PID_DEFAULT_KD, PID_TEST_SETPOINT};
+
+    seed = 12345;
+    pid_init(&params);
+    pid_setpoint(PID_TEST_SETPOINT);
+}
+
+void tearDown(void)
+{
+}
+
+/**
+ * @brief `pid_update()` follows the positional law: capped sum of errors, difference of errors.
+ */
+static void test_update_matches_reference(void)
+{
+    double speed = 0, integral = 0, prev_error = 0, setpoint = PID_TEST_SETPOINT;
+
+    for (uint32_t n = 0; n < PID_TEST_STEPS; n++)
+    {
+        double measured = measured_at(n, &speed);
+        double error, output;
+
+        if (n == PID_TEST_STEPS / 2)
+        {
+            setpoint = PID_TEST_SETPOINT_2;
+            pid_setpoint((float)setpoint);
+        }
+        error = setpoint - (float)measured;
+        integral += error;
+        integral = (integral > MAX_INTEGRAL_ERROR) ? MAX_INTEGRAL_ERROR : integral;
+        integral = (integral < -MAX_INTEGRAL_ERROR) ? -MAX_INTEGRAL_ERROR : integral;
+        output = clamp_output(PID_DEFAULT_KP * error + PID_DEFAULT_KI * integral +
+                              PID_DEFAULT_KD * (error - prev_error));
+        prev_error = error;
+
+        pid_update((float)measured);
+        TEST_ASSERT_FLOAT_WITHIN(PID_TEST_TOLERANCE, output, (double)pid_get_output_q16() / PID_Q16_ONE);
+    }
+}
+
+/**
+ * @brief `pid_update_dt_q16()` follows the dt-aware law: filtered derivative on measurement, back-calculation.
+ */
+static void test_update_dt_matches_reference(void)
+{
+    double speed = 0, i_out = 0, slope = 0, prev_measured = 0, setpoint = PID_TEST_SETPOINT;
+
+    for (uint32_t n = 0; n < PID_TEST_STEPS; n++)
+    {
+        int32_t measured_q16 = (int32_t)(measured_at(n, &speed) * PID_Q16_ONE);
+        double measured = (double)measured_q16 / PID_Q16_ONE;
+        uint32_t dt_us = dt_at(n);
+        double periods = (double)dt_us / PID_NOMINAL_DT_US;
+        double error, unsaturated, output;
+
+        if (n == PID_TEST_STEPS / 2)
+        {
+            setpoint = PID_TEST_SETPOINT_2;
+            pid_setpoint((float)setpoint);
+        }
+        error = setpoint - measured;
+        if (n)
+        {
+            slope += ((measured - prev_measured) / periods - slope) * dt_us / (PID_D_FILTER_US + dt_us);
+        }
+        prev_measured = measured;
+        i_out += PID_DEFAULT_KI * error * periods;
+        unsaturated = PID_DEFAULT_KP * error + i_out - PID_DEFAULT_KD * slope;
+        output = clamp_output(unsaturated);
+        i_out += (output - unsaturated) / PID_TRACKING_PERIODS * periods;
+
+        pid_update_dt_q16(measured_q16, dt_us, 0);
+        TEST_ASSERT_FLOAT_WITHIN(PID_TEST_TOLERANCE, output, (double)pid_get_output_q16() / PID_Q16_ONE);
+    }
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_update_matches_reference);
+    RUN_TEST(test_update_dt_matches_reference);
+    return UNITY_END();
+}
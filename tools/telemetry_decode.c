@@ -0,0 +1,146 @@
+/**
+ * @file telemetry_decode.c
+ * @brief Host-side decoder of the binary telemetry stream, writes CSV.
+ *
+ * Reads the raw USART1 byte stream from a file or a serial port (or stdin), splits
+ * it on the 0x00 delimiters, undoes the COBS encoding, checks the CRC and prints
+ * one CSV line per valid record. Text replies interleaved on the line are skipped
+ * as invalid frames. Frame and CRC errors are reported on stderr at the end.
+ *
+ * Build and run on the host:
+ *
+ *     cc -O2 -Iinclude -o telemetry_decode tools/telemetry_decode.c
+ *     stty -F /dev/ttyUSB0 115200 raw
+ *     ./telemetry_decode /dev/ttyUSB0 > run.csv
+ *
+ * Records are enabled from the serial console with "SET TM 1" (every PID tick).
+ * Speeds are in RPM, the acceleration in RPM/s, the PID terms and the duty in percent
+ * of full output.
+ */
+
+#include "telemetry.h"
+#include <stdio.h>
+#include <string.h>
+
+/** @brief Longest frame accepted before it is discarded as garbage. */
+#define MAX_FRAME 256
+
+/** @brief Q16.16 to double. */
+#define Q16_TO_DOUBLE(x) ((double)(x) / 65536.0)
+
+/**
+ * @brief Same CRC as `telemetry_crc16()` on the target.
+ */
+static uint16_t crc16(const uint8_t* data, size_t len)
+{
+    uint16_t crc = TELEMETRY_CRC_INIT;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ TELEMETRY_CRC_POLY : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Decodes a COBS frame, delimiters excluded.
+ *
+ * @return Number of decoded bytes, or 0 if the frame is malformed.
+ */
+static size_t cobs_decode(const uint8_t* in, size_t len, uint8_t* out)
+{
+    size_t i = 0, out_len = 0;
+
+    while (i < len)
+    {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > len)
+        {
+            return 0;
+        }
+        for (uint8_t k = 1; k < code; k++)
+        {
+            out[out_len++] = in[i++];
+        }
+        if (code < 0xFF && i < len)
+        {
+            out[out_len++] = 0; /** The code stood for a zero, except after the last block */
+        }
+    }
+    return out_len;
+}
+
+int main(int argc, char** argv)
+{
+    FILE* in = stdin;
+    uint8_t frame[MAX_FRAME], raw[MAX_FRAME];
+    size_t frame_len = 0;
+    unsigned long records = 0, bad_frames = 0, bad_crc = 0;
+    int ch;
+
+    if (argc > 1 && !(in = fopen(argv[1], "rb")))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    printf("sequence,timestamp_ms,rpm,setpoint,accel,p,i,d,duty,motor_state,height_mm\n");
+    while ((ch = fgetc(in)) != EOF)
+    {
+        if (ch != 0)
+        {
+            if (frame_len < MAX_FRAME)
+            {
+                frame[frame_len] = (uint8_t)ch;
+            }
+            frame_len++;
+            continue;
+        }
+        if (frame_len == 0)
+        {
+            continue; /** Leading delimiter of the next frame */
+        }
+
+        size_t len = (frame_len <= MAX_FRAME) ? cobs_decode(frame, frame_len, raw) : 0;
+        frame_len = 0;
+        if (len != sizeof(Telemetry_Record) + 2)
+        {
+            bad_frames++;
+            continue;
+        }
+        if (crc16(raw, sizeof(Telemetry_Record)) != (raw[len - 2] | (raw[len - 1] << 8)))
+        {
+            bad_crc++;
+            continue;
+        }
+
+        Telemetry_Record r;
+        memcpy(&r, raw, sizeof(r));
+        if (r.version != TELEMETRY_VERSION)
+        {
+            bad_frames++;
+            continue;
+        }
+        printf("%u,%u,%.2f,%.2f,%.2f,%.4f,%.4f,%.4f,%.3f,%u,%u\n",
+               r.sequence,
+               r.timestamp_ms,
+               Q16_TO_DOUBLE(r.rpm_q16),
+               Q16_TO_DOUBLE(r.setpoint_q16),
+               Q16_TO_DOUBLE(r.accel_q16),
+               Q16_TO_DOUBLE(r.p_q16),
+               Q16_TO_DOUBLE(r.i_q16),
+               Q16_TO_DOUBLE(r.d_q16),
+               r.duty * 100.0 / TELEMETRY_DUTY_MAX,
+               r.motor_state,
+               r.height_mm);
+        fflush(stdout);
+        records++;
+    }
+
+    fprintf(stderr, "%lu records, %lu bad frames, %lu CRC errors\n", records, bad_frames, bad_crc);
+    return 0;
+}